@@ -178,12 +178,13 @@ int init(platform_ctxt *ctxt, void *user_data)
     if (ret != err_code::RENDER_NO_ERROR) {
         return ret;
     }
+    app->rndr.gprof.overlay = true;
 
     // Upload our data to gpu
     upload_to_gpu(tex_daniel.ptr, &app->rndr);
     upload_to_gpu(tex_maria.ptr, &app->rndr);
-    upload_to_gpu(cube_msh.ptr, &app->rndr);
-    upload_to_gpu(rect_msh.ptr, &app->rndr);
+    const mesh *meshes[] = {cube_msh.ptr, rect_msh.ptr};
+    upload_to_gpu(meshes, 2, &app->rndr);
 
     // Create our sim region aka scene
     init_sim_region(&app->rgn, mem_global_arena());
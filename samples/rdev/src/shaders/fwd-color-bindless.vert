@@ -0,0 +1,59 @@
+#version 450
+
+layout(set = 0, binding = 0) uniform Frame_UBO {
+    ivec4 frame_count;
+} frame_ubo;
+
+layout(set = 1, binding = 0) uniform Pipeline_UBO {
+    mat4 proj_view;
+} pl_ubo;
+
+struct Material_Data {
+    vec4 color;
+    uvec4 tex_inds;
+};
+
+// All material parameters - indexed by the material index of the instance
+layout(std430, set = 2, binding = 0) readonly buffer Material_SB {
+    Material_Data mats[];
+} mat_sb;
+
+struct Object_Data {
+    mat4 transform;
+};
+
+// All object transforms - each instance looks up its transform through the instance buffer
+layout(std430, set = 3, binding = 0) readonly buffer Object_SB {
+    Object_Data objs[];
+} obj_sb;
+
+struct Instance_Data {
+    uint transform_ind;
+    uint mat_ind;
+};
+
+layout(std430, set = 3, binding = 1) readonly buffer Instance_SB {
+    Instance_Data insts[];
+} inst_sb;
+
+//push constants block
+layout( push_constant ) uniform PC
+{
+    uvec4 test;
+} pc;
+
+layout(location = 0) in vec3 in_pos;
+layout(location = 1) in vec2 in_tex_coord;
+layout(location = 2) in uvec4 in_color;
+
+layout(location = 0) out vec4 fragColor;
+layout(location = 1) out vec2 frag_tex_coord;
+
+void main() {
+    Instance_Data inst = inst_sb.insts[gl_InstanceIndex];
+    // Because GLSL stores matrices in column major, we reverse our multiplication order
+    mat4 transform = obj_sb.objs[inst.transform_ind].transform;
+    gl_Position = vec4(in_pos, 1.0) * transform * pl_ubo.proj_view;
+    fragColor = mat_sb.mats[inst.mat_ind].color;
+    frag_tex_coord = in_tex_coord;
+}
@@ -13,9 +13,23 @@ layout(set = 2, binding = 0) uniform Material_UBO {
     vec4 color;
 } mat_ubo;
 
-layout(set = 3, binding = 0) uniform Object_UBO {
+struct Object_Data {
     mat4 transform;
-} obj_ubo;
+};
+
+// All object transforms - each instance looks up its transform through the instance buffer
+layout(std430, set = 3, binding = 0) readonly buffer Object_SB {
+    Object_Data objs[];
+} obj_sb;
+
+struct Instance_Data {
+    uint transform_ind;
+    uint mat_ind;
+};
+
+layout(std430, set = 3, binding = 1) readonly buffer Instance_SB {
+    Instance_Data insts[];
+} inst_sb;
 
 //push constants block
 layout( push_constant ) uniform PC
@@ -32,7 +46,8 @@ layout(location = 1) out vec2 frag_tex_coord;
 
 void main() {
     // Because GLSL stores matrices in column major, we reverse our multiplication order
-    gl_Position = vec4(in_pos, 1.0) * obj_ubo.transform * pl_ubo.proj_view;
+    mat4 transform = obj_sb.objs[inst_sb.insts[gl_InstanceIndex].transform_ind].transform;
+    gl_Position = vec4(in_pos, 1.0) * transform * pl_ubo.proj_view;
     fragColor = mat_ubo.color;
     frag_tex_coord = in_tex_coord;
 }
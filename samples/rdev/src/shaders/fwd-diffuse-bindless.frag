@@ -0,0 +1,29 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+layout(location = 0) in vec4 fragColor;
+layout(location = 1) in vec2 frag_tex_coord;
+layout(location = 2) flat in uint frag_mat_ind;
+layout(location = 0) out vec4 out_color;
+
+struct Material_Data {
+    vec4 color;
+    uvec4 tex_inds;
+};
+
+layout(std430, set = 2, binding = 0) readonly buffer Material_SB {
+    Material_Data mats[];
+} mat_sb;
+
+layout(set = 2, binding = 1) uniform sampler2D textures[];
+
+void main() {
+    // Materials without an uploaded diffuse texture fall back to their color
+    uint tex_ind = mat_sb.mats[frag_mat_ind].tex_inds.x;
+    if (tex_ind == 0xffffffffu) {
+        out_color = fragColor;
+    }
+    else {
+        out_color = texture(textures[nonuniformEXT(tex_ind)], frag_tex_coord);
+    }
+}
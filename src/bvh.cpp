@@ -0,0 +1,595 @@
+#include <algorithm>
+
+#include "logging.h"
+#include "bvh.h"
+
+namespace nslib
+{
+
+struct bvh_build_item
+{
+    u32 ent_id;
+    bbox bounds;
+    vec3 centroid;
+};
+
+struct bvh_sah_bin
+{
+    bbox bounds;
+    u32 count;
+};
+
+intern u32 alloc_node(bvh *tree)
+{
+    u32 ind = tree->free_head;
+    if (is_valid(ind)) {
+        tree->free_head = tree->nodes[ind].parent;
+    }
+    else {
+        ind = (u32)tree->nodes.size;
+        arr_emplace_back(&tree->nodes);
+    }
+    tree->nodes[ind] = {};
+    tree->nodes[ind].height = 0;
+    return ind;
+}
+
+intern void free_node(bvh *tree, u32 ind)
+{
+    tree->nodes[ind] = {};
+    tree->nodes[ind].parent = tree->free_head;
+    tree->free_head = ind;
+}
+
+intern void fix_node(bvh *tree, u32 ind)
+{
+    auto node = &tree->nodes[ind];
+    auto l = &tree->nodes[node->left];
+    auto r = &tree->nodes[node->right];
+    node->bounds = math::merge(l->bounds, r->bounds);
+    node->height = 1 + std::max(l->height, r->height);
+}
+
+// Perform a left or right rotation if node a is imbalanced - returns the new root of the subtree. This is the same
+// rotation scheme used by box2d's dynamic tree.
+intern u32 balance(bvh *tree, u32 ia)
+{
+    auto a = &tree->nodes[ia];
+    if (bvh_is_leaf(a) || a->height < 2) {
+        return ia;
+    }
+
+    u32 ib = a->left;
+    u32 ic = a->right;
+    auto b = &tree->nodes[ib];
+    auto c = &tree->nodes[ic];
+    s32 bal = c->height - b->height;
+
+    // Rotate c up
+    if (bal > 1) {
+        u32 i_f = c->left;
+        u32 ig = c->right;
+        auto f = &tree->nodes[i_f];
+        auto g = &tree->nodes[ig];
+
+        c->left = ia;
+        c->parent = a->parent;
+        a->parent = ic;
+        if (is_valid(c->parent)) {
+            auto cp = &tree->nodes[c->parent];
+            if (cp->left == ia) {
+                cp->left = ic;
+            }
+            else {
+                cp->right = ic;
+            }
+        }
+        else {
+            tree->root = ic;
+        }
+
+        if (f->height > g->height) {
+            c->right = i_f;
+            a->right = ig;
+            g->parent = ia;
+        }
+        else {
+            c->right = ig;
+            a->right = i_f;
+            f->parent = ia;
+        }
+        fix_node(tree, ia);
+        fix_node(tree, ic);
+        return ic;
+    }
+
+    // Rotate b up
+    if (bal < -1) {
+        u32 id = b->left;
+        u32 ie = b->right;
+        auto d = &tree->nodes[id];
+        auto e = &tree->nodes[ie];
+
+        b->left = ia;
+        b->parent = a->parent;
+        a->parent = ib;
+        if (is_valid(b->parent)) {
+            auto bp = &tree->nodes[b->parent];
+            if (bp->left == ia) {
+                bp->left = ib;
+            }
+            else {
+                bp->right = ib;
+            }
+        }
+        else {
+            tree->root = ib;
+        }
+
+        if (d->height > e->height) {
+            b->right = id;
+            a->left = ie;
+            e->parent = ia;
+        }
+        else {
+            b->right = ie;
+            a->left = id;
+            d->parent = ia;
+        }
+        fix_node(tree, ia);
+        fix_node(tree, ib);
+        return ib;
+    }
+    return ia;
+}
+
+intern void refit_ancestors(bvh *tree, u32 ind)
+{
+    while (is_valid(ind)) {
+        ind = balance(tree, ind);
+        fix_node(tree, ind);
+        ind = tree->nodes[ind].parent;
+    }
+}
+
+intern void insert_leaf(bvh *tree, u32 leaf)
+{
+    if (!is_valid(tree->root)) {
+        tree->root = leaf;
+        tree->nodes[leaf].parent = INVALID_ID;
+        return;
+    }
+
+    // Descend choosing the child that results in the smallest increase in surface area
+    bbox leaf_bb = tree->nodes[leaf].bounds;
+    u32 ind = tree->root;
+    while (!bvh_is_leaf(&tree->nodes[ind])) {
+        auto node = &tree->nodes[ind];
+        f32 area = math::surface_area(node->bounds);
+        f32 combined_area = math::surface_area(math::merge(node->bounds, leaf_bb));
+
+        // Cost of creating a new parent for this node and the leaf
+        f32 cost = 2.0f * combined_area;
+
+        // Minimum cost of pushing the leaf further down the tree
+        f32 inheritance_cost = 2.0f * (combined_area - area);
+
+        f32 child_cost[2];
+        u32 children[2] = {node->left, node->right};
+        for (int i = 0; i < 2; ++i) {
+            auto child = &tree->nodes[children[i]];
+            f32 merged = math::surface_area(math::merge(child->bounds, leaf_bb));
+            if (bvh_is_leaf(child)) {
+                child_cost[i] = merged + inheritance_cost;
+            }
+            else {
+                child_cost[i] = (merged - math::surface_area(child->bounds)) + inheritance_cost;
+            }
+        }
+
+        if (cost < child_cost[0] && cost < child_cost[1]) {
+            break;
+        }
+        ind = (child_cost[0] < child_cost[1]) ? children[0] : children[1];
+    }
+
+    u32 sibling = ind;
+    u32 old_parent = tree->nodes[sibling].parent;
+    u32 new_parent = alloc_node(tree);
+    auto np = &tree->nodes[new_parent];
+    np->parent = old_parent;
+    np->bounds = math::merge(leaf_bb, tree->nodes[sibling].bounds);
+    np->height = tree->nodes[sibling].height + 1;
+    np->left = sibling;
+    np->right = leaf;
+
+    if (is_valid(old_parent)) {
+        auto op = &tree->nodes[old_parent];
+        if (op->left == sibling) {
+            op->left = new_parent;
+        }
+        else {
+            op->right = new_parent;
+        }
+    }
+    else {
+        tree->root = new_parent;
+    }
+    tree->nodes[sibling].parent = new_parent;
+    tree->nodes[leaf].parent = new_parent;
+    refit_ancestors(tree, tree->nodes[leaf].parent);
+}
+
+intern void remove_leaf(bvh *tree, u32 leaf)
+{
+    if (leaf == tree->root) {
+        tree->root = INVALID_ID;
+        return;
+    }
+
+    u32 parent = tree->nodes[leaf].parent;
+    u32 grand_parent = tree->nodes[parent].parent;
+    u32 sibling = (tree->nodes[parent].left == leaf) ? tree->nodes[parent].right : tree->nodes[parent].left;
+
+    if (is_valid(grand_parent)) {
+        auto gp = &tree->nodes[grand_parent];
+        if (gp->left == parent) {
+            gp->left = sibling;
+        }
+        else {
+            gp->right = sibling;
+        }
+        tree->nodes[sibling].parent = grand_parent;
+        free_node(tree, parent);
+        refit_ancestors(tree, grand_parent);
+    }
+    else {
+        tree->root = sibling;
+        tree->nodes[sibling].parent = INVALID_ID;
+        free_node(tree, parent);
+    }
+    tree->nodes[leaf].parent = INVALID_ID;
+}
+
+intern bbox refit_recursive(bvh *tree, u32 ind)
+{
+    auto node = &tree->nodes[ind];
+    if (bvh_is_leaf(node)) {
+        return node->bounds;
+    }
+    bbox l = refit_recursive(tree, node->left);
+    bbox r = refit_recursive(tree, node->right);
+
+    // The node array doesn't change size during refit so this is safe to grab again
+    node = &tree->nodes[ind];
+    node->bounds = math::merge(l, r);
+    node->height = 1 + std::max(tree->nodes[node->left].height, tree->nodes[node->right].height);
+    return node->bounds;
+}
+
+// Build the subtree for items [0, count) and return its root - nodes are pushed in depth first order
+intern u32 build_recursive(bvh *tree, bvh_build_item *items, u32 count, u32 parent)
+{
+    u32 ind = (u32)tree->nodes.size;
+    arr_emplace_back(&tree->nodes);
+    tree->nodes[ind].parent = parent;
+    tree->nodes[ind].height = 0;
+
+    if (count == 1) {
+        tree->nodes[ind].bounds = items[0].bounds;
+        tree->nodes[ind].ent_id = items[0].ent_id;
+        auto fiter = hmap_find(&tree->leaves, items[0].ent_id);
+        asrt(fiter);
+        fiter->val = ind;
+        return ind;
+    }
+
+    bbox bounds{};
+    bbox cbounds{};
+    for (u32 i = 0; i < count; ++i) {
+        math::extend(&bounds, items[i].bounds);
+        math::extend(&cbounds, items[i].centroid);
+    }
+    tree->nodes[ind].bounds = bounds;
+
+    // Find the cheapest split plane over all three axes using binned centroids
+    int best_axis = -1;
+    u32 best_split = 0;
+    f32 best_cost = math::surface_area(bounds) * (f32)count;
+    for (int axis = 0; axis < 3; ++axis) {
+        f32 extent = cbounds.max[axis] - cbounds.min[axis];
+        if (extent <= 0.0f) {
+            continue;
+        }
+
+        bvh_sah_bin bins[BVH_SAH_BIN_COUNT]{};
+        f32 scale = (f32)BVH_SAH_BIN_COUNT / extent;
+        for (u32 i = 0; i < count; ++i) {
+            u32 b = std::min((u32)((items[i].centroid[axis] - cbounds.min[axis]) * scale), BVH_SAH_BIN_COUNT - 1);
+            ++bins[b].count;
+            math::extend(&bins[b].bounds, items[i].bounds);
+        }
+
+        // Sweep from the right to get the area and count to the right of each split, then sweep from the left
+        f32 right_area[BVH_SAH_BIN_COUNT]{};
+        u32 right_count[BVH_SAH_BIN_COUNT]{};
+        bbox acc{};
+        u32 acc_count{};
+        for (u32 b = BVH_SAH_BIN_COUNT - 1; b > 0; --b) {
+            math::extend(&acc, bins[b].bounds);
+            acc_count += bins[b].count;
+            right_area[b] = (acc_count) ? math::surface_area(acc) : 0.0f;
+            right_count[b] = acc_count;
+        }
+
+        acc = {};
+        acc_count = 0;
+        for (u32 b = 1; b < BVH_SAH_BIN_COUNT; ++b) {
+            math::extend(&acc, bins[b - 1].bounds);
+            acc_count += bins[b - 1].count;
+            if (acc_count == 0 || right_count[b] == 0) {
+                continue;
+            }
+            f32 cost = math::surface_area(acc) * (f32)acc_count + right_area[b] * (f32)right_count[b];
+            if (cost < best_cost) {
+                best_cost = cost;
+                best_axis = axis;
+                best_split = b;
+            }
+        }
+    }
+
+    u32 mid = count / 2;
+    if (best_axis != -1) {
+        f32 scale = (f32)BVH_SAH_BIN_COUNT / (cbounds.max[best_axis] - cbounds.min[best_axis]);
+        auto part = std::partition(items, items + count, [&](const bvh_build_item &item) {
+            u32 b = std::min((u32)((item.centroid[best_axis] - cbounds.min[best_axis]) * scale), BVH_SAH_BIN_COUNT - 1);
+            return b < best_split;
+        });
+        mid = (u32)(part - items);
+    }
+
+    // No split was better than leaving everything together (or all centroids are coincident) - since leaves only ever
+    // hold one entity just split the longest axis down the middle
+    if (best_axis == -1 || mid == 0 || mid == count) {
+        vec3 ext = bounds.max - bounds.min;
+        int axis = (ext.x > ext.y && ext.x > ext.z) ? 0 : ((ext.y > ext.z) ? 1 : 2);
+        mid = count / 2;
+        std::nth_element(items, items + mid, items + count, [axis](const bvh_build_item &lhs, const bvh_build_item &rhs) {
+            return lhs.centroid[axis] < rhs.centroid[axis];
+        });
+    }
+
+    u32 left = build_recursive(tree, items, mid, ind);
+    u32 right = build_recursive(tree, items + mid, count - mid, ind);
+    auto node = &tree->nodes[ind];
+    node->left = left;
+    node->right = right;
+    node->height = 1 + std::max(tree->nodes[left].height, tree->nodes[right].height);
+    return ind;
+}
+
+void init_bvh(bvh *tree, mem_arena *arena, sizet initial_capacity)
+{
+    arr_init(&tree->nodes, arena, initial_capacity);
+    arr_init(&tree->stack, arena, 64);
+    hmap_init(&tree->leaves, hash_type, arena);
+    hmap_init(&tree->mesh_bounds, hash_type, arena);
+    tree->root = INVALID_ID;
+    tree->free_head = INVALID_ID;
+}
+
+void terminate_bvh(bvh *tree)
+{
+    hmap_terminate(&tree->mesh_bounds);
+    hmap_terminate(&tree->leaves);
+    arr_terminate(&tree->stack);
+    arr_terminate(&tree->nodes);
+    tree->root = INVALID_ID;
+    tree->free_head = INVALID_ID;
+}
+
+void bvh_clear(bvh *tree)
+{
+    arr_clear(&tree->nodes);
+    hmap_clear(&tree->leaves);
+    tree->root = INVALID_ID;
+    tree->free_head = INVALID_ID;
+}
+
+u32 bvh_insert(bvh *tree, u32 ent_id, const bbox &bounds)
+{
+    if (hmap_find(&tree->leaves, ent_id)) {
+        wlog("Entity %u already has a bvh leaf", ent_id);
+        return INVALID_ID;
+    }
+    u32 leaf = alloc_node(tree);
+    tree->nodes[leaf].ent_id = ent_id;
+    tree->nodes[leaf].bounds = bounds;
+    math::inflate(&tree->nodes[leaf].bounds, tree->fat_margin);
+    hmap_insert(&tree->leaves, ent_id, leaf);
+    insert_leaf(tree, leaf);
+    return leaf;
+}
+
+bool bvh_remove(bvh *tree, u32 ent_id)
+{
+    u32 leaf{};
+    if (!hmap_remove(&tree->leaves, ent_id, &leaf)) {
+        return false;
+    }
+    remove_leaf(tree, leaf);
+    free_node(tree, leaf);
+    return true;
+}
+
+bool bvh_update(bvh *tree, u32 ent_id, const bbox &bounds)
+{
+    auto fiter = hmap_find(&tree->leaves, ent_id);
+    if (!fiter) {
+        return false;
+    }
+    u32 leaf = fiter->val;
+    if (math::contains(tree->nodes[leaf].bounds, bounds)) {
+        return false;
+    }
+    remove_leaf(tree, leaf);
+    tree->nodes[leaf].bounds = bounds;
+    math::inflate(&tree->nodes[leaf].bounds, tree->fat_margin);
+    insert_leaf(tree, leaf);
+    return true;
+}
+
+bool bvh_set_leaf_bounds(bvh *tree, u32 ent_id, const bbox &bounds)
+{
+    auto fiter = hmap_find(&tree->leaves, ent_id);
+    if (!fiter) {
+        return false;
+    }
+    tree->nodes[fiter->val].bounds = bounds;
+    math::inflate(&tree->nodes[fiter->val].bounds, tree->fat_margin);
+    return true;
+}
+
+void bvh_refit(bvh *tree)
+{
+    if (is_valid(tree->root)) {
+        refit_recursive(tree, tree->root);
+    }
+}
+
+void bvh_rebuild(bvh *tree)
+{
+    sizet leaf_count = tree->leaves.count;
+    if (leaf_count == 0) {
+        bvh_clear(tree);
+        return;
+    }
+
+    array<bvh_build_item> items{};
+    arr_init(&items, tree->nodes.arena, leaf_count);
+    auto iter = hmap_begin(&tree->leaves);
+    while (iter) {
+        auto leaf = &tree->nodes[iter->val];
+        arr_push_back(&items, {iter->key, leaf->bounds, math::center(leaf->bounds)});
+        iter = hmap_next(&tree->leaves, iter);
+    }
+
+    // A binary tree with n leaves always has 2n - 1 nodes
+    arr_clear(&tree->nodes);
+    arr_reserve(&tree->nodes, leaf_count * 2 - 1);
+    tree->free_head = INVALID_ID;
+    tree->root = build_recursive(tree, items.data, (u32)items.size, INVALID_ID);
+    arr_terminate(&items);
+}
+
+void bvh_invalidate_mesh_bounds(bvh *tree, const rid &mesh_id)
+{
+    hmap_remove(&tree->mesh_bounds, mesh_id);
+}
+
+sizet bvh_sync_static_models(bvh *tree, sim_region *reg, const mesh_cache *msh_cache)
+{
+    auto sm_tbl = get_comp_tbl<static_model>(&reg->cdb);
+    auto tf_tbl = get_comp_tbl<transform>(&reg->cdb);
+    if (!sm_tbl || !tf_tbl) {
+        return 0;
+    }
+
+    sizet changed{};
+    for (sizet i = 0; i < sm_tbl->entries.size; ++i) {
+        auto sm = &sm_tbl->entries[i];
+        auto tf = get_comp(sm->ent_id, tf_tbl);
+        if (!tf) {
+            continue;
+        }
+
+        auto bnd_iter = hmap_find(&tree->mesh_bounds, sm->mesh_id);
+        if (!bnd_iter) {
+            auto msh = get_robj(msh_cache, sm->mesh_id);
+            if (!msh) {
+                continue;
+            }
+            bnd_iter = hmap_insert(&tree->mesh_bounds, sm->mesh_id, calc_bounds(msh.ptr));
+            asrt(bnd_iter);
+        }
+
+        bbox world_bb = math::transform(bnd_iter->val, tf->cached);
+        if (hmap_find(&tree->leaves, sm->ent_id)) {
+            changed += bvh_update(tree, sm->ent_id, world_bb);
+        }
+        else {
+            bvh_insert(tree, sm->ent_id, world_bb);
+            ++changed;
+        }
+    }
+
+    // Remove leaves for any entities that no longer have a static model or transform - collect them first as we can't
+    // remove from the hashmap while iterating it
+    arr_clear(&tree->stack);
+    auto iter = hmap_begin(&tree->leaves);
+    while (iter) {
+        if (!hmap_find(&sm_tbl->entc_hm, iter->key) || !hmap_find(&tf_tbl->entc_hm, iter->key)) {
+            arr_push_back(&tree->stack, iter->key);
+        }
+        iter = hmap_next(&tree->leaves, iter);
+    }
+    for (sizet i = 0; i < tree->stack.size; ++i) {
+        bvh_remove(tree, tree->stack[i]);
+    }
+    changed += tree->stack.size;
+    arr_clear(&tree->stack);
+    return changed;
+}
+
+// Generic stack based traversal - overlap_func is tested against every visited node and leaves that pass are added to
+// ent_ids
+template<class Func>
+intern void query(bvh *tree, array<u32> *ent_ids, Func overlap_func)
+{
+    if (!is_valid(tree->root)) {
+        return;
+    }
+    arr_clear(&tree->stack);
+    arr_push_back(&tree->stack, tree->root);
+    while (tree->stack.size > 0) {
+        u32 ind = tree->stack[tree->stack.size - 1];
+        arr_pop_back(&tree->stack);
+
+        auto node = &tree->nodes[ind];
+        if (!overlap_func(node->bounds)) {
+            continue;
+        }
+        if (bvh_is_leaf(node)) {
+            arr_push_back(ent_ids, node->ent_id);
+        }
+        else {
+            arr_push_back(&tree->stack, node->right);
+            arr_push_back(&tree->stack, node->left);
+        }
+    }
+}
+
+void bvh_query_frustum(bvh *tree, const frustum &fr, array<u32> *ent_ids)
+{
+    query(tree, ent_ids, [&fr](const bbox &bb) { return math::intersects(fr, bb); });
+}
+
+void bvh_query_aabb(bvh *tree, const bbox &bounds, array<u32> *ent_ids)
+{
+    query(tree, ent_ids, [&bounds](const bbox &bb) { return math::overlaps(bb, bounds); });
+}
+
+void bvh_query_sphere(bvh *tree, const vec3 &center, f32 radius, array<u32> *ent_ids)
+{
+    f32 rad_sq = radius * radius;
+    query(tree, ent_ids, [&center, rad_sq](const bbox &bb) { return math::dist_sq(bb, center) <= rad_sq; });
+}
+
+void bvh_query_ray(bvh *tree, const vec3 &origin, const vec3 &dir, f32 max_t, array<u32> *ent_ids)
+{
+    vec3 inv_dir{1.0f / dir.x, 1.0f / dir.y, 1.0f / dir.z};
+    query(tree, ent_ids, [&origin, &inv_dir, max_t](const bbox &bb) { return math::ray_intersects(bb, origin, inv_dir, max_t, (f32 *)nullptr); });
+}
+
+} // namespace nslib
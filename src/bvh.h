@@ -0,0 +1,91 @@
+#pragma once
+
+#include "sim_region.h"
+
+namespace nslib
+{
+
+// Leaves are stored with their bounds inflated by this amount so that small movements don't require a reinsert
+inline constexpr f32 BVH_DEFAULT_FAT_MARGIN = 0.1f;
+inline constexpr u32 BVH_SAH_BIN_COUNT = 12;
+inline constexpr sizet BVH_DEFAULT_NODE_COUNT = 1024;
+
+// Nodes all live in a single flat array and reference each other by index. Internal nodes always have two children -
+// leaves have left set to INVALID_ID and hold the entity id. After bvh_rebuild the array is in depth first order so
+// that the left child of any internal node directly follows it in memory.
+struct bvh_node
+{
+    bbox bounds;
+    u32 left{INVALID_ID};
+    u32 right{INVALID_ID};
+    // For nodes in the free list this holds the next free node
+    u32 parent{INVALID_ID};
+    u32 ent_id{INVALID_ID};
+    // Leaves are 0, free nodes are -1
+    s32 height{-1};
+};
+
+struct bvh
+{
+    array<bvh_node> nodes;
+    u32 root{INVALID_ID};
+    u32 free_head{INVALID_ID};
+    f32 fat_margin{BVH_DEFAULT_FAT_MARGIN};
+
+    // Entity id to leaf node index
+    hmap<u32, u32> leaves;
+
+    // Local space bounds of meshes referenced by static models - filled in lazily by bvh_sync_static_models
+    hmap<rid, bbox> mesh_bounds;
+
+    // Scratch space for traversal so queries don't allocate
+    array<u32> stack;
+};
+
+inline bool bvh_is_leaf(const bvh_node *node)
+{
+    return node->left == INVALID_ID;
+}
+
+void init_bvh(bvh *tree, mem_arena *arena, sizet initial_capacity = BVH_DEFAULT_NODE_COUNT);
+void terminate_bvh(bvh *tree);
+
+// Remove all leaves - the cached mesh bounds are kept
+void bvh_clear(bvh *tree);
+
+// Insert a leaf for ent_id with world space bounds - returns the leaf node index or INVALID_ID if ent_id is already in
+// the tree
+u32 bvh_insert(bvh *tree, u32 ent_id, const bbox &bounds);
+
+bool bvh_remove(bvh *tree, u32 ent_id);
+
+// Update the bounds for ent_id - the leaf is only reinserted if the new bounds leave its fat bounds, in which case true
+// is returned
+bool bvh_update(bvh *tree, u32 ent_id, const bbox &bounds);
+
+// Set the leaf bounds for ent_id without changing the tree structure - call bvh_refit once after all leaves are set.
+// This is cheaper than bvh_update when many objects move a little, but query performance degrades over time.
+bool bvh_set_leaf_bounds(bvh *tree, u32 ent_id, const bbox &bounds);
+
+// Recompute all internal node bounds from the leaves
+void bvh_refit(bvh *tree);
+
+// Throw away the current structure and build a new one top down from all current leaves with a binned SAH. This gives
+// the best query performance and should be done after loading a large number of objects.
+void bvh_rebuild(bvh *tree);
+
+// Forget the cached local bounds for a mesh - must be called when mesh vertices change
+void bvh_invalidate_mesh_bounds(bvh *tree, const rid &mesh_id);
+
+// Insert, update or remove leaves so that every entity with both a static_model and transform component has a leaf
+// with its world space mesh bounds. Returns the number of leaves that were inserted, reinserted or removed.
+sizet bvh_sync_static_models(bvh *tree, sim_region *reg, const mesh_cache *msh_cache);
+
+// All queries append the entity ids of matching leaves to ent_ids - they test against the fat leaf bounds so results
+// are conservative
+void bvh_query_frustum(bvh *tree, const frustum &fr, array<u32> *ent_ids);
+void bvh_query_aabb(bvh *tree, const bbox &bounds, array<u32> *ent_ids);
+void bvh_query_sphere(bvh *tree, const vec3 &center, f32 radius, array<u32> *ent_ids);
+void bvh_query_ray(bvh *tree, const vec3 &origin, const vec3 &dir, f32 max_t, array<u32> *ent_ids);
+
+} // namespace nslib
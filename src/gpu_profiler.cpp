@@ -0,0 +1,258 @@
+#include <algorithm>
+
+#include "logging.h"
+#include "profile_timer.h"
+#include "gpu_profiler.h"
+#include "imgui/imgui.h"
+
+namespace nslib
+{
+
+int gprof_init(gpu_profiler *prof, const vkr_context *vk, mem_arena *arena)
+{
+    arr_init(&prof->timings, arena);
+    arr_init(&prof->prev_timings, arena);
+    prof->cur_frame = 0;
+    prof->depth = 0;
+
+    auto limits = &vk->inst.pdev_info.props.limits;
+    if (!limits->timestampComputeAndGraphics || limits->timestampPeriod == 0.0f) {
+        wlog("Device does not support timestamps on the graphics queue - GPU profiling disabled");
+        prof->enabled = false;
+    }
+    if (!prof->enabled) {
+        return err_code::GPROF_NO_ERROR;
+    }
+    prof->ns_per_tick = limits->timestampPeriod;
+
+    VkQueryPoolCreateInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+    info.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    info.queryCount = GPROF_MAX_QUERIES;
+    for (sizet i = 0; i < prof->frames.size; ++i) {
+        auto frame = &prof->frames[i];
+        frame->scopes.size = 0;
+        frame->pending = false;
+        int err = vkCreateQueryPool(vk->inst.device.hndl, &info, &vk->alloc_cbs, &frame->pool);
+        if (err != VK_SUCCESS) {
+            elog("Failed to create timestamp query pool with vk err %d", err);
+            return err_code::GPROF_CREATE_QUERY_POOL_FAIL;
+        }
+    }
+    ilog("Initialized GPU profiler with %u scopes per frame and %f ns per tick", GPROF_MAX_SCOPES, prof->ns_per_tick);
+    return err_code::GPROF_NO_ERROR;
+}
+
+void gprof_terminate(gpu_profiler *prof, const vkr_context *vk)
+{
+    for (sizet i = 0; i < prof->frames.size; ++i) {
+        if (prof->frames[i].pool != VK_NULL_HANDLE) {
+            vkDestroyQueryPool(vk->inst.device.hndl, prof->frames[i].pool, &vk->alloc_cbs);
+            prof->frames[i].pool = VK_NULL_HANDLE;
+        }
+    }
+    arr_terminate(&prof->prev_timings);
+    arr_terminate(&prof->timings);
+}
+
+intern const gprof_timing *find_timing(const array<gprof_timing> *timings, u64 id, u32 depth)
+{
+    for (sizet i = 0; i < timings->size; ++i) {
+        if ((*timings)[i].id == id && (*timings)[i].depth == depth) {
+            return &(*timings)[i];
+        }
+    }
+    return nullptr;
+}
+
+void gprof_collect(gpu_profiler *prof, const vkr_context *vk, u32 frame_ind)
+{
+    auto frame = &prof->frames[frame_ind];
+    if (!prof->enabled || !frame->pending) {
+        return;
+    }
+    frame->pending = false;
+    if (frame->scopes.size == 0) {
+        return;
+    }
+
+    // The fence has been waited on so the results are there - if they somehow aren't the frame is skipped rather than
+    // waited on
+    u64 ticks[GPROF_MAX_QUERIES];
+    u32 query_count = (u32)frame->scopes.size * 2;
+    VkResult res = vkGetQueryPoolResults(
+        vk->inst.device.hndl, frame->pool, 0, query_count, sizeof(u64) * query_count, ticks, sizeof(u64), VK_QUERY_RESULT_64_BIT);
+    if (res != VK_SUCCESS) {
+        frame->scopes.size = 0;
+        return;
+    }
+
+    swap(&prof->timings, &prof->prev_timings);
+    arr_clear(&prof->timings);
+    for (sizet si = 0; si < frame->scopes.size; ++si) {
+        auto scope = &frame->scopes[si];
+        u64 begin = ticks[si * 2];
+        u64 end = ticks[si * 2 + 1];
+        f64 ms = NSEC_TO_MSEC((end > begin) ? (end - begin) * prof->ns_per_tick : 0.0);
+
+        auto tm = (gprof_timing *)find_timing(&prof->timings, scope->id, scope->depth);
+        if (!tm) {
+            tm = arr_emplace_back(&prof->timings);
+            tm->id = scope->id;
+            tm->name = scope->name;
+            tm->depth = scope->depth;
+            tm->begin_tick = begin;
+        }
+        tm->begin_tick = std::min(tm->begin_tick, begin);
+        tm->ms += ms;
+        ++tm->count;
+    }
+
+    for (sizet ti = 0; ti < prof->timings.size; ++ti) {
+        auto tm = &prof->timings[ti];
+        auto prev = find_timing(&prof->prev_timings, tm->id, tm->depth);
+        tm->avg_ms = (prev) ? prev->avg_ms + (tm->ms - prev->avg_ms) * GPROF_AVG_WEIGHT : tm->ms;
+    }
+
+    // Scopes recorded on other threads are added before the scopes they end up nested in, so order by when they ran
+    std::stable_sort(prof->timings.data, prof->timings.data + prof->timings.size, [](const gprof_timing &a, const gprof_timing &b) {
+        return a.begin_tick < b.begin_tick || (a.begin_tick == b.begin_tick && a.depth < b.depth);
+    });
+    frame->scopes.size = 0;
+}
+
+void gprof_begin_frame(gpu_profiler *prof, const vkr_command_buffer *cmd_buf, u32 frame_ind)
+{
+    prof->cur_frame = frame_ind;
+    prof->depth = 0;
+    auto frame = &prof->frames[frame_ind];
+    frame->scopes.size = 0;
+    if (!prof->enabled) {
+        return;
+    }
+    vkCmdResetQueryPool(cmd_buf->hndl, frame->pool, 0, GPROF_MAX_QUERIES);
+    frame->pending = true;
+}
+
+u32 gprof_add_scopes(gpu_profiler *prof, u32 count, u32 depth)
+{
+    auto frame = &prof->frames[prof->cur_frame];
+    if (!prof->enabled || count == 0 || frame->scopes.size + count > GPROF_MAX_SCOPES) {
+        return INVALID_ID;
+    }
+    u32 first = (u32)frame->scopes.size;
+    for (u32 i = 0; i < count; ++i) {
+        arr_push_back(&frame->scopes, gprof_scope{0, "", depth});
+    }
+    return first;
+}
+
+void gprof_set_scope_id(gpu_profiler *prof, u32 scope, const rid &id)
+{
+    auto frame = &prof->frames[prof->cur_frame];
+    asrt(scope < frame->scopes.size);
+    frame->scopes[scope].id = id.id;
+    frame->scopes[scope].name = str_cstr(id.str);
+}
+
+void gprof_write_begin(const gpu_profiler *prof, VkCommandBuffer cmd_buf, u32 scope)
+{
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, prof->frames[prof->cur_frame].pool, scope * 2);
+}
+
+void gprof_write_end(const gpu_profiler *prof, VkCommandBuffer cmd_buf, u32 scope)
+{
+    vkCmdWriteTimestamp(cmd_buf, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, prof->frames[prof->cur_frame].pool, scope * 2 + 1);
+}
+
+u32 gprof_begin(gpu_profiler *prof, const vkr_command_buffer *cmd_buf, const rid &id)
+{
+    u32 scope = gprof_add_scopes(prof, 1, prof->depth);
+    if (!is_valid(scope)) {
+        return scope;
+    }
+    gprof_set_scope_id(prof, scope, id);
+    gprof_write_begin(prof, cmd_buf->hndl, scope);
+    ++prof->depth;
+    return scope;
+}
+
+void gprof_end(gpu_profiler *prof, const vkr_command_buffer *cmd_buf, u32 scope)
+{
+    if (!is_valid(scope)) {
+        return;
+    }
+    gprof_write_end(prof, cmd_buf->hndl, scope);
+    --prof->depth;
+}
+
+void gprof_set_fence_wait_time(gpu_profiler *prof, f64 ms)
+{
+    prof->fence_wait_ms = ms;
+    prof->avg_fence_wait_ms += (ms - prof->avg_fence_wait_ms) * GPROF_AVG_WEIGHT;
+}
+
+void gprof_set_acquire_time(gpu_profiler *prof, f64 ms)
+{
+    prof->acquire_ms = ms;
+    prof->avg_acquire_ms += (ms - prof->avg_acquire_ms) * GPROF_AVG_WEIGHT;
+}
+
+void gprof_draw_overlay(const gpu_profiler *prof)
+{
+    ImGui::SetNextWindowBgAlpha(0.8f);
+    if (!ImGui::Begin("GPU Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize)) {
+        ImGui::End();
+        return;
+    }
+
+    if (ImGui::BeginTable("gprof", 3, ImGuiTableFlags_RowBg | ImGuiTableFlags_SizingFixedFit)) {
+        ImGui::TableSetupColumn("Scope");
+        ImGui::TableSetupColumn("ms");
+        ImGui::TableSetupColumn("avg ms");
+        ImGui::TableHeadersRow();
+
+        // CPU waits go first so they can be compared with the GPU frame time right below them
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("cpu fence wait");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", prof->fence_wait_ms);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", prof->avg_fence_wait_ms);
+
+        ImGui::TableNextRow();
+        ImGui::TableNextColumn();
+        ImGui::Text("cpu acquire image");
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", prof->acquire_ms);
+        ImGui::TableNextColumn();
+        ImGui::Text("%.3f", prof->avg_acquire_ms);
+
+        for (sizet i = 0; i < prof->timings.size; ++i) {
+            auto tm = &prof->timings[i];
+            ImGui::TableNextRow();
+            ImGui::TableNextColumn();
+            ImGui::Indent((f32)tm->depth * ImGui::GetStyle().IndentSpacing + 1.0f);
+            if (tm->count > 1) {
+                ImGui::Text("%s (x%u)", tm->name, tm->count);
+            }
+            else {
+                ImGui::Text("%s", tm->name);
+            }
+            ImGui::Unindent((f32)tm->depth * ImGui::GetStyle().IndentSpacing + 1.0f);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", tm->ms);
+            ImGui::TableNextColumn();
+            ImGui::Text("%.3f", tm->avg_ms);
+        }
+        ImGui::EndTable();
+    }
+
+    if (!prof->enabled) {
+        ImGui::TextDisabled("GPU timestamps are not supported on this device");
+    }
+    ImGui::End();
+}
+
+} // namespace nslib
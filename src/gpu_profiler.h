@@ -0,0 +1,106 @@
+#pragma once
+
+#include "vk_context.h"
+
+namespace nslib
+{
+
+namespace err_code
+{
+enum gpu_profiler
+{
+    GPROF_NO_ERROR,
+    GPROF_CREATE_QUERY_POOL_FAIL
+};
+}
+
+// Scopes per frame - each takes a begin and end timestamp query
+inline constexpr u32 GPROF_MAX_SCOPES = 256;
+inline constexpr u32 GPROF_MAX_QUERIES = GPROF_MAX_SCOPES * 2;
+// Weight of the newest frame in the averaged times
+inline constexpr f64 GPROF_AVG_WEIGHT = 0.05;
+
+struct gprof_scope
+{
+    u64 id;
+    const char *name;
+    u32 depth;
+};
+
+// Timestamps of one frame in flight - they are read the next time the frame begins, after its fence has been waited
+// on, so reading them never stalls
+struct gprof_frame
+{
+    VkQueryPool pool{VK_NULL_HANDLE};
+    static_array<gprof_scope, GPROF_MAX_SCOPES> scopes;
+    b32 pending;
+};
+
+// Scopes with the same id and depth in a frame are summed in to one timing
+struct gprof_timing
+{
+    u64 id;
+    const char *name;
+    u32 depth;
+    u32 count;
+    u64 begin_tick;
+    f64 ms;
+    f64 avg_ms;
+};
+
+// GPU timestamps around scopes of the frame's command buffers. Scopes are written in to the query pool of the frame in
+// flight being recorded, and the timings shown are from the last time that frame was rendered - MAX_FRAMES_IN_FLIGHT
+// frames behind.
+struct gpu_profiler
+{
+    // Turned off on init if the device can't write timestamps on the graphics queue
+    b32 enabled{true};
+    // Show the timings in an imgui window
+    b32 overlay{false};
+    f64 ns_per_tick;
+    static_array<gprof_frame, MAX_FRAMES_IN_FLIGHT> frames{.size = MAX_FRAMES_IN_FLIGHT};
+    // Frame being recorded and the depth of the scopes begun on it so far
+    u32 cur_frame;
+    u32 depth;
+
+    // Timings of the last frame read back in the order the scopes began on the GPU
+    array<gprof_timing> timings;
+    array<gprof_timing> prev_timings;
+
+    // CPU time blocked waiting on the frame fence and acquiring the swapchain image
+    f64 fence_wait_ms;
+    f64 acquire_ms;
+    f64 avg_fence_wait_ms;
+    f64 avg_acquire_ms;
+};
+
+int gprof_init(gpu_profiler *prof, const vkr_context *vk, mem_arena *arena);
+void gprof_terminate(gpu_profiler *prof, const vkr_context *vk);
+
+// Read the timestamps of the last time the frame was rendered - call after the frame's fence has been waited on
+void gprof_collect(gpu_profiler *prof, const vkr_context *vk, u32 frame_ind);
+
+// Reset the frame's queries - must be recorded outside of a render pass before any scopes
+void gprof_begin_frame(gpu_profiler *prof, const vkr_command_buffer *cmd_buf, u32 frame_ind);
+
+// Begin and end a scope nested in the scopes begun so far - returns INVALID_ID if the profiler is off or the frame has
+// no scopes left, which gprof_end ignores
+u32 gprof_begin(gpu_profiler *prof, const vkr_command_buffer *cmd_buf, const rid &id);
+void gprof_end(gpu_profiler *prof, const vkr_command_buffer *cmd_buf, u32 scope);
+
+// Add count scopes up front so their timestamps can be written later from other threads - returns the first scope or
+// INVALID_ID if there isn't room for all of them. Ids are set with gprof_set_scope_id.
+u32 gprof_add_scopes(gpu_profiler *prof, u32 count, u32 depth);
+void gprof_set_scope_id(gpu_profiler *prof, u32 scope, const rid &id);
+
+// Only touch the command buffer so they can be called from any thread recording a scope added with gprof_add_scopes
+void gprof_write_begin(const gpu_profiler *prof, VkCommandBuffer cmd_buf, u32 scope);
+void gprof_write_end(const gpu_profiler *prof, VkCommandBuffer cmd_buf, u32 scope);
+
+void gprof_set_fence_wait_time(gpu_profiler *prof, f64 ms);
+void gprof_set_acquire_time(gpu_profiler *prof, f64 ms);
+
+// Imgui window with the timings - call between the imgui new frame and render
+void gprof_draw_overlay(const gpu_profiler *prof);
+
+} // namespace nslib
@@ -0,0 +1,118 @@
+#include <algorithm>
+
+#include "logging.h"
+#include "job_pool.h"
+
+namespace nslib
+{
+
+intern void run_jobs(job_pool *jp, job_func func, void *user, sizet job_count, sizet thread_ind)
+{
+    sizet ji = jp->next_job.fetch_add(1, std::memory_order_relaxed);
+    while (ji < job_count) {
+        func(user, ji, thread_ind);
+        ji = jp->next_job.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+intern void worker_main(job_pool *jp, sizet thread_ind)
+{
+    u64 seen_batch = 0;
+    std::unique_lock<std::mutex> lock(jp->mtx);
+    while (true) {
+        jp->work_cv.wait(lock, [jp, seen_batch] { return jp->quit || jp->batch != seen_batch; });
+        if (jp->quit) {
+            return;
+        }
+
+        // The batch is read under the lock and the worker counted as active, so the batch can't be replaced until this
+        // worker is done with it - even if the other threads have already taken every job
+        seen_batch = jp->batch;
+        job_func func = jp->func;
+        void *user = jp->user;
+        sizet job_count = jp->job_count;
+        ++jp->active_count;
+        lock.unlock();
+
+        run_jobs(jp, func, user, job_count, thread_ind);
+
+        lock.lock();
+        --jp->active_count;
+        if (jp->active_count == 0) {
+            jp->done_cv.notify_one();
+        }
+    }
+}
+
+void init_job_pool(job_pool *jp, sizet thread_count)
+{
+    jp->thread_count = std::min(thread_count, MAX_JOB_THREAD_COUNT);
+    jp->func = nullptr;
+    jp->user = nullptr;
+    jp->job_count = 0;
+    jp->batch = 0;
+    jp->next_job = 0;
+    jp->active_count = 0;
+    jp->quit = false;
+    for (sizet i = 0; i < jp->thread_count; ++i) {
+        jp->threads[i] = std::thread(worker_main, jp, i);
+    }
+    ilog("Initialized job pool with %lu worker threads", jp->thread_count);
+}
+
+void terminate_job_pool(job_pool *jp)
+{
+    {
+        std::lock_guard<std::mutex> lock(jp->mtx);
+        jp->quit = true;
+    }
+    jp->work_cv.notify_all();
+    for (sizet i = 0; i < jp->thread_count; ++i) {
+        if (jp->threads[i].joinable()) {
+            jp->threads[i].join();
+        }
+    }
+    jp->thread_count = 0;
+}
+
+void job_pool_run(job_pool *jp, sizet count, job_func func, void *user)
+{
+    if (count == 0) {
+        return;
+    }
+
+    // Not worth waking the workers for a single job
+    if (jp->thread_count == 0 || count == 1) {
+        for (sizet i = 0; i < count; ++i) {
+            func(user, i, jp->thread_count);
+        }
+        return;
+    }
+
+    {
+        // A worker that woke up late for the last batch may still be looking at it, and would run the new batch's job
+        // indices with the old function if the counter were reset under it
+        std::unique_lock<std::mutex> lock(jp->mtx);
+        jp->done_cv.wait(lock, [jp] { return jp->active_count == 0; });
+        jp->func = func;
+        jp->user = user;
+        jp->job_count = count;
+        jp->next_job.store(0, std::memory_order_relaxed);
+        ++jp->batch;
+    }
+    jp->work_cv.notify_all();
+
+    run_jobs(jp, func, user, count, jp->thread_count);
+
+    // Every job has been taken once the calling thread runs out, so only the workers still running one are waited on
+    std::unique_lock<std::mutex> lock(jp->mtx);
+    jp->done_cv.wait(lock, [jp] { return jp->active_count == 0; });
+}
+
+sizet job_pool_default_thread_count()
+{
+    sizet hw = std::thread::hardware_concurrency();
+    return (hw > 1) ? std::min(hw - 1, MAX_JOB_THREAD_COUNT) : 0;
+}
+
+} // namespace nslib
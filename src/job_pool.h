@@ -0,0 +1,54 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+#include "basic_types.h"
+
+namespace nslib
+{
+
+inline constexpr sizet MAX_JOB_THREAD_COUNT = 16;
+
+// Called once per job index - thread_ind is the index of the thread running the job, which is thread_count for the
+// thread that called job_pool_run, so per thread data can be indexed with it without locking
+using job_func = void (*)(void *user, sizet job_ind, sizet thread_ind);
+
+// Fixed set of worker threads that run batches of jobs. Jobs are handed out one index at a time through an atomic
+// counter so uneven jobs balance out, and the calling thread runs jobs as well rather than waiting idle.
+struct job_pool
+{
+    std::thread threads[MAX_JOB_THREAD_COUNT];
+    sizet thread_count;
+
+    std::mutex mtx;
+    std::condition_variable work_cv;
+    std::condition_variable done_cv;
+
+    // Current batch - only changed under the lock while no worker is active
+    job_func func;
+    void *user;
+    sizet job_count;
+    u64 batch;
+    std::atomic<sizet> next_job;
+
+    // Workers still running jobs from the current batch
+    sizet active_count;
+    b32 quit;
+};
+
+// The thread count is clamped to MAX_JOB_THREAD_COUNT - zero is fine and runs every job on the calling thread
+void init_job_pool(job_pool *jp, sizet thread_count);
+void terminate_job_pool(job_pool *jp);
+
+// Run func for every job index in [0, count) and return once they are all done. Not reentrant - jobs can't run more
+// jobs on the same pool.
+void job_pool_run(job_pool *jp, sizet count, job_func func, void *user);
+
+// Worker threads to use for the hardware this is running on - one less than the hardware threads to leave one for the
+// calling thread
+sizet job_pool_default_thread_count();
+
+} // namespace nslib
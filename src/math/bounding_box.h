@@ -1,128 +1,193 @@
-#include "../containers/array.h"
-#include "vector3.h"
+#pragma once
+
+#include <limits>
 #include "matrix4.h"
 
 namespace nslib
 {
 
+// Axis aligned bounding box - default constructed boxes are "empty" (min > max) so that extending them by any point or
+// box results in exactly that point or box
 template<class T>
 struct bounding_box
 {
-    enum box_face
-    {
-        f_none,
-        f_bottom,
-        f_top,
-        f_left,
-        f_right,
-        f_back,
-        f_front
-    };
-
-    bounding_box(const array<vector3<T>> &verts_ = array<vector3<T>>(), const matrix4<T> &tform_=matrix4<T>())
-    {
-        calculate(verts_, tform_);
-    }
+    vector3<T> min{std::numeric_limits<T>::max()};
+    vector3<T> max{std::numeric_limits<T>::lowest()};
+};
 
-    bounding_box(const vector3<T> &min_, const vector3<T> &max_): min(min_), max(max_)
-    {
-        update_verts();
-    }
+pup_func_tt(bounding_box)
+{
+    pup_member(min);
+    pup_member(max);
+}
 
-    ~bounding_box()
-    {}
+namespace math
+{
 
-    void calculate(const array<vector3<T>> &verts_, const matrix4<T> &tform_ = matrix4<T>())
-    {
-        clear();
-        extend(verts_, tform_);
-    }
+template<class T>
+bool is_empty(const bounding_box<T> &bb)
+{
+    return bb.min.x > bb.max.x || bb.min.y > bb.max.y || bb.min.z > bb.max.z;
+}
 
-    vector3<T> center(const box_face &face_ = f_none)
-    {
-        vector3<T> center = (max - min) * 0.5;
-        switch (face_)
-        {
-        case (f_none):
-            break;
-        case (f_bottom):
-            center.z = min.z;
-            break;
-        case (f_top):
-            center.z = max.z;
-            break;
-        case (f_left):
-            center.x = min.x;
-            break;
-        case (f_right):
-            center.x = max.x;
-            break;
-        case (f_back):
-            center.y = min.y;
-            break;
-        case (f_front):
-            center.y = max.y;
-            break;
-        }
-        return center;
-    }
+template<class T>
+vector3<T> center(const bounding_box<T> &bb)
+{
+    return (bb.min + bb.max) * T(0.5);
+}
 
-    void clear()
-    {
-        min = vector3<T>();
-        max = vector3<T>();
-        for (sizet i = 0; i < 8; ++i)
-            verts[i] = vector3<T>();
-    }
+// Half size of the box in each dimension
+template<class T>
+vector3<T> extents(const bounding_box<T> &bb)
+{
+    return (bb.max - bb.min) * T(0.5);
+}
 
-    void extend(const array<vector3<T>> &verts_, const matrix4<T> &tform_ = matrix4<T>())
-    {
-        if (!verts_.empty())
-        {
-            min = verts_[0];
-            max = min;
-        }
-        
-        for (sizet i = 0; i < verts_.size(); ++i)
-        {
-            vector3<T> tvert = (tform_ * vector4<T>(verts_[i], 1.0f)).vec3();
+template<class T>
+T volume(const bounding_box<T> &bb)
+{
+    vector3<T> diff = bb.max - bb.min;
+    return diff.x * diff.y * diff.z;
+}
+
+template<class T>
+T surface_area(const bounding_box<T> &bb)
+{
+    vector3<T> d = bb.max - bb.min;
+    return T(2) * (d.x * d.y + d.y * d.z + d.z * d.x);
+}
 
-            // Find maximum of each dimension
-            max.maximize(tvert);
+template<class T>
+void extend(bounding_box<T> *bb, const vector3<T> &pt)
+{
+    bb->min = minimums(bb->min, pt);
+    bb->max = maximums(bb->max, pt);
+}
 
-            // Find minimum of each dimension
-            min.minimize(tvert);
+template<class T>
+void extend(bounding_box<T> *bb, const bounding_box<T> &other)
+{
+    bb->min = minimums(bb->min, other.min);
+    bb->max = maximums(bb->max, other.max);
+}
+
+template<class T>
+bounding_box<T> merge(bounding_box<T> lhs, const bounding_box<T> &rhs)
+{
+    extend(&lhs, rhs);
+    return lhs;
+}
+
+template<class T>
+void inflate(bounding_box<T> *bb, T amount)
+{
+    bb->min -= vector3<T>(amount);
+    bb->max += vector3<T>(amount);
+}
+
+template<class T>
+bool contains(const bounding_box<T> &outer, const bounding_box<T> &inner)
+{
+    return outer.min.x <= inner.min.x && outer.min.y <= inner.min.y && outer.min.z <= inner.min.z && outer.max.x >= inner.max.x &&
+           outer.max.y >= inner.max.y && outer.max.z >= inner.max.z;
+}
+
+template<class T>
+bool contains(const bounding_box<T> &bb, const vector3<T> &pt)
+{
+    return pt.x >= bb.min.x && pt.y >= bb.min.y && pt.z >= bb.min.z && pt.x <= bb.max.x && pt.y <= bb.max.y && pt.z <= bb.max.z;
+}
+
+template<class T>
+bool overlaps(const bounding_box<T> &lhs, const bounding_box<T> &rhs)
+{
+    return lhs.min.x <= rhs.max.x && lhs.max.x >= rhs.min.x && lhs.min.y <= rhs.max.y && lhs.max.y >= rhs.min.y && lhs.min.z <= rhs.max.z &&
+           lhs.max.z >= rhs.min.z;
+}
+
+// Squared distance from pt to the closest point on or in the box - zero if pt is inside
+template<class T>
+T dist_sq(const bounding_box<T> &bb, const vector3<T> &pt)
+{
+    T ret{};
+    for (int i = 0; i < 3; ++i) {
+        if (pt[i] < bb.min[i]) {
+            ret += (bb.min[i] - pt[i]) * (bb.min[i] - pt[i]);
+        }
+        else if (pt[i] > bb.max[i]) {
+            ret += (pt[i] - bb.max[i]) * (pt[i] - bb.max[i]);
         }
-        update_verts();
     }
+    return ret;
+}
 
-    T volume()
-    {
-        vector3<T> diff = (max - min).abs();
-        return diff.x * diff.y * diff.z;
+// Slab test - returns true if the ray hits the box within [0, max_t] and sets the entry distance in t_hit. inv_dir is 1
+// / dir per component (infinities are fine)
+template<class T>
+bool ray_intersects(const bounding_box<T> &bb, const vector3<T> &origin, const vector3<T> &inv_dir, T max_t, T *t_hit)
+{
+    T tmin{0};
+    T tmax{max_t};
+    for (int i = 0; i < 3; ++i) {
+        T t0 = (bb.min[i] - origin[i]) * inv_dir[i];
+        T t1 = (bb.max[i] - origin[i]) * inv_dir[i];
+        if (t0 > t1) {
+            std::swap(t0, t1);
+        }
+        tmin = (t0 > tmin) ? t0 : tmin;
+        tmax = (t1 < tmax) ? t1 : tmax;
+        if (tmin > tmax) {
+            return false;
+        }
+    }
+    if (t_hit) {
+        *t_hit = tmin;
     }
+    return true;
+}
 
-    void update_verts()
-    {
-        verts[0] = min;
-        verts[1] = vector3<T>(max.x, min.y, min.z);
-        verts[2] = vector3<T>(min.x, max.y, min.z);
-        verts[3] = vector3<T>(max.x, max.y, min.z);
-        verts[4] = vector3<T>(min.x, min.y, max.z);
-        verts[5] = vector3<T>(max.x, min.y, max.z);
-        verts[6] = vector3<T>(min.x, max.y, max.z);
-        verts[7] = max;
+// Transform a box by tf and return the axis aligned box containing the result (Arvo's method) - much cheaper than
+// transforming all eight corners
+template<class T>
+bounding_box<T> transform(const bounding_box<T> &bb, const matrix4<T> &tf)
+{
+    if (is_empty(bb)) {
+        return bb;
+    }
+    bounding_box<T> ret;
+    for (int i = 0; i < 3; ++i) {
+        ret.min[i] = ret.max[i] = tf[i][3];
+        for (int j = 0; j < 3; ++j) {
+            T a = tf[i][j] * bb.min[j];
+            T b = tf[i][j] * bb.max[j];
+            if (a < b) {
+                ret.min[i] += a;
+                ret.max[i] += b;
+            }
+            else {
+                ret.min[i] += b;
+                ret.max[i] += a;
+            }
+        }
     }
+    return ret;
+}
 
-    vector3<T> min;
-    vector3<T> max;
-    vector3<T> verts[8];
-};
+template<class T>
+void corners(const bounding_box<T> &bb, vector3<T> out[8])
+{
+    out[0] = bb.min;
+    out[1] = {bb.max.x, bb.min.y, bb.min.z};
+    out[2] = {bb.min.x, bb.max.y, bb.min.z};
+    out[3] = {bb.max.x, bb.max.y, bb.min.z};
+    out[4] = {bb.min.x, bb.min.y, bb.max.z};
+    out[5] = {bb.max.x, bb.min.y, bb.max.z};
+    out[6] = {bb.min.x, bb.max.y, bb.max.z};
+    out[7] = bb.max;
+}
+
+} // namespace math
 
-using cbbox = bounding_box<char>;
-using c16bbox = bounding_box<c16>;
-using c32bbox = bounding_box<c32>;
-using cwbbox = bounding_box<wchar>;
 using i8bbox = bounding_box<s8>;
 using i16bbox = bounding_box<s16>;
 using ibbox = bounding_box<s32>;
@@ -133,6 +198,5 @@ using uibbox = bounding_box<u32>;
 using ui64bbox = bounding_box<u64>;
 using bbox = bounding_box<f32>;
 using f64bbox = bounding_box<f64>;
-using f128bbox = bounding_box<f128>;
 
 } // namespace nslib
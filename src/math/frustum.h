@@ -0,0 +1,85 @@
+#pragma once
+
+#include "bounding_box.h"
+
+namespace nslib
+{
+
+enum frustum_plane
+{
+    FRUSTUM_PLANE_LEFT,
+    FRUSTUM_PLANE_RIGHT,
+    FRUSTUM_PLANE_BOTTOM,
+    FRUSTUM_PLANE_TOP,
+    FRUSTUM_PLANE_NEAR,
+    FRUSTUM_PLANE_FAR,
+    FRUSTUM_PLANE_COUNT
+};
+
+// Each plane is stored as xyz = normal pointing in to the frustum and w = distance so that dot(plane, {p, 1}) >= 0 for
+// points on the inside
+template<class T>
+struct frustum_generic
+{
+    vector4<T> planes[FRUSTUM_PLANE_COUNT];
+};
+
+using frustum = frustum_generic<f32>;
+
+namespace math
+{
+
+// Extract the planes from a projection * view matrix (Gribb/Hartmann). The near plane is taken as w + z which is correct
+// for a -1 to 1 clip depth and conservative (slightly larger) for 0 to 1
+template<class T>
+frustum_generic<T> extract_frustum(const matrix4<T> &proj_view)
+{
+    frustum_generic<T> ret;
+    const vector4<T> &r0 = proj_view[0];
+    const vector4<T> &r1 = proj_view[1];
+    const vector4<T> &r2 = proj_view[2];
+    const vector4<T> &r3 = proj_view[3];
+    ret.planes[FRUSTUM_PLANE_LEFT] = r3 + r0;
+    ret.planes[FRUSTUM_PLANE_RIGHT] = r3 - r0;
+    ret.planes[FRUSTUM_PLANE_BOTTOM] = r3 + r1;
+    ret.planes[FRUSTUM_PLANE_TOP] = r3 - r1;
+    ret.planes[FRUSTUM_PLANE_NEAR] = r3 + r2;
+    ret.planes[FRUSTUM_PLANE_FAR] = r3 - r2;
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        T len = length(ret.planes[i].xyz);
+        if (len > T(0)) {
+            ret.planes[i] /= len;
+        }
+    }
+    return ret;
+}
+
+// Returns false only if the box is completely outside one of the planes - boxes straddling a corner of the frustum may
+// still return true
+template<class T>
+bool intersects(const frustum_generic<T> &fr, const bounding_box<T> &bb)
+{
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        const vector4<T> &pl = fr.planes[i];
+        // Positive vertex - the corner furthest along the plane normal
+        vector3<T> pv{(pl.x >= 0) ? bb.max.x : bb.min.x, (pl.y >= 0) ? bb.max.y : bb.min.y, (pl.z >= 0) ? bb.max.z : bb.min.z};
+        if (dot(pl.xyz, pv) + pl.w < T(0)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template<class T>
+bool intersects(const frustum_generic<T> &fr, const vector3<T> &center, T radius)
+{
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        if (dot(fr.planes[i].xyz, center) + fr.planes[i].w < -radius) {
+            return false;
+        }
+    }
+    return true;
+}
+
+} // namespace math
+} // namespace nslib
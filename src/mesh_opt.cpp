@@ -0,0 +1,1008 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#include "logging.h"
+#include "hashfuncs.h"
+#include "mesh_opt.h"
+
+namespace nslib
+{
+
+// Forsyth's scoring constants - see "Linear-Speed Vertex Cache Optimisation"
+intern const f32 FORSYTH_CACHE_DECAY_POWER = 1.5f;
+intern const f32 FORSYTH_LAST_TRI_SCORE = 0.75f;
+intern const f32 FORSYTH_VALENCE_BOOST_SCALE = 2.0f;
+intern const f32 FORSYTH_VALENCE_BOOST_POWER = 0.5f;
+
+// Indices are processed as u32 regardless of how the submesh stores them
+intern void load_lod_inds(const submesh *sm, sizet lod, array<u32> *inds)
+{
+    const array<ind_t> *narrow = (lod == 0) ? &sm->inds : &sm->lods[lod - 1].inds;
+    const array<u32> *wide = (lod == 0) ? &sm->wide_inds : &sm->lods[lod - 1].wide_inds;
+    if (has_wide_inds(sm)) {
+        arr_copy(inds, wide);
+        return;
+    }
+    arr_resize(inds, narrow->size);
+    for (sizet i = 0; i < narrow->size; ++i) {
+        (*inds)[i] = (*narrow)[i];
+    }
+}
+
+intern void store_lod_inds(submesh *sm, sizet lod, const array<u32> *inds)
+{
+    array<ind_t> *narrow = (lod == 0) ? &sm->inds : &sm->lods[lod - 1].inds;
+    array<u32> *wide = (lod == 0) ? &sm->wide_inds : &sm->lods[lod - 1].wide_inds;
+    if (sm->verts.size > MAX_IND_T_VERT_COUNT) {
+        arr_clear(narrow);
+        arr_copy(wide, inds);
+    }
+    else {
+        arr_clear(wide);
+        arr_resize(narrow, inds->size);
+        for (sizet i = 0; i < inds->size; ++i) {
+            (*narrow)[i] = (ind_t)(*inds)[i];
+        }
+    }
+}
+
+intern void load_inds(const submesh *sm, array<u32> *inds)
+{
+    load_lod_inds(sm, 0, inds);
+}
+
+intern void store_inds(submesh *sm, const array<u32> *inds)
+{
+    store_lod_inds(sm, 0, inds);
+}
+
+// Run every LOD's indices through the vert remap - unlike the full detail indices they are never reordered
+intern void remap_lod_inds(submesh *sm, const array<u32> *remap)
+{
+    array<u32> inds{};
+    for (sizet lod = 1; lod < get_lod_count(sm); ++lod) {
+        load_lod_inds(sm, lod, &inds);
+        for (sizet i = 0; i < inds.size; ++i) {
+            inds[i] = (*remap)[inds[i]];
+        }
+        store_lod_inds(sm, lod, &inds);
+    }
+}
+
+void mopt_fit_index_size(submesh *sm)
+{
+    // The LODs have to be converted first as the index size is decided by whether the full detail inds are wide
+    array<u32> inds{};
+    for (sizet lod = get_lod_count(sm); lod > 0; --lod) {
+        load_lod_inds(sm, lod - 1, &inds);
+        store_lod_inds(sm, lod - 1, &inds);
+    }
+}
+
+sizet mopt_dedupe_verts(submesh *sm)
+{
+    sizet vert_count = sm->verts.size;
+    if (vert_count == 0) {
+        return 0;
+    }
+    bool has_joints = sm->cjoints.size == vert_count;
+
+    // Open addressing table of vert indices sized to at most half full
+    sizet table_size = 1;
+    while (table_size < vert_count * 2) {
+        table_size <<= 1;
+    }
+    array<u32> table{};
+    arr_resize(&table, table_size, INVALID_ID);
+
+    array<u32> remap{};
+    arr_resize(&remap, vert_count);
+    sizet unique_count = 0;
+    for (sizet vi = 0; vi < vert_count; ++vi) {
+        u64 hash = xxhash3(&sm->verts[vi], sizeof(vertex), 0);
+        if (has_joints) {
+            hash ^= xxhash3(&sm->cjoints[vi], sizeof(vertex_cjoints), hash);
+        }
+
+        sizet slot = hash & (table_size - 1);
+        while (true) {
+            u32 existing = table[slot];
+            if (!is_valid(existing)) {
+                // Verts are compacted in place - the unique vert is always at or before its source
+                table[slot] = (u32)unique_count;
+                sm->verts[unique_count] = sm->verts[vi];
+                if (has_joints) {
+                    sm->cjoints[unique_count] = sm->cjoints[vi];
+                }
+                remap[vi] = (u32)unique_count++;
+                break;
+            }
+            if (memcmp(&sm->verts[existing], &sm->verts[vi], sizeof(vertex)) == 0 &&
+                (!has_joints || memcmp(&sm->cjoints[existing], &sm->cjoints[vi], sizeof(vertex_cjoints)) == 0)) {
+                remap[vi] = existing;
+                break;
+            }
+            slot = (slot + 1) & (table_size - 1);
+        }
+    }
+
+    arr_resize(&sm->verts, unique_count);
+    if (has_joints) {
+        arr_resize(&sm->cjoints, unique_count);
+    }
+    array<u32> inds{};
+    load_inds(sm, &inds);
+    for (sizet i = 0; i < inds.size; ++i) {
+        inds[i] = remap[inds[i]];
+    }
+    // The LODs go first since loading them depends on the full detail index size
+    remap_lod_inds(sm, &remap);
+    store_inds(sm, &inds);
+    return unique_count;
+}
+
+intern f32 forsyth_vert_score(s32 cache_pos, u32 remaining_tris)
+{
+    // No triangles left to draw with this vert
+    if (remaining_tris == 0) {
+        return -1.0f;
+    }
+
+    f32 score = 0.0f;
+    if (cache_pos >= 0) {
+        // The last triangle's verts get a fixed score so the next triangle doesn't just reuse its edge over and over
+        if (cache_pos < 3) {
+            score = FORSYTH_LAST_TRI_SCORE;
+        }
+        else {
+            f32 scaler = 1.0f / (MOPT_VERTEX_CACHE_SIZE - 3);
+            score = std::pow(1.0f - (cache_pos - 3) * scaler, FORSYTH_CACHE_DECAY_POWER);
+        }
+    }
+
+    // Boost verts with few triangles left so lone triangles get drawn instead of being left for the end
+    score += FORSYTH_VALENCE_BOOST_SCALE * std::pow((f32)remaining_tris, -FORSYTH_VALENCE_BOOST_POWER);
+    return score;
+}
+
+intern void optimize_vertex_cache(array<u32> *ind_arr, sizet vert_count)
+{
+    const array<u32> &inds = *ind_arr;
+    sizet tri_count = inds.size / 3;
+    if (tri_count == 0) {
+        return;
+    }
+
+    // Triangles adjacent to each vert - vert v's triangles are adj[adj_start[v], adj_start[v] + remaining[v])
+    array<u32> remaining{}, adj_start{}, adj{};
+    arr_resize(&remaining, vert_count, 0u);
+    arr_resize(&adj_start, vert_count + 1, 0u);
+    for (sizet i = 0; i < tri_count * 3; ++i) {
+        ++remaining[inds[i]];
+    }
+    for (sizet vi = 0; vi < vert_count; ++vi) {
+        adj_start[vi + 1] = adj_start[vi] + remaining[vi];
+    }
+    arr_resize(&adj, tri_count * 3);
+    array<u32> fill{};
+    arr_copy(&fill, &adj_start);
+    for (sizet ti = 0; ti < tri_count; ++ti) {
+        for (int k = 0; k < 3; ++k) {
+            adj[fill[inds[ti * 3 + k]]++] = (u32)ti;
+        }
+    }
+
+    array<s32> cache_pos{};
+    array<f32> vert_score{}, tri_score{};
+    array<u8> tri_added{};
+    arr_resize(&cache_pos, vert_count, -1);
+    arr_resize(&vert_score, vert_count);
+    arr_resize(&tri_score, tri_count, 0.0f);
+    arr_resize(&tri_added, tri_count, (u8)0);
+    for (sizet vi = 0; vi < vert_count; ++vi) {
+        vert_score[vi] = forsyth_vert_score(-1, remaining[vi]);
+    }
+    for (sizet ti = 0; ti < tri_count; ++ti) {
+        for (int k = 0; k < 3; ++k) {
+            tri_score[ti] += vert_score[inds[ti * 3 + k]];
+        }
+    }
+
+    // The cache has room for one extra triangle's verts while a triangle is being added
+    u32 cache[MOPT_VERTEX_CACHE_SIZE + 3];
+    u32 cache_count = 0;
+    array<u32> out{};
+    arr_resize(&out, tri_count * 3);
+    sizet out_tris = 0;
+    sizet scan_cursor = 0;
+
+    u32 best_tri = 0;
+    for (sizet ti = 1; ti < tri_count; ++ti) {
+        if (tri_score[ti] > tri_score[best_tri]) {
+            best_tri = (u32)ti;
+        }
+    }
+
+    while (out_tris < tri_count) {
+        tri_added[best_tri] = 1;
+        u32 new_cache[MOPT_VERTEX_CACHE_SIZE + 3];
+        u32 new_count = 0;
+        for (int k = 0; k < 3; ++k) {
+            u32 v = inds[best_tri * 3 + k];
+            out[out_tris * 3 + k] = v;
+            new_cache[new_count++] = v;
+
+            // Remove the triangle from the vert's adjacency so remaining only counts triangles still to draw
+            u32 *tris = &adj[adj_start[v]];
+            for (u32 i = 0; i < remaining[v]; ++i) {
+                if (tris[i] == best_tri) {
+                    tris[i] = tris[remaining[v] - 1];
+                    break;
+                }
+            }
+            --remaining[v];
+        }
+        ++out_tris;
+
+        // The new triangle's verts go to the front and the rest shift back, skipping the ones we just added
+        for (u32 i = 0; i < cache_count; ++i) {
+            u32 v = cache[i];
+            if (v != new_cache[0] && v != new_cache[1] && v != new_cache[2]) {
+                new_cache[new_count++] = v;
+            }
+        }
+        for (u32 i = 0; i < new_count; ++i) {
+            u32 v = new_cache[i];
+            cache[i] = v;
+            cache_pos[v] = (i < MOPT_VERTEX_CACHE_SIZE) ? (s32)i : -1;
+        }
+        cache_count = std::min(new_count, MOPT_VERTEX_CACHE_SIZE);
+
+        // Update the scores of everything touched by the cache and find the best triangle among them
+        f32 best_score = -1.0f;
+        best_tri = INVALID_ID;
+        for (u32 i = 0; i < new_count; ++i) {
+            u32 v = new_cache[i];
+            f32 new_score = forsyth_vert_score(cache_pos[v], remaining[v]);
+            f32 diff = new_score - vert_score[v];
+            vert_score[v] = new_score;
+            for (u32 j = 0; j < remaining[v]; ++j) {
+                u32 t = adj[adj_start[v] + j];
+                tri_score[t] += diff;
+                if (tri_score[t] > best_score) {
+                    best_score = tri_score[t];
+                    best_tri = t;
+                }
+            }
+        }
+
+        // Nothing connected to the cache is left - take the next triangle that hasn't been added in input order
+        if (!is_valid(best_tri) && out_tris < tri_count) {
+            while (tri_added[scan_cursor]) {
+                ++scan_cursor;
+            }
+            best_tri = (u32)scan_cursor;
+        }
+    }
+    arr_copy(ind_arr, &out);
+}
+
+void mopt_optimize_vertex_cache(submesh *sm)
+{
+    array<u32> inds{};
+    load_inds(sm, &inds);
+    optimize_vertex_cache(&inds, sm->verts.size);
+    store_inds(sm, &inds);
+}
+
+// Simulate a FIFO cache over the triangles [first_tri, last_tri) - returns the miss count
+intern u32 count_cache_misses(const u32 *inds, sizet first_tri, sizet last_tri, u32 cache_size, array<u32> *timestamps, u32 *time)
+{
+    u32 misses = 0;
+    for (sizet i = first_tri * 3; i < last_tri * 3; ++i) {
+        u32 v = inds[i];
+        if (*time - (*timestamps)[v] > cache_size) {
+            (*timestamps)[v] = *time;
+            ++*time;
+            ++misses;
+        }
+    }
+    return misses;
+}
+
+f32 mopt_calc_acmr(const submesh *sm, u32 cache_size)
+{
+    array<u32> inds{};
+    load_inds(sm, &inds);
+    sizet tri_count = inds.size / 3;
+    if (tri_count == 0) {
+        return 0.0f;
+    }
+    array<u32> timestamps{};
+    arr_resize(&timestamps, sm->verts.size, 0u);
+    // Start the clock past the cache size so every vert starts out of the cache
+    u32 time = cache_size + 1;
+    return (f32)count_cache_misses(inds.data, 0, tri_count, cache_size, &timestamps, &time) / (f32)tri_count;
+}
+
+struct overdraw_cluster
+{
+    u32 first_tri;
+    u32 tri_count;
+    f32 sort_key;
+};
+
+void mopt_optimize_overdraw(submesh *sm, f32 threshold)
+{
+    array<u32> inds{};
+    load_inds(sm, &inds);
+    sizet tri_count = inds.size / 3;
+    if (tri_count < 2) {
+        return;
+    }
+
+    array<u32> timestamps{};
+    arr_resize(&timestamps, sm->verts.size, 0u);
+    u32 time = MOPT_OVERDRAW_CACHE_SIZE + 1;
+
+    // Hard boundaries are triangles where all three verts miss - the cache is effectively cold there so starting a
+    // cluster there costs nothing
+    array<u32> boundaries{};
+    arr_push_back(&boundaries, 0u);
+    for (sizet ti = 0; ti < tri_count; ++ti) {
+        if (count_cache_misses(inds.data, ti, ti + 1, MOPT_OVERDRAW_CACHE_SIZE, &timestamps, &time) == 3 && ti > 0) {
+            arr_push_back(&boundaries, (u32)ti);
+        }
+    }
+
+    // Soft boundaries - within each hard cluster, also split wherever the running miss ratio of the sub cluster from a
+    // cold cache is within the threshold of the whole submesh's ratio
+    f32 total_acmr = mopt_calc_acmr(sm, MOPT_OVERDRAW_CACHE_SIZE);
+    array<overdraw_cluster> clusters{};
+    for (sizet bi = 0; bi < boundaries.size; ++bi) {
+        u32 hard_start = boundaries[bi];
+        u32 hard_end = (bi + 1 < boundaries.size) ? boundaries[bi + 1] : (u32)tri_count;
+
+        time += MOPT_OVERDRAW_CACHE_SIZE + 1;
+        u32 start = hard_start;
+        u32 misses = 0;
+        for (u32 ti = hard_start; ti < hard_end; ++ti) {
+            misses += count_cache_misses(inds.data, ti, ti + 1, MOPT_OVERDRAW_CACHE_SIZE, &timestamps, &time);
+            u32 count = ti + 1 - start;
+            // Very small clusters aren't worth sorting and make the cache worse at every split
+            if (ti + 1 < hard_end && count >= MOPT_OVERDRAW_CACHE_SIZE && (f32)misses / (f32)count <= total_acmr * threshold) {
+                arr_push_back(&clusters, {start, count, 0.0f});
+                start = ti + 1;
+                misses = 0;
+                time += MOPT_OVERDRAW_CACHE_SIZE + 1;
+            }
+        }
+        arr_push_back(&clusters, {start, hard_end - start, 0.0f});
+    }
+    if (clusters.size < 2) {
+        return;
+    }
+
+    // Clusters facing away from the mesh center are drawn first since they tend to occlude the inward facing ones
+    vec3 mesh_center{};
+    for (sizet vi = 0; vi < sm->verts.size; ++vi) {
+        mesh_center += sm->verts[vi].pos;
+    }
+    mesh_center *= 1.0f / (f32)sm->verts.size;
+
+    for (sizet ci = 0; ci < clusters.size; ++ci) {
+        auto cl = &clusters[ci];
+        vec3 centroid{};
+        vec3 normal{};
+        f32 area_sum = 0.0f;
+        for (u32 ti = cl->first_tri; ti < cl->first_tri + cl->tri_count; ++ti) {
+            const vec3 &p0 = sm->verts[inds[ti * 3]].pos;
+            const vec3 &p1 = sm->verts[inds[ti * 3 + 1]].pos;
+            const vec3 &p2 = sm->verts[inds[ti * 3 + 2]].pos;
+            vec3 n = math::cross(p1 - p0, p2 - p0);
+            f32 area = math::length(n);
+            centroid += (p0 + p1 + p2) * (area / 3.0f);
+            normal += n;
+            area_sum += area;
+        }
+        if (area_sum > 0.0f) {
+            centroid *= 1.0f / area_sum;
+        }
+        f32 nlen = math::length(normal);
+        cl->sort_key = (nlen > 0.0f) ? math::dot(centroid - mesh_center, normal * (1.0f / nlen)) : 0.0f;
+    }
+    std::stable_sort(clusters.data, clusters.data + clusters.size, [](const overdraw_cluster &lhs, const overdraw_cluster &rhs) {
+        return lhs.sort_key > rhs.sort_key;
+    });
+
+    array<u32> out{};
+    arr_resize(&out, tri_count * 3);
+    sizet out_ind = 0;
+    for (sizet ci = 0; ci < clusters.size; ++ci) {
+        const u32 *src = &inds[clusters[ci].first_tri * 3];
+        for (u32 i = 0; i < clusters[ci].tri_count * 3; ++i) {
+            out[out_ind++] = src[i];
+        }
+    }
+    store_inds(sm, &out);
+}
+
+void mopt_optimize_vertex_fetch(submesh *sm)
+{
+    array<u32> inds{};
+    load_inds(sm, &inds);
+    sizet vert_count = sm->verts.size;
+    bool has_joints = sm->cjoints.size == vert_count;
+
+    array<u32> remap{};
+    arr_resize(&remap, vert_count, INVALID_ID);
+    u32 next = 0;
+    for (sizet i = 0; i < inds.size; ++i) {
+        u32 &r = remap[inds[i]];
+        if (!is_valid(r)) {
+            r = next++;
+        }
+        inds[i] = r;
+    }
+
+    array<vertex> verts{};
+    arr_resize(&verts, next);
+    array<vertex_cjoints> cjoints{};
+    if (has_joints) {
+        arr_resize(&cjoints, next);
+    }
+    for (sizet vi = 0; vi < vert_count; ++vi) {
+        if (is_valid(remap[vi])) {
+            verts[remap[vi]] = sm->verts[vi];
+            if (has_joints) {
+                cjoints[remap[vi]] = sm->cjoints[vi];
+            }
+        }
+    }
+    arr_copy(&sm->verts, &verts);
+    if (has_joints) {
+        arr_copy(&sm->cjoints, &cjoints);
+    }
+    // The LODs go first since loading them depends on the full detail index size
+    remap_lod_inds(sm, &remap);
+    store_inds(sm, &inds);
+}
+
+// Sum of squared distances to a set of planes - the planes of the triangles merged in to a vert
+struct quadric
+{
+    f64 a00, a01, a02, a11, a12, a22;
+    f64 b0, b1, b2;
+    f64 c;
+};
+
+intern void quadric_add_plane(quadric *q, const vec3 &n, f32 d, f32 weight)
+{
+    f64 w = weight;
+    q->a00 += w * n.x * n.x;
+    q->a01 += w * n.x * n.y;
+    q->a02 += w * n.x * n.z;
+    q->a11 += w * n.y * n.y;
+    q->a12 += w * n.y * n.z;
+    q->a22 += w * n.z * n.z;
+    q->b0 += w * n.x * d;
+    q->b1 += w * n.y * d;
+    q->b2 += w * n.z * d;
+    q->c += w * d * d;
+}
+
+intern void quadric_add(quadric *q, const quadric &rhs)
+{
+    q->a00 += rhs.a00;
+    q->a01 += rhs.a01;
+    q->a02 += rhs.a02;
+    q->a11 += rhs.a11;
+    q->a12 += rhs.a12;
+    q->a22 += rhs.a22;
+    q->b0 += rhs.b0;
+    q->b1 += rhs.b1;
+    q->b2 += rhs.b2;
+    q->c += rhs.c;
+}
+
+intern f64 quadric_error(const quadric &q, const vec3 &p)
+{
+    f64 x = p.x, y = p.y, z = p.z;
+    f64 ret = q.a00 * x * x + q.a11 * y * y + q.a22 * z * z + 2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+              2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+    return std::max(ret, 0.0);
+}
+
+struct collapse_candidate
+{
+    u32 from;
+    u32 to;
+    f64 error;
+};
+
+// Verts sharing a position with another vert are on an attribute seam (uv or color) - returns the first vert with the
+// same position for each vert
+intern void find_position_groups(const submesh *sm, array<u32> *group)
+{
+    sizet vert_count = sm->verts.size;
+    sizet table_size = 1;
+    while (table_size < vert_count * 2) {
+        table_size <<= 1;
+    }
+    array<u32> table{};
+    arr_resize(&table, table_size, INVALID_ID);
+    arr_resize(group, vert_count);
+    for (sizet vi = 0; vi < vert_count; ++vi) {
+        const vec3 &pos = sm->verts[vi].pos;
+        sizet slot = xxhash3(&pos, sizeof(vec3), 0) & (table_size - 1);
+        while (is_valid(table[slot]) && memcmp(&sm->verts[table[slot]].pos, &pos, sizeof(vec3)) != 0) {
+            slot = (slot + 1) & (table_size - 1);
+        }
+        if (!is_valid(table[slot])) {
+            table[slot] = (u32)vi;
+        }
+        (*group)[vi] = table[slot];
+    }
+}
+
+// Lock verts that can't be collapsed without changing the outline or tearing the mesh - verts on a seam, and verts on an
+// edge used by a single triangle (border) or by more than two (non manifold)
+intern void find_locked_verts(const array<u32> *inds, const array<u32> *group, array<u8> *locked)
+{
+    for (sizet vi = 0; vi < group->size; ++vi) {
+        (*locked)[vi] = ((*group)[vi] != vi) ? 1 : 0;
+    }
+    for (sizet vi = 0; vi < group->size; ++vi) {
+        if ((*group)[vi] != vi) {
+            (*locked)[(*group)[vi]] = 1;
+        }
+    }
+
+    array<u64> edges{};
+    arr_resize(&edges, inds->size);
+    for (sizet ti = 0; ti < inds->size / 3; ++ti) {
+        for (int k = 0; k < 3; ++k) {
+            u64 a = (*inds)[ti * 3 + k], b = (*inds)[ti * 3 + (k + 1) % 3];
+            edges[ti * 3 + k] = (a < b) ? (a << 32) | b : (b << 32) | a;
+        }
+    }
+    std::sort(edges.data, edges.data + edges.size);
+    sizet i = 0;
+    while (i < edges.size) {
+        sizet run = i + 1;
+        while (run < edges.size && edges[run] == edges[i]) {
+            ++run;
+        }
+        if (run - i != 2) {
+            (*locked)[edges[i] >> 32] = 1;
+            (*locked)[edges[i] & 0xffffffff] = 1;
+        }
+        i = run;
+    }
+}
+
+// Unique verts sharing a triangle with v, not counting v - returns false if there are more than fit in nbrs
+intern bool collect_neighbours(const array<u32> *inds, const array<u32> *adj, u32 adj_first, u32 adj_count, u32 v, u32 *nbrs, u32 *nbr_count)
+{
+    *nbr_count = 0;
+    for (u32 i = 0; i < adj_count; ++i) {
+        const u32 *tri = &(*inds)[(*adj)[adj_first + i] * 3];
+        for (int k = 0; k < 3; ++k) {
+            u32 n = tri[k];
+            if (n == v || std::find(nbrs, nbrs + *nbr_count, n) != nbrs + *nbr_count) {
+                continue;
+            }
+            if (*nbr_count == MOPT_MAX_COLLAPSE_VALENCE) {
+                return false;
+            }
+            nbrs[(*nbr_count)++] = n;
+        }
+    }
+    return true;
+}
+
+sizet mopt_simplify(const submesh *sm, const array<u32> *inds, sizet target_ind_count, f32 max_error, array<u32> *out, f32 *out_error)
+{
+    sizet vert_count = sm->verts.size;
+    arr_copy(out, inds);
+    f64 max_error_sq = (f64)max_error * max_error;
+    f64 worst_error_sq = 0.0;
+
+    array<u32> group{};
+    find_position_groups(sm, &group);
+    array<u8> locked{};
+    arr_resize(&locked, vert_count);
+    find_locked_verts(out, &group, &locked);
+
+    // Quadrics are kept per position so seam verts share one
+    array<quadric> quadrics{};
+    arr_resize(&quadrics, vert_count);
+    memset(quadrics.data, 0, arr_sizeof(quadrics));
+    for (sizet ti = 0; ti < out->size / 3; ++ti) {
+        const vec3 &p0 = sm->verts[(*out)[ti * 3]].pos;
+        const vec3 &p1 = sm->verts[(*out)[ti * 3 + 1]].pos;
+        const vec3 &p2 = sm->verts[(*out)[ti * 3 + 2]].pos;
+        vec3 n = math::cross(p1 - p0, p2 - p0);
+        f32 area = math::length(n);
+        if (area <= 0.0f) {
+            continue;
+        }
+        n *= 1.0f / area;
+        f32 d = -math::dot(n, p0);
+        for (int k = 0; k < 3; ++k) {
+            quadric_add_plane(&quadrics[group[(*out)[ti * 3 + k]]], n, d, area);
+        }
+    }
+
+    array<u32> remaining{}, adj_start{}, adj{}, fill{}, remap{};
+    array<u8> touched{};
+    array<collapse_candidate> candidates{};
+    arr_resize(&remaining, vert_count);
+    arr_resize(&adj_start, vert_count + 1);
+    arr_resize(&touched, vert_count);
+    arr_resize(&remap, vert_count);
+    u32 from_nbrs[MOPT_MAX_COLLAPSE_VALENCE], to_nbrs[MOPT_MAX_COLLAPSE_VALENCE];
+
+    sizet target_tri_count = target_ind_count / 3;
+    while (out->size / 3 > target_tri_count) {
+        sizet tri_count = out->size / 3;
+
+        // Triangles adjacent to each vert - rebuilt every pass since collapses change them
+        memset(remaining.data, 0, arr_sizeof(remaining));
+        for (sizet i = 0; i < out->size; ++i) {
+            ++remaining[(*out)[i]];
+        }
+        adj_start[0] = 0;
+        for (sizet vi = 0; vi < vert_count; ++vi) {
+            adj_start[vi + 1] = adj_start[vi] + remaining[vi];
+        }
+        arr_resize(&adj, out->size);
+        arr_copy(&fill, &adj_start);
+        for (sizet ti = 0; ti < tri_count; ++ti) {
+            for (int k = 0; k < 3; ++k) {
+                adj[fill[(*out)[ti * 3 + k]]++] = (u32)ti;
+            }
+        }
+
+        // Every edge can collapse in either direction if the vert it removes isn't locked - the vert collapsed to keeps
+        // its position, so the LOD can reuse the full detail vertex buffer
+        arr_clear(&candidates);
+        for (sizet ti = 0; ti < tri_count; ++ti) {
+            for (int k = 0; k < 3; ++k) {
+                u32 from = (*out)[ti * 3 + k], to = (*out)[ti * 3 + (k + 1) % 3];
+                for (int dir = 0; dir < 2; ++dir) {
+                    if (!locked[from]) {
+                        quadric q = quadrics[group[from]];
+                        quadric_add(&q, quadrics[group[to]]);
+                        f64 err = quadric_error(q, sm->verts[to].pos);
+                        if (err <= max_error_sq) {
+                            arr_push_back(&candidates, {from, to, err});
+                        }
+                    }
+                    std::swap(from, to);
+                }
+            }
+        }
+        if (candidates.size == 0) {
+            break;
+        }
+        std::sort(candidates.data, candidates.data + candidates.size, [](const collapse_candidate &lhs, const collapse_candidate &rhs) {
+            return lhs.error < rhs.error;
+        });
+
+        // Apply the cheapest collapses whose triangles weren't touched by another collapse this pass
+        memset(touched.data, 0, arr_sizeof(touched));
+        for (sizet vi = 0; vi < vert_count; ++vi) {
+            remap[vi] = (u32)vi;
+        }
+        sizet removed_tris = 0;
+        sizet collapse_count = 0;
+        for (sizet ci = 0; ci < candidates.size && tri_count - removed_tris > target_tri_count; ++ci) {
+            u32 from = candidates[ci].from, to = candidates[ci].to;
+            if (touched[from] || touched[to]) {
+                continue;
+            }
+
+            // The edge is shared by two triangles since from isn't on a border. If the verts have any common neighbour
+            // other than the two opposite the edge the collapse would fold the surface on to itself.
+            u32 from_nbr_count = 0, to_nbr_count = 0, shared_tris = 0;
+            bool too_many = !collect_neighbours(out, &adj, adj_start[from], remaining[from], from, from_nbrs, &from_nbr_count) ||
+                            !collect_neighbours(out, &adj, adj_start[to], remaining[to], to, to_nbrs, &to_nbr_count);
+            if (too_many) {
+                continue;
+            }
+            for (u32 i = 0; i < remaining[from]; ++i) {
+                const u32 *tri = &(*out)[adj[adj_start[from] + i] * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                    ++shared_tris;
+                }
+            }
+            u32 common = 0;
+            for (u32 i = 0; i < from_nbr_count; ++i) {
+                for (u32 j = 0; j < to_nbr_count; ++j) {
+                    common += (from_nbrs[i] == to_nbrs[j]) ? 1 : 0;
+                }
+            }
+            if (shared_tris != 2 || common != 2) {
+                continue;
+            }
+
+            // Reject collapses that flip a triangle over or turn it far enough to leave it standing on its edge
+            bool flips = false;
+            const vec3 &to_pos = sm->verts[to].pos;
+            for (u32 i = 0; i < remaining[from] && !flips; ++i) {
+                const u32 *tri = &(*out)[adj[adj_start[from] + i] * 3];
+                if (tri[0] == to || tri[1] == to || tri[2] == to) {
+                    continue;
+                }
+                vec3 p[3], moved[3];
+                for (int k = 0; k < 3; ++k) {
+                    p[k] = sm->verts[tri[k]].pos;
+                    moved[k] = (tri[k] == from) ? to_pos : p[k];
+                }
+                vec3 n_before = math::cross(p[1] - p[0], p[2] - p[0]);
+                vec3 n_after = math::cross(moved[1] - moved[0], moved[2] - moved[0]);
+                flips = math::dot(n_before, n_after) <= MOPT_MIN_COLLAPSE_NORMAL_COS * math::length(n_before) * math::length(n_after);
+            }
+            if (flips) {
+                continue;
+            }
+
+            remap[from] = to;
+            quadric_add(&quadrics[group[to]], quadrics[group[from]]);
+            worst_error_sq = std::max(worst_error_sq, candidates[ci].error);
+            removed_tris += shared_tris;
+            ++collapse_count;
+            // Everything around the removed vert changed so none of it can take part in another collapse this pass
+            touched[from] = touched[to] = 1;
+            for (u32 i = 0; i < remaining[from]; ++i) {
+                const u32 *tri = &(*out)[adj[adj_start[from] + i] * 3];
+                touched[tri[0]] = touched[tri[1]] = touched[tri[2]] = 1;
+            }
+        }
+        if (collapse_count == 0) {
+            break;
+        }
+
+        // Remap and drop the triangles that collapsed to a line
+        sizet write = 0;
+        for (sizet ti = 0; ti < tri_count; ++ti) {
+            u32 a = remap[(*out)[ti * 3]], b = remap[(*out)[ti * 3 + 1]], c = remap[(*out)[ti * 3 + 2]];
+            if (a == b || b == c || a == c) {
+                continue;
+            }
+            (*out)[write++] = a;
+            (*out)[write++] = b;
+            (*out)[write++] = c;
+        }
+        arr_resize(out, write);
+    }
+
+    if (out_error) {
+        *out_error = (f32)std::sqrt(worst_error_sq);
+    }
+    return out->size;
+}
+
+sizet mopt_generate_lods(submesh *sm, const mesh_lod_cfg &cfg)
+{
+    for (sizet i = 0; i < sm->lods.size; ++i) {
+        arr_clear(&sm->lods[i].inds);
+        arr_clear(&sm->lods[i].wide_inds);
+    }
+    sm->lods.size = 0;
+
+    // The allowed error is relative to the radius of the bounds so the same settings work at any scale
+    f32 radius = math::length(math::extents(calc_bounds(sm)));
+    if (radius <= 0.0f) {
+        return 0;
+    }
+
+    // Each LOD is simplified from the one before it, so the errors add up
+    array<u32> src{}, dst{};
+    load_inds(sm, &src);
+    f32 error = 0.0f;
+    sizet lod_count = std::min<sizet>(cfg.lod_count, MAX_LOD_COUNT - 1);
+    while (sm->lods.size < lod_count) {
+        sizet target = (sizet)((f32)(src.size / 3) * cfg.reduction) * 3;
+        f32 lod_error = 0.0f;
+        mopt_simplify(sm, &src, target, cfg.max_error * radius - error, &dst, &lod_error);
+        // Not worth a level if it barely removed anything
+        if (dst.size == 0 || (f32)dst.size > (f32)src.size * MOPT_MIN_LOD_REDUCTION) {
+            break;
+        }
+        optimize_vertex_cache(&dst, sm->verts.size);
+        error += lod_error;
+        ++sm->lods.size;
+        store_lod_inds(sm, sm->lods.size, &dst);
+        sm->lods[sm->lods.size - 1].error = error;
+        arr_copy(&src, &dst);
+    }
+    return sm->lods.size;
+}
+
+void generate_mesh_lods(mesh *msh, const mesh_lod_cfg &cfg)
+{
+    for (sizet i = 0; i < msh->submeshes.size; ++i) {
+        auto sm = &msh->submeshes[i];
+        sizet ind_count = get_ind_count(sm);
+        sizet lod_count = mopt_generate_lods(sm, cfg);
+        dlog("Generated %lu LODs for submesh %lu with %lu inds%s%lu inds (error %f)",
+             lod_count,
+             i,
+             ind_count,
+             (lod_count > 0) ? " - coarsest has " : " - ",
+             get_lod_ind_count(sm, lod_count),
+             (lod_count > 0) ? sm->lods[lod_count - 1].error : 0.0f);
+    }
+}
+
+void optimize_submesh(submesh *sm, const mesh_opt_cfg &cfg)
+{
+    sizet vert_count = sm->verts.size;
+    f32 acmr_before = mopt_calc_acmr(sm);
+    if (cfg.dedupe_verts) {
+        mopt_dedupe_verts(sm);
+    }
+    if (cfg.vertex_cache) {
+        mopt_optimize_vertex_cache(sm);
+    }
+    if (cfg.overdraw) {
+        mopt_optimize_overdraw(sm, cfg.overdraw_threshold);
+    }
+    if (cfg.vertex_fetch) {
+        mopt_optimize_vertex_fetch(sm);
+    }
+    mopt_fit_index_size(sm);
+    dlog("Optimized submesh - verts %lu -> %lu  acmr %.3f -> %.3f%s",
+         vert_count,
+         sm->verts.size,
+         acmr_before,
+         mopt_calc_acmr(sm),
+         (has_wide_inds(sm)) ? "  (32 bit indices)" : "");
+}
+
+void optimize_mesh(mesh *msh, const mesh_opt_cfg &cfg)
+{
+    for (sizet i = 0; i < msh->submeshes.size; ++i) {
+        optimize_submesh(&msh->submeshes[i], cfg);
+    }
+}
+
+intern quantize_params params_from_bounds(const bbox &bounds)
+{
+    quantize_params ret{};
+    if (math::is_empty(bounds)) {
+        ret.pos_scale = {1.0f};
+        return ret;
+    }
+    ret.pos_offset = math::center(bounds);
+    ret.pos_scale = math::extents(bounds);
+    // Flat axes would divide by zero
+    for (int i = 0; i < 3; ++i) {
+        if (ret.pos_scale[i] <= 0.0f) {
+            ret.pos_scale[i] = 1.0f;
+        }
+    }
+    return ret;
+}
+
+quantize_params mopt_calc_quantize_params(const mesh *msh)
+{
+    return params_from_bounds(calc_bounds(msh));
+}
+
+quantize_params mopt_calc_quantize_params(const submesh *sm)
+{
+    return params_from_bounds(calc_bounds(sm));
+}
+
+intern s16 f32_to_snorm16(f32 val)
+{
+    val = std::clamp(val, -1.0f, 1.0f);
+    return (s16)std::lround(val * 32767.0f);
+}
+
+void mopt_quantize(const submesh *sm, const quantize_params &params, array<quantized_vertex> *out)
+{
+    arr_resize(out, sm->verts.size);
+    for (sizet vi = 0; vi < sm->verts.size; ++vi) {
+        const vertex &v = sm->verts[vi];
+        auto qv = &(*out)[vi];
+        for (int i = 0; i < 3; ++i) {
+            qv->pos[i] = f32_to_snorm16((v.pos[i] - params.pos_offset[i]) / params.pos_scale[i]);
+        }
+        qv->pos[3] = 0;
+        qv->tc[0] = mopt_f32_to_f16(v.tc.x);
+        qv->tc[1] = mopt_f32_to_f16(v.tc.y);
+        qv->color = v.color;
+    }
+}
+
+vertex mopt_dequantize(const quantized_vertex &qv, const quantize_params &params)
+{
+    vertex ret{};
+    for (int i = 0; i < 3; ++i) {
+        ret.pos[i] = params.pos_offset[i] + std::max(qv.pos[i] / 32767.0f, -1.0f) * params.pos_scale[i];
+    }
+    ret.tc = {mopt_f16_to_f32(qv.tc[0]), mopt_f16_to_f32(qv.tc[1])};
+    ret.color = qv.color;
+    return ret;
+}
+
+// Round to nearest even, with overflow going to infinity and values too small for a half denormal going to zero
+u16 mopt_f32_to_f16(f32 val)
+{
+    u32 bits;
+    memcpy(&bits, &val, sizeof(bits));
+    u32 sign = (bits >> 16) & 0x8000;
+    u32 exp = (bits >> 23) & 0xff;
+    u32 mantissa = bits & 0x7fffff;
+
+    // Inf and nan - keep a mantissa bit set for nan
+    if (exp == 0xff) {
+        return (u16)(sign | 0x7c00 | ((mantissa) ? 0x200 : 0));
+    }
+
+    s32 half_exp = (s32)exp - 127 + 15;
+    if (half_exp >= 31) {
+        return (u16)(sign | 0x7c00);
+    }
+    if (half_exp <= 0) {
+        // Denormal half - shift the mantissa (with its implicit bit) down
+        if (half_exp < -10) {
+            return (u16)sign;
+        }
+        mantissa |= 0x800000;
+        u32 shift = (u32)(14 - half_exp);
+        u32 half_mantissa = mantissa >> shift;
+        u32 rem = mantissa & ((1u << shift) - 1);
+        u32 halfway = 1u << (shift - 1);
+        if (rem > halfway || (rem == halfway && (half_mantissa & 1))) {
+            ++half_mantissa;
+        }
+        return (u16)(sign | half_mantissa);
+    }
+
+    u32 half = sign | ((u32)half_exp << 10) | (mantissa >> 13);
+    u32 rem = mantissa & 0x1fff;
+    // A mantissa carry rolls in to the exponent, which is the correct rounding up to the next power of two (or inf)
+    if (rem > 0x1000 || (rem == 0x1000 && (half & 1))) {
+        ++half;
+    }
+    return (u16)half;
+}
+
+f32 mopt_f16_to_f32(u16 val)
+{
+    u32 sign = (u32)(val & 0x8000) << 16;
+    u32 exp = (val >> 10) & 0x1f;
+    u32 mantissa = val & 0x3ff;
+    u32 bits;
+    if (exp == 0) {
+        if (mantissa == 0) {
+            bits = sign;
+        }
+        else {
+            // Denormal half - normalize it
+            s32 e = -1;
+            do {
+                ++e;
+                mantissa <<= 1;
+            } while ((mantissa & 0x400) == 0);
+            bits = sign | ((u32)(127 - 15 - e) << 23) | ((mantissa & 0x3ff) << 13);
+        }
+    }
+    else if (exp == 0x1f) {
+        bits = sign | 0x7f800000 | (mantissa << 13);
+    }
+    else {
+        bits = sign | ((exp - 15 + 127) << 23) | (mantissa << 13);
+    }
+    f32 ret;
+    memcpy(&ret, &bits, sizeof(ret));
+    return ret;
+}
+
+} // namespace nslib
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "model.h"
+
+namespace nslib
+{
+
+// Size of the simulated post transform cache used for vertex cache ordering
+inline constexpr u32 MOPT_VERTEX_CACHE_SIZE = 32;
+// Smaller cache used to find cluster boundaries for overdraw ordering - it matches the smallest real hardware caches so
+// the boundaries hold up everywhere
+inline constexpr u32 MOPT_OVERDRAW_CACHE_SIZE = 16;
+// Overdraw ordering may make the average cache miss ratio this much worse in exchange for fewer overdrawn pixels
+inline constexpr f32 MOPT_DEFAULT_OVERDRAW_THRESHOLD = 1.05f;
+// Verts with more neighbours than this are never collapsed by the simplifier
+inline constexpr u32 MOPT_MAX_COLLAPSE_VALENCE = 64;
+// Collapses that turn a triangle's normal by more than about 75 degrees are rejected
+inline constexpr f32 MOPT_MIN_COLLAPSE_NORMAL_COS = 0.25f;
+// A LOD has to have at most this fraction of the previous LOD's indices or it isn't added
+inline constexpr f32 MOPT_MIN_LOD_REDUCTION = 0.85f;
+
+struct mesh_opt_cfg
+{
+    b32 dedupe_verts{true};
+    b32 vertex_cache{true};
+    b32 overdraw{true};
+    f32 overdraw_threshold{MOPT_DEFAULT_OVERDRAW_THRESHOLD};
+    b32 vertex_fetch{true};
+};
+
+struct mesh_lod_cfg
+{
+    // LODs to add after the full detail one - at most MAX_LOD_COUNT - 1
+    u32 lod_count{MAX_LOD_COUNT - 1};
+    // Each LOD aims for this fraction of the previous LOD's triangles
+    f32 reduction{0.5f};
+    // Largest error allowed for the coarsest LOD as a fraction of the submesh bounds radius - LOD generation stops early
+    // once no more triangles can be removed without going over
+    f32 max_error{0.05f};
+};
+
+// Positions are snorm16 relative to the quantize params, tex coords are half floats. The fourth position component is
+// padding so the vertex is 16 bytes.
+struct quantized_vertex
+{
+    s16 pos[4];
+    u16 tc[2];
+    u32 color;
+};
+
+// Positions decode as offset + snorm * scale - shared by all submeshes of a mesh so they line up exactly
+struct quantize_params
+{
+    vec3 pos_offset;
+    vec3 pos_scale;
+};
+
+// Run the enabled steps in order: dedupe, vertex cache, overdraw, vertex fetch. The result is still a regular submesh
+// (with 32 bit indices only if needed) so it can be passed to upload_to_gpu as is.
+void optimize_submesh(submesh *sm, const mesh_opt_cfg &cfg = {});
+void optimize_mesh(mesh *msh, const mesh_opt_cfg &cfg = {});
+
+// Merge bitwise identical verts (including the joints if the submesh has them) and remap the indices - returns the new
+// vert count
+sizet mopt_dedupe_verts(submesh *sm);
+
+// Reorder triangles for the post transform vertex cache using Forsyth's linear speed algorithm
+void mopt_optimize_vertex_cache(submesh *sm);
+
+// Split the (vertex cache ordered) triangles in to clusters at points where the cache is mostly cold, then sort the
+// clusters so outward facing ones are drawn first. Clusters are only split where the cluster's miss ratio stays within
+// threshold times the miss ratio of the whole submesh.
+void mopt_optimize_overdraw(submesh *sm, f32 threshold = MOPT_DEFAULT_OVERDRAW_THRESHOLD);
+
+// Reorder verts in the order the indices first reference them so vertex fetch reads memory mostly linearly - unused
+// verts are dropped
+void mopt_optimize_vertex_fetch(submesh *sm);
+
+// Quadric error edge collapse on the triangles in inds until there are target_ind_count indices or no collapse stays
+// under max_error (in local units). Verts are only removed, never moved, so the result indexes the same verts as the
+// submesh. Verts on borders and attribute seams are kept so the outline and uv layout stay intact. Returns the index count
+// and sets out_error to the largest error of the collapses done.
+sizet mopt_simplify(const submesh *sm, const array<u32> *inds, sizet target_ind_count, f32 max_error, array<u32> *out, f32 *out_error);
+
+// Replace the submesh's LODs with a chain simplified from the full detail indices - returns the number of LODs added.
+// Run after the other optimization steps (dedupe and vertex fetch remap the LODs, but the overdraw order isn't applied
+// to them).
+sizet mopt_generate_lods(submesh *sm, const mesh_lod_cfg &cfg = {});
+void generate_mesh_lods(mesh *msh, const mesh_lod_cfg &cfg = {});
+
+// Average cache misses per triangle for a FIFO cache of the given size - 0.5 is about the best possible and 3 the worst
+f32 mopt_calc_acmr(const submesh *sm, u32 cache_size = MOPT_VERTEX_CACHE_SIZE);
+
+// Move indices to wide_inds if the submesh has more verts than 16 bit indices can address, or back to inds if it fits.
+// Every step above calls this so this is only needed after editing the indices by hand.
+void mopt_fit_index_size(submesh *sm);
+
+quantize_params mopt_calc_quantize_params(const mesh *msh);
+quantize_params mopt_calc_quantize_params(const submesh *sm);
+void mopt_quantize(const submesh *sm, const quantize_params &params, array<quantized_vertex> *out);
+vertex mopt_dequantize(const quantized_vertex &qv, const quantize_params &params);
+
+u16 mopt_f32_to_f16(f32 val);
+f32 mopt_f16_to_f32(u16 val);
+
+} // namespace nslib
@@ -188,6 +188,11 @@ void init_submesh(submesh *sm, mem_arena *arena)
     arr_init(&sm->verts, arena);
     arr_init(&sm->cjoints, arena);
     arr_init(&sm->inds, arena);
+    arr_init(&sm->wide_inds, arena);
+    for (sizet i = 0; i < sm->lods.capacity; ++i) {
+        arr_init(&sm->lods.data[i].inds, arena);
+        arr_init(&sm->lods.data[i].wide_inds, arena);
+    }
 }
 
 void terminate_submesh(submesh *sm)
@@ -195,6 +200,12 @@ void terminate_submesh(submesh *sm)
     arr_terminate(&sm->verts);
     arr_terminate(&sm->cjoints);
     arr_terminate(&sm->inds);
+    arr_terminate(&sm->wide_inds);
+    for (sizet i = 0; i < sm->lods.capacity; ++i) {
+        arr_terminate(&sm->lods.data[i].inds);
+        arr_terminate(&sm->lods.data[i].wide_inds);
+    }
+    sm->lods.size = 0;
 }
 
 void init_mesh(mesh *msh, const string &name, mem_arena *arena)
@@ -211,4 +222,22 @@ void terminate_mesh(mesh *msh)
     }
 }
 
+bbox calc_bounds(const submesh *sm)
+{
+    bbox ret{};
+    for (sizet i = 0; i < sm->verts.size; ++i) {
+        math::extend(&ret, sm->verts[i].pos);
+    }
+    return ret;
+}
+
+bbox calc_bounds(const mesh *msh)
+{
+    bbox ret{};
+    for (sizet i = 0; i < msh->submeshes.size; ++i) {
+        math::extend(&ret, calc_bounds(&msh->submeshes[i]));
+    }
+    return ret;
+}
+
 } // namespace nslib
@@ -1,6 +1,7 @@
 #pragma once
 #include "robj_common.h"
 #include "math/vector4.h"
+#include "math/bounding_box.h"
 #include "containers/array.h"
 #include "containers/hset.h"
 
@@ -10,6 +11,10 @@ namespace nslib
 inline constexpr sizet JOINTS_PER_VERTEX = 4;
 inline constexpr sizet MAX_SUBMESH_COUNT = 16;
 using ind_t = u16;
+// Submeshes with more verts than this use 32 bit indices
+inline constexpr sizet MAX_IND_T_VERT_COUNT = 65536;
+// Levels of detail per submesh including the full detail one
+inline constexpr sizet MAX_LOD_COUNT = 4;
 
 enum mat_sampler_slot
 {
@@ -56,13 +61,57 @@ struct vertex_cjoints
     f32 weights[JOINTS_PER_VERTEX];
 };
 
+// Simplified version of a submesh drawn with the submesh's verts - only the indices differ
+struct submesh_lod
+{
+    // Filled the same way as the submesh inds/wide_inds
+    array<ind_t> inds;
+    array<u32> wide_inds;
+    // Largest distance between the simplified and the full detail surface in local units
+    f32 error;
+};
+
 struct submesh
 {
     array<vertex> verts;
     array<vertex_cjoints> cjoints;
     array<ind_t> inds;
+    // Used instead of inds when there are more than MAX_IND_T_VERT_COUNT verts - only one of the two is ever filled
+    array<u32> wide_inds;
+    // Levels of detail after the full detail one, from most to least detailed
+    static_array<submesh_lod, MAX_LOD_COUNT - 1> lods;
 };
 
+inline bool has_wide_inds(const submesh *sm)
+{
+    return sm->wide_inds.size > 0;
+}
+
+inline sizet get_ind_count(const submesh *sm)
+{
+    return (has_wide_inds(sm)) ? sm->wide_inds.size : sm->inds.size;
+}
+
+inline u32 get_ind(const submesh *sm, sizet i)
+{
+    return (has_wide_inds(sm)) ? sm->wide_inds[i] : (u32)sm->inds[i];
+}
+
+// LOD 0 is the submesh itself
+inline sizet get_lod_count(const submesh *sm)
+{
+    return sm->lods.size + 1;
+}
+
+inline sizet get_lod_ind_count(const submesh *sm, sizet lod)
+{
+    if (lod == 0) {
+        return get_ind_count(sm);
+    }
+    auto l = &sm->lods[lod - 1];
+    return (has_wide_inds(sm)) ? l->wide_inds.size : l->inds.size;
+}
+
 struct mesh
 {
     ROBJ(MESH);
@@ -92,4 +141,8 @@ void terminate_mesh(mesh *msh);
 void init_submesh(submesh *sm, mem_arena *arena);
 void terminate_submesh(submesh *sm);
 
+// Local space bounds of the submesh/mesh vertex positions - an empty mesh returns an empty box
+bbox calc_bounds(const submesh *sm);
+bbox calc_bounds(const mesh *msh);
+
 } // namespace nslib
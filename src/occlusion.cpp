@@ -0,0 +1,292 @@
+#include <algorithm>
+
+#include "occlusion.h"
+
+namespace nslib
+{
+
+intern constexpr f32 OCC_CLEAR_DEPTH = std::numeric_limits<f32>::max();
+
+void init_occlusion_culler(occlusion_culler *oc, mem_arena *arena, u32 width, u32 height)
+{
+    asrt(width > 0 && height > 0);
+    oc->tiles_x = (width + OCC_TILE_WIDTH - 1) / OCC_TILE_WIDTH;
+    oc->tiles_y = (height + OCC_TILE_HEIGHT - 1) / OCC_TILE_HEIGHT;
+    oc->width = oc->tiles_x * OCC_TILE_WIDTH;
+    oc->height = oc->tiles_y * OCC_TILE_HEIGHT;
+
+    // Work out the size of all pyramid levels so the depth storage never needs to grow
+    sizet total = 0;
+    u32 w = oc->width, h = oc->height;
+    while (oc->levels.size < OCC_MAX_HIZ_LEVELS) {
+        arr_push_back(&oc->levels, {w, h, nullptr});
+        total += (sizet)w * h;
+        if (w == 1 && h == 1) {
+            break;
+        }
+        w = std::max(w / 2, 1u);
+        h = std::max(h / 2, 1u);
+    }
+    arr_init(&oc->depth, arena, total);
+    arr_resize(&oc->depth, total, OCC_CLEAR_DEPTH);
+
+    sizet offset = 0;
+    for (sizet i = 0; i < oc->levels.size; ++i) {
+        oc->levels[i].texels = oc->depth.data + offset;
+        offset += (sizet)oc->levels[i].width * oc->levels[i].height;
+    }
+
+    arr_init(&oc->tris, arena);
+    arr_init(&oc->clip_verts, arena);
+    arr_init(&oc->tiles, arena, oc->tiles_x * oc->tiles_y);
+    arr_resize(&oc->tiles, oc->tiles_x * oc->tiles_y);
+    for (sizet i = 0; i < oc->tiles.size; ++i) {
+        arr_init(&oc->tiles[i].tris, arena);
+    }
+}
+
+void terminate_occlusion_culler(occlusion_culler *oc)
+{
+    for (sizet i = 0; i < oc->tiles.size; ++i) {
+        arr_terminate(&oc->tiles[i].tris);
+    }
+    arr_terminate(&oc->tiles);
+    arr_terminate(&oc->clip_verts);
+    arr_terminate(&oc->tris);
+    arr_terminate(&oc->depth);
+    oc->levels.size = 0;
+}
+
+void occ_begin_frame(occlusion_culler *oc, const mat4 &proj_view)
+{
+    oc->proj_view = proj_view;
+    arr_clear(&oc->tris);
+    for (sizet i = 0; i < oc->tiles.size; ++i) {
+        arr_clear(&oc->tiles[i].tris);
+    }
+    std::fill(oc->depth.data, oc->depth.data + oc->depth.size, OCC_CLEAR_DEPTH);
+}
+
+intern vec3 clip_to_screen(const occlusion_culler *oc, const vec4 &clip)
+{
+    f32 inv_w = 1.0f / clip.w;
+    return {(clip.x * inv_w * 0.5f + 0.5f) * (f32)oc->width, (clip.y * inv_w * 0.5f + 0.5f) * (f32)oc->height, clip.z * inv_w};
+}
+
+void occ_add_occluder(occlusion_culler *oc, const submesh *sm, const mat4 &tform)
+{
+    mat4 mvp = oc->proj_view * tform;
+    arr_resize(&oc->clip_verts, sm->verts.size);
+    for (sizet i = 0; i < sm->verts.size; ++i) {
+        oc->clip_verts[i] = mvp * vec4{sm->verts[i].pos, 1.0f};
+    }
+
+    sizet ind_count = get_ind_count(sm);
+    for (sizet i = 0; i + 2 < ind_count; i += 3) {
+        const vec4 &c0 = oc->clip_verts[get_ind(sm, i)];
+        const vec4 &c1 = oc->clip_verts[get_ind(sm, i + 1)];
+        const vec4 &c2 = oc->clip_verts[get_ind(sm, i + 2)];
+        if (c0.w < OCC_MIN_CLIP_W || c1.w < OCC_MIN_CLIP_W || c2.w < OCC_MIN_CLIP_W) {
+            continue;
+        }
+
+        occ_tri tri{{clip_to_screen(oc, c0), clip_to_screen(oc, c1), clip_to_screen(oc, c2)}};
+        f32 min_x = std::min({tri.verts[0].x, tri.verts[1].x, tri.verts[2].x});
+        f32 max_x = std::max({tri.verts[0].x, tri.verts[1].x, tri.verts[2].x});
+        f32 min_y = std::min({tri.verts[0].y, tri.verts[1].y, tri.verts[2].y});
+        f32 max_y = std::max({tri.verts[0].y, tri.verts[1].y, tri.verts[2].y});
+        if (max_x < 0.0f || max_y < 0.0f || min_x >= (f32)oc->width || min_y >= (f32)oc->height) {
+            continue;
+        }
+
+        // Bin in to every tile the triangle's screen rect touches
+        u32 tx0 = (u32)std::max(min_x, 0.0f) / OCC_TILE_WIDTH;
+        u32 ty0 = (u32)std::max(min_y, 0.0f) / OCC_TILE_HEIGHT;
+        u32 tx1 = (u32)std::min(max_x, (f32)(oc->width - 1)) / OCC_TILE_WIDTH;
+        u32 ty1 = (u32)std::min(max_y, (f32)(oc->height - 1)) / OCC_TILE_HEIGHT;
+        u32 tri_ind = (u32)oc->tris.size;
+        arr_push_back(&oc->tris, tri);
+        for (u32 ty = ty0; ty <= ty1; ++ty) {
+            for (u32 tx = tx0; tx <= tx1; ++tx) {
+                arr_push_back(&oc->tiles[ty * oc->tiles_x + tx].tris, tri_ind);
+            }
+        }
+    }
+}
+
+void occ_add_occluder(occlusion_culler *oc, const mesh *msh, const mat4 &tform)
+{
+    for (sizet i = 0; i < msh->submeshes.size; ++i) {
+        occ_add_occluder(oc, &msh->submeshes[i], tform);
+    }
+}
+
+// Edge function e(p) = a * p.x + b * p.y + c which is positive on the inside of the edge from v0 to v1
+struct occ_edge
+{
+    f32 a;
+    f32 b;
+    f32 c;
+};
+
+intern occ_edge make_edge(const vec3 &v0, const vec3 &v1)
+{
+    return {v0.y - v1.y, v1.x - v0.x, v0.x * v1.y - v0.y * v1.x};
+}
+
+intern void rasterize_tri(occlusion_culler *oc, const occ_tri &tri, u32 tile_x0, u32 tile_y0)
+{
+    vec3 v0 = tri.verts[0], v1 = tri.verts[1], v2 = tri.verts[2];
+    f32 area = (v1.x - v0.x) * (v2.y - v0.y) - (v2.x - v0.x) * (v1.y - v0.y);
+    if (std::abs(area) < 1e-8f) {
+        return;
+    }
+
+    // Occluders are drawn without backface culling so flip clockwise triangles to keep the edge functions positive inside
+    if (area < 0.0f) {
+        std::swap(v1, v2);
+        area = -area;
+    }
+
+    // Barycentric weights for v1 and v2 come from the edges opposite them, and depth is linear in screen space
+    occ_edge e0 = make_edge(v1, v2), e1 = make_edge(v2, v0), e2 = make_edge(v0, v1);
+    f32 inv_area = 1.0f / area;
+    f32 dz1 = (v1.z - v0.z) * inv_area, dz2 = (v2.z - v0.z) * inv_area;
+    occ_edge zpl{e1.a * dz1 + e2.a * dz2, e1.b * dz1 + e2.b * dz2, v0.z + e1.c * dz1 + e2.c * dz2};
+
+    // Clamp the triangle rect to the tile - the x start is rounded down to a multiple of 4 for the SIMD loop
+    f32 tx0 = (f32)tile_x0, tx1 = (f32)(tile_x0 + OCC_TILE_WIDTH - 1);
+    f32 ty0 = (f32)tile_y0, ty1 = (f32)(tile_y0 + OCC_TILE_HEIGHT - 1);
+    s32 x0 = (s32)std::clamp(std::floor(std::min({v0.x, v1.x, v2.x})), tx0, tx1) & ~3;
+    s32 x1 = (s32)std::clamp(std::ceil(std::max({v0.x, v1.x, v2.x})), tx0, tx1);
+    s32 y0 = (s32)std::clamp(std::floor(std::min({v0.y, v1.y, v2.y})), ty0, ty1);
+    s32 y1 = (s32)std::clamp(std::ceil(std::max({v0.y, v1.y, v2.y})), ty0, ty1);
+
+#if NOBLE_STEED_SIMD
+    __m128 zero = _mm_setzero_ps();
+    __m128 e0a = _mm_set1_ps(e0.a), e1a = _mm_set1_ps(e1.a), e2a = _mm_set1_ps(e2.a), za = _mm_set1_ps(zpl.a);
+    __m128 lane_offs = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+    for (s32 y = y0; y <= y1; ++y) {
+        f32 py = (f32)y + 0.5f;
+        __m128 e0row = _mm_set1_ps(e0.b * py + e0.c);
+        __m128 e1row = _mm_set1_ps(e1.b * py + e1.c);
+        __m128 e2row = _mm_set1_ps(e2.b * py + e2.c);
+        __m128 zrow = _mm_set1_ps(zpl.b * py + zpl.c);
+        f32 *row = oc->depth.data + (sizet)y * oc->width;
+        for (s32 x = x0; x <= x1; x += 4) {
+            __m128 px = _mm_add_ps(_mm_set1_ps((f32)x), lane_offs);
+            __m128 w0 = _mm_add_ps(_mm_mul_ps(e0a, px), e0row);
+            __m128 w1 = _mm_add_ps(_mm_mul_ps(e1a, px), e1row);
+            __m128 w2 = _mm_add_ps(_mm_mul_ps(e2a, px), e2row);
+            __m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(w0, zero), _mm_cmpge_ps(w1, zero)), _mm_cmpge_ps(w2, zero));
+            if (_mm_movemask_ps(inside) == 0) {
+                continue;
+            }
+            __m128 z = _mm_add_ps(_mm_mul_ps(za, px), zrow);
+            __m128 cur = _mm_loadu_ps(row + x);
+            __m128 closer = _mm_min_ps(cur, z);
+            _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, closer), _mm_andnot_ps(inside, cur)));
+        }
+    }
+#else
+    for (s32 y = y0; y <= y1; ++y) {
+        f32 py = (f32)y + 0.5f;
+        f32 *row = oc->depth.data + (sizet)y * oc->width;
+        for (s32 x = x0; x <= x1; ++x) {
+            f32 px = (f32)x + 0.5f;
+            if (e0.a * px + e0.b * py + e0.c >= 0.0f && e1.a * px + e1.b * py + e1.c >= 0.0f && e2.a * px + e2.b * py + e2.c >= 0.0f) {
+                row[x] = std::min(row[x], zpl.a * px + zpl.b * py + zpl.c);
+            }
+        }
+    }
+#endif
+}
+
+void occ_rasterize_tiles(occlusion_culler *oc, u32 first_tile, u32 tile_count)
+{
+    u32 end = std::min(first_tile + tile_count, (u32)oc->tiles.size);
+    for (u32 ti = first_tile; ti < end; ++ti) {
+        u32 tile_x0 = (ti % oc->tiles_x) * OCC_TILE_WIDTH;
+        u32 tile_y0 = (ti / oc->tiles_x) * OCC_TILE_HEIGHT;
+        auto tile = &oc->tiles[ti];
+        for (sizet i = 0; i < tile->tris.size; ++i) {
+            rasterize_tri(oc, oc->tris[tile->tris[i]], tile_x0, tile_y0);
+        }
+    }
+}
+
+void occ_build_hiz(occlusion_culler *oc)
+{
+    for (sizet li = 1; li < oc->levels.size; ++li) {
+        const occ_hiz_level *src = &oc->levels[li - 1];
+        occ_hiz_level *dst = &oc->levels[li];
+        for (u32 y = 0; y < dst->height; ++y) {
+            // Odd sized levels fold the last row/column in to the last texel so nothing is missed
+            u32 sy0 = y * 2, sy1 = (y == dst->height - 1) ? src->height - 1 : sy0 + 1;
+            for (u32 x = 0; x < dst->width; ++x) {
+                u32 sx0 = x * 2, sx1 = (x == dst->width - 1) ? src->width - 1 : sx0 + 1;
+                f32 mx = 0.0f;
+                bool first = true;
+                for (u32 sy = sy0; sy <= sy1; ++sy) {
+                    for (u32 sx = sx0; sx <= sx1; ++sx) {
+                        f32 d = src->texels[sy * src->width + sx];
+                        mx = first ? d : std::max(mx, d);
+                        first = false;
+                    }
+                }
+                dst->texels[y * dst->width + x] = mx;
+            }
+        }
+    }
+}
+
+void occ_rasterize(occlusion_culler *oc)
+{
+    occ_rasterize_tiles(oc, 0, (u32)oc->tiles.size);
+    occ_build_hiz(oc);
+}
+
+bool occ_test_aabb(const occlusion_culler *oc, const bbox &world_bounds)
+{
+    vec3 corners[8];
+    math::corners(world_bounds, corners);
+
+    vec2 smin{std::numeric_limits<f32>::max()}, smax{std::numeric_limits<f32>::lowest()};
+    f32 min_z = std::numeric_limits<f32>::max();
+    for (int i = 0; i < 8; ++i) {
+        vec4 clip = oc->proj_view * vec4{corners[i], 1.0f};
+        // Boxes crossing the near plane are right in front of the camera - never cull them
+        if (clip.w < OCC_MIN_CLIP_W) {
+            return true;
+        }
+        vec3 sc = clip_to_screen(oc, clip);
+        smin = {std::min(smin.x, sc.x), std::min(smin.y, sc.y)};
+        smax = {std::max(smax.x, sc.x), std::max(smax.y, sc.y)};
+        min_z = std::min(min_z, sc.z);
+    }
+    if (smax.x < 0.0f || smax.y < 0.0f || smin.x >= (f32)oc->width || smin.y >= (f32)oc->height) {
+        return true;
+    }
+
+    u32 x0 = (u32)std::max(smin.x, 0.0f), y0 = (u32)std::max(smin.y, 0.0f);
+    u32 x1 = (u32)std::min(smax.x, (f32)(oc->width - 1)), y1 = (u32)std::min(smax.y, (f32)(oc->height - 1));
+
+    // Go up the pyramid until the rect covers at most 2x2 texels
+    sizet li = 0;
+    while (li + 1 < oc->levels.size && ((x1 >> li) - (x0 >> li) > 1 || (y1 >> li) - (y0 >> li) > 1)) {
+        ++li;
+    }
+
+    const occ_hiz_level *lvl = &oc->levels[li];
+    u32 lx1 = std::min(x1 >> li, lvl->width - 1), ly1 = std::min(y1 >> li, lvl->height - 1);
+    for (u32 y = std::min(y0 >> li, ly1); y <= ly1; ++y) {
+        for (u32 x = std::min(x0 >> li, lx1); x <= lx1; ++x) {
+            if (min_z <= lvl->texels[y * lvl->width + x]) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+} // namespace nslib
@@ -0,0 +1,85 @@
+#pragma once
+
+#include "model.h"
+#include "math/matrix4.h"
+
+namespace nslib
+{
+
+// Tiles are rasterized independently so the width must stay a multiple of 4 for the SIMD row loop
+inline constexpr u32 OCC_TILE_WIDTH = 32;
+inline constexpr u32 OCC_TILE_HEIGHT = 16;
+inline constexpr u32 OCC_DEFAULT_WIDTH = 320;
+inline constexpr u32 OCC_DEFAULT_HEIGHT = 192;
+inline constexpr u32 OCC_MAX_HIZ_LEVELS = 16;
+// Clip space w below this is treated as crossing the near plane
+inline constexpr f32 OCC_MIN_CLIP_W = 1e-4f;
+
+// Screen space triangle - x and y are in depth buffer pixels and z is ndc depth
+struct occ_tri
+{
+    vec3 verts[3];
+};
+
+struct occ_tile
+{
+    // Indices in to the occlusion culler tris which overlap this tile
+    array<u32> tris;
+};
+
+struct occ_hiz_level
+{
+    u32 width;
+    u32 height;
+    f32 *texels;
+};
+
+// Low resolution software depth buffer for occlusion culling. Each frame the occluder triangles are transformed and
+// binned in to screen tiles, then each tile is rasterized on its own (so tiles can be split across threads) with four
+// pixels per SIMD step. A max depth pyramid is built from the result, and occludee boxes are tested against the
+// smallest level where their screen rect covers at most 2x2 texels. Depth is ndc z with smaller values closer.
+struct occlusion_culler
+{
+    u32 width;
+    u32 height;
+    u32 tiles_x;
+    u32 tiles_y;
+    mat4 proj_view;
+
+    // Full resolution depth followed by each reduced level
+    array<f32> depth;
+    static_array<occ_hiz_level, OCC_MAX_HIZ_LEVELS> levels;
+
+    array<occ_tri> tris;
+    array<occ_tile> tiles;
+
+    // Scratch for transforming occluder verts
+    array<vec4> clip_verts;
+};
+
+// The size is rounded up to a multiple of the tile size
+void init_occlusion_culler(occlusion_culler *oc, mem_arena *arena, u32 width = OCC_DEFAULT_WIDTH, u32 height = OCC_DEFAULT_HEIGHT);
+void terminate_occlusion_culler(occlusion_culler *oc);
+
+// Clear the depth buffer and the occluder triangles
+void occ_begin_frame(occlusion_culler *oc, const mat4 &proj_view);
+
+// Transform and bin the occluder triangles - triangles crossing the near plane are dropped, which only makes culling
+// less aggressive
+void occ_add_occluder(occlusion_culler *oc, const submesh *sm, const mat4 &tform);
+void occ_add_occluder(occlusion_culler *oc, const mesh *msh, const mat4 &tform);
+
+// Rasterize the binned triangles of tiles [first_tile, first_tile + tile_count). Different tile ranges touch different
+// pixels so they can be rasterized from different threads.
+void occ_rasterize_tiles(occlusion_culler *oc, u32 first_tile, u32 tile_count);
+
+// Build the max depth pyramid - must be called after all tiles are rasterized and before testing
+void occ_build_hiz(occlusion_culler *oc);
+
+// Rasterize all tiles and build the pyramid
+void occ_rasterize(occlusion_culler *oc);
+
+// Returns false only if the world space box is completely behind the occluders
+bool occ_test_aabb(const occlusion_culler *oc, const bbox &world_bounds);
+
+} // namespace nslib
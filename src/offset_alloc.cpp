@@ -0,0 +1,277 @@
+#include <bit>
+
+#include "logging.h"
+#include "offset_alloc.h"
+
+namespace nslib
+{
+
+inline constexpr u32 OALLOC_MANTISSA_VALUE = 1 << OALLOC_MANTISSA_BITS;
+inline constexpr u32 OALLOC_MANTISSA_MASK = OALLOC_MANTISSA_VALUE - 1;
+
+// Bin index of the smallest bin whose sizes are all at least size - used when allocating
+intern u32 size_to_bin_round_up(u32 size)
+{
+    if (size < OALLOC_MANTISSA_VALUE) {
+        return size;
+    }
+    u32 highest_bit = 31 - std::countl_zero(size);
+    u32 mantissa_start = highest_bit - OALLOC_MANTISSA_BITS;
+    u32 exp = mantissa_start + 1;
+    u32 mantissa = (size >> mantissa_start) & OALLOC_MANTISSA_MASK;
+    // A mantissa overflow carries in to the exponent which is the next bin up as well
+    if ((size & ((1u << mantissa_start) - 1)) != 0) {
+        ++mantissa;
+    }
+    return (exp << OALLOC_MANTISSA_BITS) + mantissa;
+}
+
+// Bin index of the largest bin whose sizes are all at most size - used when inserting free ranges
+intern u32 size_to_bin_round_down(u32 size)
+{
+    if (size < OALLOC_MANTISSA_VALUE) {
+        return size;
+    }
+    u32 highest_bit = 31 - std::countl_zero(size);
+    u32 mantissa_start = highest_bit - OALLOC_MANTISSA_BITS;
+    u32 exp = mantissa_start + 1;
+    u32 mantissa = (size >> mantissa_start) & OALLOC_MANTISSA_MASK;
+    return (exp << OALLOC_MANTISSA_BITS) | mantissa;
+}
+
+intern u32 bin_to_size(u32 bin)
+{
+    u32 exp = bin >> OALLOC_MANTISSA_BITS;
+    u32 mantissa = bin & OALLOC_MANTISSA_MASK;
+    if (exp == 0) {
+        return mantissa;
+    }
+    return (mantissa | OALLOC_MANTISSA_VALUE) << (exp - 1);
+}
+
+// Index of the lowest set bit at or above start_bit, or INVALID_ID if there isn't one
+intern u32 find_lowest_set_bit_after(u32 mask, u32 start_bit)
+{
+    if (start_bit >= 32) {
+        return INVALID_ID;
+    }
+    u32 masked = mask & (~0u << start_bit);
+    if (masked == 0) {
+        return INVALID_ID;
+    }
+    return (u32)std::countr_zero(masked);
+}
+
+intern u32 alloc_node(offset_allocator *oa)
+{
+    if (oa->free_nodes.size > 0) {
+        u32 ni = *arr_back(&oa->free_nodes);
+        arr_pop_back(&oa->free_nodes);
+        oa->nodes[ni] = {};
+        return ni;
+    }
+    u32 ni = (u32)oa->nodes.size;
+    arr_emplace_back(&oa->nodes);
+    return ni;
+}
+
+intern void release_node(offset_allocator *oa, u32 ni)
+{
+    arr_push_back(&oa->free_nodes, ni);
+}
+
+// Push the node on the front of its bin's free list
+intern void insert_node_to_bin(offset_allocator *oa, u32 ni)
+{
+    auto node = &oa->nodes[ni];
+    u32 bin = size_to_bin_round_down(node->size);
+    u32 top = bin >> OALLOC_MANTISSA_BITS;
+    u32 leaf = bin & OALLOC_MANTISSA_MASK;
+
+    if (!is_valid(oa->bin_heads[bin])) {
+        oa->used_bins[top] |= (u8)(1 << leaf);
+        oa->used_bins_top |= 1u << top;
+    }
+
+    node->used = false;
+    node->bin_prev = INVALID_ID;
+    node->bin_next = oa->bin_heads[bin];
+    if (is_valid(node->bin_next)) {
+        oa->nodes[node->bin_next].bin_prev = ni;
+    }
+    oa->bin_heads[bin] = ni;
+    oa->free_storage += node->size;
+}
+
+intern void remove_node_from_bin(offset_allocator *oa, u32 ni)
+{
+    auto node = &oa->nodes[ni];
+    if (is_valid(node->bin_prev)) {
+        oa->nodes[node->bin_prev].bin_next = node->bin_next;
+    }
+    else {
+        u32 bin = size_to_bin_round_down(node->size);
+        u32 top = bin >> OALLOC_MANTISSA_BITS;
+        u32 leaf = bin & OALLOC_MANTISSA_MASK;
+        oa->bin_heads[bin] = node->bin_next;
+        if (!is_valid(node->bin_next)) {
+            oa->used_bins[top] &= (u8)~(1 << leaf);
+            if (oa->used_bins[top] == 0) {
+                oa->used_bins_top &= ~(1u << top);
+            }
+        }
+    }
+    if (is_valid(node->bin_next)) {
+        oa->nodes[node->bin_next].bin_prev = node->bin_prev;
+    }
+    node->bin_prev = INVALID_ID;
+    node->bin_next = INVALID_ID;
+    oa->free_storage -= node->size;
+}
+
+void init_offset_allocator(offset_allocator *oa, mem_arena *arena, u32 size, sizet initial_node_count)
+{
+    arr_init(&oa->nodes, arena, initial_node_count);
+    arr_init(&oa->free_nodes, arena, initial_node_count);
+    oa->size = size;
+    oalloc_reset(oa);
+}
+
+void terminate_offset_allocator(offset_allocator *oa)
+{
+    arr_terminate(&oa->free_nodes);
+    arr_terminate(&oa->nodes);
+}
+
+void oalloc_reset(offset_allocator *oa)
+{
+    oa->free_storage = 0;
+    oa->used_bins_top = 0;
+    for (u32 i = 0; i < OALLOC_TOP_BIN_COUNT; ++i) {
+        oa->used_bins[i] = 0;
+    }
+    for (u32 i = 0; i < OALLOC_BIN_COUNT; ++i) {
+        oa->bin_heads[i] = INVALID_ID;
+    }
+    arr_clear(&oa->nodes);
+    arr_clear(&oa->free_nodes);
+
+    if (oa->size > 0) {
+        u32 ni = alloc_node(oa);
+        oa->nodes[ni].offset = 0;
+        oa->nodes[ni].size = oa->size;
+        insert_node_to_bin(oa, ni);
+    }
+}
+
+oalloc_block oalloc_alloc(offset_allocator *oa, u32 size)
+{
+    if (size == 0 || size > oa->free_storage) {
+        return {};
+    }
+
+    // Look for a non-empty bin at least as big as the rounded up size in the same top bin first, then in the higher
+    // top bins where any leaf bin will do
+    u32 min_bin = size_to_bin_round_up(size);
+    u32 min_top = min_bin >> OALLOC_MANTISSA_BITS;
+    u32 min_leaf = min_bin & OALLOC_MANTISSA_MASK;
+
+    u32 top = min_top;
+    u32 leaf = INVALID_ID;
+    if (min_top < OALLOC_TOP_BIN_COUNT && (oa->used_bins_top & (1u << min_top))) {
+        leaf = find_lowest_set_bit_after(oa->used_bins[min_top], min_leaf);
+    }
+    if (!is_valid(leaf)) {
+        top = find_lowest_set_bit_after(oa->used_bins_top, min_top + 1);
+        if (is_valid(top)) {
+            leaf = (u32)std::countr_zero((u32)oa->used_bins[top]);
+        }
+    }
+
+    u32 ni = INVALID_ID;
+    if (is_valid(leaf)) {
+        ni = oa->bin_heads[(top << OALLOC_MANTISSA_BITS) | leaf];
+    }
+    else {
+        // Nothing in the bins that are guaranteed to fit - ranges in the bin the size rounds down to might still be
+        // big enough, which matters when the allocator is nearly full
+        ni = oa->bin_heads[size_to_bin_round_down(size)];
+        while (is_valid(ni) && oa->nodes[ni].size < size) {
+            ni = oa->nodes[ni].bin_next;
+        }
+        if (!is_valid(ni)) {
+            return {};
+        }
+    }
+    remove_node_from_bin(oa, ni);
+
+    auto node = &oa->nodes[ni];
+    u32 remain = node->size - size;
+    node->size = size;
+    node->used = true;
+
+    // Split the remainder off in to its own free range right after the allocation
+    if (remain > 0) {
+        u32 rni = alloc_node(oa);
+        // Adding a node might have moved the node array
+        node = &oa->nodes[ni];
+        auto rnode = &oa->nodes[rni];
+        rnode->offset = node->offset + size;
+        rnode->size = remain;
+        rnode->neighbor_prev = ni;
+        rnode->neighbor_next = node->neighbor_next;
+        if (is_valid(node->neighbor_next)) {
+            oa->nodes[node->neighbor_next].neighbor_prev = rni;
+        }
+        node->neighbor_next = rni;
+        insert_node_to_bin(oa, rni);
+        node = &oa->nodes[ni];
+    }
+    return {node->offset, node->size, ni};
+}
+
+void oalloc_free(offset_allocator *oa, u32 ni)
+{
+    asrt(ni < oa->nodes.size);
+    auto node = &oa->nodes[ni];
+    asrt(node->used);
+
+    // Absorb the free neighbours in to this node so the merged range keeps its index
+    u32 prev = node->neighbor_prev;
+    if (is_valid(prev) && !oa->nodes[prev].used) {
+        auto pnode = &oa->nodes[prev];
+        remove_node_from_bin(oa, prev);
+        node->offset = pnode->offset;
+        node->size += pnode->size;
+        node->neighbor_prev = pnode->neighbor_prev;
+        if (is_valid(node->neighbor_prev)) {
+            oa->nodes[node->neighbor_prev].neighbor_next = ni;
+        }
+        release_node(oa, prev);
+    }
+
+    u32 next = node->neighbor_next;
+    if (is_valid(next) && !oa->nodes[next].used) {
+        auto nnode = &oa->nodes[next];
+        remove_node_from_bin(oa, next);
+        node->size += nnode->size;
+        node->neighbor_next = nnode->neighbor_next;
+        if (is_valid(node->neighbor_next)) {
+            oa->nodes[node->neighbor_next].neighbor_prev = ni;
+        }
+        release_node(oa, next);
+    }
+    insert_node_to_bin(oa, ni);
+}
+
+u32 oalloc_largest_free_size(const offset_allocator *oa)
+{
+    if (oa->used_bins_top == 0) {
+        return 0;
+    }
+    u32 top = 31 - std::countl_zero(oa->used_bins_top);
+    u32 leaf = 31 - std::countl_zero((u32)oa->used_bins[top]);
+    return bin_to_size((top << OALLOC_MANTISSA_BITS) | leaf);
+}
+
+} // namespace nslib
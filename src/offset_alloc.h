@@ -0,0 +1,69 @@
+#pragma once
+
+#include "containers/array.h"
+
+namespace nslib
+{
+
+// Sizes are binned with a tiny float - 3 mantissa bits and 5 exponent bits give 8 leaf bins per power of two and 256
+// bins in total, so every bin is within 12.5 percent of its neighbours
+inline constexpr u32 OALLOC_MANTISSA_BITS = 3;
+inline constexpr u32 OALLOC_LEAF_BINS_PER_TOP = 1 << OALLOC_MANTISSA_BITS;
+inline constexpr u32 OALLOC_TOP_BIN_COUNT = 32;
+inline constexpr u32 OALLOC_BIN_COUNT = OALLOC_TOP_BIN_COUNT * OALLOC_LEAF_BINS_PER_TOP;
+inline constexpr sizet OALLOC_DEFAULT_NODE_COUNT = 1024;
+
+// Contiguous range of the allocator's space - allocated ranges are used, the rest are on the free list of their bin.
+// Neighbours link all nodes in address order so freed ranges can be merged with the free ranges around them.
+struct oalloc_node
+{
+    u32 offset;
+    u32 size;
+    u32 bin_prev{INVALID_ID};
+    u32 bin_next{INVALID_ID};
+    u32 neighbor_prev{INVALID_ID};
+    u32 neighbor_next{INVALID_ID};
+    b32 used;
+};
+
+struct oalloc_block
+{
+    u32 offset;
+    u32 size;
+    // Node index passed to oalloc_free - INVALID_ID if the allocation failed
+    u32 node{INVALID_ID};
+};
+
+// Two level segregated fit allocator for sub-ranges of a buffer. It only hands out offsets, so the units are whatever
+// the caller indexes the buffer with (verts, inds, bytes). Free ranges are kept in a list per size bin, and a bit per
+// bin (and per group of bins) is set when the list is non-empty, so both allocating and freeing are a couple of bit
+// scans regardless of how many ranges are free. Allocations round the size up to the next bin so any range in the bin
+// found is big enough; the remainder is split off and put back as a free range.
+struct offset_allocator
+{
+    u32 size;
+    u32 free_storage;
+    u32 used_bins_top;
+    u8 used_bins[OALLOC_TOP_BIN_COUNT];
+    u32 bin_heads[OALLOC_BIN_COUNT];
+    array<oalloc_node> nodes;
+    // Unused node indices
+    array<u32> free_nodes;
+};
+
+void init_offset_allocator(offset_allocator *oa, mem_arena *arena, u32 size, sizet initial_node_count = OALLOC_DEFAULT_NODE_COUNT);
+void terminate_offset_allocator(offset_allocator *oa);
+
+// Free everything - the whole space becomes a single free range
+void oalloc_reset(offset_allocator *oa);
+
+// Returns a block with node set to INVALID_ID if there is no free range big enough
+oalloc_block oalloc_alloc(offset_allocator *oa, u32 size);
+
+// Free the block allocated with node and merge it with free neighbouring ranges
+void oalloc_free(offset_allocator *oa, u32 node);
+
+// Size of the largest range that can be allocated at the moment - rounded down to its bin
+u32 oalloc_largest_free_size(const offset_allocator *oa);
+
+} // namespace nslib
@@ -0,0 +1,876 @@
+#include <algorithm>
+
+#include "logging.h"
+#include "render_graph.h"
+
+namespace nslib
+{
+
+intern const VkAccessFlags RG_WRITE_ACCESS_MASK = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT |
+                                                  VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT;
+
+intern const rg_access_info ACCESS_INFO[RG_ACCESS_TYPE_COUNT] = {
+    // RG_ACCESS_COLOR_ATTACHMENT
+    {VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+     VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+     VK_ACCESS_COLOR_ATTACHMENT_READ_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT,
+     VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT,
+     true,
+     true},
+    // RG_ACCESS_DEPTH_ATTACHMENT
+    {VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL,
+     VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT,
+     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+     true,
+     true},
+    // RG_ACCESS_DEPTH_READ
+    {VK_IMAGE_LAYOUT_DEPTH_STENCIL_READ_ONLY_OPTIMAL,
+     VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT | VK_PIPELINE_STAGE_LATE_FRAGMENT_TESTS_BIT,
+     VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_READ_BIT,
+     VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT,
+     false,
+     true},
+    // RG_ACCESS_SAMPLED
+    {VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+     VK_ACCESS_SHADER_READ_BIT,
+     VK_IMAGE_USAGE_SAMPLED_BIT,
+     false,
+     false},
+    // RG_ACCESS_STORAGE_READ
+    {VK_IMAGE_LAYOUT_GENERAL,
+     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+     VK_ACCESS_SHADER_READ_BIT,
+     VK_IMAGE_USAGE_STORAGE_BIT,
+     false,
+     false},
+    // RG_ACCESS_STORAGE_WRITE
+    {VK_IMAGE_LAYOUT_GENERAL,
+     VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+     VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+     VK_IMAGE_USAGE_STORAGE_BIT,
+     true,
+     false},
+    // RG_ACCESS_TRANSFER_SRC
+    {VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+     VK_PIPELINE_STAGE_TRANSFER_BIT,
+     VK_ACCESS_TRANSFER_READ_BIT,
+     VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
+     false,
+     false},
+    // RG_ACCESS_TRANSFER_DST
+    {VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+     VK_PIPELINE_STAGE_TRANSFER_BIT,
+     VK_ACCESS_TRANSFER_WRITE_BIT,
+     VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+     true,
+     false},
+};
+
+// Where a resource was left by the passes recorded so far while the barriers are being derived
+struct rg_resource_state
+{
+    VkImageLayout layout;
+    // The last write - later accesses have to wait on it
+    VkPipelineStageFlags write_stages;
+    VkAccessFlags write_access;
+    // Reads since the last write - the next write has to wait on them
+    VkPipelineStageFlags read_stages;
+    // Stages the last write has been made visible to
+    VkPipelineStageFlags synced_stages;
+};
+
+const rg_access_info *rg_get_access_info(rg_access_type type)
+{
+    asrt(type < RG_ACCESS_TYPE_COUNT);
+    return &ACCESS_INFO[type];
+}
+
+void init_render_graph(render_graph *rg, mem_arena *arena)
+{
+    arr_init(&rg->resources, arena);
+    arr_init(&rg->passes, arena);
+    arr_init(&rg->order, arena);
+    arr_init(&rg->barriers, arena);
+    arr_init(&rg->blocks, arena);
+    rg->final_barriers = {};
+    rg->compiled = false;
+}
+
+void terminate_render_graph(render_graph *rg, vkr_context *vk)
+{
+    rg_terminate_resources(rg, vk);
+    arr_terminate(&rg->blocks);
+    arr_terminate(&rg->barriers);
+    arr_terminate(&rg->order);
+    arr_terminate(&rg->passes);
+    arr_terminate(&rg->resources);
+}
+
+u32 rg_add_image(render_graph *rg, const rid &id, VkFormat format, VkImageAspectFlags aspect, const uvec2 &size)
+{
+    asrt(!rg->compiled);
+    u32 ind = (u32)rg->resources.size;
+    auto res = arr_emplace_back(&rg->resources);
+    res->id = id;
+    res->format = format;
+    res->aspect = aspect;
+    res->size = size;
+    return ind;
+}
+
+u32 rg_add_swapchain_image(render_graph *rg, const rid &id, VkFormat format, rg_access_type final_access)
+{
+    u32 ind = rg_add_image(rg, id, format, VK_IMAGE_ASPECT_COLOR_BIT);
+    rg->resources[ind].swapchain = true;
+    rg->resources[ind].final_access = final_access;
+    return ind;
+}
+
+u32 rg_add_pass(render_graph *rg, const rid &id, bool side_effects)
+{
+    asrt(!rg->compiled);
+    u32 ind = (u32)rg->passes.size;
+    auto pass = arr_emplace_back(&rg->passes);
+    pass->id = id;
+    pass->side_effects = side_effects;
+    return ind;
+}
+
+void rg_pass_write(render_graph *rg, u32 pass, u32 resource, rg_access_type type, VkAttachmentLoadOp load_op, const VkClearValue &clear)
+{
+    asrt(!rg->compiled);
+    asrt(ACCESS_INFO[type].write);
+    asrt(resource < rg->resources.size);
+    rg_pass_access acc{resource, type, load_op, clear};
+    arr_push_back(&rg->passes[pass].accesses, acc);
+}
+
+void rg_pass_read(render_graph *rg, u32 pass, u32 resource, rg_access_type type)
+{
+    asrt(!rg->compiled);
+    asrt(!ACCESS_INFO[type].write);
+    asrt(resource < rg->resources.size);
+    rg_pass_access acc{resource, type, VK_ATTACHMENT_LOAD_OP_LOAD, {}};
+    arr_push_back(&rg->passes[pass].accesses, acc);
+}
+
+u32 rg_find_pass(const render_graph *rg, const rid &id)
+{
+    for (u32 i = 0; i < rg->passes.size; ++i) {
+        if (rg->passes[i].id.id == id.id) {
+            return i;
+        }
+    }
+    return INVALID_ID;
+}
+
+u32 rg_find_resource(const render_graph *rg, const rid &id)
+{
+    for (u32 i = 0; i < rg->resources.size; ++i) {
+        if (rg->resources[i].id.id == id.id) {
+            return i;
+        }
+    }
+    return INVALID_ID;
+}
+
+intern const rg_pass_access *find_access(const rg_pass *pass, u32 resource)
+{
+    for (sizet i = 0; i < pass->accesses.size; ++i) {
+        if (pass->accesses[i].resource == resource) {
+            return &pass->accesses[i];
+        }
+    }
+    return nullptr;
+}
+
+intern bool pass_writes(const rg_pass *pass, u32 resource)
+{
+    auto acc = find_access(pass, resource);
+    return acc && ACCESS_INFO[acc->type].write;
+}
+
+// Whether a write replaces the whole image - only cleared or don't care attachments do, everything else may keep some of
+// what was there so it depends on the earlier writers
+intern bool is_full_write(const rg_pass_access *acc)
+{
+    return ACCESS_INFO[acc->type].attachment && acc->load_op != VK_ATTACHMENT_LOAD_OP_LOAD;
+}
+
+// Passes that must run before the pass - writers of a resource run in the order they were added, and every pass only
+// reading a resource runs after all of its writers
+intern void add_pass_deps(const render_graph *rg, u32 pass_ind, array<u32> *deps)
+{
+    auto pass = &rg->passes[pass_ind];
+    for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+        auto acc = &pass->accesses[ai];
+        bool write = ACCESS_INFO[acc->type].write;
+        for (u32 pi = 0; pi < rg->passes.size; ++pi) {
+            if (pi == pass_ind || !pass_writes(&rg->passes[pi], acc->resource)) {
+                continue;
+            }
+            if (!write || pi < pass_ind) {
+                arr_push_back(deps, pi);
+            }
+        }
+    }
+}
+
+// Mark the passes whose writes the pass depends on - a read needs the writers from the last full write on, and a
+// partial write needs the writers before it
+intern void mark_needed_writers(const render_graph *rg, u32 pass_ind, array<u32> *stack, array<u8> *alive)
+{
+    auto pass = &rg->passes[pass_ind];
+    for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+        auto acc = &pass->accesses[ai];
+        bool write = ACCESS_INFO[acc->type].write;
+        if (write && is_full_write(acc)) {
+            continue;
+        }
+
+        u32 end = write ? pass_ind : (u32)rg->passes.size;
+        u32 begin = 0;
+        for (u32 pi = 0; pi < end; ++pi) {
+            auto wacc = find_access(&rg->passes[pi], acc->resource);
+            if (pi != pass_ind && wacc && ACCESS_INFO[wacc->type].write && is_full_write(wacc)) {
+                begin = pi;
+            }
+        }
+        for (u32 pi = begin; pi < end; ++pi) {
+            if (pi != pass_ind && !(*alive)[pi] && pass_writes(&rg->passes[pi], acc->resource)) {
+                (*alive)[pi] = true;
+                arr_push_back(stack, pi);
+            }
+        }
+    }
+}
+
+intern void cull_passes(render_graph *rg, mem_arena *arena)
+{
+    array<u8> alive{};
+    arr_init(&alive, arena);
+    arr_resize(&alive, rg->passes.size);
+    array<u32> stack{};
+    arr_init(&stack, arena);
+
+    // Passes writing the swapchain image or marked as having side effects are the roots - everything else is only kept
+    // if one of them needs it
+    for (u32 pi = 0; pi < rg->passes.size; ++pi) {
+        auto pass = &rg->passes[pi];
+        alive[pi] = pass->side_effects;
+        for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+            if (rg->resources[pass->accesses[ai].resource].swapchain && ACCESS_INFO[pass->accesses[ai].type].write) {
+                alive[pi] = true;
+            }
+        }
+        if (alive[pi]) {
+            arr_push_back(&stack, pi);
+        }
+    }
+
+    while (stack.size > 0) {
+        u32 pi = *arr_back(&stack);
+        arr_pop_back(&stack);
+        mark_needed_writers(rg, pi, &stack, &alive);
+    }
+
+    for (u32 pi = 0; pi < rg->passes.size; ++pi) {
+        rg->passes[pi].culled = !alive[pi];
+        if (!alive[pi]) {
+            ilog("Culling render graph pass %s", str_cstr(rg->passes[pi].id.str));
+        }
+    }
+    arr_terminate(&stack);
+    arr_terminate(&alive);
+}
+
+// Kahn's algorithm over the passes that weren't culled - when more than one pass is ready the one added first goes next
+// so the order stays as close to the order passes were added as the dependencies allow
+intern int order_passes(render_graph *rg, mem_arena *arena)
+{
+    sizet pcount = rg->passes.size;
+    array<u32> dep_counts{};
+    arr_init(&dep_counts, arena);
+    arr_resize(&dep_counts, pcount);
+
+    // Flattened dependency lists - the deps of pass i are deps[dep_offsets[i]] to deps[dep_offsets[i+1]]
+    array<u32> deps{};
+    arr_init(&deps, arena);
+    array<u32> dep_offsets{};
+    arr_init(&dep_offsets, arena);
+    for (u32 pi = 0; pi < pcount; ++pi) {
+        arr_push_back(&dep_offsets, (u32)deps.size);
+        if (!rg->passes[pi].culled) {
+            add_pass_deps(rg, pi, &deps);
+        }
+    }
+    arr_push_back(&dep_offsets, (u32)deps.size);
+
+    sizet alive_count = 0;
+    for (u32 pi = 0; pi < pcount; ++pi) {
+        if (rg->passes[pi].culled) {
+            continue;
+        }
+        ++alive_count;
+        for (u32 di = dep_offsets[pi]; di < dep_offsets[pi + 1]; ++di) {
+            dep_counts[pi] += !rg->passes[deps[di]].culled;
+        }
+    }
+
+    array<u8> done{};
+    arr_init(&done, arena);
+    arr_resize(&done, pcount);
+
+    arr_clear(&rg->order);
+    while (rg->order.size < alive_count) {
+        u32 next = INVALID_ID;
+        for (u32 pi = 0; pi < pcount; ++pi) {
+            if (!rg->passes[pi].culled && !done[pi] && dep_counts[pi] == 0) {
+                next = pi;
+                break;
+            }
+        }
+        if (next == INVALID_ID) {
+            break;
+        }
+
+        done[next] = true;
+        arr_push_back(&rg->order, next);
+        for (u32 pi = 0; pi < pcount; ++pi) {
+            if (rg->passes[pi].culled || done[pi]) {
+                continue;
+            }
+            for (u32 di = dep_offsets[pi]; di < dep_offsets[pi + 1]; ++di) {
+                dep_counts[pi] -= (deps[di] == next);
+            }
+        }
+    }
+
+    int ret = err_code::RG_NO_ERROR;
+    if (rg->order.size < alive_count) {
+        elog("Render graph has a dependency cycle between the passes:");
+        for (u32 pi = 0; pi < pcount; ++pi) {
+            if (!rg->passes[pi].culled && !done[pi]) {
+                elog("    %s", str_cstr(rg->passes[pi].id.str));
+            }
+        }
+        ret = err_code::RG_CYCLE;
+    }
+
+    arr_terminate(&done);
+    arr_terminate(&dep_offsets);
+    arr_terminate(&deps);
+    arr_terminate(&dep_counts);
+    return ret;
+}
+
+intern void add_barrier(render_graph *rg, rg_barrier_batch *batch, const rg_barrier &bar, VkPipelineStageFlags src_stages, VkPipelineStageFlags dst_stages)
+{
+    arr_push_back(&rg->barriers, bar);
+    ++batch->count;
+    batch->src_stages |= src_stages;
+    batch->dst_stages |= dst_stages;
+}
+
+// Move the resource state to the access, adding a barrier to the batch only if there is something to wait on or a layout
+// to change
+intern void transition(render_graph *rg, rg_barrier_batch *batch, u32 resource, rg_resource_state *st, const rg_access_info *info)
+{
+    bool layout_change = st->layout != info->layout;
+    rg_barrier bar{resource, st->layout, info->layout, 0, info->access};
+
+    if (info->write || layout_change) {
+        // Writes and layout changes wait on every earlier access - reads only need ordering, not availability
+        VkPipelineStageFlags src_stages = st->write_stages | st->read_stages;
+        bar.src_access = st->write_access;
+        add_barrier(rg, batch, bar, src_stages ? src_stages : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, info->stages);
+        st->layout = info->layout;
+        st->synced_stages = info->stages;
+        if (info->write) {
+            st->write_stages = info->stages;
+            st->write_access = info->access & RG_WRITE_ACCESS_MASK;
+            st->read_stages = 0;
+        }
+        else {
+            st->read_stages = info->stages;
+        }
+        return;
+    }
+
+    // Read after read in the same layout - only needs a barrier if the last write hasn't been made visible to these
+    // stages yet
+    if (st->write_stages && (info->stages & ~st->synced_stages)) {
+        bar.src_access = st->write_access;
+        add_barrier(rg, batch, bar, st->write_stages, info->stages);
+        st->synced_stages |= info->stages;
+    }
+    st->read_stages |= info->stages;
+}
+
+intern void derive_barriers(render_graph *rg, mem_arena *arena)
+{
+    // Transient images are undefined at the start of the frame, but the memory may still be in use by the images
+    // aliasing it or by the last frame, so the first barrier for each waits on every stage any transient is used in
+    VkPipelineStageFlags transient_stages = 0;
+    VkAccessFlags transient_access = 0;
+    for (sizet oi = 0; oi < rg->order.size; ++oi) {
+        auto pass = &rg->passes[rg->order[oi]];
+        for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+            if (!rg->resources[pass->accesses[ai].resource].swapchain) {
+                transient_stages |= ACCESS_INFO[pass->accesses[ai].type].stages;
+                transient_access |= ACCESS_INFO[pass->accesses[ai].type].access & RG_WRITE_ACCESS_MASK;
+            }
+        }
+    }
+
+    array<rg_resource_state> states{};
+    arr_init(&states, arena);
+    arr_resize(&states, rg->resources.size);
+    for (sizet ri = 0; ri < rg->resources.size; ++ri) {
+        states[ri].layout = VK_IMAGE_LAYOUT_UNDEFINED;
+        if (rg->resources[ri].swapchain) {
+            // The image available semaphore is waited on at the color output stage - chaining on to that stage makes
+            // the layout transition wait for the image too
+            states[ri].write_stages = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        }
+        else {
+            states[ri].write_stages = transient_stages;
+            states[ri].write_access = transient_access;
+        }
+    }
+
+    arr_clear(&rg->barriers);
+    for (u32 oi = 0; oi < rg->order.size; ++oi) {
+        auto pass = &rg->passes[rg->order[oi]];
+        pass->barriers = {(u32)rg->barriers.size, 0, 0, 0};
+        for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+            u32 res = pass->accesses[ai].resource;
+            transition(rg, &pass->barriers, res, &states[res], &ACCESS_INFO[pass->accesses[ai].type]);
+        }
+    }
+
+    rg->final_barriers = {(u32)rg->barriers.size, 0, 0, 0};
+    for (u32 ri = 0; ri < rg->resources.size; ++ri) {
+        auto st = &states[ri];
+        if (!rg->resources[ri].swapchain || !is_valid(rg->resources[ri].first_use)) {
+            continue;
+        }
+        auto fa = rg->resources[ri].final_access;
+        if (fa < RG_ACCESS_TYPE_COUNT) {
+            transition(rg, &rg->final_barriers, ri, st, &ACCESS_INFO[fa]);
+            continue;
+        }
+        rg_barrier bar{ri, st->layout, VK_IMAGE_LAYOUT_PRESENT_SRC_KHR, st->write_access, 0};
+        add_barrier(rg, &rg->final_barriers, bar, st->write_stages | st->read_stages, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT);
+    }
+    arr_terminate(&states);
+}
+
+intern void calc_resource_usage(render_graph *rg)
+{
+    for (sizet ri = 0; ri < rg->resources.size; ++ri) {
+        rg->resources[ri].usage = 0;
+        rg->resources[ri].first_use = INVALID_ID;
+        rg->resources[ri].last_use = INVALID_ID;
+    }
+    for (u32 oi = 0; oi < rg->order.size; ++oi) {
+        auto pass = &rg->passes[rg->order[oi]];
+        for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+            auto res = &rg->resources[pass->accesses[ai].resource];
+            res->usage |= ACCESS_INFO[pass->accesses[ai].type].usage;
+            if (!is_valid(res->first_use)) {
+                res->first_use = oi;
+            }
+            res->last_use = oi;
+        }
+    }
+}
+
+// The render pass leaves the layouts alone (the barriers before the pass do the transitions) and doesn't store
+// transient attachments nothing reads afterwards
+intern int create_render_pass(render_graph *rg, rg_pass *pass, u32 order_ind, vkr_context *vk)
+{
+    vkr_rpass_cfg rp_cfg{};
+    vkr_rpass_cfg_subpass subpass{};
+    subpass.pipeline_bind_point = VK_PIPELINE_BIND_POINT_GRAPHICS;
+    VkAttachmentReference depth_ref{};
+    pass->clear_vals.size = 0;
+
+    for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+        auto acc = &pass->accesses[ai];
+        auto info = &ACCESS_INFO[acc->type];
+        if (!info->attachment) {
+            continue;
+        }
+
+        auto res = &rg->resources[acc->resource];
+        bool keep = res->swapchain || res->last_use != order_ind;
+        pass->uses_swapchain |= res->swapchain;
+
+        VkAttachmentDescription att{};
+        att.format = res->format;
+        att.samples = VK_SAMPLE_COUNT_1_BIT;
+        att.loadOp = info->write ? acc->load_op : VK_ATTACHMENT_LOAD_OP_LOAD;
+        att.storeOp = (info->write && !keep) ? VK_ATTACHMENT_STORE_OP_DONT_CARE : VK_ATTACHMENT_STORE_OP_STORE;
+        att.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        att.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        if (test_flags(res->aspect, VK_IMAGE_ASPECT_STENCIL_BIT)) {
+            att.stencilLoadOp = att.loadOp;
+            att.stencilStoreOp = att.storeOp;
+        }
+        att.initialLayout = info->layout;
+        att.finalLayout = info->layout;
+
+        VkAttachmentReference ref{(u32)rp_cfg.attachments.size, info->layout};
+        if (acc->type == RG_ACCESS_COLOR_ATTACHMENT) {
+            arr_push_back(&subpass.color_attachments, ref);
+        }
+        else {
+            asrt(!subpass.depth_stencil_attachment);
+            depth_ref = ref;
+            subpass.depth_stencil_attachment = &depth_ref;
+        }
+        arr_push_back(&rp_cfg.attachments, att);
+        arr_push_back(&pass->clear_vals, acc->clear);
+    }
+
+    if (rp_cfg.attachments.size == 0) {
+        return err_code::RG_NO_ERROR;
+    }
+    arr_push_back(&rp_cfg.subpasses, subpass);
+
+    sizet rpind = vkr_add_render_pass(&vk->inst.device, {});
+    int err = vkr_init_render_pass(&vk->inst.device.render_passes[rpind], &rp_cfg, vk);
+    if (err != err_code::VKR_NO_ERROR) {
+        elog("Failed to create render pass for render graph pass %s with err %d", str_cstr(pass->id.str), err);
+        return err_code::RG_CREATE_RENDER_PASS_FAIL;
+    }
+    pass->rpind = rpind;
+    return err_code::RG_NO_ERROR;
+}
+
+int rg_compile(render_graph *rg, vkr_context *vk)
+{
+    asrt(!rg->compiled);
+    auto arena = vk->cfg.arenas.command_arena;
+    cull_passes(rg, arena);
+    int err = order_passes(rg, arena);
+    if (err != err_code::RG_NO_ERROR) {
+        return err;
+    }
+    calc_resource_usage(rg);
+    derive_barriers(rg, arena);
+
+    // Render passes are created in execution order so their indices sort the same way the passes run
+    for (u32 oi = 0; oi < rg->order.size; ++oi) {
+        err = create_render_pass(rg, &rg->passes[rg->order[oi]], oi, vk);
+        if (err != err_code::RG_NO_ERROR) {
+            return err;
+        }
+    }
+
+    rg->compiled = true;
+    ilog("Compiled render graph with %lu of %lu passes and %lu barriers", rg->order.size, rg->passes.size, rg->barriers.size);
+    return err_code::RG_NO_ERROR;
+}
+
+intern uvec2 resource_size(const rg_resource *res, const vkr_context *vk)
+{
+    if (res->swapchain || (res->size.x == 0 && res->size.y == 0)) {
+        return {vk->inst.device.swapchain.extent.width, vk->inst.device.swapchain.extent.height};
+    }
+    return res->size;
+}
+
+intern bool lifetimes_overlap(const rg_resource *a, const rg_resource *b)
+{
+    return a->first_use <= b->last_use && b->first_use <= a->last_use;
+}
+
+// Greedily put each image (largest first) in the first block whose images are all used at other times and which shares
+// a memory type with it - the block grows to fit
+intern int assign_memory_blocks(render_graph *rg, const array<VkMemoryRequirements> *reqs, mem_arena *arena)
+{
+    array<u32> sorted{};
+    arr_init(&sorted, arena);
+    for (u32 ri = 0; ri < rg->resources.size; ++ri) {
+        if (!rg->resources[ri].swapchain && is_valid(rg->resources[ri].first_use)) {
+            arr_push_back(&sorted, ri);
+        }
+    }
+    std::sort(sorted.data, sorted.data + sorted.size, [reqs](u32 a, u32 b) { return (*reqs)[a].size > (*reqs)[b].size; });
+
+    for (sizet si = 0; si < sorted.size; ++si) {
+        auto res = &rg->resources[sorted[si]];
+        auto req = &(*reqs)[sorted[si]];
+        for (u32 bi = 0; bi < rg->blocks.size && !is_valid(res->block); ++bi) {
+            auto block = &rg->blocks[bi];
+            if ((block->reqs.memoryTypeBits & req->memoryTypeBits) == 0) {
+                continue;
+            }
+            bool fits = true;
+            for (sizet oi = 0; oi < si && fits; ++oi) {
+                auto other = &rg->resources[sorted[oi]];
+                fits = other->block != bi || !lifetimes_overlap(res, other);
+            }
+            if (fits) {
+                res->block = bi;
+                block->reqs.size = std::max(block->reqs.size, req->size);
+                block->reqs.alignment = std::max(block->reqs.alignment, req->alignment);
+                block->reqs.memoryTypeBits &= req->memoryTypeBits;
+            }
+        }
+        if (!is_valid(res->block)) {
+            res->block = (u32)rg->blocks.size;
+            arr_push_back(&rg->blocks, rg_memory_block{*req, nullptr});
+        }
+    }
+    arr_terminate(&sorted);
+    return err_code::RG_NO_ERROR;
+}
+
+intern int init_transient_images(render_graph *rg, vkr_context *vk)
+{
+    auto dev = &vk->inst.device;
+    auto arena = vk->cfg.arenas.command_arena;
+    array<VkMemoryRequirements> reqs{};
+    arr_init(&reqs, arena);
+    arr_resize(&reqs, rg->resources.size);
+
+    int err = err_code::RG_NO_ERROR;
+    for (u32 ri = 0; ri < rg->resources.size && err == err_code::RG_NO_ERROR; ++ri) {
+        auto res = &rg->resources[ri];
+        if (res->swapchain || !is_valid(res->first_use)) {
+            continue;
+        }
+        uvec2 sz = resource_size(res, vk);
+
+        VkImageCreateInfo cinfo{};
+        cinfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        cinfo.imageType = VK_IMAGE_TYPE_2D;
+        cinfo.extent = {sz.x, sz.y, 1};
+        cinfo.mipLevels = 1;
+        cinfo.arrayLayers = 1;
+        cinfo.format = res->format;
+        cinfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        cinfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        cinfo.usage = res->usage;
+        cinfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        cinfo.samples = VK_SAMPLE_COUNT_1_BIT;
+
+        res->img.image = {};
+        res->img.image.format = res->format;
+        res->img.image.dims = {sz.x, sz.y, 1};
+        res->img.image.vma_alloc = &dev->vma_alloc;
+        int vkerr = vkCreateImage(dev->hndl, &cinfo, &vk->alloc_cbs, &res->img.image.hndl);
+        if (vkerr != VK_SUCCESS) {
+            elog("Failed to create render graph image %s with vk err %d", str_cstr(res->id.str), vkerr);
+            err = err_code::RG_CREATE_IMAGE_FAIL;
+            break;
+        }
+        vkGetImageMemoryRequirements(dev->hndl, res->img.image.hndl, &reqs[ri]);
+        res->block = INVALID_ID;
+    }
+
+    if (err == err_code::RG_NO_ERROR) {
+        err = assign_memory_blocks(rg, &reqs, arena);
+    }
+
+    for (u32 bi = 0; bi < rg->blocks.size && err == err_code::RG_NO_ERROR; ++bi) {
+        auto block = &rg->blocks[bi];
+        if (block->reqs.memoryTypeBits == 0) {
+            elog("No memory type fits all of the render graph images in block %u", bi);
+            err = err_code::RG_NO_COMPATIBLE_MEMORY;
+            break;
+        }
+        VmaAllocationCreateInfo alloc_info{};
+        alloc_info.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        int vkerr = vmaAllocateMemory(dev->vma_alloc.hndl, &block->reqs, &alloc_info, &block->alloc, nullptr);
+        if (vkerr != VK_SUCCESS) {
+            elog("Failed to allocate %lu bytes for render graph images with vk err %d", block->reqs.size, vkerr);
+            err = err_code::RG_ALLOC_TRANSIENT_MEMORY_FAIL;
+        }
+    }
+
+    sizet aliased = 0;
+    for (u32 ri = 0; ri < rg->resources.size && err == err_code::RG_NO_ERROR; ++ri) {
+        auto res = &rg->resources[ri];
+        if (res->swapchain || !is_valid(res->first_use)) {
+            continue;
+        }
+        aliased += reqs[ri].size;
+        int vkerr = vmaBindImageMemory(dev->vma_alloc.hndl, rg->blocks[res->block].alloc, res->img.image.hndl);
+        if (vkerr != VK_SUCCESS) {
+            elog("Failed to bind render graph image %s memory with vk err %d", str_cstr(res->id.str), vkerr);
+            err = err_code::RG_BIND_IMAGE_MEMORY_FAIL;
+            break;
+        }
+
+        vkr_image_view_cfg imv_cfg{};
+        imv_cfg.srange.aspectMask = res->aspect;
+        imv_cfg.image = &res->img.image;
+        if (vkr_init_image_view(&res->img.view, &imv_cfg, vk) != err_code::VKR_NO_ERROR) {
+            elog("Failed to create render graph image %s view", str_cstr(res->id.str));
+            err = err_code::RG_CREATE_IMAGE_VIEW_FAIL;
+        }
+    }
+
+    if (err == err_code::RG_NO_ERROR) {
+        sizet total = 0;
+        for (sizet bi = 0; bi < rg->blocks.size; ++bi) {
+            total += rg->blocks[bi].reqs.size;
+        }
+        ilog("Render graph images take %lu bytes in %lu blocks (%lu bytes without aliasing)", total, rg->blocks.size, aliased);
+    }
+    arr_terminate(&reqs);
+    return err;
+}
+
+intern int init_pass_framebuffers(render_graph *rg, rg_pass *pass, vkr_context *vk)
+{
+    auto dev = &vk->inst.device;
+    sizet fb_count = pass->uses_swapchain ? dev->swapchain.image_views.size : 1;
+    asrt(fb_count <= RG_MAX_SWAPCHAIN_IMAGES);
+
+    // The slots are kept when the resources are terminated so they can be reused unless there are more swapchain
+    // images than before
+    if (!is_valid(pass->fb_ind) || pass->fb_count < fb_count) {
+        pass->fb_ind = vkr_add_framebuffer(dev);
+        for (sizet i = 1; i < fb_count; ++i) {
+            vkr_add_framebuffer(dev);
+        }
+    }
+    pass->fb_count = fb_count;
+
+    for (sizet fbi = 0; fbi < fb_count; ++fbi) {
+        static_array<vkr_framebuffer_attachment, RG_MAX_PASS_ACCESSES> atts{};
+        uvec2 size{};
+        for (sizet ai = 0; ai < pass->accesses.size; ++ai) {
+            auto acc = &pass->accesses[ai];
+            if (!ACCESS_INFO[acc->type].attachment) {
+                continue;
+            }
+            auto res = &rg->resources[acc->resource];
+            uvec2 res_size = resource_size(res, vk);
+            if (atts.size > 0 && res_size != size) {
+                elog("Render graph pass %s attachments are not all the same size", str_cstr(pass->id.str));
+                return err_code::RG_ATTACHMENT_SIZE_MISMATCH;
+            }
+            size = res_size;
+
+            vkr_framebuffer_attachment att{};
+            att.iview = res->swapchain ? dev->swapchain.image_views[fbi] : res->img.view;
+            att.cv = acc->clear;
+            arr_push_back(&atts, att);
+        }
+
+        vkr_framebuffer_cfg cfg{};
+        cfg.size = size;
+        cfg.rpass = &dev->render_passes[pass->rpind];
+        cfg.attachments = atts.data;
+        cfg.attachment_count = (u32)atts.size;
+        int err = vkr_init_framebuffer(&dev->framebuffers[pass->fb_ind + fbi], &cfg, vk);
+        if (err != err_code::VKR_NO_ERROR) {
+            elog("Failed to create framebuffer %lu for render graph pass %s with err %d", fbi, str_cstr(pass->id.str), err);
+            return err_code::RG_CREATE_FRAMEBUFFER_FAIL;
+        }
+    }
+    return err_code::RG_NO_ERROR;
+}
+
+int rg_init_resources(render_graph *rg, vkr_context *vk)
+{
+    asrt(rg->compiled);
+    int err = init_transient_images(rg, vk);
+    if (err != err_code::RG_NO_ERROR) {
+        return err;
+    }
+    for (u32 oi = 0; oi < rg->order.size; ++oi) {
+        auto pass = &rg->passes[rg->order[oi]];
+        if (is_valid(pass->rpind)) {
+            err = init_pass_framebuffers(rg, pass, vk);
+            if (err != err_code::RG_NO_ERROR) {
+                return err;
+            }
+        }
+    }
+    return err_code::RG_NO_ERROR;
+}
+
+void rg_terminate_resources(render_graph *rg, vkr_context *vk)
+{
+    auto dev = &vk->inst.device;
+    for (sizet pi = 0; pi < rg->passes.size; ++pi) {
+        auto pass = &rg->passes[pi];
+        if (!is_valid(pass->fb_ind)) {
+            continue;
+        }
+        for (sizet fbi = 0; fbi < pass->fb_count; ++fbi) {
+            vkr_terminate_framebuffer(&dev->framebuffers[pass->fb_ind + fbi], vk);
+            dev->framebuffers[pass->fb_ind + fbi] = {};
+        }
+    }
+
+    for (sizet ri = 0; ri < rg->resources.size; ++ri) {
+        auto res = &rg->resources[ri];
+        if (res->img.view.hndl) {
+            vkr_terminate_image_view(&res->img.view);
+        }
+        if (res->img.image.hndl) {
+            vkDestroyImage(dev->hndl, res->img.image.hndl, &vk->alloc_cbs);
+        }
+        res->img = {};
+        res->block = INVALID_ID;
+    }
+
+    for (sizet bi = 0; bi < rg->blocks.size; ++bi) {
+        vmaFreeMemory(dev->vma_alloc.hndl, rg->blocks[bi].alloc);
+    }
+    arr_clear(&rg->blocks);
+}
+
+const vkr_framebuffer *rg_get_framebuffer(const render_graph *rg, const vkr_device *dev, u32 pass, u32 swapchain_im_ind)
+{
+    auto p = &rg->passes[pass];
+    asrt(is_valid(p->fb_ind));
+    return &dev->framebuffers[p->fb_ind + (p->uses_swapchain ? swapchain_im_ind : 0)];
+}
+
+intern void record_barrier_batch(const render_graph *rg, const vkr_device *dev, const vkr_command_buffer *cmd_buf, const rg_barrier_batch *batch, u32 swapchain_im_ind)
+{
+    if (batch->count == 0) {
+        return;
+    }
+
+    static_array<VkImageMemoryBarrier, RG_MAX_PASS_ACCESSES> vk_bars{};
+    for (u32 i = 0; i < batch->count; ++i) {
+        auto bar = &rg->barriers[batch->first + i];
+        auto res = &rg->resources[bar->resource];
+        VkImageMemoryBarrier ib{};
+        ib.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        ib.oldLayout = bar->old_layout;
+        ib.newLayout = bar->new_layout;
+        ib.srcAccessMask = bar->src_access;
+        ib.dstAccessMask = bar->dst_access;
+        ib.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        ib.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        ib.image = res->swapchain ? dev->swapchain.images[swapchain_im_ind].hndl : res->img.image.hndl;
+        ib.subresourceRange = {res->aspect, 0, 1, 0, 1};
+        arr_push_back(&vk_bars, ib);
+    }
+    vkCmdPipelineBarrier(cmd_buf->hndl, batch->src_stages, batch->dst_stages, 0, 0, nullptr, 0, nullptr, (u32)vk_bars.size, vk_bars.data);
+}
+
+void rg_record_pass_barriers(const render_graph *rg, const vkr_device *dev, const vkr_command_buffer *cmd_buf, u32 pass, u32 swapchain_im_ind)
+{
+    record_barrier_batch(rg, dev, cmd_buf, &rg->passes[pass].barriers, swapchain_im_ind);
+}
+
+void rg_record_final_barriers(const render_graph *rg, const vkr_device *dev, const vkr_command_buffer *cmd_buf, u32 swapchain_im_ind)
+{
+    record_barrier_batch(rg, dev, cmd_buf, &rg->final_barriers, swapchain_im_ind);
+}
+
+} // namespace nslib
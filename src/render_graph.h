@@ -0,0 +1,195 @@
+#pragma once
+
+#include "vk_context.h"
+
+namespace nslib
+{
+
+namespace err_code
+{
+enum render_graph
+{
+    RG_NO_ERROR,
+    RG_CYCLE,
+    RG_ATTACHMENT_SIZE_MISMATCH,
+    RG_NO_COMPATIBLE_MEMORY,
+    RG_CREATE_RENDER_PASS_FAIL,
+    RG_CREATE_IMAGE_FAIL,
+    RG_ALLOC_TRANSIENT_MEMORY_FAIL,
+    RG_BIND_IMAGE_MEMORY_FAIL,
+    RG_CREATE_IMAGE_VIEW_FAIL,
+    RG_CREATE_FRAMEBUFFER_FAIL
+};
+}
+
+inline constexpr sizet RG_MAX_PASS_ACCESSES = 16;
+inline constexpr sizet RG_MAX_SWAPCHAIN_IMAGES = 8;
+
+// How a pass uses an image - each maps to the layout, stages and access flags the image must be in for the pass
+enum rg_access_type : u32
+{
+    RG_ACCESS_COLOR_ATTACHMENT,
+    RG_ACCESS_DEPTH_ATTACHMENT,
+    // Depth tested but not written
+    RG_ACCESS_DEPTH_READ,
+    // Sampled in the fragment or compute shader
+    RG_ACCESS_SAMPLED,
+    RG_ACCESS_STORAGE_READ,
+    RG_ACCESS_STORAGE_WRITE,
+    RG_ACCESS_TRANSFER_SRC,
+    RG_ACCESS_TRANSFER_DST,
+    RG_ACCESS_TYPE_COUNT
+};
+
+struct rg_access_info
+{
+    VkImageLayout layout;
+    VkPipelineStageFlags stages;
+    VkAccessFlags access;
+    VkImageUsageFlags usage;
+    b32 write;
+    b32 attachment;
+};
+
+struct rg_pass_access
+{
+    u32 resource;
+    rg_access_type type;
+    // Only used for attachments - LOAD keeps what earlier passes wrote, which makes the pass depend on them
+    VkAttachmentLoadOp load_op;
+    VkClearValue clear;
+};
+
+struct rg_image
+{
+    vkr_image image;
+    vkr_image_view view;
+};
+
+struct rg_resource
+{
+    rid id;
+    VkFormat format;
+    VkImageAspectFlags aspect;
+    // Zero tracks the swapchain extent
+    uvec2 size;
+    // The swapchain image - the graph doesn't own it, and transitions it to present at the end of the graph
+    b32 swapchain;
+    // How the swapchain image is used after the graph in place of present - RG_ACCESS_TYPE_COUNT is present
+    rg_access_type final_access{RG_ACCESS_TYPE_COUNT};
+
+    // Set by rg_compile
+    VkImageUsageFlags usage;
+    u32 first_use{INVALID_ID};
+    u32 last_use{INVALID_ID};
+
+    // Set by rg_init_resources
+    rg_image img;
+    u32 block{INVALID_ID};
+};
+
+// Image barriers recorded together before a pass (or after the last one)
+struct rg_barrier_batch
+{
+    u32 first;
+    u32 count;
+    VkPipelineStageFlags src_stages;
+    VkPipelineStageFlags dst_stages;
+};
+
+struct rg_barrier
+{
+    u32 resource;
+    VkImageLayout old_layout;
+    VkImageLayout new_layout;
+    VkAccessFlags src_access;
+    VkAccessFlags dst_access;
+};
+
+struct rg_pass
+{
+    rid id;
+    static_array<rg_pass_access, RG_MAX_PASS_ACCESSES> accesses;
+    // Kept even if nothing reads what it writes
+    b32 side_effects;
+
+    // Set by rg_compile
+    b32 culled;
+    rg_barrier_batch barriers;
+    // Passes with attachments get a render pass with the attachments in access order - pipelines drawn in the pass are
+    // created against it
+    sizet rpind{INVALID_IND};
+    static_array<VkClearValue, RG_MAX_PASS_ACCESSES> clear_vals;
+    b32 uses_swapchain;
+
+    // Set by rg_init_resources - one framebuffer per swapchain image if the pass draws to the swapchain
+    sizet fb_ind{INVALID_IND};
+    sizet fb_count;
+};
+
+// One allocation shared by transient images whose lifetimes don't overlap
+struct rg_memory_block
+{
+    VkMemoryRequirements reqs;
+    VmaAllocation alloc;
+};
+
+// Passes declare the images they read and write, and rg_compile works out the rest: the passes are ordered so every
+// pass runs after the passes writing what it reads, passes whose results are never used are culled, and the layout
+// transitions and barriers between passes are derived from how each image was last used - reads following reads in
+// the same layout need none. Transient images are only used within a frame so images whose first to last use don't
+// overlap share memory.
+struct render_graph
+{
+    array<rg_resource> resources;
+    array<rg_pass> passes;
+
+    // Set by rg_compile - pass indices in execution order with culled passes left out
+    array<u32> order;
+    array<rg_barrier> barriers;
+    // Transitions the swapchain image for present (or its final access) after the last pass
+    rg_barrier_batch final_barriers;
+    b32 compiled;
+
+    array<rg_memory_block> blocks;
+};
+
+void init_render_graph(render_graph *rg, mem_arena *arena);
+// Terminates the resources as well - render passes are left for the device to clean up
+void terminate_render_graph(render_graph *rg, vkr_context *vk);
+
+// Add a transient image - a zero size is the swapchain extent
+u32 rg_add_image(render_graph *rg, const rid &id, VkFormat format, VkImageAspectFlags aspect, const uvec2 &size = {});
+// Final access is how the image is used after the last pass - left as RG_ACCESS_TYPE_COUNT the image is transitioned
+// for present. Offscreen swapchain images that are read back use RG_ACCESS_TRANSFER_SRC.
+u32 rg_add_swapchain_image(render_graph *rg, const rid &id, VkFormat format, rg_access_type final_access = RG_ACCESS_TYPE_COUNT);
+u32 rg_add_pass(render_graph *rg, const rid &id, bool side_effects = false);
+
+void rg_pass_write(render_graph *rg,
+                   u32 pass,
+                   u32 resource,
+                   rg_access_type type,
+                   VkAttachmentLoadOp load_op = VK_ATTACHMENT_LOAD_OP_CLEAR,
+                   const VkClearValue &clear = {});
+void rg_pass_read(render_graph *rg, u32 pass, u32 resource, rg_access_type type);
+
+u32 rg_find_pass(const render_graph *rg, const rid &id);
+u32 rg_find_resource(const render_graph *rg, const rid &id);
+const rg_access_info *rg_get_access_info(rg_access_type type);
+
+// Order and cull the passes, derive the barriers, and create the render passes. Can only be done once.
+int rg_compile(render_graph *rg, vkr_context *vk);
+
+// Create the transient images (aliased where possible) and the framebuffers - call again after
+// rg_terminate_resources when the swapchain is recreated
+int rg_init_resources(render_graph *rg, vkr_context *vk);
+void rg_terminate_resources(render_graph *rg, vkr_context *vk);
+
+const vkr_framebuffer *rg_get_framebuffer(const render_graph *rg, const vkr_device *dev, u32 pass, u32 swapchain_im_ind);
+
+// Record the barriers needed before the pass - outside of any render pass
+void rg_record_pass_barriers(const render_graph *rg, const vkr_device *dev, const vkr_command_buffer *cmd_buf, u32 pass, u32 swapchain_im_ind);
+// Record the barriers needed after the last pass
+void rg_record_final_barriers(const render_graph *rg, const vkr_device *dev, const vkr_command_buffer *cmd_buf, u32 swapchain_im_ind);
+
+} // namespace nslib
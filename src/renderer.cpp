@@ -3,6 +3,7 @@
 #include "containers/linked_list.h"
 #include "stb_image.h"
 #include "platform.h"
+#include "profile_timer.h"
 #include "vk_context.h"
 #include "renderer.h"
 
@@ -11,6 +12,9 @@
 #include "imgui/imgui_impl_vulkan.h"
 #include "SDL3/SDL_events.h"
 
+#include <algorithm>
+#include <bit>
+
 namespace nslib
 {
 
@@ -36,9 +40,14 @@ intern constexpr const char *ADDITIONAL_INST_EXTENSIONS[ADDITIONAL_INST_EXTENSIO
 intern constexpr u32 DEVICE_EXTENSION_COUNT = 1;
 intern constexpr const char *DEVICE_EXTENSIONS[DEVICE_EXTENSION_COUNT] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
 #endif
+// Headless devices don't present - the swapchain extension is first in the device extensions so they skip it
+intern const char *const *HEADLESS_DEVICE_EXTENSIONS = DEVICE_EXTENSIONS + 1;
+intern constexpr u32 HEADLESS_DEVICE_EXTENSION_COUNT = DEVICE_EXTENSION_COUNT - 1;
 
 intern constexpr f64 RESIZE_DEBOUNCE_FRAME_COUNT = 0.15; // 100 ms
 intern VkPipelineLayout G_FRAME_PL_LAYOUT{};
+// Occlusion tiles rasterized per job - enough that a job outweighs handing it out
+intern constexpr u32 OCC_TILES_PER_JOB = 8;
 
 enum descriptor_set_layout
 {
@@ -54,47 +63,32 @@ enum descriptor_set_binding
     DESCRIPTOR_SET_BINDING_IMAGE_SAMPLER,
 };
 
-enum draw_call_flags
-{
-    DRAW_CALL_FLAG_NONE = 0,
-    DRAW_CALL_FLAG_HIDDEN = 1 << 0,
-};
-
-struct draw_call
+// With bindless materials the material set holds every material's parameters and every texture
+enum bindless_descriptor_set_binding
 {
-    u32 index_count;
-    u32 instance_count;
-    u32 first_index;
-    u32 vertex_offset;
-    u32 first_instance;
-    u32 flags{};
-    sizet ubo_offset;
+    BINDLESS_DESCRIPTOR_SET_BINDING_MATERIALS,
+    BINDLESS_DESCRIPTOR_SET_BINDING_TEXTURES,
 };
 
-struct material_draw_group
+// The object set holds storage buffers instead - all object transforms, and the transform index of each instance drawn
+// this frame
+enum obj_descriptor_set_binding
 {
-    const material_info *mi;
-    sizet set_layouti;
-    array<draw_call> dcs;
+    OBJ_DESCRIPTOR_SET_BINDING_TRANSFORMS,
+    OBJ_DESCRIPTOR_SET_BINDING_INSTANCES,
 };
 
-struct pipeline_draw_group
+// The GPU cull compute pass reads the candidates and writes the indirect draw instance counts and the instance buffer
+enum gpu_cull_descriptor_set_binding
 {
-    const pipeline_info *plinfo;
-    // Not to be conused with the set index in the descriptor set layout, this is the index of the descriptor set struct
-    // that should be bound during draw - ie
-    sizet set_layouti;
-    hmap<rid, material_draw_group *> mats;
+    GPU_CULL_DESCRIPTOR_SET_BINDING_CANDIDATES,
+    GPU_CULL_DESCRIPTOR_SET_BINDING_DRAW_COMMANDS,
+    GPU_CULL_DESCRIPTOR_SET_BINDING_INSTANCES,
+    GPU_CULL_DESCRIPTOR_SET_BINDING_COUNT
 };
 
-struct render_pass_draw_group
-{
-    const rpass_info *rpinfo;
-    sizet frame_set_layouti{INVALID_IND};
-    sizet obj_set_layouti{INVALID_IND};
-    array<VkDescriptorSetLayout> set_layouts;
-    hmap<rid, pipeline_draw_group *> plines;
-};
+// Must match the local size in the cull shader
+intern constexpr u32 GPU_CULL_GROUP_SIZE = 64;
 
 intern void imgui_mem_free(void *ptr, void *usr)
 {
@@ -145,7 +139,13 @@ intern void init_imgui(renderer *rndr, void *win_hndl)
     rndr->imgui.ctxt = ImGui::CreateContext();
     ImGui::StyleColorsDark();
     auto &io = ImGui::GetIO();
-    io.FontGlobalScale = get_window_display_scale(win_hndl);
+    if (rndr->headless) {
+        // There is no platform backend to fill in the display size each frame
+        io.DisplaySize = {(f32)rndr->headless_size.x, (f32)rndr->headless_size.y};
+    }
+    else {
+        io.FontGlobalScale = get_window_display_scale(win_hndl);
+    }
 
     vkr_descriptor_cfg cfg{};
     cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER] = IMGUI_IMPL_VULKAN_MINIMUM_IMAGE_SAMPLER_POOL_SIZE;
@@ -154,7 +154,9 @@ intern void init_imgui(renderer *rndr, void *win_hndl)
         wlog("Could not create imgui descriptor pool");
     }
 
-    ImGui_ImplSDL3_InitForVulkan((SDL_Window *)rndr->vk.cfg.window);
+    if (!rndr->headless) {
+        ImGui_ImplSDL3_InitForVulkan((SDL_Window *)rndr->vk.cfg.window);
+    }
 
     ImGui_ImplVulkan_InitInfo init_info = {};
     init_info.ApiVersion = VKR_API_VERSION;
@@ -178,87 +180,116 @@ intern void init_imgui(renderer *rndr, void *win_hndl)
         wlog("Could not create imgui vulkan font texture");
     }
 
-    set_platform_sdl_event_hook(win_hndl, {.cb = sdl_event_func});
+    if (!rndr->headless) {
+        set_platform_sdl_event_hook(win_hndl, {.cb = sdl_event_func});
+    }
 }
 
 intern void terminate_imgui(renderer *rndr)
 {
     ImGui_ImplVulkan_Shutdown();
     vkr_terminate_descriptor_pool(&rndr->imgui.pool, &rndr->vk);
-    ImGui_ImplSDL3_Shutdown();
+    if (!rndr->headless) {
+        ImGui_ImplSDL3_Shutdown();
+    }
     ImGui::DestroyContext(rndr->imgui.ctxt);
     mem_terminate_arena(&rndr->imgui.fl);
 }
 
-intern int setup_render_pass(renderer *rndr)
+// The frame is built as a render graph - passes declare the images they draw to and read, and the graph creates their
+// render passes and the barriers between them. There is only the forward pass drawing to the swapchain for now.
+intern int setup_render_graph(renderer *rndr)
 {
     auto vk = &rndr->vk;
-    vkr_rpass_cfg rp_cfg{};
-
-    VkAttachmentDescription att{};
-    att.format = vk->inst.device.swapchain.format;
-    att.samples = VK_SAMPLE_COUNT_1_BIT;
-    att.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    att.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
-    att.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
-    att.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
-    att.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-    att.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
-    arr_push_back(&rp_cfg.attachments, att);
-
-    att.format = vkr_find_best_depth_format(&rndr->vk.inst.pdev_info);
-    att.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
-    att.finalLayout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    arr_push_back(&rp_cfg.attachments, att);
-
-    vkr_rpass_cfg_subpass subpass{};
-
-    VkAttachmentReference att_ref{};
-    att_ref.attachment = 0;
-    att_ref.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
-    arr_push_back(&subpass.color_attachments, att_ref);
-
-    att_ref.attachment = 1;
-    att_ref.layout = VK_IMAGE_LAYOUT_DEPTH_STENCIL_ATTACHMENT_OPTIMAL;
-    subpass.depth_stencil_attachment = &att_ref;
-    arr_push_back(&rp_cfg.subpasses, subpass);
-
-    // Because we use this render pass each frame, this dependency makes it so that we won't begin our first subpass
-    // until all color attachment and depth attachment (early fragment tests) operations are done for any subpass
-    // (pipeline) associated with this render pass.
-    // Since the depth image isn't 'presented', we don't have to have a separate depth image across each FIF.
-    VkSubpassDependency sp_dep{};
-    sp_dep.srcSubpass = VK_SUBPASS_EXTERNAL;
-    sp_dep.srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    sp_dep.srcAccessMask = 0;
-    sp_dep.dstSubpass = 0;
-    sp_dep.dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT | VK_PIPELINE_STAGE_EARLY_FRAGMENT_TESTS_BIT;
-    sp_dep.dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT | VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT;
-    arr_push_back(&rp_cfg.subpass_dependencies, sp_dep);
-
-    rpass_info rpi{};
-    rpi.id = FWD_RPASS;
-    rpi.rpind = vkr_add_render_pass(&vk->inst.device, {});
-
-    int ret = vkr_init_render_pass(&vk->inst.device.render_passes[rpi.rpind], &rp_cfg, vk);
-    if (ret == err_code::VKR_NO_ERROR) {
+    auto rg = &rndr->rgraph;
+
+    // Headless frames end by copying the offscreen image to the readback buffer rather than presenting it
+    rg_access_type color_final = (rndr->headless && rndr->headless_readback) ? RG_ACCESS_TRANSFER_SRC : RG_ACCESS_TYPE_COUNT;
+    u32 color = rg_add_swapchain_image(rg, RG_SWAPCHAIN_IMAGE, vk->inst.device.swapchain.format, color_final);
+    u32 depth = rg_add_image(rg, RG_FWD_DEPTH_IMAGE, vkr_find_best_depth_format(&vk->inst.pdev_info), VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT);
+
+    u32 fwd = rg_add_pass(rg, FWD_RPASS);
+    rg_pass_write(rg, fwd, color, RG_ACCESS_COLOR_ATTACHMENT, VK_ATTACHMENT_LOAD_OP_CLEAR, {.color{{0.05f, 0.05f, 0.05f, 1.0f}}});
+    rg_pass_write(rg, fwd, depth, RG_ACCESS_DEPTH_ATTACHMENT, VK_ATTACHMENT_LOAD_OP_CLEAR, {.depthStencil{1.0f, 0}});
+
+    int ret = rg_compile(rg, vk);
+    if (ret != err_code::RG_NO_ERROR) {
+        return ret;
+    }
+
+    // Pipelines look up their render pass by id so every pass that got one is added to the render pass map
+    for (u32 oi = 0; oi < rg->order.size; ++oi) {
+        auto pass = &rg->passes[rg->order[oi]];
+        if (!is_valid(pass->rpind)) {
+            continue;
+        }
+        rpass_info rpi{};
+        rpi.id = pass->id;
+        rpi.rpind = pass->rpind;
+        rpi.rg_pass = rg->order[oi];
         ilog("Setting render pass %s", str_cstr(rpi.id.str));
         hmap_set(&rndr->rpasses, rpi.id, rpi);
     }
-    return ret;
+    return err_code::RG_NO_ERROR;
+}
+
+// The texture array is partially bound and update after bind so textures uploaded later can be written in to unused
+// slots while the set is in use
+intern void fill_bindless_material_set_layout(vkr_descriptor_set_layout_desc *desc)
+{
+    VkDescriptorSetLayoutBinding b{};
+    b.binding = BINDLESS_DESCRIPTOR_SET_BINDING_MATERIALS;
+    b.descriptorCount = 1;
+    b.stageFlags = VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;
+    b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    arr_push_back(&desc->bindings, b);
+    arr_push_back(&desc->binding_flags, (VkDescriptorBindingFlags)0);
+
+    b.binding = BINDLESS_DESCRIPTOR_SET_BINDING_TEXTURES;
+    b.descriptorCount = MAX_BINDLESS_TEXTURE_COUNT;
+    b.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+    b.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+    arr_push_back(&desc->bindings, b);
+    arr_push_back(&desc->binding_flags,
+                  (VkDescriptorBindingFlags)(VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT |
+                                             VK_DESCRIPTOR_BINDING_UPDATE_UNUSED_WHILE_PENDING_BIT));
+    desc->flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+}
+
+intern bool bindless_supported(const vkr_phys_device *pdev)
+{
+    auto f = &pdev->features12;
+    return f->descriptorIndexing && f->runtimeDescriptorArray && f->descriptorBindingPartiallyBound &&
+           f->descriptorBindingSampledImageUpdateAfterBind && f->descriptorBindingUpdateUnusedWhilePending &&
+           f->shaderSampledImageArrayNonUniformIndexing;
 }
 
-intern int setup_diffuse_mat_pipeline(renderer *rndr)
+// A graphics pipeline filled in on the main thread and created on the job pool
+struct pipeline_create_job
+{
+    vkr_pipeline_cfg cfg;
+    pipeline_info plinfo;
+    int err;
+};
+
+struct pipeline_create_ctxt
+{
+    renderer *rndr;
+    pipeline_create_job *jobs;
+};
+
+// Fill in the job for the pipeline - it is created along with the others in create_pipelines
+intern int setup_diffuse_mat_pipeline(renderer *rndr, pipeline_create_job *job)
 {
     auto vk = &rndr->vk;
-    vkr_pipeline_cfg info{};
+    auto info = &job->cfg;
 
-    arr_push_back(&info.dynamic_states, VK_DYNAMIC_STATE_VIEWPORT);
-    arr_push_back(&info.dynamic_states, VK_DYNAMIC_STATE_SCISSOR);
+    arr_push_back(&info->dynamic_states, VK_DYNAMIC_STATE_VIEWPORT);
+    arr_push_back(&info->dynamic_states, VK_DYNAMIC_STATE_SCISSOR);
 
     // Descripitor Set Layouts - Just one layout for the moment with a binding at 0 for uniforms and a binding at 1 for
     // image sampler
-    info.set_layouts.size = 4;
+    info->set_layouts.size = 4;
 
     // Descriptor layouts
     // Single Uniform buffer
@@ -269,32 +300,42 @@ intern int setup_diffuse_mat_pipeline(renderer *rndr)
     b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
     // Add uniform buffer binding to each set, and image sampler to material set as well
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_FRAME].bindings, b);
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_PIPELINE].bindings, b);
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL].bindings, b);
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_FRAME].bindings, b);
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_PIPELINE].bindings, b);
+    if (rndr->bindless) {
+        fill_bindless_material_set_layout(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL]);
+    }
+    else {
+        arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL].bindings, b);
+    }
 
-    // Change descriptor type to dynamic descriptor for object - we bind it with an offset for each object
-    b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT].bindings, b);
+    // Object set is the transform and instance storage buffers - instances look up their transform by instance index
+    b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    b.binding = OBJ_DESCRIPTOR_SET_BINDING_TRANSFORMS;
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT].bindings, b);
+    b.binding = OBJ_DESCRIPTOR_SET_BINDING_INSTANCES;
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT].bindings, b);
 
     // Add image sampler to material
-    b.binding = DESCRIPTOR_SET_BINDING_IMAGE_SAMPLER;
-    b.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
-    b.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL].bindings, b);
+    if (!rndr->bindless) {
+        b.binding = DESCRIPTOR_SET_BINDING_IMAGE_SAMPLER;
+        b.stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT;
+        b.descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL].bindings, b);
+    }
 
     // Setup our push constant
-    ++info.push_constant_ranges.size;
-    info.push_constant_ranges[0].offset = 0;
-    info.push_constant_ranges[0].size = sizeof(push_constants);
-    info.push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    ++info->push_constant_ranges.size;
+    info->push_constant_ranges[0].offset = 0;
+    info->push_constant_ranges[0].size = sizeof(push_constants);
+    info->push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     // Vertex binding:
     VkVertexInputBindingDescription binding_desc{};
     binding_desc.binding = 0;
     binding_desc.stride = sizeof(vertex);
     binding_desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    arr_push_back(&info.vert_binding_desc, binding_desc);
+    arr_push_back(&info->vert_binding_desc, binding_desc);
 
     // Attribute Descriptions - so far we just have three
     VkVertexInputAttributeDescription attrib_desc{};
@@ -302,19 +343,19 @@ intern int setup_diffuse_mat_pipeline(renderer *rndr)
     attrib_desc.location = 0;
     attrib_desc.format = VK_FORMAT_R32G32B32_SFLOAT;
     attrib_desc.offset = offsetof(vertex, pos);
-    arr_push_back(&info.vert_attrib_desc, attrib_desc);
+    arr_push_back(&info->vert_attrib_desc, attrib_desc);
 
     attrib_desc.binding = 0;
     attrib_desc.location = 1;
     attrib_desc.format = VK_FORMAT_R32G32_SFLOAT;
     attrib_desc.offset = offsetof(vertex, tc);
-    arr_push_back(&info.vert_attrib_desc, attrib_desc);
+    arr_push_back(&info->vert_attrib_desc, attrib_desc);
 
     attrib_desc.binding = 0;
     attrib_desc.location = 2;
     attrib_desc.format = VK_FORMAT_R8G8B8A8_UINT;
     attrib_desc.offset = offsetof(vertex, color);
-    arr_push_back(&info.vert_attrib_desc, attrib_desc);
+    arr_push_back(&info->vert_attrib_desc, attrib_desc);
 
     // Viewports and scissors
     VkViewport viewport{};
@@ -324,28 +365,28 @@ intern int setup_diffuse_mat_pipeline(renderer *rndr)
     viewport.height = (float)vk->inst.device.swapchain.extent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
-    arr_push_back(&info.viewports, viewport);
+    arr_push_back(&info->viewports, viewport);
 
     VkRect2D scissor{};
     scissor.offset = {0, 0};
     scissor.extent = vk->inst.device.swapchain.extent;
-    arr_push_back(&info.scissors, scissor);
+    arr_push_back(&info->scissors, scissor);
 
     // Input Assembly
-    info.input_assembly.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    info.input_assembly.primitive_restart_enable = false;
+    info->input_assembly.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    info->input_assembly.primitive_restart_enable = false;
 
     // Raster options
-    info.raster.depth_clamp_enable = false;
-    info.raster.rasterizer_discard_enable = false;
-    info.raster.polygon_mode = VK_POLYGON_MODE_FILL;
-    info.raster.line_width = 1.0f;
-    info.raster.cull_mode = VK_CULL_MODE_NONE;
-    info.raster.front_face = VK_FRONT_FACE_CLOCKWISE;
-    info.raster.depth_bias_enable = false;
-    info.raster.depth_bias_constant_factor = 0.0f;
-    info.raster.depth_bias_clamp = 0.0f;
-    info.raster.depth_bias_slope_factor = 0.0f;
+    info->raster.depth_clamp_enable = false;
+    info->raster.rasterizer_discard_enable = false;
+    info->raster.polygon_mode = VK_POLYGON_MODE_FILL;
+    info->raster.line_width = 1.0f;
+    info->raster.cull_mode = VK_CULL_MODE_NONE;
+    info->raster.front_face = VK_FRONT_FACE_CLOCKWISE;
+    info->raster.depth_bias_enable = false;
+    info->raster.depth_bias_constant_factor = 0.0f;
+    info->raster.depth_bias_clamp = 0.0f;
+    info->raster.depth_bias_slope_factor = 0.0f;
 
     // Multisampling defaults are good
 
@@ -353,44 +394,39 @@ intern int setup_diffuse_mat_pipeline(renderer *rndr)
     VkPipelineColorBlendAttachmentState col_blnd_att{};
     col_blnd_att.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     col_blnd_att.blendEnable = false;
-    arr_push_back(&info.col_blend.attachments, col_blnd_att);
+    arr_push_back(&info->col_blend.attachments, col_blnd_att);
 
     // Depth Stencil
-    info.depth_stencil.depth_test_enable = true;
-    info.depth_stencil.depth_write_enable = true;
-    info.depth_stencil.depth_compare_op = VK_COMPARE_OP_LESS;
-    info.depth_stencil.depth_bounds_test_enable = false;
-    info.depth_stencil.min_depth_bounds = 0.0f;
-    info.depth_stencil.max_depth_bounds = 1.0f;
+    info->depth_stencil.depth_test_enable = true;
+    info->depth_stencil.depth_write_enable = true;
+    info->depth_stencil.depth_compare_op = VK_COMPARE_OP_LESS;
+    info->depth_stencil.depth_bounds_test_enable = false;
+    info->depth_stencil.min_depth_bounds = 0.0f;
+    info->depth_stencil.max_depth_bounds = 1.0f;
 
     // Our basic shaders
     const char *fnames[] = {"data/shaders/fwd-diffuse.vert.spv", "data/shaders/fwd-diffuse.frag.spv"};
+    if (rndr->bindless) {
+        fnames[VKR_SHADER_STAGE_VERT] = "data/shaders/fwd-diffuse-bindless.vert.spv";
+        fnames[VKR_SHADER_STAGE_FRAG] = "data/shaders/fwd-diffuse-bindless.frag.spv";
+    }
     for (int i = 0; i <= VKR_SHADER_STAGE_FRAG; ++i) {
         platform_file_err_desc err{};
-        arr_init(&info.shader_stages[i].code, &rndr->vk_frame_linear);
-        read_file(fnames[i], &info.shader_stages[i].code, 0, &err);
+        arr_init(&info->shader_stages[i].code, &rndr->vk_frame_linear);
+        read_file(fnames[i], &info->shader_stages[i].code, 0, &err);
         if (err.code != err_code::PLATFORM_NO_ERROR) {
             wlog("Error reading file %s from disk (code %d): %s", fnames[i], err.code, err.str);
             return err_code::RENDER_LOAD_SHADERS_FAIL;
         }
-        info.shader_stages[i].entry_point = "main";
+        info->shader_stages[i].entry_point = "main";
     }
 
     auto rpass_fiter = hmap_find(&rndr->rpasses, FWD_RPASS);
     if (rpass_fiter) {
-        info.rpass = &vk->inst.device.render_passes[rpass_fiter->val.rpind];
-        pipeline_info plinfo{};
-        plinfo.id = PLINE_FWD_RPASS_S0_OPAQUE_DIFFUSE;
-        plinfo.ubo_offset = rndr->pipelines.count;
-        plinfo.plind = vkr_add_pipeline(&vk->inst.device, {});
-        plinfo.rpass_id = rpass_fiter->val.id;
-        int code = vkr_init_pipeline(&vk->inst.device.pipelines[plinfo.plind], &info, vk);
-        if (code == err_code::VKR_NO_ERROR) {
-            hmap_set(&rndr->pipelines, plinfo.id, plinfo);
-            // Set our global frame layout
-            G_FRAME_PL_LAYOUT = vk->inst.device.pipelines[plinfo.plind].layout_hndl;
-        }
-        return code;
+        info->rpass = &vk->inst.device.render_passes[rpass_fiter->val.rpind];
+        job->plinfo.id = PLINE_FWD_RPASS_S0_OPAQUE_DIFFUSE;
+        job->plinfo.rpass_id = rpass_fiter->val.id;
+        return err_code::VKR_NO_ERROR;
     }
     else {
         elog("Failed to find render pass %s", str_cstr(FWD_RPASS.str));
@@ -398,17 +434,18 @@ intern int setup_diffuse_mat_pipeline(renderer *rndr)
     return err_code::RENDER_INIT_FAIL;
 }
 
-intern int setup_color_mat_pipeline(renderer *rndr)
+// Fill in the job for the pipeline - it is created along with the others in create_pipelines
+intern int setup_color_mat_pipeline(renderer *rndr, pipeline_create_job *job)
 {
     auto vk = &rndr->vk;
-    vkr_pipeline_cfg info{};
+    auto info = &job->cfg;
 
-    arr_push_back(&info.dynamic_states, VK_DYNAMIC_STATE_VIEWPORT);
-    arr_push_back(&info.dynamic_states, VK_DYNAMIC_STATE_SCISSOR);
+    arr_push_back(&info->dynamic_states, VK_DYNAMIC_STATE_VIEWPORT);
+    arr_push_back(&info->dynamic_states, VK_DYNAMIC_STATE_SCISSOR);
 
     // Descripitor Set Layouts - Just one layout for the moment with a binding at 0 for uniforms and a binding at 1 for
     // image sampler
-    info.set_layouts.size = 4;
+    info->set_layouts.size = 4;
 
     // Single Uniform buffer
     VkDescriptorSetLayoutBinding b{};
@@ -418,26 +455,34 @@ intern int setup_color_mat_pipeline(renderer *rndr)
     b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 
     // Add uniform buffer binding to each set
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_FRAME].bindings, b);
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_PIPELINE].bindings, b);
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL].bindings, b);
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_FRAME].bindings, b);
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_PIPELINE].bindings, b);
+    if (rndr->bindless) {
+        fill_bindless_material_set_layout(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL]);
+    }
+    else {
+        arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL].bindings, b);
+    }
 
-    // Change descriptor type to dynamic descriptor for object so we only are binding it once per frame
-    b.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
-    arr_push_back(&info.set_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT].bindings, b);
+    // Object set is the transform and instance storage buffers - instances look up their transform by instance index
+    b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    b.binding = OBJ_DESCRIPTOR_SET_BINDING_TRANSFORMS;
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT].bindings, b);
+    b.binding = OBJ_DESCRIPTOR_SET_BINDING_INSTANCES;
+    arr_push_back(&info->set_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT].bindings, b);
 
     // Setup our push constant
-    ++info.push_constant_ranges.size;
-    info.push_constant_ranges[0].offset = 0;
-    info.push_constant_ranges[0].size = sizeof(push_constants);
-    info.push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    ++info->push_constant_ranges.size;
+    info->push_constant_ranges[0].offset = 0;
+    info->push_constant_ranges[0].size = sizeof(push_constants);
+    info->push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
 
     // Vertex binding:
     VkVertexInputBindingDescription binding_desc{};
     binding_desc.binding = 0;
     binding_desc.stride = sizeof(vertex);
     binding_desc.inputRate = VK_VERTEX_INPUT_RATE_VERTEX;
-    arr_push_back(&info.vert_binding_desc, binding_desc);
+    arr_push_back(&info->vert_binding_desc, binding_desc);
 
     // Attribute Descriptions - so far we just have three
     VkVertexInputAttributeDescription attrib_desc{};
@@ -445,19 +490,19 @@ intern int setup_color_mat_pipeline(renderer *rndr)
     attrib_desc.location = 0;
     attrib_desc.format = VK_FORMAT_R32G32B32_SFLOAT;
     attrib_desc.offset = offsetof(vertex, pos);
-    arr_push_back(&info.vert_attrib_desc, attrib_desc);
+    arr_push_back(&info->vert_attrib_desc, attrib_desc);
 
     attrib_desc.binding = 0;
     attrib_desc.location = 1;
     attrib_desc.format = VK_FORMAT_R32G32_SFLOAT;
     attrib_desc.offset = offsetof(vertex, tc);
-    arr_push_back(&info.vert_attrib_desc, attrib_desc);
+    arr_push_back(&info->vert_attrib_desc, attrib_desc);
 
     attrib_desc.binding = 0;
     attrib_desc.location = 2;
     attrib_desc.format = VK_FORMAT_R8G8B8A8_UINT;
     attrib_desc.offset = offsetof(vertex, color);
-    arr_push_back(&info.vert_attrib_desc, attrib_desc);
+    arr_push_back(&info->vert_attrib_desc, attrib_desc);
 
     // Viewports and scissors
     VkViewport viewport{};
@@ -467,28 +512,28 @@ intern int setup_color_mat_pipeline(renderer *rndr)
     viewport.height = (float)vk->inst.device.swapchain.extent.height;
     viewport.minDepth = 0.0f;
     viewport.maxDepth = 1.0f;
-    arr_push_back(&info.viewports, viewport);
+    arr_push_back(&info->viewports, viewport);
 
     VkRect2D scissor{};
     scissor.offset = {0, 0};
     scissor.extent = vk->inst.device.swapchain.extent;
-    arr_push_back(&info.scissors, scissor);
+    arr_push_back(&info->scissors, scissor);
 
     // Input Assembly
-    info.input_assembly.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
-    info.input_assembly.primitive_restart_enable = false;
+    info->input_assembly.primitive_topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+    info->input_assembly.primitive_restart_enable = false;
 
     // Raster options
-    info.raster.depth_clamp_enable = false;
-    info.raster.rasterizer_discard_enable = false;
-    info.raster.polygon_mode = VK_POLYGON_MODE_FILL;
-    info.raster.line_width = 1.0f;
-    info.raster.cull_mode = VK_CULL_MODE_BACK_BIT;
-    info.raster.front_face = VK_FRONT_FACE_CLOCKWISE;
-    info.raster.depth_bias_enable = false;
-    info.raster.depth_bias_constant_factor = 0.0f;
-    info.raster.depth_bias_clamp = 0.0f;
-    info.raster.depth_bias_slope_factor = 0.0f;
+    info->raster.depth_clamp_enable = false;
+    info->raster.rasterizer_discard_enable = false;
+    info->raster.polygon_mode = VK_POLYGON_MODE_FILL;
+    info->raster.line_width = 1.0f;
+    info->raster.cull_mode = VK_CULL_MODE_BACK_BIT;
+    info->raster.front_face = VK_FRONT_FACE_CLOCKWISE;
+    info->raster.depth_bias_enable = false;
+    info->raster.depth_bias_constant_factor = 0.0f;
+    info->raster.depth_bias_clamp = 0.0f;
+    info->raster.depth_bias_slope_factor = 0.0f;
 
     // Multisampling defaults are good
 
@@ -496,7 +541,7 @@ intern int setup_color_mat_pipeline(renderer *rndr)
     VkPipelineColorBlendAttachmentState col_blnd_att{};
     col_blnd_att.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
     col_blnd_att.blendEnable = false;
-    arr_push_back(&info.col_blend.attachments, col_blnd_att);
+    arr_push_back(&info->col_blend.attachments, col_blnd_att);
 
     // This is to do alpha blending - leaving here until we create a pipeline that uses it
     // col_blnd_att.colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT |
@@ -508,41 +553,35 @@ intern int setup_color_mat_pipeline(renderer *rndr)
     // col_blnd_att.alphaBlendOp = VK_BLEND_OP_ADD;
 
     // Depth Stencil
-    info.depth_stencil.depth_test_enable = true;
-    info.depth_stencil.depth_write_enable = true;
-    info.depth_stencil.depth_compare_op = VK_COMPARE_OP_LESS;
-    info.depth_stencil.depth_bounds_test_enable = false;
-    info.depth_stencil.min_depth_bounds = 0.0f;
-    info.depth_stencil.max_depth_bounds = 1.0f;
+    info->depth_stencil.depth_test_enable = true;
+    info->depth_stencil.depth_write_enable = true;
+    info->depth_stencil.depth_compare_op = VK_COMPARE_OP_LESS;
+    info->depth_stencil.depth_bounds_test_enable = false;
+    info->depth_stencil.min_depth_bounds = 0.0f;
+    info->depth_stencil.max_depth_bounds = 1.0f;
 
     // Our basic shaders
     const char *fnames[] = {"data/shaders/fwd-color.vert.spv", "data/shaders/fwd-color.frag.spv"};
+    if (rndr->bindless) {
+        fnames[VKR_SHADER_STAGE_VERT] = "data/shaders/fwd-color-bindless.vert.spv";
+    }
     for (int i = 0; i <= VKR_SHADER_STAGE_FRAG; ++i) {
         platform_file_err_desc err{};
-        arr_init(&info.shader_stages[i].code, &rndr->vk_frame_linear);
-        read_file(fnames[i], &info.shader_stages[i].code, 0, &err);
+        arr_init(&info->shader_stages[i].code, &rndr->vk_frame_linear);
+        read_file(fnames[i], &info->shader_stages[i].code, 0, &err);
         if (err.code != err_code::PLATFORM_NO_ERROR) {
             wlog("Error reading file %s from disk (code %d): %s", fnames[i], err.code, err.str);
             return err_code::RENDER_LOAD_SHADERS_FAIL;
         }
-        info.shader_stages[i].entry_point = "main";
+        info->shader_stages[i].entry_point = "main";
     }
 
     auto rpass_fiter = hmap_find(&rndr->rpasses, FWD_RPASS);
     if (rpass_fiter) {
-        info.rpass = &vk->inst.device.render_passes[rpass_fiter->val.rpind];
-        pipeline_info plinfo{};
-        plinfo.id = PLINE_FWD_RPASS_S0_OPAQUE_COL;
-        plinfo.ubo_offset = rndr->pipelines.count;
-        plinfo.plind = vkr_add_pipeline(&vk->inst.device, {});
-        plinfo.rpass_id = rpass_fiter->val.id;
-        int code = vkr_init_pipeline(&vk->inst.device.pipelines[plinfo.plind], &info, vk);
-        if (code == err_code::VKR_NO_ERROR) {
-            hmap_set(&rndr->pipelines, plinfo.id, plinfo);
-            // Set our global frame layout
-            G_FRAME_PL_LAYOUT = vk->inst.device.pipelines[plinfo.plind].layout_hndl;
-        }
-        return code;
+        info->rpass = &vk->inst.device.render_passes[rpass_fiter->val.rpind];
+        job->plinfo.id = PLINE_FWD_RPASS_S0_OPAQUE_COL;
+        job->plinfo.rpass_id = rpass_fiter->val.id;
+        return err_code::VKR_NO_ERROR;
     }
     else {
         elog("Failed to find render pass %s", str_cstr(FWD_RPASS.str));
@@ -550,97 +589,198 @@ intern int setup_color_mat_pipeline(renderer *rndr)
     return err_code::RENDER_INIT_FAIL;
 }
 
-intern int setup_rmesh_info(renderer *rndr)
+intern void run_pipeline_create_job(void *user, sizet job_ind, sizet thread_ind)
 {
-    auto vk = &rndr->vk;
-    auto dev = &vk->inst.device;
-
-    // Create vertex buffer on GPU
-    vkr_buffer_cfg b_cfg{};
-    rndr->rmi.verts.buf_ind = vkr_add_buffer(dev, {});
-    rndr->rmi.verts.min_free_block_size = MIN_VERT_FREE_BLOCK_SIZE;
+    auto ctxt = (pipeline_create_ctxt *)user;
+    auto job = &ctxt->jobs[job_ind];
+    auto dev = &ctxt->rndr->vk.inst.device;
+    job->err = vkr_init_pipeline(&dev->pipelines[job->plinfo.plind], &job->cfg, &ctxt->rndr->vk);
+}
 
-    rndr->rmi.inds.buf_ind = vkr_add_buffer(dev, {});
-    rndr->rmi.inds.min_free_block_size = MIN_IND_FREE_BLOCK_SIZE;
+// Create the pipelines across the job pool - the driver compiles the shader modules in to device code here, which is
+// most of the startup time when the pipeline cache is cold. The pipelines are registered in job order once they are all
+// done so the ubo offsets don't depend on which finished first.
+intern int create_pipelines(renderer *rndr, pipeline_create_job *jobs, sizet count)
+{
+    auto dev = &rndr->vk.inst.device;
+    // Pipelines can't be added from the job threads as adding might move the array
+    for (sizet i = 0; i < count; ++i) {
+        jobs[i].plinfo.plind = vkr_add_pipeline(dev, {});
+    }
 
-    // Common to all buffer options
-    b_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-    b_cfg.sharing_mode = VK_SHARING_MODE_EXCLUSIVE;
-    b_cfg.vma_alloc = &dev->vma_alloc;
+    pipeline_create_ctxt ctxt{rndr, jobs};
+    job_pool_run(&rndr->jobs, count, run_pipeline_create_job, &ctxt);
 
-    // Vert buffer
-    b_cfg.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    b_cfg.buffer_size = DEFAULT_VERT_BUFFER_SIZE * sizeof(vertex);
-    int err = vkr_init_buffer(&dev->buffers[rndr->rmi.verts.buf_ind], &b_cfg);
-    if (err != err_code::VKR_NO_ERROR) {
-        return err;
+    for (sizet i = 0; i < count; ++i) {
+        if (jobs[i].err != err_code::VKR_NO_ERROR) {
+            elog("Failed to create pipeline %s with code %d", str_cstr(jobs[i].plinfo.id.str), jobs[i].err);
+            return jobs[i].err;
+        }
+        jobs[i].plinfo.ubo_offset = rndr->pipelines.count;
+        hmap_set(&rndr->pipelines, jobs[i].plinfo.id, jobs[i].plinfo);
+        // Set our global frame layout
+        G_FRAME_PL_LAYOUT = dev->pipelines[jobs[i].plinfo.plind].layout_hndl;
     }
+    return err_code::VKR_NO_ERROR;
+}
 
-    // Ind buffer
-    b_cfg.usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
-    b_cfg.buffer_size = DEFAULT_IND_BUFFER_SIZE * sizeof(ind_t);
-    err = vkr_init_buffer(&dev->buffers[rndr->rmi.inds.buf_ind], &b_cfg);
-    if (err != err_code::VKR_NO_ERROR) {
-        return err;
+intern int setup_gpu_cull_pipeline(renderer *rndr)
+{
+    auto vk = &rndr->vk;
+    vkr_compute_pipeline_cfg info{};
+
+    // A single set with the candidate, draw command and instance storage buffers
+    info.set_layouts.size = 1;
+    VkDescriptorSetLayoutBinding b{};
+    b.descriptorCount = 1;
+    b.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    b.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    for (u32 i = 0; i < GPU_CULL_DESCRIPTOR_SET_BINDING_COUNT; ++i) {
+        b.binding = i;
+        arr_push_back(&info.set_layouts[0].bindings, b);
     }
 
-    mem_init_pool_arena<sbuffer_entry_slnode>(&rndr->rmi.verts.node_pool, MAX_FREE_SBUFFER_NODE_COUNT, mem_global_stack_arena(), "mesh-verts");
-    mem_init_pool_arena<sbuffer_entry_slnode>(&rndr->rmi.inds.node_pool, MAX_FREE_SBUFFER_NODE_COUNT, mem_global_stack_arena(), "mesh-inds");
-    hmap_init(&rndr->rmi.meshes, hash_type);
+    // Frustum planes and candidate count
+    ++info.push_constant_ranges.size;
+    info.push_constant_ranges[0].offset = 0;
+    info.push_constant_ranges[0].size = sizeof(gpu_cull_push_constants);
+    info.push_constant_ranges[0].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+
+    const char *fname = "data/shaders/cull-instances.comp.spv";
+    platform_file_err_desc err{};
+    arr_init(&info.shader_stage.code, &rndr->vk_frame_linear);
+    read_file(fname, &info.shader_stage.code, 0, &err);
+    if (err.code != err_code::PLATFORM_NO_ERROR) {
+        wlog("Error reading file %s from disk (code %d): %s", fname, err.code, err.str);
+        return err_code::RENDER_LOAD_SHADERS_FAIL;
+    }
+    info.shader_stage.entry_point = "main";
 
-    // Create the head nodes of our vert and index buffer free list - indice 0 and full buffer size
-    auto vert_head = mem_alloc<sbuffer_entry_slnode>(&rndr->rmi.verts.node_pool);
-    vert_head->next = nullptr;
-    vert_head->data.size = DEFAULT_VERT_BUFFER_SIZE;
-    vert_head->data.offset = 0;
-    ll_push_back(&rndr->rmi.verts.fl, vert_head);
+    sizet plind = vkr_add_pipeline(&vk->inst.device, {});
+    int code = vkr_init_compute_pipeline(&vk->inst.device.pipelines[plind], &info, vk);
+    if (code == err_code::VKR_NO_ERROR) {
+        rndr->gpu_cull_plind = plind;
+    }
+    return code;
+}
 
-    auto ind_head = mem_alloc<sbuffer_entry_slnode>(&rndr->rmi.inds.node_pool);
-    ind_head->next = nullptr;
-    ind_head->data.size = DEFAULT_IND_BUFFER_SIZE;
-    ind_head->data.offset = 0;
-    ll_push_back(&rndr->rmi.inds.fl, ind_head);
+intern int init_sbuffer_gpu_buffer(renderer *rndr, vkr_buffer *buf, VkBufferUsageFlags usage, sizet byte_size)
+{
+    auto dev = &rndr->vk.inst.device;
+    vkr_buffer_cfg b_cfg{};
+    b_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+    b_cfg.sharing_mode = VK_SHARING_MODE_EXCLUSIVE;
+    b_cfg.vma_alloc = &dev->vma_alloc;
+    // Transfer src is needed to copy the live ranges out when defragmenting
+    b_cfg.usage = usage | VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    b_cfg.buffer_size = byte_size;
+    return vkr_init_buffer(buf, &b_cfg);
+}
 
+intern int setup_rmesh_info(renderer *rndr)
+{
+    // Geometry chunks are added when the first meshes are uploaded
+    hmap_init(&rndr->rmi.meshes, hash_type);
     return err_code::VKR_NO_ERROR;
 }
 
-intern sbuffer_entry find_sbuffer_block(sbuffer_info *sbuf, sizet req_size)
+intern int init_sbuffer(renderer *rndr, sbuffer_info *sbuf, VkBufferUsageFlags usage, sizet elem_size, sizet elem_count)
 {
-    // Find the first node with enough available memory
-    auto node = sbuf->fl.head;
-    sbuffer_entry_slnode *prev_node{};
-    while (node && req_size > node->data.size) {
-        prev_node = node;
-        node = node->next;
+    auto dev = &rndr->vk.inst.device;
+    sbuf->buf_ind = vkr_add_buffer(dev, {});
+    sbuf->elem_size = elem_size;
+    int err = init_sbuffer_gpu_buffer(rndr, &dev->buffers[sbuf->buf_ind], usage, elem_count * elem_size);
+    if (err == err_code::VKR_NO_ERROR) {
+        init_offset_allocator(&sbuf->alloc, rndr->upstream_fl_arena, (u32)elem_count, SBUFFER_INITIAL_NODE_COUNT);
     }
+    return err;
+}
 
-    // Crash if we don't have enough memory spots left
-    asrt(node);
-    auto ret_entry = node->data;
+// Add a chunk with room for at least the passed vert and ind counts - returns the chunk index or INVALID_ID
+intern u32 add_geometry_chunk(renderer *rndr, sizet min_vert_count, sizet min_ind_count, bool wide_inds)
+{
+    auto rmi = &rndr->rmi;
+    if (rmi->chunks.size == MAX_GEOMETRY_CHUNK_COUNT) {
+        elog("Reached the max geometry chunk count of %lu", MAX_GEOMETRY_CHUNK_COUNT);
+        return INVALID_ID;
+    }
 
-    // Remove the node we just used
-    ll_remove(&sbuf->fl, prev_node, node);
-    mem_free(node, &sbuf->node_pool);
+    geometry_chunk chunk{};
+    chunk.wide_inds = wide_inds;
+    sizet vert_count = std::max(min_vert_count, GEOMETRY_CHUNK_VERT_COUNT);
+    sizet ind_count = std::max(min_ind_count, GEOMETRY_CHUNK_IND_COUNT);
+    int err = init_sbuffer(rndr, &chunk.verts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, sizeof(vertex), vert_count);
+    if (err == err_code::VKR_NO_ERROR) {
+        err = init_sbuffer(rndr, &chunk.inds, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, (wide_inds) ? sizeof(u32) : sizeof(ind_t), ind_count);
+    }
+    if (err != err_code::VKR_NO_ERROR) {
+        elog("Failed to create geometry chunk with %lu verts and %lu inds - err code %d", vert_count, ind_count, err);
+        return INVALID_ID;
+    }
 
-    // If the remaining is enough to hold at least a quad we should insert a new free entry at the proper spot
-    sizet remain = ret_entry.size - req_size;
-    if (remain >= sbuf->min_free_block_size) {
+    u32 ci = (u32)rmi->chunks.size;
+    arr_push_back(&rmi->chunks, chunk);
+    ilog("Added geometry chunk %u with %lu verts and %lu %s inds", ci, vert_count, ind_count, (wide_inds) ? "32 bit" : "16 bit");
+    return ci;
+}
 
-        auto fnode = sbuf->fl.head;
-        sbuffer_entry_slnode *prev_fnode{};
-        while (fnode && fnode->data.size < remain) {
-            prev_fnode = fnode;
-            fnode = fnode->next;
+// Allocate the vert and ind ranges for a submesh from the first chunk with the right index size and room for both,
+// adding a chunk if none has
+intern bool alloc_submesh_geometry(renderer *rndr, sizet vert_count, sizet ind_count, bool wide_inds, rsubmesh_entry *entry)
+{
+    auto rmi = &rndr->rmi;
+    for (u32 ci = 0; ci <= rmi->chunks.size; ++ci) {
+        if (ci == rmi->chunks.size && !is_valid(add_geometry_chunk(rndr, vert_count, ind_count, wide_inds))) {
+            return false;
         }
-
-        auto new_node = mem_alloc<sbuffer_entry_slnode>(&sbuf->node_pool);
-        ret_entry.size -= remain;
-        new_node->next = nullptr;
-        new_node->data.size = remain;
-        new_node->data.offset = ret_entry.offset + ret_entry.size;
-        ll_insert(&sbuf->fl, prev_fnode, new_node);
+        auto chunk = &rmi->chunks[ci];
+        if ((bool)chunk->wide_inds != wide_inds) {
+            continue;
+        }
+        auto vblk = oalloc_alloc(&chunk->verts.alloc, (u32)vert_count);
+        if (!is_valid(vblk.node)) {
+            continue;
+        }
+        auto iblk = oalloc_alloc(&chunk->inds.alloc, (u32)ind_count);
+        if (!is_valid(iblk.node)) {
+            oalloc_free(&chunk->verts.alloc, vblk.node);
+            continue;
+        }
+        entry->chunk = ci;
+        entry->verts = {vblk.offset, vblk.size, vblk.node};
+        entry->inds = {iblk.offset, iblk.size, iblk.node};
+        return true;
     }
-    return ret_entry;
+    return false;
+}
+
+// Assign the texture the next slot in the bindless texture array and write it to every frame's bindless set. The slot
+// has never been used by a draw so it can be written while the sets are in use.
+intern void add_bindless_texture(renderer *rndr, sampled_texture_info *stex)
+{
+    auto dev = &rndr->vk.inst.device;
+    if (rndr->bindless_texture_count == MAX_BINDLESS_TEXTURE_COUNT) {
+        wlog("Bindless texture array is full - texture will not be sampled");
+        return;
+    }
+    stex->bindless_ind = rndr->bindless_texture_count++;
+
+    VkDescriptorImageInfo im_info{};
+    im_info.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    im_info.imageView = dev->image_views[stex->im_view].hndl;
+    im_info.sampler = dev->samplers[stex->sampler].hndl;
+
+    VkWriteDescriptorSet writes[MAX_FRAMES_IN_FLIGHT]{};
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = rndr->bindless_pool.desc_sets[rndr->per_frame_data[i].bindless_set].hndl;
+        writes[i].dstBinding = BINDLESS_DESCRIPTOR_SET_BINDING_TEXTURES;
+        writes[i].dstArrayElement = stex->bindless_ind;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+        writes[i].descriptorCount = 1;
+        writes[i].pImageInfo = &im_info;
+    }
+    vkUpdateDescriptorSets(dev->hndl, MAX_FRAMES_IN_FLIGHT, writes, 0, nullptr);
 }
 
 bool upload_to_gpu(const texture *tex, renderer *rndr)
@@ -662,9 +802,8 @@ bool upload_to_gpu(const texture *tex, renderer *rndr)
         return err;
     }
 
-    // Upload texture data to created image using staging buffer
-    err = vkr_stage_and_upload_image_data(
-        &im, tex->pixels.data, get_texture_memsize(tex), &dev->qfams[VKR_QUEUE_FAM_TYPE_GFX], VKR_RENDER_QUEUE, &rndr->vk);
+    // Queue the texture data upload - the copy goes out with the next batch of uploads
+    err = vkr_upload_image_data(&rndr->uploads, &rndr->vk, &im, tex->pixels.data, get_texture_memsize(tex));
     if (err != err_code::VKR_NO_ERROR) {
         wlog("Failed to upload texture data for %s with err code %d", to_cstr(tex->name), err);
         vkr_terminate_image(&im);
@@ -717,183 +856,432 @@ bool upload_to_gpu(const texture *tex, renderer *rndr)
         vkr_terminate_sampler(&sampler);
         return false;
     }
+
+    if (rndr->bindless) {
+        add_bindless_texture(rndr, &ins->val);
+    }
+
+    // Materials referencing the texture may have descriptor sets or bindless material data written before it was
+    // uploaded - post an update for them which also invalidates their cached sets
+    auto mat_iter = hmap_begin(&rndr->materials);
+    while (mat_iter) {
+        auto mat = mat_iter->val.mat;
+        for (sizet i = 0; i < mat->textures.size; ++i) {
+            if (mat->textures[i] == tex->id) {
+                post_material_ubo_update(rndr, mat_iter->key);
+                break;
+            }
+        }
+        mat_iter = hmap_next(&rndr->materials, mat_iter);
+    }
     return true;
 }
 
-// Upload mesh data to GPU using the shared indice/vertex buffer, also "registers" the mesh with the renderer so it can
-// be drawn
-bool upload_to_gpu(const mesh *msh, renderer *rndr)
+// Submesh data waiting to be copied in to the ranges reserved for it
+struct pending_submesh_upload
+{
+    const submesh *sm;
+    u32 chunk;
+    sizet vert_offset;
+    sizet ind_offset;
+};
+
+bool upload_to_gpu(const mesh *const *meshes, sizet count, renderer *rndr)
 {
-    auto fiter = hmap_find(&rndr->rmi.meshes, msh->id);
-    if (fiter) {
-        return false;
-    }
     auto dev = &rndr->vk.inst.device;
-    // Find the first available sbuffer entry in the free list
-    rmesh_entry new_mentry{};
-    // arr_init(&new_mentry.submesh_entrees, rndr->upstream_fl_arena);
-    for (int subi = 0; subi < msh->submeshes.size; ++subi) {
-        sizet req_vert_size = arr_len(msh->submeshes[subi].verts);
-        sizet req_vert_byte_size = arr_sizeof(msh->submeshes[subi].verts);
-        sizet req_inds_size = arr_len(msh->submeshes[subi].inds);
-        sizet req_inds_byte_size = arr_sizeof(msh->submeshes[subi].inds);
-
-        // Add an entry in the hashmap for our mesh to refer to this sbuffer entry we just got from the free list
-        rsubmesh_entry new_smentry{};
-        new_smentry.verts = find_sbuffer_block(&rndr->rmi.verts, req_vert_size);
-        new_smentry.inds = find_sbuffer_block(&rndr->rmi.inds, req_inds_size);
-        asrt(new_smentry.verts.size > 0);
-        asrt(new_smentry.inds.size > 0);
-        arr_emplace_back(&new_mentry.submesh_entrees, new_smentry);
-
-        // Our required vert and ind size might be a little less than the avail block size, if a block was picked that
-        // was big enough to fit our needs but the remaining available in the block was less than the required min block
-        // size fot the sbuffer
-        VkBufferCopy vert_region{}, ind_region{};
-        vert_region.size = req_vert_byte_size;
-        vert_region.dstOffset = new_smentry.verts.offset * sizeof(vertex);
-
-        ind_region.size = req_inds_byte_size;
-        ind_region.dstOffset = new_smentry.inds.offset * sizeof(ind_t);
-
-        // TODO: Handle error conditions here - there are several reasons why a buffer upload might fail - for new we
-        // just asrt it worked
-
-        // Upload our vert data to the GPU
-        int ret = vkr_stage_and_upload_buffer_data(&dev->buffers[rndr->rmi.verts.buf_ind],
-                                                   msh->submeshes[subi].verts.data,
-                                                   req_vert_byte_size,
-                                                   &vert_region,
-                                                   &dev->qfams[VKR_QUEUE_FAM_TYPE_GFX],
-                                                   VKR_RENDER_QUEUE,
-                                                   &rndr->vk);
-        asrt(ret == err_code::VKR_NO_ERROR);
+    array<pending_submesh_upload> pending{};
+    array<vkr_buffer_upload> vert_uploads{}, ind_uploads{};
+    arr_init(&pending, rndr->upstream_fl_arena);
+    arr_init(&vert_uploads, rndr->upstream_fl_arena);
+    arr_init(&ind_uploads, rndr->upstream_fl_arena);
+
+    // Reserve the ranges for every submesh first so the data for each chunk can go out in one copy per buffer
+    bool all_added = true;
+    sizet mesh_count = 0, vert_count = 0, ind_count = 0;
+    for (sizet mi = 0; mi < count; ++mi) {
+        auto msh = meshes[mi];
+        if (hmap_find(&rndr->rmi.meshes, msh->id)) {
+            all_added = false;
+            continue;
+        }
+
+        rmesh_entry new_mentry{};
+        for (int subi = 0; subi < msh->submeshes.size; ++subi) {
+            auto sm = &msh->submeshes[subi];
+            rsubmesh_entry new_smentry{};
+            // The LOD indices go right after the full detail ones in the same range
+            u32 sm_ind_count = 0;
+            for (sizet lod = 0; lod < get_lod_count(sm); ++lod) {
+                u32 lod_ind_count = (u32)get_lod_ind_count(sm, lod);
+                f32 error = (lod > 0) ? sm->lods[lod - 1].error : 0.0f;
+                arr_push_back(&new_smentry.lods, {sm_ind_count, lod_ind_count, error});
+                sm_ind_count += lod_ind_count;
+            }
+            bool allocated = alloc_submesh_geometry(rndr, arr_len(sm->verts), sm_ind_count, has_wide_inds(sm), &new_smentry);
+            // Crash if we don't have enough memory spots left
+            asrt(allocated);
+            new_smentry.bounds = calc_bounds(sm);
+            asrt(new_smentry.verts.size > 0);
+            asrt(new_smentry.inds.size > 0);
+            arr_emplace_back(&new_mentry.submesh_entrees, new_smentry);
+            arr_push_back(&pending, {sm, new_smentry.chunk, new_smentry.verts.offset, new_smentry.inds.offset});
+            vert_count += new_smentry.verts.size;
+            ind_count += new_smentry.inds.size;
+        }
+        // Add the smesh entry we just built to the renderer mesh entry map (stored by id)
+        hmap_set(&rndr->rmi.meshes, msh->id, new_mentry);
+        ++mesh_count;
+    }
+
+    // TODO: Handle error conditions here - there are several reasons why a buffer upload might fail - for now we
+    // just asrt it worked
+    sizet chunk_count = 0;
+    for (u32 ci = 0; ci < rndr->rmi.chunks.size; ++ci) {
+        arr_clear(&vert_uploads);
+        arr_clear(&ind_uploads);
+        auto chunk = &rndr->rmi.chunks[ci];
+        for (sizet i = 0; i < pending.size; ++i) {
+            auto pu = &pending[i];
+            if (pu->chunk == ci) {
+                arr_push_back(&vert_uploads, {pu->sm->verts.data, arr_sizeof(pu->sm->verts), pu->vert_offset * sizeof(vertex)});
+                sizet ind_offset = pu->ind_offset;
+                for (sizet lod = 0; lod < get_lod_count(pu->sm); ++lod) {
+                    const array<ind_t> *inds = (lod == 0) ? &pu->sm->inds : &pu->sm->lods[lod - 1].inds;
+                    const array<u32> *wide_inds = (lod == 0) ? &pu->sm->wide_inds : &pu->sm->lods[lod - 1].wide_inds;
+                    if (chunk->wide_inds) {
+                        arr_push_back(&ind_uploads, {wide_inds->data, arr_sizeof(wide_inds), ind_offset * sizeof(u32)});
+                        ind_offset += wide_inds->size;
+                    }
+                    else {
+                        arr_push_back(&ind_uploads, {inds->data, arr_sizeof(inds), ind_offset * sizeof(ind_t)});
+                        ind_offset += inds->size;
+                    }
+                }
+            }
+        }
+        if (vert_uploads.size == 0) {
+            continue;
+        }
 
-        // Upload our ind data to the GPU
-        ret = vkr_stage_and_upload_buffer_data(&dev->buffers[rndr->rmi.inds.buf_ind],
-                                               msh->submeshes[subi].inds.data,
-                                               req_inds_byte_size,
-                                               &ind_region,
-                                               &dev->qfams[VKR_QUEUE_FAM_TYPE_GFX],
-                                               VKR_RENDER_QUEUE,
-                                               &rndr->vk);
+        // Queue our vert and ind data uploads - they go out with the next batch of uploads
+        int ret = vkr_upload_buffer_regions(
+            &rndr->uploads, &rndr->vk, &dev->buffers[chunk->verts.buf_ind], vert_uploads.data, vert_uploads.size);
+        asrt(ret == err_code::VKR_NO_ERROR);
+        ret = vkr_upload_buffer_regions(&rndr->uploads, &rndr->vk, &dev->buffers[chunk->inds.buf_ind], ind_uploads.data, ind_uploads.size);
         asrt(ret == err_code::VKR_NO_ERROR);
+        ++chunk_count;
     }
-    ilog("Adding mesh id %s %d submeshes", str_cstr(msh->id.str), new_mentry.submesh_entrees.size);
-    for (int si = 0; si < new_mentry.submesh_entrees.size; ++si) {
-        auto sub = &new_mentry.submesh_entrees[si];
-        ilog("submesh %d:  vertsp(ubo_offset:%d  size:%d)  inds(ubo_offset:%d size:%d)",
-             si,
-             sub->verts.offset,
-             sub->verts.size,
-             sub->inds.offset,
-             sub->inds.size);
-    }
-    // Add the smesh entry we just built to the renderer mesh entry map (stored by id)
-    hmap_set(&rndr->rmi.meshes, msh->id, new_mentry);
-    return true;
+
+    if (mesh_count > 0) {
+        ilog("Added %lu meshes with %lu submeshes (%lu verts and %lu inds) to %lu geometry chunks",
+             mesh_count,
+             pending.size,
+             vert_count,
+             ind_count,
+             chunk_count);
+    }
+
+    arr_terminate(&ind_uploads);
+    arr_terminate(&vert_uploads);
+    arr_terminate(&pending);
+    return all_added;
 }
 
-intern void insert_node_to_free_list(sbuffer_info *sbuf, const sbuffer_entry *entry)
+bool upload_to_gpu(const mesh *msh, renderer *rndr)
 {
-    // Iterate over the free list and find the lowest index position to insert the new node
-    auto it = sbuf->fl.head;
-    sbuffer_entry_slnode *it_prev{};
-    while (it && entry->offset < it->data.offset) {
-        it_prev = it;
-        it = it->next;
-    }
-    auto new_node = mem_alloc<sbuffer_entry_slnode>(&sbuf->node_pool);
-    new_node->next = nullptr;
-    new_node->data = *entry;
-    ll_insert(&sbuf->fl, it_prev, new_node);
+    return upload_to_gpu(&msh, 1, rndr);
 }
 
 bool remove_from_gpu(mesh *msh, renderer *rndr)
 {
-    // TODO: This code is basically completely untested
     auto minfo = hmap_find(&rndr->rmi.meshes, msh->id);
     if (minfo) {
         for (int subi = 0; subi < minfo->val.submesh_entrees.size; ++subi) {
-            // Insert the block to our free list
+            // Free the ranges - they are merged with any free neighbours
             auto cur_entry = &minfo->val.submesh_entrees[subi];
-            insert_node_to_free_list(&rndr->rmi.verts, &cur_entry->verts);
-            insert_node_to_free_list(&rndr->rmi.inds, &cur_entry->inds);
+            auto chunk = &rndr->rmi.chunks[cur_entry->chunk];
+            oalloc_free(&chunk->verts.alloc, cur_entry->verts.node);
+            oalloc_free(&chunk->inds.alloc, cur_entry->inds.node);
         }
         hmap_remove(&rndr->rmi.meshes, msh->id);
     }
     return minfo;
 }
 
-intern int init_swapchain_images_and_framebuffer(renderer *rndr)
+intern bool sbuffer_entry_offset_less(const sbuffer_entry *lhs, const sbuffer_entry *rhs)
+{
+    return lhs->offset < rhs->offset;
+}
+
+// Reallocate the entries back to back from the start of the buffer in their current order and copy them in to a new
+// buffer which replaces the old one. The new offset of each entry is added to remap keyed by the chunk in the high 32
+// bits and its old offset in the low 32 bits. Nothing is changed if the new buffer can't be created.
+intern int compact_sbuffer(
+    renderer *rndr, u32 chunk, sbuffer_info *sbuf, VkBufferUsageFlags usage, array<sbuffer_entry *> *entries, hmap<u64, u32> *remap)
 {
-    auto vk = &rndr->vk;
     auto dev = &rndr->vk.inst.device;
+    auto old_buf = &dev->buffers[sbuf->buf_ind];
+    vkr_buffer new_buf{};
+    int err = init_sbuffer_gpu_buffer(rndr, &new_buf, usage, old_buf->mem_info.size);
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+
+    std::sort(entries->data, entries->data + entries->size, sbuffer_entry_offset_less);
+
+    array<VkBufferCopy> regions{};
+    arr_init(&regions, rndr->upstream_fl_arena, entries->size);
+    oalloc_reset(&sbuf->alloc);
+    for (sizet i = 0; i < entries->size; ++i) {
+        auto entry = entries->data[i];
+        auto blk = oalloc_alloc(&sbuf->alloc, (u32)entry->size);
+        asrt(is_valid(blk.node));
+        hmap_set(remap, ((u64)chunk << 32) | (u64)entry->offset, blk.offset);
+
+        VkBufferCopy region{};
+        region.srcOffset = entry->offset * sbuf->elem_size;
+        region.dstOffset = blk.offset * sbuf->elem_size;
+        region.size = entry->size * sbuf->elem_size;
+        arr_push_back(&regions, region);
+        *entry = {blk.offset, blk.size, blk.node};
+    }
+
+    if (regions.size > 0) {
+        err = vkr_copy_buffer(
+            &new_buf, old_buf, regions.data, &dev->qfams[VKR_QUEUE_FAM_TYPE_GFX], VKR_RENDER_QUEUE, &rndr->vk, (u32)regions.size);
+    }
+    arr_terminate(&regions);
+
+    // The entries already point at the new offsets so the new buffer is used even if the copy failed
+    vkr_terminate_buffer(old_buf, &rndr->vk);
+    *old_buf = new_buf;
+    return err;
+}
+
+// Id for the index range put in the geometry key bits - ranges don't overlap within a chunk so the first index is enough
+// to tell them apart. Each call adds a reference which the packet LOD drawing the range releases when it is freed.
+intern u32 get_or_add_geometry_id(static_model_draw_info *dcs, u32 chunk, u32 first_index)
+{
+    u64 geom_key = ((u64)chunk << 32) | (u64)first_index;
+    auto geom_fiter = hmap_find(&dcs->geometry_ids, geom_key);
+    if (!geom_fiter) {
+        geometry_id_entry entry{};
+        if (dcs->free_geometry_ids.size > 0) {
+            entry.id = *arr_back(&dcs->free_geometry_ids);
+            arr_pop_back(&dcs->free_geometry_ids);
+        }
+        else {
+            entry.id = (u32)dcs->geometry_ids.count;
+            asrt(entry.id < (1u << DRAW_KEY_GEOMETRY_BITS));
+        }
+        geom_fiter = hmap_insert(&dcs->geometry_ids, geom_key, entry);
+    }
+    ++geom_fiter->val.ref_count;
+    return geom_fiter->val.id;
+}
+
+intern void release_geometry_id(static_model_draw_info *dcs, u32 chunk, u32 first_index)
+{
+    u64 geom_key = ((u64)chunk << 32) | (u64)first_index;
+    auto geom_fiter = hmap_find(&dcs->geometry_ids, geom_key);
+    asrt(geom_fiter && geom_fiter->val.ref_count > 0);
+    if (--geom_fiter->val.ref_count == 0) {
+        arr_push_back(&dcs->free_geometry_ids, geom_fiter->val.id);
+        hmap_remove(&dcs->geometry_ids, geom_key);
+    }
+}
 
-    vkr_image_cfg im_cfg{};
-    im_cfg.dims = {dev->swapchain.extent.width, dev->swapchain.extent.height, 1};
-    im_cfg.format = vkr_find_best_depth_format(&rndr->vk.inst.pdev_info);
-    im_cfg.usage = VK_IMAGE_USAGE_DEPTH_STENCIL_ATTACHMENT_BIT;
-    im_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
-    im_cfg.vma_alloc = &dev->vma_alloc;
+int defrag_mesh_buffers(renderer *rndr)
+{
+    auto dcs = &rndr->dcs;
 
-    if (rndr->swapchain_fb_depth_stencil_im_ind == INVALID_IND) {
-        rndr->swapchain_fb_depth_stencil_im_ind = vkr_add_image(dev);
+    // Nothing may be reading or writing the shared buffers while they are swapped out
+    int err = vkr_submit_uploads(&rndr->uploads, &rndr->vk);
+    if (err == err_code::VKR_NO_ERROR) {
+        err = vkr_wait_uploads(&rndr->uploads, &rndr->vk);
     }
-    int err = vkr_init_image(&dev->images[rndr->swapchain_fb_depth_stencil_im_ind], &im_cfg);
     if (err != err_code::VKR_NO_ERROR) {
         return err;
     }
+    vkr_device_wait_idle(&rndr->vk.inst.device);
+
+    array<rsubmesh_entry *> submeshes{};
+    array<sbuffer_entry *> vert_entries{}, ind_entries{};
+    hmap<u64, u32> vert_remap{}, ind_remap{};
+    arr_init(&submeshes, rndr->upstream_fl_arena);
+    arr_init(&vert_entries, rndr->upstream_fl_arena);
+    arr_init(&ind_entries, rndr->upstream_fl_arena);
+    hmap_init(&vert_remap, hash_type, rndr->upstream_fl_arena);
+    hmap_init(&ind_remap, hash_type, rndr->upstream_fl_arena);
+
+    auto miter = hmap_begin(&rndr->rmi.meshes);
+    while (miter) {
+        for (int subi = 0; subi < miter->val.submesh_entrees.size; ++subi) {
+            arr_push_back(&submeshes, &miter->val.submesh_entrees[subi]);
+        }
+        miter = hmap_next(&rndr->rmi.meshes, miter);
+    }
+
+    // Each chunk is compacted on its own - submeshes never move between chunks
+    for (u32 ci = 0; ci < rndr->rmi.chunks.size && err == err_code::VKR_NO_ERROR; ++ci) {
+        auto chunk = &rndr->rmi.chunks[ci];
+        arr_clear(&vert_entries);
+        arr_clear(&ind_entries);
+        for (sizet i = 0; i < submeshes.size; ++i) {
+            if (submeshes[i]->chunk == ci) {
+                arr_push_back(&vert_entries, &submeshes[i]->verts);
+                arr_push_back(&ind_entries, &submeshes[i]->inds);
+            }
+        }
+        u32 largest_before = oalloc_largest_free_size(&chunk->verts.alloc);
+        err = compact_sbuffer(rndr, ci, &chunk->verts, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT, &vert_entries, &vert_remap);
+        if (err == err_code::VKR_NO_ERROR) {
+            err = compact_sbuffer(rndr, ci, &chunk->inds, VK_BUFFER_USAGE_INDEX_BUFFER_BIT, &ind_entries, &ind_remap);
+        }
+        if (err == err_code::VKR_NO_ERROR) {
+            ilog("Defragmented geometry chunk %u - vert free space %u (largest block %u -> %u)",
+                 ci,
+                 chunk->verts.alloc.free_storage,
+                 largest_before,
+                 oalloc_largest_free_size(&chunk->verts.alloc));
+        }
+    }
 
-    vkr_image_view_cfg imv_cfg{};
-    imv_cfg.srange.aspectMask = VK_IMAGE_ASPECT_DEPTH_BIT | VK_IMAGE_ASPECT_STENCIL_BIT;
-    imv_cfg.image = &dev->images[rndr->swapchain_fb_depth_stencil_im_ind];
+    // Offsets missing from a remap belong to a buffer that wasn't compacted and are left as they are
+    if (vert_remap.count > 0 || ind_remap.count > 0) {
+        // Patch the static model draw packets with the new offsets - the geometry ids are keyed by offset as well so
+        // they are rebuilt from the live packets
+        hmap_clear(&dcs->geometry_ids);
+        arr_clear(&dcs->free_geometry_ids);
+        for (sizet pi = 0; pi < dcs->packets.size; ++pi) {
+            auto pkt = &dcs->packets[pi];
+            if (test_flags(pkt->dc.flags, DRAW_CALL_FLAG_FREE)) {
+                continue;
+            }
+            u64 chunk_bits = (u64)pkt->dc.chunk << 32;
+            auto vfiter = hmap_find(&vert_remap, chunk_bits | (u64)pkt->dc.vertex_offset);
+            if (vfiter) {
+                pkt->dc.vertex_offset = vfiter->val;
+            }
+            // The remap is keyed by the start of the submesh's ind range, which is where LOD 0 starts - the other LODs
+            // move with it
+            auto ifiter = hmap_find(&ind_remap, chunk_bits | (u64)pkt->dc.lods[0].first_index);
+            if (ifiter) {
+                u32 old_first = pkt->dc.lods[0].first_index;
+                for (u32 lod = 0; lod < pkt->dc.lod_count; ++lod) {
+                    pkt->dc.lods[lod].first_index = ifiter->val + (pkt->dc.lods[lod].first_index - old_first);
+                }
+            }
 
-    if (rndr->swapchain_fb_depth_stencil_iview_ind == INVALID_IND) {
-        rndr->swapchain_fb_depth_stencil_iview_ind = vkr_add_image_view(dev);
+            for (u32 lod = 0; lod < pkt->dc.lod_count; ++lod) {
+                pkt->dc.lods[lod].geometry_id = get_or_add_geometry_id(dcs, pkt->dc.chunk, pkt->dc.lods[lod].first_index);
+            }
+            pkt->key = (pkt->key & ~DRAW_KEY_GEOMETRY_MASK) | ((u64)pkt->dc.lods[0].geometry_id << DRAW_KEY_GEOMETRY_SHIFT);
+        }
     }
-    err = vkr_init_image_view(&dev->image_views[rndr->swapchain_fb_depth_stencil_iview_ind], &imv_cfg, vk);
+
     if (err != err_code::VKR_NO_ERROR) {
-        return err;
+        elog("Failed to defragment mesh buffers with err code %d", err);
     }
-    // We need the render pass associated with our main framebuffer
-    auto rp_fiter = hmap_find(&rndr->rpasses, FWD_RPASS);
-    asrt(rp_fiter);
-    vkr_init_swapchain_framebuffers(dev,
-                                    vk,
-                                    &dev->render_passes[rp_fiter->val.rpind],
-                                    vkr_framebuffer_attachment{dev->image_views[rndr->swapchain_fb_depth_stencil_iview_ind]});
 
+    hmap_terminate(&ind_remap);
+    hmap_terminate(&vert_remap);
+    arr_terminate(&ind_entries);
+    arr_terminate(&vert_entries);
+    arr_terminate(&submeshes);
     return err;
 }
 
+// Create the update after bind pool and allocate a bindless set for each frame in flight pointing at that frame's
+// material storage buffer - textures are written in to the sets as they are uploaded
+intern int setup_bindless_sets(renderer *rndr)
+{
+    auto vk = &rndr->vk;
+    auto dev = &vk->inst.device;
+
+    vkr_descriptor_cfg cfg{};
+    cfg.max_sets = MAX_FRAMES_IN_FLIGHT;
+    cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_STORAGE_BUFFER] = MAX_FRAMES_IN_FLIGHT;
+    cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER] = MAX_FRAMES_IN_FLIGHT * MAX_BINDLESS_TEXTURE_COUNT;
+    cfg.flags = VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+    int err = vkr_init_descriptor_pool(&rndr->bindless_pool, vk, &cfg);
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+
+    // All pipelines use the same bindless material set layout so any of them can be used to allocate the sets
+    auto pl_fiter = hmap_find(&rndr->pipelines, PLINE_FWD_RPASS_S0_OPAQUE_DIFFUSE);
+    asrt(pl_fiter);
+    VkDescriptorSetLayout layouts[MAX_FRAMES_IN_FLIGHT];
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        layouts[i] = dev->pipelines[pl_fiter->val.plind].descriptor_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL];
+    }
+    vkr_add_result desc_ind = vkr_add_descriptor_sets(&rndr->bindless_pool, vk, layouts, MAX_FRAMES_IN_FLIGHT);
+    if (desc_ind.err_code != err_code::VKR_NO_ERROR) {
+        return desc_ind.err_code;
+    }
+
+    VkDescriptorBufferInfo buf_infos[MAX_FRAMES_IN_FLIGHT]{};
+    VkWriteDescriptorSet writes[MAX_FRAMES_IN_FLIGHT]{};
+    for (int i = 0; i < MAX_FRAMES_IN_FLIGHT; ++i) {
+        auto fd = &rndr->per_frame_data[i];
+        fd->bindless_set = desc_ind.begin + i;
+        buf_infos[i].buffer = dev->buffers[fd->vkf->mat_sb_ind].hndl;
+        buf_infos[i].offset = 0;
+        buf_infos[i].range = MAX_MATERIAL_COUNT * sizeof(bindless_material_data);
+
+        writes[i].sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+        writes[i].dstSet = rndr->bindless_pool.desc_sets[fd->bindless_set].hndl;
+        writes[i].dstBinding = BINDLESS_DESCRIPTOR_SET_BINDING_MATERIALS;
+        writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+        writes[i].descriptorCount = 1;
+        writes[i].pBufferInfo = &buf_infos[i];
+    }
+    vkUpdateDescriptorSets(dev->hndl, MAX_FRAMES_IN_FLIGHT, writes, 0, nullptr);
+    return err_code::VKR_NO_ERROR;
+}
+
 intern int setup_rendering(renderer *rndr)
 {
     ilog("Setting up default rendering...");
     auto vk = &rndr->vk;
     auto dev = &rndr->vk.inst.device;
 
-    int err = setup_render_pass(rndr);
-    if (err != err_code::VKR_NO_ERROR) {
-        elog("Failed to setup render pass");
+    // The pipeline layouts depend on whether materials are bindless so this must be decided first
+    if (rndr->bindless && !bindless_supported(&vk->inst.pdev_info)) {
+        wlog("Device does not support the descriptor indexing features needed for bindless materials");
+        rndr->bindless = false;
+    }
+
+    int err = setup_render_graph(rndr);
+    if (err != err_code::RG_NO_ERROR) {
+        elog("Failed to setup render graph");
         return err;
     }
 
-    err = setup_diffuse_mat_pipeline(rndr);
+    // The material pipelines are filled in one after the other and then created in parallel
+    static_array<pipeline_create_job, 2> pl_jobs{};
+    pl_jobs.size = pl_jobs.capacity;
+    err = setup_diffuse_mat_pipeline(rndr, &pl_jobs[0]);
     if (err != err_code::VKR_NO_ERROR) {
         elog("Failed to setup pipeline");
         return err;
     }
 
-    err = setup_color_mat_pipeline(rndr);
+    err = setup_color_mat_pipeline(rndr, &pl_jobs[1]);
     if (err != err_code::VKR_NO_ERROR) {
         elog("Failed to setup pipeline");
         return err;
     }
 
-    err = init_swapchain_images_and_framebuffer(rndr);
+    err = create_pipelines(rndr, pl_jobs.data, pl_jobs.size);
     if (err != err_code::VKR_NO_ERROR) {
-        elog("Failed to setup swapchain images/framebuffers");
+        return err;
+    }
+
+    err = rg_init_resources(&rndr->rgraph, vk);
+    if (err != err_code::RG_NO_ERROR) {
+        elog("Failed to setup render graph images/framebuffers");
         return err;
     }
 
@@ -907,24 +1295,19 @@ intern int setup_rendering(renderer *rndr)
     // Create uniform buffers and descriptor sets pointing to them for each frame //
     ////////////////////////////////////////////////////////////////////////////////
     for (int i = 0; i < dev->rframes.size; ++i) {
-        // Create a uniform buffers for each frame
+        // Frame ring - everything which is rewritten each frame is sub-allocated from it
+        int err = vkr_init_frame_ring(&dev->rframes[i].ring, dev, FRAME_RING_DEFAULT_SIZE);
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
+        }
 
-        // Frame uniform buffer - per frame data
         vkr_buffer_cfg buf_cfg{};
         buf_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
         buf_cfg.sharing_mode = VK_SHARING_MODE_EXCLUSIVE;
         buf_cfg.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
-        buf_cfg.buffer_size = vkr_uniform_buffer_offset_alignment(vk, sizeof(frame_ubo_data));
         buf_cfg.alloc_flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
         buf_cfg.vma_alloc = &dev->vma_alloc;
 
-        vkr_buffer frame_uniform_buf{};
-        int err = vkr_init_buffer(&frame_uniform_buf, &buf_cfg);
-        if (err != err_code::VKR_NO_ERROR) {
-            return err;
-        }
-        dev->rframes[i].frame_ubo_ind = vkr_add_buffer(dev, frame_uniform_buf);
-
         // Pipeline uniform buffer - per pipeline data
         buf_cfg.buffer_size = MAX_PIPELINE_COUNT * vkr_uniform_buffer_offset_alignment(vk, sizeof(pipeline_ubo_data));
         vkr_buffer pl_uniform_buf{};
@@ -943,14 +1326,53 @@ intern int setup_rendering(renderer *rndr)
         }
         dev->rframes[i].mat_ubo_ind = vkr_add_buffer(dev, mat_uniform_buf);
 
-        // Object uniform buffer - per material data
-        buf_cfg.buffer_size = MAX_OBJECT_COUNT * vkr_uniform_buffer_offset_alignment(vk, sizeof(obj_ubo_data));
+        // Object storage buffer - per object data tightly packed and indexed by transform index
+        buf_cfg.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+        buf_cfg.buffer_size = MAX_OBJECT_COUNT * sizeof(obj_ubo_data);
         vkr_buffer obj_uniform_buf{};
         err = vkr_init_buffer(&obj_uniform_buf, &buf_cfg);
         if (err != err_code::VKR_NO_ERROR) {
             return err;
         }
         dev->rframes[i].obj_ubo_ind = vkr_add_buffer(dev, obj_uniform_buf);
+
+        // Bindless material parameters
+        if (rndr->bindless) {
+            buf_cfg.buffer_size = MAX_MATERIAL_COUNT * sizeof(bindless_material_data);
+            vkr_buffer mat_sb{};
+            err = vkr_init_buffer(&mat_sb, &buf_cfg);
+            if (err != err_code::VKR_NO_ERROR) {
+                return err;
+            }
+            dev->rframes[i].mat_sb_ind = vkr_add_buffer(dev, mat_sb);
+        }
+    }
+
+    if (rndr->bindless) {
+        err = setup_bindless_sets(rndr);
+        if (err != err_code::VKR_NO_ERROR) {
+            elog("Failed to setup bindless descriptor sets");
+            return err;
+        }
+    }
+
+    // Indirect draws set the first instance to the batch's offset in the instance buffer
+    if (rndr->indirect_draws && !vk->inst.pdev_info.features.drawIndirectFirstInstance) {
+        wlog("Device does not support indirect draw first instance - using direct draws");
+        rndr->indirect_draws = false;
+    }
+
+    // The cull pipeline is set up whenever indirect draws are available so GPU culling can be turned on at runtime -
+    // failing to set it up isn't fatal, the CPU frustum cull is used instead
+    if (rndr->indirect_draws) {
+        err = setup_gpu_cull_pipeline(rndr);
+        if (err != err_code::VKR_NO_ERROR) {
+            wlog("Failed to setup GPU cull pipeline (code %d) - culling on the CPU instead", err);
+            rndr->gpu_cull = false;
+        }
+    }
+    else {
+        rndr->gpu_cull = false;
     }
     return err_code::VKR_NO_ERROR;
 }
@@ -989,7 +1411,8 @@ intern void add_uniform_desc_write_update(renderer *rndr,
                                           sizet buf_ind,
                                           sizet set_ind,
                                           array<VkWriteDescriptorSet> *updates,
-                                          VkDescriptorType type)
+                                          VkDescriptorType type,
+                                          u32 binding = DESCRIPTOR_SET_BINDING_UNIFORM_BUFFER)
 {
     // Add a write descriptor set to update our obj descriptor to point at this portion of our unifrom buffer
     auto buffer_info = mem_calloc<VkDescriptorBufferInfo>(1, &rndr->frame_linear);
@@ -1000,7 +1423,7 @@ intern void add_uniform_desc_write_update(renderer *rndr,
     VkWriteDescriptorSet desc_write{};
     desc_write.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
     desc_write.dstSet = cur_frame->desc_pool.desc_sets[set_ind].hndl;
-    desc_write.dstBinding = DESCRIPTOR_SET_BINDING_UNIFORM_BUFFER;
+    desc_write.dstBinding = binding;
     desc_write.dstArrayElement = 0;
     desc_write.descriptorType = type;
     desc_write.descriptorCount = 1;
@@ -1008,53 +1431,561 @@ intern void add_uniform_desc_write_update(renderer *rndr,
     arr_push_back(updates, desc_write);
 }
 
-intern int record_command_buffer(renderer *rndr, vkr_framebuffer *fb, vkr_frame *cur_frame, vkr_command_buffer *cmd_buf)
+intern void init_cull_info(static_model_cull_info *cull, mem_arena *arena)
 {
-    auto dev = &rndr->vk.inst.device;
-    auto vert_buf = &dev->buffers[rndr->rmi.verts.buf_ind];
-    auto ind_buf = &dev->buffers[rndr->rmi.inds.buf_ind];
+    arr_init(&cull->transform_inds, arena);
+    arr_init(&cull->local_bounds, arena);
+    arr_init(&cull->free_entries, arena);
+    arr_init(&cull->center_x, arena);
+    arr_init(&cull->center_y, arena);
+    arr_init(&cull->center_z, arena);
+    arr_init(&cull->ext_x, arena);
+    arr_init(&cull->ext_y, arena);
+    arr_init(&cull->ext_z, arena);
+    arr_init(&cull->visible, arena);
+    arr_init(&cull->occluders, arena);
+    init_occlusion_culler(&cull->occ, arena);
+}
 
-    int err = vkr_begin_cmd_buf(cmd_buf);
-    if (err != err_code::VKR_NO_ERROR) {
-        return err;
-    }
+intern void clear_cull_info(static_model_cull_info *cull)
+{
+    arr_clear(&cull->transform_inds);
+    arr_clear(&cull->local_bounds);
+    arr_clear(&cull->free_entries);
+    arr_clear(&cull->visible);
+    arr_clear(&cull->occluders);
+    cull->visible_count = 0;
+    cull->occluded_count = 0;
+}
 
-    VkClearValue att_clear_vals[] = {{.color{{0.05f, 0.05f, 0.05f, 1.0f}}}, {.depthStencil{1.0f, 0}}};
+intern void terminate_cull_info(static_model_cull_info *cull)
+{
+    terminate_occlusion_culler(&cull->occ);
+    arr_terminate(&cull->occluders);
+    arr_terminate(&cull->visible);
+    arr_terminate(&cull->ext_z);
+    arr_terminate(&cull->ext_y);
+    arr_terminate(&cull->ext_x);
+    arr_terminate(&cull->center_z);
+    arr_terminate(&cull->center_y);
+    arr_terminate(&cull->center_x);
+    arr_terminate(&cull->free_entries);
+    arr_terminate(&cull->local_bounds);
+    arr_terminate(&cull->transform_inds);
+}
 
-    // Bind the global vertex/index buffer/s
-    VkBuffer vert_bufs[] = {vert_buf->hndl};
-    VkDeviceSize offsets[] = {0};
-    vkCmdBindVertexBuffers(cmd_buf->hndl, 0, 1, vert_bufs, offsets);
-    vkCmdBindIndexBuffer(cmd_buf->hndl, ind_buf->hndl, 0, VK_INDEX_TYPE_UINT16);
-
-    // TODO: This really can't go in any order we want for render passes.. We might have dependency ordered between
-    // them.. for now we just have the one.. I'm not sure if we need to do a
-    auto rpass_iter = hmap_begin(&rndr->dcs.rpasses);
-    while (rpass_iter) {
-        auto rpass = &dev->render_passes[rpass_iter->val->rpinfo->rpind];
-        vkr_cmd_begin_rpass(cmd_buf, fb, rpass, att_clear_vals, 2);
-
-        // Bind frame rpass descriptor set
-        auto ds = cur_frame->desc_pool.desc_sets[rpass_iter->val->frame_set_layouti].hndl;
-        vkCmdBindDescriptorSets(
-            cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, G_FRAME_PL_LAYOUT, DESCRIPTOR_SET_LAYOUT_FRAME, 1, &ds, 0, nullptr);
-
-        // We could make our render pass have the vert/index buffer info.. ie
-        auto pl_iter = hmap_begin(&rpass_iter->val->plines);
-        while (pl_iter) {
-            // Grab the pipeline and set it, and set the viewport/scissor
-            auto pipeline = &dev->pipelines[pl_iter->val->plinfo->plind];
-            vkCmdBindPipeline(cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->hndl);
+intern u32 add_cull_entry(static_model_cull_info *cull, sizet transform_ind, const bbox &local_bounds)
+{
+    if (cull->free_entries.size > 0) {
+        u32 ind = cull->free_entries[cull->free_entries.size - 1];
+        arr_pop_back(&cull->free_entries);
+        cull->transform_inds[ind] = (u32)transform_ind;
+        cull->local_bounds[ind] = local_bounds;
+        return ind;
+    }
+    u32 ind = (u32)cull->transform_inds.size;
+    arr_push_back(&cull->transform_inds, (u32)transform_ind);
+    arr_push_back(&cull->local_bounds, local_bounds);
+    return ind;
+}
 
-            auto ds = cur_frame->desc_pool.desc_sets[pl_iter->val->set_layouti].hndl;
-            vkCmdBindDescriptorSets(
-                cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout_hndl, DESCRIPTOR_SET_LAYOUT_PIPELINE, 1, &ds, 0, nullptr);
+// No packets may reference the entry after it is released
+intern void release_cull_entry(static_model_cull_info *cull, u32 ind)
+{
+    cull->transform_inds[ind] = INVALID_ID;
+    arr_push_back(&cull->free_entries, ind);
+}
 
-            VkViewport viewport{};
-            viewport.x = 0.0f;
-            viewport.y = 0.0f;
-            viewport.width = (float)fb->size.w;
-            viewport.height = (float)fb->size.h;
+// Compute the world space center and half extents of every entry from its transform. Entries without a valid transform
+// get infinite extents so they are never culled.
+intern void update_cull_world_bounds(static_model_cull_info *cull)
+{
+    sizet count = cull->transform_inds.size;
+    sizet padded = (count + 3) & ~(sizet)3;
+    arr_resize(&cull->center_x, padded, 0.0f);
+    arr_resize(&cull->center_y, padded, 0.0f);
+    arr_resize(&cull->center_z, padded, 0.0f);
+    arr_resize(&cull->ext_x, padded, 0.0f);
+    arr_resize(&cull->ext_y, padded, 0.0f);
+    arr_resize(&cull->ext_z, padded, 0.0f);
+    arr_resize(&cull->visible, padded, (u8)0);
+
+    f32 *centers[3] = {cull->center_x.data, cull->center_y.data, cull->center_z.data};
+    f32 *exts[3] = {cull->ext_x.data, cull->ext_y.data, cull->ext_z.data};
+    for (sizet i = 0; i < count; ++i) {
+        u32 tfi = cull->transform_inds[i];
+        if (!cull->transforms || tfi >= cull->transforms->entries.size) {
+            for (int r = 0; r < 3; ++r) {
+                centers[r][i] = 0.0f;
+                exts[r][i] = std::numeric_limits<f32>::max();
+            }
+            continue;
+        }
+
+        const mat4 &tf = cull->transforms->entries[tfi].cached;
+        vec3 c = math::center(cull->local_bounds[i]);
+        vec3 e = math::extents(cull->local_bounds[i]);
+        for (int r = 0; r < 3; ++r) {
+            centers[r][i] = tf[r][0] * c.x + tf[r][1] * c.y + tf[r][2] * c.z + tf[r][3];
+            exts[r][i] = std::abs(tf[r][0]) * e.x + std::abs(tf[r][1]) * e.y + std::abs(tf[r][2]) * e.z;
+        }
+    }
+}
+
+// Test the world bounds against each frustum plane - a box is outside a plane if the distance from its center is less
+// than the negative of its projected radius (the half extents projected on to the plane normal)
+intern void cull_against_frustum(static_model_cull_info *cull, const frustum &fr)
+{
+    sizet count = cull->transform_inds.size;
+    sizet vis_count = 0;
+#if NOBLE_STEED_SIMD
+    __m128 zero = _mm_setzero_ps();
+    __m128 sign_mask = _mm_set1_ps(-0.0f);
+    __m128 nx[FRUSTUM_PLANE_COUNT], ny[FRUSTUM_PLANE_COUNT], nz[FRUSTUM_PLANE_COUNT], nw[FRUSTUM_PLANE_COUNT];
+    for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+        nx[p] = _mm_set1_ps(fr.planes[p].x);
+        ny[p] = _mm_set1_ps(fr.planes[p].y);
+        nz[p] = _mm_set1_ps(fr.planes[p].z);
+        nw[p] = _mm_set1_ps(fr.planes[p].w);
+    }
+
+    for (sizet i = 0; i < count; i += 4) {
+        __m128 cx = _mm_loadu_ps(&cull->center_x[i]);
+        __m128 cy = _mm_loadu_ps(&cull->center_y[i]);
+        __m128 cz = _mm_loadu_ps(&cull->center_z[i]);
+        __m128 ex = _mm_loadu_ps(&cull->ext_x[i]);
+        __m128 ey = _mm_loadu_ps(&cull->ext_y[i]);
+        __m128 ez = _mm_loadu_ps(&cull->ext_z[i]);
+        __m128 outside = zero;
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT; ++p) {
+            __m128 dist = _mm_add_ps(_mm_add_ps(_mm_mul_ps(nx[p], cx), _mm_mul_ps(ny[p], cy)), _mm_add_ps(_mm_mul_ps(nz[p], cz), nw[p]));
+            __m128 rad = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_andnot_ps(sign_mask, nx[p]), ex), _mm_mul_ps(_mm_andnot_ps(sign_mask, ny[p]), ey)),
+                                    _mm_mul_ps(_mm_andnot_ps(sign_mask, nz[p]), ez));
+            outside = _mm_or_ps(outside, _mm_cmplt_ps(_mm_add_ps(dist, rad), zero));
+        }
+        int mask = _mm_movemask_ps(outside);
+        sizet lanes = std::min<sizet>(4, count - i);
+        for (sizet l = 0; l < lanes; ++l) {
+            u8 vis = !((mask >> l) & 1);
+            cull->visible[i + l] = vis;
+            vis_count += vis;
+        }
+    }
+#else
+    for (sizet i = 0; i < count; ++i) {
+        bool vis = true;
+        for (int p = 0; p < FRUSTUM_PLANE_COUNT && vis; ++p) {
+            const vec4 &pl = fr.planes[p];
+            f32 dist = pl.x * cull->center_x[i] + pl.y * cull->center_y[i] + pl.z * cull->center_z[i] + pl.w;
+            f32 rad = std::abs(pl.x) * cull->ext_x[i] + std::abs(pl.y) * cull->ext_y[i] + std::abs(pl.z) * cull->ext_z[i];
+            vis = (dist + rad >= 0.0f);
+        }
+        cull->visible[i] = vis;
+        vis_count += vis;
+    }
+#endif
+    cull->visible_count = vis_count;
+}
+
+intern void run_occ_raster_job(void *user, sizet job_ind, sizet)
+{
+    auto oc = (occlusion_culler *)user;
+    u32 first = (u32)job_ind * OCC_TILES_PER_JOB;
+    occ_rasterize_tiles(oc, first, std::min(OCC_TILES_PER_JOB, (u32)oc->tiles.size - first));
+}
+
+// Rasterize the occluders and test the boxes that survived the frustum cull against the depth pyramid. Tiles touch
+// separate pixels so ranges of them are rasterized across the job pool threads.
+intern void cull_occluded(static_model_cull_info *cull, const mat4 &proj_view, job_pool *jobs)
+{
+    cull->occluded_count = 0;
+    if (cull->occluders.size == 0 || !cull->transforms) {
+        return;
+    }
+
+    occ_begin_frame(&cull->occ, proj_view);
+    for (sizet i = 0; i < cull->occluders.size; ++i) {
+        auto occ = &cull->occluders[i];
+        if (occ->transform_ind < cull->transforms->entries.size) {
+            occ_add_occluder(&cull->occ, occ->msh, cull->transforms->entries[occ->transform_ind].cached);
+        }
+    }
+    if (jobs->thread_count > 0) {
+        u32 job_count = ((u32)cull->occ.tiles.size + OCC_TILES_PER_JOB - 1) / OCC_TILES_PER_JOB;
+        job_pool_run(jobs, job_count, run_occ_raster_job, &cull->occ);
+        occ_build_hiz(&cull->occ);
+    }
+    else {
+        occ_rasterize(&cull->occ);
+    }
+
+    sizet count = cull->transform_inds.size;
+    for (sizet i = 0; i < count; ++i) {
+        // Entries without a transform have infinite extents and are never culled
+        if (!cull->visible[i] || cull->ext_x[i] == std::numeric_limits<f32>::max()) {
+            continue;
+        }
+        vec3 c{cull->center_x[i], cull->center_y[i], cull->center_z[i]};
+        vec3 e{cull->ext_x[i], cull->ext_y[i], cull->ext_z[i]};
+        if (!occ_test_aabb(&cull->occ, bbox{c - e, c + e})) {
+            cull->visible[i] = 0;
+            ++cull->occluded_count;
+        }
+    }
+    cull->visible_count -= cull->occluded_count;
+}
+
+// LSD radix sort on the keys, one byte per pass. Passes where every key has the same byte are skipped, so key bits that
+// don't vary this frame (like the chunk bits with a single geometry chunk) cost nothing.
+intern void radix_sort(array<draw_sort_item> *items, array<draw_sort_item> *scratch)
+{
+    arr_resize(scratch, items->size);
+    draw_sort_item *src = items->data, *dst = scratch->data;
+    for (u32 shift = 0; shift < 64; shift += 8) {
+        sizet offsets[256]{};
+        for (sizet i = 0; i < items->size; ++i) {
+            ++offsets[(src[i].key >> shift) & 0xff];
+        }
+        if (items->size == 0 || offsets[(src[0].key >> shift) & 0xff] == items->size) {
+            continue;
+        }
+        sizet total = 0;
+        for (int b = 0; b < 256; ++b) {
+            sizet cnt = offsets[b];
+            offsets[b] = total;
+            total += cnt;
+        }
+        for (sizet i = 0; i < items->size; ++i) {
+            dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+        }
+        std::swap(src, dst);
+    }
+
+    // An odd number of passes leaves the result in the scratch array
+    if (src != items->data) {
+        swap(items, scratch);
+    }
+}
+
+// Map view space depth to the depth key bits - anything beyond the far plane lands in the last bucket
+intern u64 depth_bucket(f32 view_z, f32 far_z)
+{
+    f32 max_bucket = (f32)((1u << DRAW_KEY_DEPTH_BITS) - 1);
+    f32 t = (far_z > 0.0f) ? std::clamp(view_z / far_z, 0.0f, 1.0f) : 0.0f;
+    return (u64)(t * max_bucket) << DRAW_KEY_DEPTH_SHIFT;
+}
+
+// Coarsest LOD whose error projects to at most max_px_error pixels. The error is scaled to world units by the ratio of
+// the world to local bounds, and the distance is to the front of the bounds so the LOD is never coarser than the
+// nearest part of the submesh needs. Entries without a transform always get LOD 0.
+intern u32 select_lod(const static_model_cull_info *cull, u32 ci, const draw_call *dc, f32 view_z, f32 px_per_unit, f32 max_px_error)
+{
+    if (dc->lod_count < 2 || max_px_error <= 0.0f || cull->ext_x[ci] == std::numeric_limits<f32>::max()) {
+        return 0;
+    }
+    f32 local_radius = math::length(math::extents(cull->local_bounds[ci]));
+    if (local_radius <= 0.0f) {
+        return 0;
+    }
+    f32 world_radius = math::length(vec3{cull->ext_x[ci], cull->ext_y[ci], cull->ext_z[ci]});
+    f32 dist = view_z - world_radius;
+    if (dist <= 0.0f) {
+        return 0;
+    }
+
+    f32 px_per_local_unit = px_per_unit * (world_radius / local_radius) / dist;
+    u32 lod = 0;
+    while (lod + 1 < dc->lod_count && dc->lods[lod + 1].error * px_per_local_unit <= max_px_error) {
+        ++lod;
+    }
+    return lod;
+}
+
+intern bool gpu_cull_enabled(const renderer *rndr)
+{
+    return rndr->gpu_cull && rndr->indirect_draws && is_valid(rndr->gpu_cull_plind);
+}
+
+// Run the frustum and occlusion culls for this frame, then fill the visible list with the keys of every packet that
+// survived and sort it. If there is no camera nothing is culled and the depth bits are left at zero. With GPU culling
+// the frustum test is left to the cull pass, so only the planes are stored here.
+intern void cull_static_models(renderer *rndr, const camera *cam)
+{
+    auto cull = &rndr->dcs.cull;
+    update_cull_world_bounds(cull);
+    rndr->dcs.gpu_cull_frustum = {};
+    if (cam && gpu_cull_enabled(rndr)) {
+        rndr->dcs.gpu_cull_frustum = camera_frustum(cam);
+        memset(cull->visible.data, 1, arr_sizeof(cull->visible));
+        cull->visible_count = cull->transform_inds.size;
+        cull_occluded(cull, cam->proj * cam->view, &rndr->jobs);
+    }
+    else if (cam) {
+        cull_against_frustum(cull, camera_frustum(cam));
+        cull_occluded(cull, cam->proj * cam->view, &rndr->jobs);
+    }
+    else {
+        memset(cull->visible.data, 1, arr_sizeof(cull->visible));
+        cull->visible_count = cull->transform_inds.size;
+        cull->occluded_count = 0;
+    }
+
+    // Pixels covered by one world unit at a distance of one unit along the camera's forward axis
+    f32 px_per_unit = 0.0f;
+    if (cam) {
+        px_per_unit = (f32)cam->vp_size.h / (2.0f * math::tan(cam->fov * 0.5f * math::TO_RADS));
+    }
+
+    auto dcs = &rndr->dcs;
+    arr_clear(&dcs->visible);
+    arr_reserve(&dcs->visible, dcs->packets.size);
+    for (u32 pi = 0; pi < dcs->packets.size; ++pi) {
+        const draw_packet *pkt = &dcs->packets[pi];
+        u32 ci = pkt->dc.cull_ind;
+        if ((pkt->dc.flags & (DRAW_CALL_FLAG_HIDDEN | DRAW_CALL_FLAG_FREE)) || !cull->visible[ci]) {
+            continue;
+        }
+        u64 key = pkt->key;
+        u32 lod = 0;
+        if (cam) {
+            // Row 2 of the view matrix gives the distance along the camera's forward axis
+            const vec4 &fwd = cam->view[2];
+            f32 view_z = fwd.x * cull->center_x[ci] + fwd.y * cull->center_y[ci] + fwd.z * cull->center_z[ci] + fwd.w;
+            key |= depth_bucket(view_z, cam->near_far.y);
+            lod = select_lod(cull, ci, &pkt->dc, view_z, px_per_unit, rndr->lod_pixel_error);
+            if (lod > 0) {
+                key = (key & ~DRAW_KEY_GEOMETRY_MASK) | ((u64)pkt->dc.lods[lod].geometry_id << DRAW_KEY_GEOMETRY_SHIFT);
+            }
+        }
+        arr_push_back(&dcs->visible, {key, pi, lod});
+    }
+    radix_sort(&dcs->visible, &dcs->sort_scratch);
+}
+
+intern renderer_fif_data *get_current_frame(renderer *rndr)
+{
+    // Grab the current in flight frame and its command buffer
+    int current_frame_ind = rndr->finished_frames % MAX_FRAMES_IN_FLIGHT;
+    return &rndr->per_frame_data[current_frame_ind];
+}
+
+intern renderer_fif_data *get_previous_frame(renderer *rndr)
+{
+    // Grab the current in flight frame and its command buffer
+    int prev_frame_ind = (rndr->finished_frames - 1) % MAX_FRAMES_IN_FLIGHT;
+    return &rndr->per_frame_data[prev_frame_ind];
+}
+
+intern void write_frame_ubo(renderer *rndr, renderer_fif_data *fd)
+{
+    sizet align = vkr_min_uniform_buffer_offset_alignment(&rndr->vk);
+    fd->frame_ubo = vkr_frame_ring_alloc(&fd->vkf->ring, &rndr->vk, sizeof(frame_ubo_data), align);
+    if (fd->frame_ubo.ptr) {
+        auto ubo = (frame_ubo_data *)fd->frame_ubo.ptr;
+        ubo->frame_count = {(s32)rndr->finished_frames, 0, 0, 0};
+    }
+}
+
+// Split the sorted visible list in to batches - runs of packets with the same key down to the geometry bits are the
+// same submesh drawn with the same state, so they are drawn as one instanced draw. The indirect draw command for each
+// batch is written to the frame's indirect buffer. Without GPU culling the transform and material index of each instance
+// are written to the instance buffer here, otherwise a cull candidate is written for it and the cull pass fills in the instances
+// and instance counts. The buffers are allocated from the frame ring sized for the visible list.
+intern void write_draw_batches(renderer *rndr, renderer_fif_data *fd)
+{
+    auto dcs = &rndr->dcs;
+    auto cull = &dcs->cull;
+    auto ring = &fd->vkf->ring;
+    bool gpu_cull = gpu_cull_enabled(rndr);
+
+    arr_clear(&dcs->batches);
+    dcs->gpu_cull_candidate_count = 0;
+
+    // Descriptors can't have an empty range so always allocate at least one of each
+    sizet sb_align = vkr_min_storage_buffer_offset_alignment(&rndr->vk);
+    sizet max_insts = std::max<sizet>(std::min(dcs->visible.size, MAX_OBJECT_COUNT), 1);
+    sizet max_draws = std::min(max_insts, MAX_DRAW_COUNT);
+    fd->instances = vkr_frame_ring_alloc(ring, &rndr->vk, max_insts * sizeof(draw_instance), sb_align);
+    fd->draw_cmds = vkr_frame_ring_alloc(ring, &rndr->vk, max_draws * sizeof(VkDrawIndexedIndirectCommand), sb_align);
+    fd->cull_candidates = {};
+    if (gpu_cull) {
+        fd->cull_candidates = vkr_frame_ring_alloc(ring, &rndr->vk, max_insts * sizeof(gpu_cull_candidate), sb_align);
+    }
+    if (!fd->instances.ptr || !fd->draw_cmds.ptr || (gpu_cull && !fd->cull_candidates.ptr)) {
+        wlog("Failed to allocate draw buffers from the frame ring - skipping %lu draws", dcs->visible.size);
+        return;
+    }
+
+    // Growing the ring for a later allocation moves the earlier ones, so get the pointers after allocating everything
+    char *ring_data = (char *)rndr->vk.inst.device.buffers[ring->buf_ind].mem_info.pMappedData;
+    auto insts = (draw_instance *)(ring_data + fd->instances.offset);
+    auto cmds = (VkDrawIndexedIndirectCommand *)(ring_data + fd->draw_cmds.offset);
+    auto candidates = (gpu_cull_candidate *)(ring_data + fd->cull_candidates.offset);
+
+    u32 inst_count = 0;
+    sizet vi = 0;
+    while (vi < dcs->visible.size) {
+        if (dcs->batches.size == max_draws || inst_count == max_insts) {
+            wlog("Draw or instance buffer is full - skipping the remaining %lu draws", dcs->visible.size - vi);
+            break;
+        }
+
+        draw_batch batch{dcs->visible[vi].packet, dcs->visible[vi].lod, inst_count, 0};
+        u32 draw_ind = (u32)dcs->batches.size;
+        u64 batch_prefix = dcs->visible[vi].key >> DRAW_KEY_GEOMETRY_SHIFT;
+        while (vi < dcs->visible.size && (dcs->visible[vi].key >> DRAW_KEY_GEOMETRY_SHIFT) == batch_prefix &&
+               inst_count < max_insts) {
+            const draw_call *dc = &dcs->packets[dcs->visible[vi].packet].dc;
+            if (gpu_cull) {
+                u32 ci = dc->cull_ind;
+                vec3 e{cull->ext_x[ci], cull->ext_y[ci], cull->ext_z[ci]};
+                f32 radius = (e.x == std::numeric_limits<f32>::max()) ? e.x : math::length(e);
+                auto cand = &candidates[inst_count];
+                cand->center_radius = {cull->center_x[ci], cull->center_y[ci], cull->center_z[ci], radius};
+                cand->transform_ind = (u32)dc->ubo_offset;
+                cand->draw_ind = draw_ind;
+                cand->mat_ind = dc->mat_ind;
+            }
+            else {
+                insts[inst_count] = {(u32)dc->ubo_offset, dc->mat_ind};
+            }
+            ++inst_count;
+            ++vi;
+        }
+        batch.instance_count = inst_count - batch.first_instance;
+
+        if (rndr->indirect_draws) {
+            const draw_call *dc = &dcs->packets[batch.packet].dc;
+            auto cmd = &cmds[draw_ind];
+            cmd->indexCount = dc->lods[batch.lod].index_count;
+            cmd->instanceCount = (gpu_cull) ? 0 : batch.instance_count;
+            cmd->firstIndex = dc->lods[batch.lod].first_index;
+            cmd->vertexOffset = (s32)dc->vertex_offset;
+            cmd->firstInstance = batch.first_instance;
+        }
+        arr_push_back(&dcs->batches, batch);
+    }
+
+    if (gpu_cull) {
+        dcs->gpu_cull_candidate_count = inst_count;
+    }
+}
+
+// Frustum cull the candidates in to the instance buffer and indirect draw commands, and make the results visible to the
+// indirect draws and vertex shaders
+intern void record_gpu_cull(renderer *rndr, vkr_frame *cur_frame, vkr_command_buffer *cmd_buf)
+{
+    auto dev = &rndr->vk.inst.device;
+    auto dcs = &rndr->dcs;
+    auto pipeline = &dev->pipelines[rndr->gpu_cull_plind];
+    vkCmdBindPipeline(cmd_buf->hndl, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->hndl);
+
+    auto ds = cur_frame->desc_pool.desc_sets[dcs->gpu_cull_set].hndl;
+    vkCmdBindDescriptorSets(cmd_buf->hndl, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline->layout_hndl, 0, 1, &ds, 0, nullptr);
+
+    gpu_cull_push_constants pc{};
+    for (int i = 0; i < FRUSTUM_PLANE_COUNT; ++i) {
+        pc.planes[i] = dcs->gpu_cull_frustum.planes[i];
+    }
+    pc.counts.x = dcs->gpu_cull_candidate_count;
+    vkCmdPushConstants(cmd_buf->hndl, pipeline->layout_hndl, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof(gpu_cull_push_constants), &pc);
+    vkCmdDispatch(cmd_buf->hndl, (dcs->gpu_cull_candidate_count + GPU_CULL_GROUP_SIZE - 1) / GPU_CULL_GROUP_SIZE, 1, 1);
+
+    VkMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmd_buf->hndl,
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                         VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT,
+                         0,
+                         1,
+                         &barrier,
+                         0,
+                         nullptr,
+                         0,
+                         nullptr);
+}
+
+// Bind the vertex/index buffers of the geometry chunk - the bindings are command buffer state so they carry over render
+// passes
+intern void bind_geometry_chunk(renderer *rndr, vkr_command_buffer *cmd_buf, u32 chunk_ind)
+{
+    auto dev = &rndr->vk.inst.device;
+    auto chunk = &rndr->rmi.chunks[chunk_ind];
+    VkBuffer vert_bufs[] = {dev->buffers[chunk->verts.buf_ind].hndl};
+    VkDeviceSize offsets[] = {0};
+    vkCmdBindVertexBuffers(cmd_buf->hndl, 0, 1, vert_bufs, offsets);
+    VkIndexType ind_type = (chunk->wide_inds) ? VK_INDEX_TYPE_UINT32 : VK_INDEX_TYPE_UINT16;
+    vkCmdBindIndexBuffer(cmd_buf->hndl, dev->buffers[chunk->inds.buf_ind].hndl, 0, ind_type);
+}
+
+// Record the draw batches in [first_batch, end_batch) of the render pass - the render pass must already be begun on
+// cmd_buf (or cmd_buf is a secondary buffer continuing it). Every bit of state is bound from scratch so ranges can be
+// recorded in to separate command buffers on separate threads - nothing here writes to the renderer.
+intern void record_draw_batches(renderer *rndr,
+                                const vkr_framebuffer *fb,
+                                vkr_frame *cur_frame,
+                                vkr_command_buffer *cmd_buf,
+                                const draw_rpass_entry *rpe,
+                                sizet first_batch,
+                                sizet end_batch,
+                                u32 first_scope)
+{
+    auto dev = &rndr->vk.inst.device;
+    auto dcs = &rndr->dcs;
+    auto fd = get_current_frame(rndr);
+    auto indirect_buf = &dev->buffers[cur_frame->ring.buf_ind];
+    VkDescriptorSet bindless_ds{VK_NULL_HANDLE};
+    if (rndr->bindless) {
+        bindless_ds = rndr->bindless_pool.desc_sets[fd->bindless_set].hndl;
+    }
+    bool multi_draw = rndr->vk.inst.pdev_info.features.multiDrawIndirect;
+
+    // Bind frame rpass descriptor set
+    auto frame_ds = cur_frame->desc_pool.desc_sets[rpe->frame_set].hndl;
+    vkCmdBindDescriptorSets(cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, G_FRAME_PL_LAYOUT, DESCRIPTOR_SET_LAYOUT_FRAME, 1, &frame_ds, 0, nullptr);
+    auto obj_ds = cur_frame->desc_pool.desc_sets[rpe->obj_set].hndl;
+
+    const vkr_pipeline *pipeline{};
+    u64 cur_pl_prefix = (u64)-1;
+    u64 cur_group_prefix = (u64)-1;
+    u32 cur_chunk = INVALID_ID;
+    u32 cur_scope = INVALID_ID;
+    sizet bi = first_batch;
+    while (bi < end_batch) {
+        const draw_packet *pkt = &dcs->packets[dcs->batches[bi].packet];
+        u64 key = pkt->key;
+        const draw_group *grp = &dcs->groups[pkt->group];
+
+        // Pipeline changed - bind it along with its descriptor set, and set the viewport/scissor
+        if ((key >> DRAW_KEY_PIPELINE_SHIFT) != cur_pl_prefix) {
+            cur_pl_prefix = key >> DRAW_KEY_PIPELINE_SHIFT;
+            pipeline = &dev->pipelines[grp->plinfo->plind];
+
+            // Each pipeline run gets the next of the scopes added for the batches by add_pipeline_scopes
+            if (is_valid(first_scope)) {
+                if (is_valid(cur_scope)) {
+                    gprof_write_end(&rndr->gprof, cmd_buf->hndl, cur_scope++);
+                }
+                else {
+                    cur_scope = first_scope;
+                }
+                gprof_write_begin(&rndr->gprof, cmd_buf->hndl, cur_scope);
+            }
+            vkCmdBindPipeline(cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->hndl);
+
+            auto ds = cur_frame->desc_pool.desc_sets[grp->pl_set].hndl;
+            vkCmdBindDescriptorSets(
+                cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout_hndl, DESCRIPTOR_SET_LAYOUT_PIPELINE, 1, &ds, 0, nullptr);
+            vkCmdBindDescriptorSets(
+                cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout_hndl, DESCRIPTOR_SET_LAYOUT_OBJECT, 1, &obj_ds, 0, nullptr);
+
+            VkViewport viewport{};
+            viewport.x = 0.0f;
+            viewport.y = 0.0f;
+            viewport.width = (float)fb->size.w;
+            viewport.height = (float)fb->size.h;
             viewport.minDepth = 0.0f;
             viewport.maxDepth = 1.0f;
             vkCmdSetViewport(cmd_buf->hndl, 0, 1, &viewport);
@@ -1063,69 +1994,540 @@ intern int record_command_buffer(renderer *rndr, vkr_framebuffer *fb, vkr_frame
             scissor.offset = {0, 0};
             scissor.extent = {fb->size.w, fb->size.h};
             vkCmdSetScissor(cmd_buf->hndl, 0, 1, &scissor);
+        }
 
-            auto mat_iter = hmap_begin(&pl_iter->val->mats);
-            while (mat_iter) {
-                // Bind the material set
-                auto ds = cur_frame->desc_pool.desc_sets[mat_iter->val->set_layouti].hndl;
-                vkCmdBindDescriptorSets(
-                    cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout_hndl, DESCRIPTOR_SET_LAYOUT_MATERIAL, 1, &ds, 0, nullptr);
-
-                for (u32 dci = 0; dci < mat_iter->val->dcs.size; ++dci) {
-                    const draw_call *cur_dc = &mat_iter->val->dcs[dci];
-                    auto ds = cur_frame->desc_pool.desc_sets[rpass_iter->val->obj_set_layouti].hndl;
-                    sizet obj_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(obj_ubo_data));
-                    // Our dynamic ubo_offset in to our singlestoring all of our transforms is computed by adding
-                    // the material base draw call ubo_offset (computed each frame).
-                    u32 dyn_offset = (u32)(obj_ubo_item_size * cur_dc->ubo_offset);
-                    vkCmdBindDescriptorSets(cmd_buf->hndl,
-                                            VK_PIPELINE_BIND_POINT_GRAPHICS,
-                                            pipeline->layout_hndl,
-                                            DESCRIPTOR_SET_LAYOUT_OBJECT,
-                                            1,
-                                            &ds,
-                                            1,
-                                            &dyn_offset);
-
-                    push_constants pc{3};
-                    vkCmdPushConstants(cmd_buf->hndl, pipeline->layout_hndl, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push_constants), &pc);
-                    vkCmdDrawIndexed(cmd_buf->hndl,
-                                     cur_dc->index_count,
-                                     cur_dc->instance_count,
-                                     cur_dc->first_index,
-                                     cur_dc->vertex_offset,
-                                     cur_dc->first_instance);
+        // Material changed - bind the material set. With bindless materials the material bits are always zero so
+        // this binds the bindless set once per pipeline.
+        if ((key >> DRAW_KEY_MATERIAL_SHIFT) != cur_group_prefix) {
+            cur_group_prefix = key >> DRAW_KEY_MATERIAL_SHIFT;
+            auto ds = (grp->mi) ? cur_frame->desc_pool.desc_sets[grp->mat_set].hndl : bindless_ds;
+            vkCmdBindDescriptorSets(
+                cmd_buf->hndl, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline->layout_hndl, DESCRIPTOR_SET_LAYOUT_MATERIAL, 1, &ds, 0, nullptr);
+        }
+
+        // Geometry chunk changed - bind its vertex/index buffers. Batches are sorted by chunk within each material so
+        // this happens at most once per chunk per material.
+        if (pkt->dc.chunk != cur_chunk) {
+            cur_chunk = pkt->dc.chunk;
+            bind_geometry_chunk(rndr, cmd_buf, cur_chunk);
+        }
+
+        push_constants pc{3};
+        vkCmdPushConstants(cmd_buf->hndl, pipeline->layout_hndl, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof(push_constants), &pc);
+
+        // All batches of the material in the same chunk are contiguous in the indirect buffer so they go out in one
+        // indirect draw when the device supports multi draw indirect
+        if (rndr->indirect_draws) {
+            sizet run_first = bi;
+            u64 chunk_prefix = key >> DRAW_KEY_CHUNK_SHIFT;
+            while (bi < end_batch && (dcs->packets[dcs->batches[bi].packet].key >> DRAW_KEY_CHUNK_SHIFT) == chunk_prefix) {
+                ++bi;
+            }
+            VkDeviceSize offset = fd->draw_cmds.offset + run_first * sizeof(VkDrawIndexedIndirectCommand);
+            if (multi_draw) {
+                vkCmdDrawIndexedIndirect(cmd_buf->hndl, indirect_buf->hndl, offset, (u32)(bi - run_first), sizeof(VkDrawIndexedIndirectCommand));
+            }
+            else {
+                for (sizet i = run_first; i < bi; ++i) {
+                    vkCmdDrawIndexedIndirect(
+                        cmd_buf->hndl, indirect_buf->hndl, fd->draw_cmds.offset + i * sizeof(VkDrawIndexedIndirectCommand), 1, 0);
                 }
-                mat_iter = hmap_next(&pl_iter->val->mats, mat_iter);
             }
-            pl_iter = hmap_next(&rpass_iter->val->plines, pl_iter);
         }
+        else {
+            const draw_batch *batch = &dcs->batches[bi];
+            const draw_lod *lod = &pkt->dc.lods[batch->lod];
+            vkCmdDrawIndexed(cmd_buf->hndl, lod->index_count, batch->instance_count, lod->first_index, pkt->dc.vertex_offset, batch->first_instance);
+            ++bi;
+        }
+    }
+    if (is_valid(cur_scope)) {
+        gprof_write_end(&rndr->gprof, cmd_buf->hndl, cur_scope);
+    }
+}
 
-        // If we are on the imgui rpass, render its stuff. It has it's own pipeling, vertex/index buffers, etc
-        if (rpass == rndr->imgui.rpass) {
-            auto img_data = ImGui::GetDrawData();
-            ImGui_ImplVulkan_RenderDrawData(img_data, cmd_buf->hndl);
+// Add a GPU profiler scope for each run of batches with the same pipeline in [first_batch, end_batch) so the runs can
+// be timed while recording on any thread - returns the first scope or INVALID_ID if profiling is off or out of scopes
+intern u32 add_pipeline_scopes(renderer *rndr, sizet first_batch, sizet end_batch, u32 depth)
+{
+    auto dcs = &rndr->dcs;
+    if (!rndr->gprof.enabled || first_batch == end_batch) {
+        return INVALID_ID;
+    }
+
+    u32 count = 0;
+    u64 cur_pl_prefix = (u64)-1;
+    for (sizet bi = first_batch; bi < end_batch; ++bi) {
+        u64 prefix = dcs->packets[dcs->batches[bi].packet].key >> DRAW_KEY_PIPELINE_SHIFT;
+        count += (prefix != cur_pl_prefix);
+        cur_pl_prefix = prefix;
+    }
+
+    u32 first = gprof_add_scopes(&rndr->gprof, count, depth);
+    if (!is_valid(first)) {
+        return first;
+    }
+    u32 scope = first;
+    cur_pl_prefix = (u64)-1;
+    for (sizet bi = first_batch; bi < end_batch; ++bi) {
+        const draw_packet *pkt = &dcs->packets[dcs->batches[bi].packet];
+        if ((pkt->key >> DRAW_KEY_PIPELINE_SHIFT) != cur_pl_prefix) {
+            cur_pl_prefix = pkt->key >> DRAW_KEY_PIPELINE_SHIFT;
+            gprof_set_scope_id(&rndr->gprof, scope++, dcs->groups[pkt->group].plinfo->id);
+        }
+    }
+    return first;
+}
+
+// Index of the first batch after the ones in the render pass starting at first_batch
+intern sizet find_rpass_batch_end(const static_model_draw_info *dcs, const draw_rpass_entry *rpe, sizet first_batch)
+{
+    sizet bi = first_batch;
+    u64 rpass_bits = (u64)rpe->rpinfo->rpind;
+    while (bi < dcs->batches.size && (dcs->packets[dcs->batches[bi].packet].key >> DRAW_KEY_RPASS_SHIFT) == rpass_bits) {
+        ++bi;
+    }
+    return bi;
+}
+
+struct record_jobs_ctxt
+{
+    renderer *rndr;
+    u32 im_ind;
+    vkr_frame *cur_frame;
+    renderer_fif_data *fd;
+};
+
+intern void run_record_job(void *user, sizet job_ind, sizet thread_ind)
+{
+    auto ctxt = (record_jobs_ctxt *)user;
+    auto rndr = ctxt->rndr;
+    auto job = &rndr->record_jobs[job_ind];
+    auto rth = &ctxt->fd->record_threads[thread_ind];
+    auto dev = &rndr->vk.inst.device;
+
+    // Each thread only touches its own pool - enough buffers were added for it to take every job if it had to
+    asrt(rth->used_bufs < rth->pool.buffers.size);
+    vkr_command_buffer *cmd_buf = &rth->pool.buffers[rth->used_bufs++];
+    const draw_rpass_entry *rpe = &rndr->dcs.rpasses[job->rpass_entry];
+    auto fb = rg_get_framebuffer(&rndr->rgraph, dev, rpe->rpinfo->rg_pass, ctxt->im_ind);
+    job->cmd_buf = cmd_buf->hndl;
+    job->err = vkr_begin_secondary_cmd_buf(cmd_buf, &dev->render_passes[rpe->rpinfo->rpind], fb);
+    if (job->err != err_code::VKR_NO_ERROR) {
+        return;
+    }
+    record_draw_batches(rndr, fb, ctxt->cur_frame, cmd_buf, rpe, job->first_batch, job->end_batch, job->first_scope);
+    job->err = vkr_end_cmd_buf(cmd_buf);
+}
+
+// Make sure every recording thread's pool has at least count secondary buffers
+intern int reserve_record_cmd_bufs(renderer *rndr, renderer_fif_data *fd, sizet count)
+{
+    for (sizet ti = 0; ti < fd->record_threads.size; ++ti) {
+        auto pool = &fd->record_threads[ti].pool;
+        if (pool->buffers.size < count) {
+            auto res = vkr_add_cmd_bufs(pool, &rndr->vk, count - pool->buffers.size, VK_COMMAND_BUFFER_LEVEL_SECONDARY);
+            if (res.err_code != err_code::VKR_NO_ERROR) {
+                return res.err_code;
+            }
+        }
+    }
+    return err_code::VKR_NO_ERROR;
+}
+
+// Split each render pass's batches in to jobs of at least MIN_RECORD_JOB_BATCH_COUNT and record them in to secondary
+// command buffers across the job pool - returns false without recording anything if there aren't enough batches to be
+// worth it, in which case everything is recorded inline
+intern bool record_draw_jobs(renderer *rndr, u32 im_ind, vkr_frame *cur_frame, int *err)
+{
+    auto dcs = &rndr->dcs;
+    auto fd = get_current_frame(rndr);
+    *err = err_code::VKR_NO_ERROR;
+    if (!rndr->parallel_record || dcs->batches.size < MIN_RECORD_JOB_BATCH_COUNT * 2) {
+        return false;
+    }
+
+    arr_clear(&rndr->record_jobs);
+    sizet max_jobs_per_rpass = fd->record_threads.size * RECORD_JOBS_PER_THREAD;
+    sizet bi = 0;
+    for (sizet rpi = 0; rpi < dcs->rpasses.size; ++rpi) {
+        sizet end = find_rpass_batch_end(dcs, &dcs->rpasses[rpi], bi);
+        sizet count = end - bi;
+        sizet job_count = std::min(std::max<sizet>(count / MIN_RECORD_JOB_BATCH_COUNT, 1), max_jobs_per_rpass);
+        for (sizet ji = 0; ji < job_count && count > 0; ++ji) {
+            record_job job{};
+            job.rpass_entry = (u32)rpi;
+            job.first_batch = (u32)(bi + count * ji / job_count);
+            job.end_batch = (u32)(bi + count * (ji + 1) / job_count);
+            // The jobs run before the render pass scopes are begun, so their scopes go one level below the current one
+            job.first_scope = add_pipeline_scopes(rndr, job.first_batch, job.end_batch, rndr->gprof.depth + 1);
+            arr_push_back(&rndr->record_jobs, job);
+        }
+        bi = end;
+    }
+
+    // The calling thread also needs one for imgui
+    *err = reserve_record_cmd_bufs(rndr, fd, rndr->record_jobs.size + 1);
+    if (*err != err_code::VKR_NO_ERROR) {
+        return false;
+    }
+
+    record_jobs_ctxt ctxt{rndr, im_ind, cur_frame, fd};
+    job_pool_run(&rndr->jobs, rndr->record_jobs.size, run_record_job, &ctxt);
+    for (sizet ji = 0; ji < rndr->record_jobs.size; ++ji) {
+        if (rndr->record_jobs[ji].err != err_code::VKR_NO_ERROR) {
+            *err = rndr->record_jobs[ji].err;
+            return false;
+        }
+    }
+    return true;
+}
+
+intern void record_imgui(renderer *rndr, const vkr_command_buffer *cmd_buf)
+{
+    auto img_data = ImGui::GetDrawData();
+    ImGui_ImplVulkan_RenderDrawData(img_data, cmd_buf->hndl);
+}
+
+// Copy the offscreen color image (left in transfer src by the graph's final barriers) to the frame's readback buffer
+intern void record_readback(renderer *rndr, u32 im_ind, const vkr_command_buffer *cmd_buf)
+{
+    auto dev = &rndr->vk.inst.device;
+    auto fd = get_current_frame(rndr);
+    auto buf = &dev->buffers[fd->readback_buf_ind];
+    auto image = &dev->swapchain.images[im_ind];
+
+    VkBufferImageCopy region{};
+    region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.imageExtent = {image->dims.x, image->dims.y, 1};
+    vkCmdCopyImageToBuffer(cmd_buf->hndl, image->hndl, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buf->hndl, 1, &region);
+
+    // Make the copy visible to the host once the fence has signaled
+    VkBufferMemoryBarrier bar{};
+    bar.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    bar.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    bar.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    bar.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bar.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bar.buffer = buf->hndl;
+    bar.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(cmd_buf->hndl, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1, &bar, 0, nullptr);
+    fd->readback_pending = true;
+}
+
+intern int record_command_buffer(renderer *rndr, u32 im_ind, vkr_frame *cur_frame, vkr_command_buffer *cmd_buf)
+{
+    auto dev = &rndr->vk.inst.device;
+    auto rg = &rndr->rgraph;
+
+    int err = vkr_begin_cmd_buf(cmd_buf);
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+    gprof_begin_frame(&rndr->gprof, cmd_buf, rndr->finished_frames % MAX_FRAMES_IN_FLIGHT);
+    u32 frame_scope = gprof_begin(&rndr->gprof, cmd_buf, GPROF_FRAME_SCOPE);
+
+    // The cull pass has to run outside of a render pass
+    auto dcs = &rndr->dcs;
+    if (dcs->gpu_cull_candidate_count > 0) {
+        u32 cull_scope = gprof_begin(&rndr->gprof, cmd_buf, GPROF_GPU_CULL_SCOPE);
+        record_gpu_cull(rndr, cur_frame, cmd_buf);
+        gprof_end(&rndr->gprof, cmd_buf, cull_scope);
+    }
+
+    // With enough batches the draws are recorded in to secondary buffers on the job threads first, and each render pass
+    // executes its jobs' buffers in order
+    bool parallel = record_draw_jobs(rndr, im_ind, cur_frame, &err);
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+    VkSubpassContents contents = (parallel) ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS : VK_SUBPASS_CONTENTS_INLINE;
+    auto fd = get_current_frame(rndr);
+    auto main_rth = &fd->record_threads[fd->record_threads.size - 1];
+
+    // Passes are recorded in graph order, each after the barriers the graph derived for it. The graph creates render
+    // passes in the order they run so the draw render pass entries (sorted by render pass index) come in the same order.
+    // Render passes are begun even when all of their draws are culled so they still clear and draw imgui.
+    sizet bi = 0;
+    sizet ji = 0;
+    sizet rpi = 0;
+    for (u32 oi = 0; oi < rg->order.size; ++oi) {
+        u32 pass_ind = rg->order[oi];
+        auto pass = &rg->passes[pass_ind];
+        u32 pass_scope = gprof_begin(&rndr->gprof, cmd_buf, pass->id);
+        rg_record_pass_barriers(rg, dev, cmd_buf, pass_ind, im_ind);
+        if (!is_valid(pass->rpind)) {
+            gprof_end(&rndr->gprof, cmd_buf, pass_scope);
+            continue;
+        }
+
+        auto fb = rg_get_framebuffer(rg, dev, pass_ind, im_ind);
+        auto rpass = &dev->render_passes[pass->rpind];
+        vkr_cmd_begin_rpass(cmd_buf, fb, rpass, pass->clear_vals.data, (u32)pass->clear_vals.size, contents);
+
+        const draw_rpass_entry *rpe{};
+        if (rpi < dcs->rpasses.size && dcs->rpasses[rpi].rpinfo->rpind == pass->rpind) {
+            rpe = &dcs->rpasses[rpi];
+        }
+
+        if (parallel) {
+            static_array<VkCommandBuffer, (MAX_JOB_THREAD_COUNT + 1) * RECORD_JOBS_PER_THREAD + 1> secondaries{};
+            while (rpe && ji < rndr->record_jobs.size && rndr->record_jobs[ji].rpass_entry == rpi) {
+                arr_push_back(&secondaries, rndr->record_jobs[ji].cmd_buf);
+                ++ji;
+            }
+
+            // Imgui has to go in a secondary buffer as well since the render pass only takes secondaries
+            if (rpass == rndr->imgui.rpass) {
+                vkr_command_buffer *img_buf = &main_rth->pool.buffers[main_rth->used_bufs++];
+                err = vkr_begin_secondary_cmd_buf(img_buf, rpass, fb);
+                if (err != err_code::VKR_NO_ERROR) {
+                    return err;
+                }
+                record_imgui(rndr, img_buf);
+                err = vkr_end_cmd_buf(img_buf);
+                if (err != err_code::VKR_NO_ERROR) {
+                    return err;
+                }
+                arr_push_back(&secondaries, img_buf->hndl);
+            }
+            if (secondaries.size > 0) {
+                vkCmdExecuteCommands(cmd_buf->hndl, (u32)secondaries.size, secondaries.data);
+            }
+        }
+        else {
+            if (rpe) {
+                sizet end = find_rpass_batch_end(dcs, rpe, bi);
+                u32 first_scope = add_pipeline_scopes(rndr, bi, end, rndr->gprof.depth);
+                record_draw_batches(rndr, fb, cur_frame, cmd_buf, rpe, bi, end, first_scope);
+            }
+
+            // If we are on the imgui rpass, render its stuff. It has it's own pipeling, vertex/index buffers, etc
+            if (rpass == rndr->imgui.rpass) {
+                record_imgui(rndr, cmd_buf);
+            }
+        }
+        if (rpe) {
+            bi = find_rpass_batch_end(dcs, rpe, bi);
+            ++rpi;
+        }
+
+        vkr_cmd_end_rpass(cmd_buf);
+        gprof_end(&rndr->gprof, cmd_buf, pass_scope);
+    }
+
+    // Transitions the swapchain image for present, or the offscreen image for readback
+    rg_record_final_barriers(rg, dev, cmd_buf, im_ind);
+    if (rndr->headless && rndr->headless_readback) {
+        record_readback(rndr, im_ind, cmd_buf);
+    }
+    gprof_end(&rndr->gprof, cmd_buf, frame_scope);
+    return vkr_end_cmd_buf(cmd_buf);
+}
+
+intern void dirty_set_init(ubo_dirty_set *ds, mem_arena *arena)
+{
+    arr_init(&ds->bits, arena);
+    ds->count = 0;
+    ds->all = false;
+}
+
+intern void dirty_set_terminate(ubo_dirty_set *ds)
+{
+    arr_terminate(&ds->bits);
+}
+
+intern void dirty_set_clear(ubo_dirty_set *ds)
+{
+    if (ds->count > 0) {
+        memset(ds->bits.data, 0, ds->bits.size * sizeof(u64));
+    }
+    ds->count = 0;
+    ds->all = false;
+}
+
+intern void dirty_set_mark_range(ubo_dirty_set *ds, sizet first, sizet count)
+{
+    if (ds->all || count == 0) {
+        return;
+    }
+    sizet last = first + count - 1;
+    sizet first_word = first / 64;
+    sizet last_word = last / 64;
+    if (last_word >= ds->bits.size) {
+        arr_resize(&ds->bits, last_word + 1, (u64)0);
+    }
+    for (sizet w = first_word; w <= last_word; ++w) {
+        u64 mask = ~(u64)0;
+        if (w == first_word) {
+            mask &= ~(u64)0 << (first % 64);
+        }
+        if (w == last_word) {
+            mask &= ~(u64)0 >> (63 - last % 64);
+        }
+        ds->count += std::popcount(mask & ~ds->bits[w]);
+        ds->bits[w] |= mask;
+    }
+}
+
+intern void dirty_set_mark(ubo_dirty_set *ds, sizet ind)
+{
+    dirty_set_mark_range(ds, ind, 1);
+}
+
+intern void dirty_set_mark_all(ubo_dirty_set *ds)
+{
+    ds->all = true;
+}
+
+intern bool dirty_set_test(const ubo_dirty_set *ds, sizet ind)
+{
+    if (ds->all) {
+        return true;
+    }
+    sizet word = ind / 64;
+    return word < ds->bits.size && (ds->bits[word] & ((u64)1 << (ind % 64))) != 0;
+}
+
+// Find the next run of set bits starting at or after cursor and move the cursor past it - returns false when there are
+// no more set bits
+intern bool dirty_set_next_span(const ubo_dirty_set *ds, sizet *cursor, sizet *first, sizet *count)
+{
+    sizet bit_count = ds->bits.size * 64;
+    sizet i = *cursor;
+    while (i < bit_count) {
+        u64 word = ds->bits[i / 64] >> (i % 64);
+        if (word) {
+            i += std::countr_zero(word);
+            break;
+        }
+        i = (i / 64 + 1) * 64;
+    }
+    if (i >= bit_count) {
+        *cursor = bit_count;
+        return false;
+    }
+
+    *first = i;
+    while (i < bit_count) {
+        // Bits shifted in from the top are zero so they count as set, which just moves us on to the next word
+        u64 clear_bits = ~ds->bits[i / 64] >> (i % 64);
+        if (clear_bits) {
+            i += std::countr_zero(clear_bits);
+            break;
+        }
+        i = (i / 64 + 1) * 64;
+    }
+    *count = i - *first;
+    *cursor = i;
+    return true;
+}
+
+// Create a command pool for each recording thread in each frame in flight - parallel recording is turned off if the job
+// pool has no worker threads or a pool can't be created
+intern void init_record_threads(renderer *rndr, mem_arena *fl_arena)
+{
+    arr_init(&rndr->record_jobs, fl_arena);
+    if (rndr->jobs.thread_count == 0) {
+        rndr->parallel_record = false;
+    }
+
+    // The calling thread always gets a pool as it runs jobs too (and records imgui)
+    u32 fam_ind = rndr->vk.inst.device.qfams[VKR_QUEUE_FAM_TYPE_GFX].fam_ind;
+    sizet thread_count = (rndr->parallel_record) ? rndr->jobs.thread_count : 0;
+    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+        auto fd = &rndr->per_frame_data[fif_ind];
+        fd->record_threads.size = thread_count + 1;
+        for (sizet ti = 0; ti < fd->record_threads.size; ++ti) {
+            fd->record_threads[ti] = {};
+            if (vkr_init_cmd_pool(&rndr->vk, fam_ind, VK_COMMAND_POOL_CREATE_TRANSIENT_BIT, &fd->record_threads[ti].pool) !=
+                err_code::VKR_NO_ERROR) {
+                wlog("Failed to create recording thread command pool - recording on the main thread only");
+                rndr->parallel_record = false;
+            }
+        }
+    }
+    ilog("Parallel command buffer recording %s", (rndr->parallel_record) ? "enabled" : "disabled");
+}
+
+intern void terminate_record_threads(renderer *rndr)
+{
+    u32 fam_ind = rndr->vk.inst.device.qfams[VKR_QUEUE_FAM_TYPE_GFX].fam_ind;
+    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+        auto fd = &rndr->per_frame_data[fif_ind];
+        for (sizet ti = 0; ti < fd->record_threads.size; ++ti) {
+            if (fd->record_threads[ti].pool.hndl != VK_NULL_HANDLE) {
+                vkr_terminate_cmd_pool(&rndr->vk, fam_ind, &fd->record_threads[ti].pool);
+            }
+        }
+        fd->record_threads.size = 0;
+    }
+    arr_terminate(&rndr->record_jobs);
+}
+
+// Create the pipeline cache with the data saved by the last run if there is any - a missing or stale file only means
+// the driver compiles every pipeline from scratch
+intern void load_pipeline_cache(renderer *rndr)
+{
+    byte_array data{};
+    arr_init(&data, rndr->upstream_fl_arena);
+    if (rndr->pipeline_cache_fname) {
+        platform_file_err_desc err{};
+        read_file(rndr->pipeline_cache_fname, &data, 0, &err);
+        if (err.code != err_code::PLATFORM_NO_ERROR) {
+            ilog("No saved pipeline cache at %s (code %d): %s", rndr->pipeline_cache_fname, err.code, err.str);
+            arr_clear(&data);
         }
-
-        vkr_cmd_end_rpass(cmd_buf);
-        rpass_iter = hmap_next(&rndr->dcs.rpasses, rpass_iter);
     }
-
-    return vkr_end_cmd_buf(cmd_buf);
+    if (vkr_init_pipeline_cache(&rndr->vk, &data) != err_code::VKR_NO_ERROR) {
+        wlog("Pipelines will be created without a pipeline cache");
+    }
+    arr_terminate(&data);
 }
 
-intern renderer_fif_data *get_current_frame(renderer *rndr)
+intern void save_pipeline_cache(renderer *rndr)
 {
-    // Grab the current in flight frame and its command buffer
-    int current_frame_ind = rndr->finished_frames % MAX_FRAMES_IN_FLIGHT;
-    return &rndr->per_frame_data[current_frame_ind];
+    if (!rndr->pipeline_cache_fname || rndr->vk.inst.device.pipeline_cache == VK_NULL_HANDLE) {
+        return;
+    }
+    byte_array data{};
+    arr_init(&data, rndr->upstream_fl_arena);
+    if (vkr_get_pipeline_cache_data(&rndr->vk, &data) == err_code::VKR_NO_ERROR) {
+        platform_file_err_desc err{};
+        write_file(rndr->pipeline_cache_fname, &data, 0, &err);
+        if (err.code != err_code::PLATFORM_NO_ERROR) {
+            wlog("Error writing pipeline cache to %s (code %d): %s", rndr->pipeline_cache_fname, err.code, err.str);
+        }
+        else {
+            ilog("Saved %lu bytes of pipeline cache to %s", data.size, rndr->pipeline_cache_fname);
+        }
+    }
+    arr_terminate(&data);
 }
 
-intern renderer_fif_data *get_previous_frame(renderer *rndr)
+intern int init_readback_buffers(renderer *rndr)
 {
-    // Grab the current in flight frame and its command buffer
-    int prev_frame_ind = (rndr->finished_frames - 1) % MAX_FRAMES_IN_FLIGHT;
-    return &rndr->per_frame_data[prev_frame_ind];
+    auto dev = &rndr->vk.inst.device;
+    auto ext = dev->swapchain.extent;
+    vkr_buffer_cfg buf_cfg{};
+    buf_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+    buf_cfg.sharing_mode = VK_SHARING_MODE_EXCLUSIVE;
+    buf_cfg.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+    buf_cfg.alloc_flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_RANDOM_BIT;
+    buf_cfg.vma_alloc = &dev->vma_alloc;
+    buf_cfg.buffer_size = (sizet)ext.width * ext.height * 4;
+    for (int i = 0; i < rndr->per_frame_data.size; ++i) {
+        vkr_buffer buf{};
+        int err = vkr_init_buffer(&buf, &buf_cfg);
+        if (err != err_code::VKR_NO_ERROR) {
+            elog("Failed to create readback buffer for frame %d", i);
+            return err;
+        }
+        rndr->per_frame_data[i].readback_buf_ind = vkr_add_buffer(dev, buf);
+        rndr->per_frame_data[i].readback_pending = false;
+    }
+    ilog("Reading back headless frames of %u by %u", ext.width, ext.height);
+    return err_code::VKR_NO_ERROR;
 }
 
 int init_renderer(renderer *rndr, const handle<material> &default_mat, void *win_hndl, mem_arena *fl_arena)
@@ -1133,31 +2535,43 @@ int init_renderer(renderer *rndr, const handle<material> &default_mat, void *win
     asrt(fl_arena->alloc_type == mem_alloc_type::FREE_LIST);
     rndr->upstream_fl_arena = fl_arena;
     mem_init_fl_arena(&rndr->vk_free_list, 500 * MB_SIZE, fl_arena, "vk");
-    mem_init_lin_arena(&rndr->frame_linear, 10 * KB_SIZE, fl_arena, "frame");
+    mem_init_lin_arena(&rndr->frame_linear, 1 * MB_SIZE, fl_arena, "frame");
     mem_init_lin_arena(&rndr->vk_frame_linear, 10 * MB_SIZE, mem_global_stack_arena(), "vk-frame");
 
     hmap_init(&rndr->rpasses, hash_type, fl_arena);
+    init_render_graph(&rndr->rgraph, fl_arena);
     hmap_init(&rndr->pipelines, hash_type, fl_arena);
     hmap_init(&rndr->materials, hash_type, fl_arena);
     hmap_init(&rndr->sampled_textures, hash_type, fl_arena);
 
-    mem_init_lin_arena(&rndr->dcs.dc_linear, 100 * MB_SIZE, fl_arena, "dcs");
-    hmap_init(&rndr->dcs.rpasses);
+    arr_init(&rndr->dcs.rpasses, fl_arena);
+    arr_init(&rndr->dcs.groups, fl_arena);
+    hmap_init(&rndr->dcs.group_lookup, hash_type, fl_arena);
+    arr_init(&rndr->dcs.packets, fl_arena);
+    arr_init(&rndr->dcs.models, fl_arena);
+    hmap_init(&rndr->dcs.geometry_ids, hash_type, fl_arena);
+    arr_init(&rndr->dcs.free_geometry_ids, fl_arena);
+    arr_init(&rndr->dcs.visible, fl_arena);
+    arr_init(&rndr->dcs.sort_scratch, fl_arena);
+    arr_init(&rndr->dcs.batches, fl_arena);
+    init_cull_info(&rndr->dcs.cull, fl_arena);
 
     rndr->default_mat = default_mat;
 
     // Set up our draw call list render pass hashmap with frame linear memory
     vkr_descriptor_cfg desc_cfg{};
-    // Frame + pl + mat + obj uob
-    desc_cfg.max_sets = (MAX_RENDERPASS_COUNT * 2 + MAX_PIPELINE_COUNT + MAX_MATERIAL_COUNT);
+    // Frame + pl + mat + obj uob, and the GPU cull set
+    desc_cfg.max_sets = (MAX_RENDERPASS_COUNT * 2 + MAX_PIPELINE_COUNT + MAX_MATERIAL_COUNT + 1);
     desc_cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER] = (MAX_RENDERPASS_COUNT + MAX_PIPELINE_COUNT + MAX_MATERIAL_COUNT);
-    desc_cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC] = MAX_RENDERPASS_COUNT;
+    desc_cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_STORAGE_BUFFER] = MAX_RENDERPASS_COUNT * 2 + GPU_CULL_DESCRIPTOR_SET_BINDING_COUNT;
     desc_cfg.max_desc_per_type[VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER] = MAX_MATERIAL_COUNT * MAT_SAMPLER_SLOT_COUNT;
     vkr_cfg vkii{.app_name = "rdev",
                  .vi{1, 0, 0},
                  .arenas{.persistent_arena = &rndr->vk_free_list, .command_arena = &rndr->vk_frame_linear},
                  .log_verbosity = LOG_DEBUG,
                  .window = win_hndl,
+                 .headless = rndr->headless,
+                 .headless_extent = rndr->headless_size,
                  .inst_create_flags = INST_CREATE_FLAGS,
                  .desc_cfg{desc_cfg},
                  .extra_instance_extension_names = ADDITIONAL_INST_EXTENSIONS,
@@ -1167,13 +2581,30 @@ int init_renderer(renderer *rndr, const handle<material> &default_mat, void *win
                  .validation_layer_names = VALIDATION_LAYERS,
                  .validation_layer_count = VALIDATION_LAYER_COUNT};
 
+    if (rndr->headless) {
+        vkii.device_extension_names = HEADLESS_DEVICE_EXTENSIONS;
+        vkii.device_extension_count = HEADLESS_DEVICE_EXTENSION_COUNT;
+    }
+
     if (vkr_init(&vkii, &rndr->vk) != err_code::VKR_NO_ERROR) {
         return err_code::RENDER_INIT_FAIL;
     }
 
+    if (vkr_init_upload_manager(&rndr->uploads, &rndr->vk) != err_code::VKR_NO_ERROR) {
+        return err_code::RENDER_INIT_FAIL;
+    }
+
+    // Pipelines are created on the job pool threads (through the pipeline cache) in setup_rendering, and draws are
+    // recorded on them each frame
+    init_job_pool(&rndr->jobs, job_pool_default_thread_count());
+    load_pipeline_cache(rndr);
+
     // Set up our per frame data
     for (int fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
-        arr_init(&rndr->per_frame_data[fif_ind].buffer_updates, fl_arena);
+        dirty_set_init(&rndr->per_frame_data[fif_ind].dirty_transforms, fl_arena);
+        dirty_set_init(&rndr->per_frame_data[fif_ind].dirty_materials, fl_arena);
+        dirty_set_init(&rndr->per_frame_data[fif_ind].dirty_pipelines, fl_arena);
+        hmap_init(&rndr->per_frame_data[fif_ind].desc_cache, hash_type, fl_arena);
         rndr->per_frame_data[fif_ind].vkf = &rndr->vk.inst.device.rframes[fif_ind];
     }
 
@@ -1183,38 +2614,50 @@ int init_renderer(renderer *rndr, const handle<material> &default_mat, void *win
         return err;
     }
 
+    if (rndr->headless && rndr->headless_readback) {
+        err = init_readback_buffers(rndr);
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
+        }
+    }
+
     init_imgui(rndr, win_hndl);
 
+    init_record_threads(rndr, fl_arena);
+
+    err = gprof_init(&rndr->gprof, &rndr->vk, fl_arena);
+    if (err != err_code::GPROF_NO_ERROR) {
+        return err;
+    }
+
     // Setup our indice and vert buffer sbuffer
     return err_code::RENDER_NO_ERROR;
 }
 
-intern void terminate_swapchain_images_and_framebuffer(renderer *rndr)
-{
-    auto dev = &rndr->vk.inst.device;
-    vkr_terminate_image_view(&dev->image_views[rndr->swapchain_fb_depth_stencil_iview_ind]);
-    vkr_terminate_image(&dev->images[rndr->swapchain_fb_depth_stencil_im_ind]);
-    vkr_terminate_swapchain_framebuffers(dev, &rndr->vk);
-}
-
 intern void recreate_swapchain(renderer *rndr)
 {
     ilog("Recreating swapchain");
     // Recreating the swapchain will wait on all semaphores and fences before continuing
     auto dev = &rndr->vk.inst.device;
     vkr_device_wait_idle(dev);
-    terminate_swapchain_images_and_framebuffer(rndr);
+    rg_terminate_resources(&rndr->rgraph, &rndr->vk);
     vkr_terminate_swapchain(&dev->swapchain, &rndr->vk);
     vkr_terminate_surface(&rndr->vk, rndr->vk.inst.surface);
     vkr_init_surface(&rndr->vk, &rndr->vk.inst.surface);
     vkr_init_swapchain(&dev->swapchain, &rndr->vk);
-    init_swapchain_images_and_framebuffer(rndr);
+    rg_init_resources(&rndr->rgraph, &rndr->vk);
 }
 
 intern s32 acquire_swapchain_image(renderer *rndr, vkr_frame *cur_frame, u32 *im_ind)
 {
     auto dev = &rndr->vk.inst.device;
     auto prev_frame = get_previous_frame(rndr);
+
+    // Each frame in flight has its own offscreen image, and the frame's fence has already been waited on
+    if (rndr->headless) {
+        *im_ind = (u32)(rndr->finished_frames % dev->swapchain.images.size);
+        return err_code::RENDER_NO_ERROR;
+    }
     
     // Acquire the image, signal the image_avail semaphore once the image has been acquired. We get the index back, but
     // that doesn't mean the image is ready. The image is only ready (on the GPU side) once the image avail semaphore is triggered
@@ -1253,6 +2696,12 @@ intern s32 submit_command_buffer(renderer *rndr, vkr_frame *cur_frame, vkr_comma
     submit_info.pCommandBuffers = &cmd_buf->hndl;
     submit_info.signalSemaphoreCount = 1;
     submit_info.pSignalSemaphores = &rndr->vk.inst.device.swapchain.renders_finished[image_ind];
+
+    // Nothing is acquired or presented when headless so the fence is all there is to signal
+    if (rndr->headless) {
+        submit_info.waitSemaphoreCount = 0;
+        submit_info.signalSemaphoreCount = 0;
+    }
     if (vkQueueSubmit(dev->qfams[VKR_QUEUE_FAM_TYPE_GFX].qs[VKR_RENDER_QUEUE].hndl, 1, &submit_info, cur_frame->in_flight) != VK_SUCCESS) {
         return err_code::RENDER_SUBMIT_QUEUE_FAIL;
     }
@@ -1287,34 +2736,70 @@ intern s32 present_image(renderer *rndr, vkr_frame *cur_frame, u32 image_ind)
     return err_code::RENDER_NO_ERROR;
 }
 
-intern void push_ubo_event(renderer *rndr, const update_ubo_buffer_event &ev)
+// Copy the cached matrices of count transforms to the packed object buffer. The mapped buffer is usually write
+// combined memory which is never read back on the host, so when the destination is aligned the rows are written with
+// non-temporal stores that skip the cache instead of pulling the destination lines in first.
+intern void stream_transforms(obj_ubo_data *dst, const transform *src, sizet count)
 {
-    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
-        arr_push_back(&rndr->per_frame_data[fif_ind].buffer_updates, ev);
+#if NOBLE_STEED_SIMD
+    if (((sizet)dst & 15) == 0) {
+        for (sizet i = 0; i < count; ++i) {
+            f32 *drow = (f32 *)&dst[i].transform;
+            for (int r = 0; r < 4; ++r) {
+                _mm_stream_ps(drow + r * 4, src[i].cached._data[r]);
+            }
+        }
+        _mm_sfence();
+        return;
+    }
+#endif
+    for (sizet i = 0; i < count; ++i) {
+        dst[i].transform = src[i].cached;
     }
 }
 
-intern void update_transform_ubo_data(renderer *rndr, sizet ubo_ind, const transform *tform, sizet ubo_offset)
+intern void update_transform_ubo_data(renderer *rndr, sizet ubo_ind, const transform *tforms, sizet ubo_offset, sizet count)
 {
+    if (ubo_offset >= MAX_OBJECT_COUNT) {
+        wlog("Transform offset %lu is past the max object count %lu", ubo_offset, MAX_OBJECT_COUNT);
+        return;
+    }
+    if (ubo_offset + count > MAX_OBJECT_COUNT) {
+        wlog("Only uploading %lu of %lu transforms as the max object count is %lu",
+             MAX_OBJECT_COUNT - ubo_offset,
+             count,
+             MAX_OBJECT_COUNT);
+        count = MAX_OBJECT_COUNT - ubo_offset;
+    }
     auto dev = &rndr->vk.inst.device;
-    obj_ubo_data oubo{};
-    sizet obj_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(obj_ubo_data));
-    oubo.transform = tform->cached;
-    sizet byte_offset = obj_ubo_item_size * ubo_offset;
-    char *adjusted_addr = (char *)dev->buffers[ubo_ind].mem_info.pMappedData + byte_offset;
-    memcpy(adjusted_addr, &oubo, obj_ubo_item_size);
+    auto dst = (obj_ubo_data *)dev->buffers[ubo_ind].mem_info.pMappedData + ubo_offset;
+    stream_transforms(dst, tforms, count);
 }
 
-intern void handle_post_transform_event(renderer *rndr, vkr_frame *cur_frame, const update_ubo_buffer_event &ev)
+// Upload each contiguous span of dirty transforms with a single streaming copy from the table
+intern void upload_dirty_transforms(renderer *rndr, vkr_frame *vkf, ubo_dirty_set *ds)
 {
-    update_transform_ubo_data(rndr, cur_frame->obj_ubo_ind, ev.tf.tform, ev.tf.ubo_offset);
-}
+    auto tbl = rndr->dcs.cull.transforms;
+    if (!tbl || tbl->entries.size == 0) {
+        dirty_set_clear(ds);
+        return;
+    }
 
-intern void handle_post_transform_ubo_update_all(renderer *rndr, vkr_frame *cur_frame, const update_ubo_buffer_event &ev)
-{
-    for (int i = 0; i < ev.tfall.transforms->entries.size; ++i) {
-        update_transform_ubo_data(rndr, cur_frame->obj_ubo_ind, &ev.tfall.transforms->entries[i], i);
+    if (ds->all) {
+        update_transform_ubo_data(rndr, vkf->obj_ubo_ind, tbl->entries.data, 0, tbl->entries.size);
     }
+    else if (ds->count > 0) {
+        sizet cursor{}, first{}, count{};
+        while (dirty_set_next_span(ds, &cursor, &first, &count)) {
+            // Entries removed from the table since they were marked have nothing to upload
+            if (first >= tbl->entries.size) {
+                break;
+            }
+            count = std::min(count, tbl->entries.size - first);
+            update_transform_ubo_data(rndr, vkf->obj_ubo_ind, &tbl->entries[first], first, count);
+        }
+    }
+    dirty_set_clear(ds);
 }
 
 intern void update_material_ubo_data(renderer *rndr, sizet ubo_ind, const material_info *mi)
@@ -1326,21 +2811,43 @@ intern void update_material_ubo_data(renderer *rndr, sizet ubo_ind, const materi
     sizet mat_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(material_ubo_data));
     sizet byte_offset = mat_ubo_item_size * mi->ubo_offset;
     char *adjusted_addr = (char *)dev->buffers[ubo_ind].mem_info.pMappedData + byte_offset;
-    memcpy(adjusted_addr, &mat_ubo, mat_ubo_item_size);
+    memcpy(adjusted_addr, &mat_ubo, sizeof(material_ubo_data));
 }
 
-intern void handle_post_material_ubo_update(renderer *rndr, vkr_frame *cur_frame, const update_ubo_buffer_event &ev)
+intern void update_bindless_material_data(renderer *rndr, vkr_frame *cur_frame, const material_info *mi)
 {
-    update_material_ubo_data(rndr, cur_frame->mat_ubo_ind, ev.mat.mi);
+    auto dev = &rndr->vk.inst.device;
+    bindless_material_data mat_data{};
+    mat_data.color = mi->mat->col;
+    for (sizet i = 0; i < MAT_SAMPLER_SLOT_COUNT; ++i) {
+        mat_data.tex_inds[i] = INVALID_ID;
+        if (i < mi->mat->textures.size && is_valid(mi->mat->textures[i])) {
+            auto tex_fiter = hmap_find(&rndr->sampled_textures, mi->mat->textures[i]);
+            if (tex_fiter) {
+                mat_data.tex_inds[i] = tex_fiter->val.bindless_ind;
+            }
+        }
+    }
+    auto mats = (bindless_material_data *)dev->buffers[cur_frame->mat_sb_ind].mem_info.pMappedData;
+    mats[mi->ubo_offset] = mat_data;
 }
 
-intern void handle_post_material_ubo_update_all(renderer *rndr, vkr_frame *cur_frame, const update_ubo_buffer_event &ev)
+// Materials and pipelines live in hashmaps, so walk them and upload the ones whose ubo offset is marked
+intern void upload_dirty_materials(renderer *rndr, vkr_frame *vkf, ubo_dirty_set *ds)
 {
-    auto matiter = hmap_begin(&rndr->materials);
-    while (matiter) {
-        update_material_ubo_data(rndr, cur_frame->mat_ubo_ind, &matiter->val);
-        matiter = hmap_next(&rndr->materials, matiter);
+    if (ds->all || ds->count > 0) {
+        auto matiter = hmap_begin(&rndr->materials);
+        while (matiter) {
+            if (dirty_set_test(ds, matiter->val.ubo_offset)) {
+                update_material_ubo_data(rndr, vkf->mat_ubo_ind, &matiter->val);
+                if (rndr->bindless) {
+                    update_bindless_material_data(rndr, vkf, &matiter->val);
+                }
+            }
+            matiter = hmap_next(&rndr->materials, matiter);
+        }
     }
+    dirty_set_clear(ds);
 }
 
 intern void update_pipeline_ubo_data(renderer *rndr, sizet ubo_ind, const pipeline_info *plinfo)
@@ -1355,179 +2862,309 @@ intern void update_pipeline_ubo_data(renderer *rndr, sizet ubo_ind, const pipeli
     sizet pl_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(pipeline_ubo_data));
     sizet byte_offset = pl_ubo_item_size * plinfo->ubo_offset;
     char *adjusted_addr = (char *)dev->buffers[ubo_ind].mem_info.pMappedData + byte_offset;
-    memcpy(adjusted_addr, &pl_ubo, pl_ubo_item_size);
+    memcpy(adjusted_addr, &pl_ubo, sizeof(pipeline_ubo_data));
 }
 
-intern void handle_post_pipeline_ubo_update(renderer *rndr, vkr_frame *cur_frame, const update_ubo_buffer_event &ev)
+intern void upload_dirty_pipelines(renderer *rndr, vkr_frame *vkf, ubo_dirty_set *ds)
 {
-    update_pipeline_ubo_data(rndr, cur_frame->pl_ubo_ind, ev.pl.plinfo);
+    if (ds->all || ds->count > 0) {
+        auto pliter = hmap_begin(&rndr->pipelines);
+        while (pliter) {
+            if (dirty_set_test(ds, pliter->val.ubo_offset)) {
+                update_pipeline_ubo_data(rndr, vkf->pl_ubo_ind, &pliter->val);
+            }
+            pliter = hmap_next(&rndr->pipelines, pliter);
+        }
+    }
+    dirty_set_clear(ds);
 }
 
-intern void handle_post_pipeline_ubo_update_all(renderer *rndr, vkr_frame *cur_frame, const update_ubo_buffer_event &ev)
+// A descriptor set needed this frame - set points at the render pass entry or group field which receives the set index
+struct desc_set_request
 {
-    auto pliter = hmap_begin(&rndr->pipelines);
-    while (pliter) {
-        update_pipeline_ubo_data(rndr, cur_frame->pl_ubo_ind, &pliter->val);
-        pliter = hmap_next(&rndr->pipelines, pliter);
-    }
+    desc_cache_key key;
+    u32 version;
+    sizet *set;
+    // Pipeline or material info for those set types
+    const void *src;
+    b32 write;
+};
+
+intern void add_desc_set_request(array<desc_set_request> *reqs,
+                                 VkDescriptorSetLayout layout,
+                                 u32 type,
+                                 sizet resource,
+                                 u32 version,
+                                 sizet *set,
+                                 const void *src = nullptr)
+{
+    arr_push_back(reqs, {{layout, type, (u32)resource}, version, set, src, false});
 }
 
-// This only creates/writes the descriptors using the current frame data ubo offsets for the draw call data structure.
-// It does not update the underlying buffers at those offsets. That is done with ubo buffer events that the user is
-// responsible for submitting whenever anything changes
-intern int update_uniform_descriptors(renderer *rndr, vkr_frame *cur_frame)
+// Look up each request in the frame's cache, allocate sets for the ones missing in one go, and flag the requests whose
+// set has to be written. Several requests may share a key (the pipeline set for each group using the pipeline for
+// example) - only the first of them is flagged for writing.
+intern int resolve_desc_set_requests(renderer *rndr, renderer_fif_data *fd, array<desc_set_request> *reqs)
 {
-    auto dev = &rndr->vk.inst.device;
-    // rough capacity estimate - should overshoot i think
-    sizet cap = (rndr->materials.count * rndr->pipelines.count + 1) * rndr->rpasses.count;
-    array<VkWriteDescriptorSet> desc_updates(&rndr->frame_linear, cap);
-
-    auto rp_iter = hmap_begin(&rndr->dcs.rpasses);
-    while (rp_iter) {
-        vkr_add_result desc_ind =
-            vkr_add_descriptor_sets(&cur_frame->desc_pool, &rndr->vk, rp_iter->val->set_layouts.data, rp_iter->val->set_layouts.size);
+    array<VkDescriptorSetLayout> new_layouts(&rndr->frame_linear, reqs->size);
+    array<desc_cache_key> new_keys(&rndr->frame_linear, reqs->size);
+    for (sizet i = 0; i < reqs->size; ++i) {
+        auto req = &(*reqs)[i];
+        req->write = false;
+        auto fiter = hmap_find(&fd->desc_cache, req->key);
+        if (!fiter) {
+            hmap_insert(&fd->desc_cache, req->key, {INVALID_IND, req->version});
+            arr_push_back(&new_layouts, req->key.layout);
+            arr_push_back(&new_keys, req->key);
+            req->write = true;
+        }
+        else if (fiter->val.version != req->version) {
+            fiter->val.version = req->version;
+            req->write = true;
+        }
+    }
+
+    if (new_layouts.size > 0) {
+        vkr_add_result desc_ind = vkr_add_descriptor_sets(&fd->vkf->desc_pool, &rndr->vk, new_layouts.data, new_layouts.size);
         if (desc_ind.err_code != err_code::VKR_NO_ERROR) {
+            for (sizet i = 0; i < new_keys.size; ++i) {
+                hmap_remove(&fd->desc_cache, new_keys[i]);
+            }
             return desc_ind.err_code;
         }
+        for (sizet i = 0; i < new_keys.size; ++i) {
+            hmap_find(&fd->desc_cache, new_keys[i])->val.set = desc_ind.begin + i;
+        }
+    }
+
+    for (sizet i = 0; i < reqs->size; ++i) {
+        auto req = &(*reqs)[i];
+        *req->set = hmap_find(&fd->desc_cache, req->key)->val.set;
+    }
+    return err_code::VKR_NO_ERROR;
+}
 
-        // Add the frame rpass desc write update
-        sizet frame_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(frame_ubo_data));
+intern void add_desc_set_writes(renderer *rndr, renderer_fif_data *fd, const desc_set_request *req, array<VkWriteDescriptorSet> *updates)
+{
+    auto cur_frame = fd->vkf;
+    sizet ring_ind = cur_frame->ring.buf_ind;
+    sizet set = *req->set;
+    switch (req->key.type) {
+    case (DESC_CACHE_SET_FRAME): {
+        add_uniform_desc_write_update(
+            rndr, cur_frame, fd->frame_ubo.offset, fd->frame_ubo.size, ring_ind, set, updates, VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
+    } break;
+    case (DESC_CACHE_SET_OBJECT): {
+        // The per obj transform and instance storage buffers
         add_uniform_desc_write_update(rndr,
                                       cur_frame,
                                       0,
-                                      frame_ubo_item_size,
-                                      cur_frame->frame_ubo_ind,
-                                      rp_iter->val->frame_set_layouti,
-                                      &desc_updates,
+                                      MAX_OBJECT_COUNT * sizeof(obj_ubo_data),
+                                      cur_frame->obj_ubo_ind,
+                                      set,
+                                      updates,
+                                      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                      OBJ_DESCRIPTOR_SET_BINDING_TRANSFORMS);
+        add_uniform_desc_write_update(rndr,
+                                      cur_frame,
+                                      fd->instances.offset,
+                                      fd->instances.size,
+                                      ring_ind,
+                                      set,
+                                      updates,
+                                      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                      OBJ_DESCRIPTOR_SET_BINDING_INSTANCES);
+    } break;
+    case (DESC_CACHE_SET_PIPELINE): {
+        auto plinfo = (const pipeline_info *)req->src;
+        sizet pl_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(pipeline_ubo_data));
+        add_uniform_desc_write_update(rndr,
+                                      cur_frame,
+                                      pl_ubo_item_size * plinfo->ubo_offset,
+                                      pl_ubo_item_size,
+                                      cur_frame->pl_ubo_ind,
+                                      set,
+                                      updates,
                                       VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-        // Add the dynamic per obj desc write update
-        sizet obj_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(obj_ubo_data));
+    } break;
+    case (DESC_CACHE_SET_MATERIAL): {
+        auto mi = (const material_info *)req->src;
+        sizet mat_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(material_ubo_data));
         add_uniform_desc_write_update(rndr,
                                       cur_frame,
-                                      0,
-                                      obj_ubo_item_size,
-                                      cur_frame->obj_ubo_ind,
-                                      rp_iter->val->obj_set_layouti,
-                                      &desc_updates,
-                                      VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC);
+                                      mat_ubo_item_size * mi->ubo_offset,
+                                      mat_ubo_item_size,
+                                      cur_frame->mat_ubo_ind,
+                                      set,
+                                      updates,
+                                      VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
 
-        // Update material and pipeline UBOs and create the descriptor writes for them
-        auto pl_iter = hmap_begin(&rp_iter->val->plines);
-        while (pl_iter) {
-            sizet pl_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(pipeline_ubo_data));
-            sizet byte_offset = pl_ubo_item_size * pl_iter->val->plinfo->ubo_offset;
-            add_uniform_desc_write_update(rndr,
-                                          cur_frame,
-                                          byte_offset,
-                                          pl_ubo_item_size,
-                                          cur_frame->pl_ubo_ind,
-                                          pl_iter->val->set_layouti,
-                                          &desc_updates,
-                                          VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-            auto mat_iter = hmap_begin(&pl_iter->val->mats);
-            while (mat_iter) {
-                sizet mat_ubo_item_size = vkr_uniform_buffer_offset_alignment(&rndr->vk, sizeof(material_ubo_data));
-                sizet byte_offset = mat_ubo_item_size * mat_iter->val->mi->ubo_offset;
-                add_uniform_desc_write_update(rndr,
-                                              cur_frame,
-                                              byte_offset,
-                                              mat_ubo_item_size,
-                                              cur_frame->mat_ubo_ind,
-                                              mat_iter->val->set_layouti,
-                                              &desc_updates,
-                                              VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER);
-
-                // Go through all sampler slots - if there is a valid texture in a slot then set the associated sampler descriptor
-                for (sizet sloti = 0; sloti < mat_iter->val->mi->mat->textures.size; ++sloti) {
-                    auto cur_s = &mat_iter->val->mi->mat->textures[sloti];
-                    if (is_valid(*cur_s)) {
-                        auto tex_fiter = hmap_find(&rndr->sampled_textures, *cur_s);
-                        if (tex_fiter) {
-                            add_image_sampler_desc_write_update(rndr,
-                                                                cur_frame,
-                                                                tex_fiter->val.im_view,
-                                                                tex_fiter->val.sampler,
-                                                                sloti,
-                                                                mat_iter->val->set_layouti,
-                                                                &desc_updates,
-                                                                VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
-                        }
-                    }
+        // Go through all sampler slots - if there is a valid texture in a slot then set the associated sampler descriptor
+        for (sizet sloti = 0; sloti < mi->mat->textures.size; ++sloti) {
+            auto cur_s = &mi->mat->textures[sloti];
+            if (is_valid(*cur_s)) {
+                auto tex_fiter = hmap_find(&rndr->sampled_textures, *cur_s);
+                if (tex_fiter) {
+                    add_image_sampler_desc_write_update(rndr,
+                                                        cur_frame,
+                                                        tex_fiter->val.im_view,
+                                                        tex_fiter->val.sampler,
+                                                        sloti,
+                                                        set,
+                                                        updates,
+                                                        VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER);
                 }
-
-                mat_iter = hmap_next(&pl_iter->val->mats, mat_iter);
             }
-            pl_iter = hmap_next(&rp_iter->val->plines, pl_iter);
         }
-
-        vkUpdateDescriptorSets(dev->hndl, (u32)desc_updates.size, desc_updates.data, 0, nullptr);
-        rp_iter = hmap_next(&rndr->dcs.rpasses, rp_iter);
+    } break;
+    case (DESC_CACHE_SET_GPU_CULL): {
+        add_uniform_desc_write_update(rndr,
+                                      cur_frame,
+                                      fd->cull_candidates.offset,
+                                      fd->cull_candidates.size,
+                                      ring_ind,
+                                      set,
+                                      updates,
+                                      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                      GPU_CULL_DESCRIPTOR_SET_BINDING_CANDIDATES);
+        add_uniform_desc_write_update(rndr,
+                                      cur_frame,
+                                      fd->draw_cmds.offset,
+                                      fd->draw_cmds.size,
+                                      ring_ind,
+                                      set,
+                                      updates,
+                                      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                      GPU_CULL_DESCRIPTOR_SET_BINDING_DRAW_COMMANDS);
+        add_uniform_desc_write_update(rndr,
+                                      cur_frame,
+                                      fd->instances.offset,
+                                      fd->instances.size,
+                                      ring_ind,
+                                      set,
+                                      updates,
+                                      VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                                      GPU_CULL_DESCRIPTOR_SET_BINDING_INSTANCES);
+    } break;
+    default:
+        asrt(false);
     }
-    return err_code::VKR_NO_ERROR;
 }
 
-intern void process_ubo_update_events(renderer *rndr, renderer_fif_data *frame_data)
+intern void flush_desc_cache(renderer *rndr, renderer_fif_data *fd)
+{
+    vkr_reset_descriptor_pool(&fd->vkf->desc_pool, &rndr->vk);
+    hmap_clear(&fd->desc_cache);
+    fd->flush_desc_cache = false;
+}
+
+// Get the descriptor sets the frame's render passes and draw groups bind, only allocating and writing sets which aren't
+// cached or whose resource changed. The buffer contents the sets point at are uploaded separately from the dirty sets.
+intern int update_uniform_descriptors(renderer *rndr, renderer_fif_data *fd)
 {
     auto dev = &rndr->vk.inst.device;
-    auto cur_frame = get_current_frame(rndr);
+    auto dcs = &rndr->dcs;
+
+    // Gather the sets needed this frame - a frame and object set for each render pass, then a pipeline and material
+    // set for each group in the sorted visible list
+    array<desc_set_request> reqs(&rndr->frame_linear, dcs->rpasses.size * 2 + dcs->groups.size * 2 + 1);
+
+    // Sets pointing in to the frame ring are rewritten every frame as the ring allocations move - the frame count is
+    // different each time this frame in flight comes around
+    u32 ring_version = (u32)rndr->finished_frames;
+    for (sizet rpi = 0; rpi < dcs->rpasses.size; ++rpi) {
+        auto rpe = &dcs->rpasses[rpi];
+        add_desc_set_request(&reqs, rpe->frame_layout, DESC_CACHE_SET_FRAME, 0, ring_version, &rpe->frame_set);
+        add_desc_set_request(&reqs, rpe->obj_layout, DESC_CACHE_SET_OBJECT, 0, ring_version, &rpe->obj_set);
+    }
+
+    u64 cur_group_prefix = (u64)-1;
+    for (sizet vi = 0; vi < dcs->visible.size; ++vi) {
+        u64 key = dcs->visible[vi].key;
+        if ((key >> DRAW_KEY_MATERIAL_SHIFT) == cur_group_prefix) {
+            continue;
+        }
+        cur_group_prefix = key >> DRAW_KEY_MATERIAL_SHIFT;
+        auto grp = &dcs->groups[dcs->packets[dcs->visible[vi].packet].group];
+        add_desc_set_request(&reqs, grp->pl_layout, DESC_CACHE_SET_PIPELINE, grp->plinfo->ubo_offset, 0, &grp->pl_set, grp->plinfo);
+        // Groups have no material with bindless materials - the frame's bindless set is bound instead
+        if (grp->mi) {
+            add_desc_set_request(&reqs, grp->mat_layout, DESC_CACHE_SET_MATERIAL, grp->mi->ubo_offset, grp->mi->desc_version, &grp->mat_set, grp->mi);
+        }
+    }
 
-    for (sizet i = 0; i < frame_data->buffer_updates.size; ++i) {
-        const auto &ev = frame_data->buffer_updates[i];
-        switch (ev.type) {
-        case UPDATE_BUFFER_EVENT_TYPE_TRANSFORM:
-            handle_post_transform_event(rndr, cur_frame->vkf, ev);
-            break;
-        case UPDATE_BUFFER_EVENT_TYPE_ALL_TRANSFORMS:
-            handle_post_transform_ubo_update_all(rndr, cur_frame->vkf, ev);
-            break;
-        case UPDATE_BUFFER_EVENT_TYPE_MATERIAL:
-            handle_post_material_ubo_update(rndr, cur_frame->vkf, ev);
-            break;
-        case UPDATE_BUFFER_EVENT_TYPE_ALL_MATERIALS:
-            handle_post_material_ubo_update_all(rndr, cur_frame->vkf, ev);
-            break;
-        case UPDATE_BUFFER_EVENT_TYPE_PIPELINE:
-            handle_post_pipeline_ubo_update(rndr, cur_frame->vkf, ev);
-            break;
-        case UPDATE_BUFFER_EVENT_TYPE_ALL_PIPELINES:
-            handle_post_pipeline_ubo_update_all(rndr, cur_frame->vkf, ev);
-            break;
-        default:
-            wlog("Unknown update buffer event type %d", ev.type);
+    dcs->gpu_cull_set = INVALID_IND;
+    if (dcs->gpu_cull_candidate_count > 0) {
+        auto layout = dev->pipelines[rndr->gpu_cull_plind].descriptor_layouts[0];
+        add_desc_set_request(&reqs, layout, DESC_CACHE_SET_GPU_CULL, 0, ring_version, &dcs->gpu_cull_set);
+    }
+
+    if (reqs.size == 0) {
+        return err_code::VKR_NO_ERROR;
+    }
+
+    int err = resolve_desc_set_requests(rndr, fd, &reqs);
+    if (err != err_code::VKR_NO_ERROR) {
+        // The pool is likely full of sets which are no longer used - start the cache over
+        wlog("Failed to allocate descriptor sets with %lu cached - flushing the descriptor cache", fd->desc_cache.count);
+        flush_desc_cache(rndr, fd);
+        err = resolve_desc_set_requests(rndr, fd, &reqs);
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
         }
     }
 
-    // Clear the events
-    arr_clear(&frame_data->buffer_updates);
+    // Rough capacity estimate - one write per set plus the material sampler slots and extra storage buffers
+    array<VkWriteDescriptorSet> desc_updates(&rndr->frame_linear, reqs.size * 2 + dcs->groups.size * MAT_SAMPLER_SLOT_COUNT + 1);
+    for (sizet i = 0; i < reqs.size; ++i) {
+        if (reqs[i].write) {
+            add_desc_set_writes(rndr, fd, &reqs[i], &desc_updates);
+        }
+    }
+
+    if (desc_updates.size > 0) {
+        vkUpdateDescriptorSets(dev->hndl, (u32)desc_updates.size, desc_updates.data, 0, nullptr);
+    }
+    return err_code::VKR_NO_ERROR;
+}
+
+intern void process_ubo_update_events(renderer *rndr, renderer_fif_data *frame_data)
+{
+    upload_dirty_transforms(rndr, frame_data->vkf, &frame_data->dirty_transforms);
+    upload_dirty_materials(rndr, frame_data->vkf, &frame_data->dirty_materials);
+    upload_dirty_pipelines(rndr, frame_data->vkf, &frame_data->dirty_pipelines);
 }
 
 void post_transform_ubo_update(renderer *rndr, const transform *tf, const comp_table<transform> *ctbl)
 {
-    update_ubo_buffer_event ev{};
-    ev.type = UPDATE_BUFFER_EVENT_TYPE_TRANSFORM;
-    ev.tf.ubo_offset = get_comp_ind(tf, ctbl);
-    ev.tf.tform = tf;
-    push_ubo_event(rndr, ev);
+    post_transform_ubo_update_range(rndr, ctbl, get_comp_ind(tf, ctbl), 1);
+}
+
+void post_transform_ubo_update_range(renderer *rndr, const comp_table<transform> *ctbl, sizet first, sizet count)
+{
+    rndr->dcs.cull.transforms = ctbl;
+    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+        dirty_set_mark_range(&rndr->per_frame_data[fif_ind].dirty_transforms, first, count);
+    }
 }
 
 void post_transform_ubo_update_all(renderer *rndr, const comp_table<transform> *ctbl)
 {
-    update_ubo_buffer_event ev{};
-    ev.type = UPDATE_BUFFER_EVENT_TYPE_ALL_TRANSFORMS;
-    ev.tfall.transforms = ctbl;
-    push_ubo_event(rndr, ev);
+    rndr->dcs.cull.transforms = ctbl;
+    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+        dirty_set_mark_all(&rndr->per_frame_data[fif_ind].dirty_transforms);
+    }
 }
 
 void post_material_ubo_update(renderer *rndr, const rid &mat_id)
 {
     auto mat_fiter = hmap_find(&rndr->materials, mat_id);
     if (mat_fiter) {
-        update_ubo_buffer_event ev{};
-        ev.type = UPDATE_BUFFER_EVENT_TYPE_MATERIAL;
-        ev.mat.mi = &mat_fiter->val;
-        push_ubo_event(rndr, ev);
+        // The material's textures may have changed
+        ++mat_fiter->val.desc_version;
+        for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+            dirty_set_mark(&rndr->per_frame_data[fif_ind].dirty_materials, mat_fiter->val.ubo_offset);
+        }
     }
     else {
         wlog("Could not find material %s", to_cstr(mat_id));
@@ -1536,19 +3173,23 @@ void post_material_ubo_update(renderer *rndr, const rid &mat_id)
 
 void post_material_ubo_update_all(renderer *rndr)
 {
-    update_ubo_buffer_event ev{};
-    ev.type = UPDATE_BUFFER_EVENT_TYPE_ALL_MATERIALS;
-    push_ubo_event(rndr, ev);
+    auto mat_iter = hmap_begin(&rndr->materials);
+    while (mat_iter) {
+        ++mat_iter->val.desc_version;
+        mat_iter = hmap_next(&rndr->materials, mat_iter);
+    }
+    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+        dirty_set_mark_all(&rndr->per_frame_data[fif_ind].dirty_materials);
+    }
 }
 
 void post_pipeline_ubo_update(renderer *rndr, const rid &plid)
 {
     auto pl_fiter = hmap_find(&rndr->pipelines, plid);
     if (pl_fiter) {
-        update_ubo_buffer_event ev{};
-        ev.type = UPDATE_BUFFER_EVENT_TYPE_PIPELINE;
-        ev.pl.plinfo = &pl_fiter->val;
-        push_ubo_event(rndr, ev);
+        for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+            dirty_set_mark(&rndr->per_frame_data[fif_ind].dirty_pipelines, pl_fiter->val.ubo_offset);
+        }
     }
     else {
         wlog("Could not find pipeline %s", to_cstr(plid));
@@ -1557,9 +3198,9 @@ void post_pipeline_ubo_update(renderer *rndr, const rid &plid)
 
 void post_pipeline_ubo_update_all(renderer *rndr)
 {
-    update_ubo_buffer_event ev{};
-    ev.type = UPDATE_BUFFER_EVENT_TYPE_ALL_PIPELINES;
-    push_ubo_event(rndr, ev);
+    for (sizet fif_ind = 0; fif_ind < rndr->per_frame_data.size; ++fif_ind) {
+        dirty_set_mark_all(&rndr->per_frame_data[fif_ind].dirty_pipelines);
+    }
 }
 
 void post_ubo_update_all(renderer *rndr, const comp_table<transform> *ctbl)
@@ -1572,17 +3213,146 @@ void post_ubo_update_all(renderer *rndr, const comp_table<transform> *ctbl)
     post_pipeline_ubo_update_all(rndr);
 }
 
+void invalidate_descriptor_cache(renderer *rndr)
+{
+    for (int i = 0; i < rndr->per_frame_data.size; ++i) {
+        rndr->per_frame_data[i].flush_desc_cache = true;
+    }
+}
+
 void clear_static_models(renderer *rndr)
 {
-    hmap_terminate(&rndr->dcs.rpasses);
-    mem_reset_arena(&rndr->dcs.dc_linear);
-    hmap_init(&rndr->dcs.rpasses);
+    auto dcs = &rndr->dcs;
+    arr_clear(&dcs->rpasses);
+    arr_clear(&dcs->groups);
+    hmap_clear(&dcs->group_lookup);
+    arr_clear(&dcs->packets);
+    dcs->free_packet_head = INVALID_ID;
+    arr_clear(&dcs->models);
+    dcs->free_model_head = INVALID_ID;
+    hmap_clear(&dcs->geometry_ids);
+    arr_clear(&dcs->free_geometry_ids);
+    arr_clear(&dcs->visible);
+    arr_clear(&dcs->batches);
+    clear_cull_info(&dcs->cull);
+}
+
+void add_occluder(renderer *rndr, const mesh *msh, sizet transform_ind)
+{
+    arr_push_back(&rndr->dcs.cull.occluders, {msh, (u32)transform_ind});
+}
+
+// Find the group for the render pass, pipeline, material combination or add it if it doesn't exist yet - returns the
+// group index and sets the packet key prefix. The material is null with bindless materials.
+intern u32 get_or_add_draw_group(static_model_draw_info *dcs,
+                                 const rpass_info *rpinfo,
+                                 const pipeline_info *plinfo,
+                                 const material_info *mi,
+                                 const vkr_pipeline *pline,
+                                 u64 *key)
+{
+    asrt(rpinfo->rpind < MAX_RENDERPASS_COUNT);
+    asrt(plinfo->plind < MAX_PIPELINE_COUNT);
+    asrt(!mi || mi->ubo_offset < MAX_MATERIAL_COUNT);
+    u64 mat_bits = (mi) ? (u64)mi->ubo_offset : 0;
+    *key = ((u64)rpinfo->rpind << DRAW_KEY_RPASS_SHIFT) | ((u64)plinfo->plind << DRAW_KEY_PIPELINE_SHIFT) |
+           (mat_bits << DRAW_KEY_MATERIAL_SHIFT);
+
+    auto fiter = hmap_find(&dcs->group_lookup, *key);
+    if (fiter) {
+        return fiter->val;
+    }
+
+    // If the render pass has not yet been added, add it now keeping the render passes ordered by index
+    sizet rpi = 0;
+    while (rpi < dcs->rpasses.size && dcs->rpasses[rpi].rpinfo->rpind < rpinfo->rpind) {
+        ++rpi;
+    }
+    if (rpi == dcs->rpasses.size || dcs->rpasses[rpi].rpinfo != rpinfo) {
+        draw_rpass_entry rpe{};
+        rpe.rpinfo = rpinfo;
+        rpe.frame_layout = pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_FRAME];
+        rpe.obj_layout = pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT];
+        arr_emplace_back(&dcs->rpasses);
+        for (sizet i = dcs->rpasses.size - 1; i > rpi; --i) {
+            dcs->rpasses[i] = dcs->rpasses[i - 1];
+        }
+        dcs->rpasses[rpi] = rpe;
+    }
+
+    draw_group grp{};
+    grp.rpinfo = rpinfo;
+    grp.plinfo = plinfo;
+    grp.mi = mi;
+    grp.pl_layout = pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_PIPELINE];
+    grp.mat_layout = pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL];
+    u32 grpi = (u32)dcs->groups.size;
+    arr_push_back(&dcs->groups, grp);
+    hmap_insert(&dcs->group_lookup, *key, grpi);
+    return grpi;
+}
+
+intern u32 alloc_draw_packet(static_model_draw_info *dcs, const draw_packet &pkt)
+{
+    u32 pi = dcs->free_packet_head;
+    if (is_valid(pi)) {
+        dcs->free_packet_head = dcs->packets[pi].next;
+        dcs->packets[pi] = pkt;
+    }
+    else {
+        pi = (u32)dcs->packets.size;
+        arr_push_back(&dcs->packets, pkt);
+    }
+    return pi;
+}
+
+// Put all packets of the model on the free list and release their cull entries and geometry ids. Packets of the same
+// submesh are linked one after the other and share a cull entry, so an entry is released when it differs from the
+// previous packet's.
+intern void free_model_packets(static_model_draw_info *dcs, static_model_draw_entry *mdl)
+{
+    u32 prev_cull_ind = INVALID_ID;
+    u32 pi = mdl->first_packet;
+    while (is_valid(pi)) {
+        auto pkt = &dcs->packets[pi];
+        u32 next = pkt->next;
+        if (pkt->dc.cull_ind != prev_cull_ind) {
+            release_cull_entry(&dcs->cull, pkt->dc.cull_ind);
+            prev_cull_ind = pkt->dc.cull_ind;
+        }
+        for (u32 lod = 0; lod < pkt->dc.lod_count; ++lod) {
+            release_geometry_id(dcs, pkt->dc.chunk, pkt->dc.lods[lod].first_index);
+        }
+        pkt->dc.flags = DRAW_CALL_FLAG_FREE;
+        pkt->next = dcs->free_packet_head;
+        dcs->free_packet_head = pi;
+        pi = next;
+    }
+    mdl->first_packet = INVALID_ID;
+}
+
+intern static_model_draw_entry *get_model_entry(static_model_draw_info *dcs, const static_model_draw_handle &hndl)
+{
+    if (!is_valid(hndl) || hndl.slot >= dcs->models.size) {
+        return nullptr;
+    }
+    auto mdl = &dcs->models[hndl.slot];
+    // Removing a model bumps the slot generation, so free slots never match a handle
+    if (mdl->gen != hndl.gen) {
+        return nullptr;
+    }
+    return mdl;
 }
 
-int add_static_model(renderer *rndr, const static_model *sm, sizet transform_ind, const mesh_cache *msh_cache, const material_cache *mat_cache)
+intern void add_model_packets(renderer *rndr,
+                              static_model_draw_entry *mdl,
+                              const static_model *sm,
+                              sizet transform_ind,
+                              const mesh_cache *msh_cache,
+                              const material_cache *mat_cache)
 {
     auto dev = &rndr->vk.inst.device;
-    auto cur_frame = get_current_frame(rndr);
+    auto dcs = &rndr->dcs;
 
     auto rmesh = hmap_find(&rndr->rmi.meshes, sm->mesh_id);
     asrt(rmesh);
@@ -1591,7 +3361,26 @@ int add_static_model(renderer *rndr, const static_model *sm, sizet transform_ind
     asrt(msh);
     asrt(rmesh->val.submesh_entrees.size == msh->submeshes.size);
 
+    // Packets are linked in the order they are added so the packets of each submesh stay next to each other. The previous
+    // packet is kept by index as adding a packet can grow (and move) the packet array.
+    u32 prev = INVALID_ID;
     for (int i = 0; i < msh->submeshes.size; ++i) {
+        auto sm_entry = &rmesh->val.submesh_entrees[i];
+
+        // All draw calls for this submesh share one cull entry - it is added with the first packet
+        u32 cull_ind = INVALID_ID;
+
+        // Packets with the same geometry id (and so the same chunk and index range) are drawn as instances of one draw
+        // if they also share the material and were given the same LOD this frame
+        draw_lod lods[MAX_LOD_COUNT]{};
+        u32 lod_count = (u32)sm_entry->lods.size;
+        for (u32 lod = 0; lod < lod_count; ++lod) {
+            auto sm_lod = &sm_entry->lods[lod];
+            lods[lod].first_index = (u32)sm_entry->inds.offset + sm_lod->ind_offset;
+            lods[lod].index_count = sm_lod->ind_count;
+            lods[lod].error = sm_lod->error;
+        }
+
         auto mat = rndr->default_mat;
         if (sm->mat_ids[i].id != 0) {
             auto mato = get_robj(mat_cache, sm->mat_ids[i]);
@@ -1600,7 +3389,16 @@ int add_static_model(renderer *rndr, const static_model *sm, sizet transform_ind
             }
         }
 
-        // Go through all pipelines this material references
+        // Get the material info, and create it if it doesn't exist
+        auto mat_fiter = hmap_find(&rndr->materials, mat->id);
+        if (!mat_fiter) {
+            sizet ubo_offset = rndr->materials.count;
+            mat_fiter = hmap_insert(&rndr->materials, mat->id, material_info{});
+            mat_fiter->val.mat = mat;
+            mat_fiter->val.ubo_offset = ubo_offset;
+        }
+
+        // Go through all pipelines this material references and add a packet for each
         auto pl_iter = hset_begin(&mat->pipelines);
         while (pl_iter) {
             auto pl_fiter = hmap_find(&rndr->pipelines, pl_iter->val);
@@ -1611,83 +3409,95 @@ int add_static_model(renderer *rndr, const static_model *sm, sizet transform_ind
             auto rp_fiter = hmap_find(&rndr->rpasses, pl_fiter->val.rpass_id);
             asrt(rp_fiter);
 
-            // If the render pass has not yet been added to our renderer's push list, add it now
-            auto push_rp_fiter = hmap_find(&rndr->dcs.rpasses, rp_fiter->key);
-            if (!push_rp_fiter) {
-                auto rpdg = mem_calloc<render_pass_draw_group>(1, &rndr->dcs.dc_linear);
-
-                rpdg->rpinfo = &rp_fiter->val;
-                arr_init(&rpdg->set_layouts, &rndr->dcs.dc_linear);
-                hmap_init(&rpdg->plines, hash_type, &rndr->dcs.dc_linear);
-
-                // Add the frame rpass descriptor set;
-                rpdg->frame_set_layouti = rpdg->set_layouts.size;
-                arr_emplace_back(&rpdg->set_layouts, pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_FRAME]);
-
-                // Add the obj rpass descriptor set
-                rpdg->obj_set_layouti = rpdg->set_layouts.size;
-                arr_emplace_back(&rpdg->set_layouts, pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_OBJECT]);
-
-                push_rp_fiter = hmap_insert(&rndr->dcs.rpasses, rp_fiter->key, rpdg);
-            }
-            asrt(push_rp_fiter);
-
-            // If the pipeline has not yey been added to our render pass' push list, add it now
-            auto push_pl_fiter = hmap_find(&push_rp_fiter->val->plines, pl_fiter->key);
-            if (!push_pl_fiter) {
-                auto pldg = mem_calloc<pipeline_draw_group>(1, &rndr->dcs.dc_linear);
-
-                pldg->plinfo = &pl_fiter->val;
-                hmap_init(&pldg->mats, hash_type, &rndr->dcs.dc_linear);
-
-                // Add the pipeline discriptor set
-                pldg->set_layouti = push_rp_fiter->val->set_layouts.size;
-                arr_emplace_back(&push_rp_fiter->val->set_layouts, pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_PIPELINE]);
-
-                push_pl_fiter = hmap_insert(&push_rp_fiter->val->plines, pl_fiter->key, pldg);
+            if (!is_valid(cull_ind)) {
+                cull_ind = add_cull_entry(&dcs->cull, transform_ind, sm_entry->bounds);
             }
-            asrt(push_pl_fiter);
-
-            // Get the material info, and create it if it doesn't exist
-            auto mat_fiter = hmap_find(&rndr->materials, mat->id);
-            if (!mat_fiter) {
-                sizet ubo_offset = rndr->materials.count;
-                mat_fiter = hmap_insert(&rndr->materials, mat->id, material_info{});
-                mat_fiter->val.mat = mat;
-                mat_fiter->val.ubo_offset = ubo_offset;
-            }
-
-            // Now create the material set, if it doesn't exist
-            auto push_mat_fiter = hmap_find(&push_pl_fiter->val->mats, mat->id);
-            if (!push_mat_fiter) {
-                auto matdg = mem_calloc<material_draw_group>(1, &rndr->dcs.dc_linear);
-
-                matdg->mi = &mat_fiter->val;
-                arr_init(&matdg->dcs, &rndr->dcs.dc_linear);
-
-                // Add the material discriptor set
-                matdg->set_layouti = push_rp_fiter->val->set_layouts.size;
-                arr_emplace_back(&push_rp_fiter->val->set_layouts, pline->descriptor_layouts[DESCRIPTOR_SET_LAYOUT_MATERIAL]);
 
-                push_mat_fiter = hmap_insert(&push_pl_fiter->val->mats, mat->id, matdg);
+            // Every packet holds its own reference to the geometry ids of its LODs
+            for (u32 lod = 0; lod < lod_count; ++lod) {
+                lods[lod].geometry_id = get_or_add_geometry_id(dcs, sm_entry->chunk, lods[lod].first_index);
             }
-            asrt(push_mat_fiter);
 
-            // Now we create the actual draw call, and add the tform to the tform uniform buffer and increase the cur index
-            draw_call dc{
-                .index_count = (u32)rmesh->val.submesh_entrees[i].inds.size,
+            draw_packet pkt{};
+            const material_info *grp_mi = (rndr->bindless) ? nullptr : &mat_fiter->val;
+            pkt.group = get_or_add_draw_group(dcs, &rp_fiter->val, &pl_fiter->val, grp_mi, pline, &pkt.key);
+            pkt.key |= ((u64)sm_entry->chunk << DRAW_KEY_CHUNK_SHIFT) | ((u64)lods[0].geometry_id << DRAW_KEY_GEOMETRY_SHIFT);
+            pkt.dc = {
+                .lod_count = lod_count,
                 .instance_count = 1,
-                .first_index = (u32)rmesh->val.submesh_entrees[i].inds.offset,
-                .vertex_offset = (u32)rmesh->val.submesh_entrees[i].verts.offset,
+                .vertex_offset = (u32)sm_entry->verts.offset,
                 .first_instance = 0,
+                .chunk = sm_entry->chunk,
+                .cull_ind = cull_ind,
                 .ubo_offset = transform_ind,
+                .mat_ind = (u32)mat_fiter->val.ubo_offset,
             };
-            arr_push_back(&push_mat_fiter->val->dcs, dc);
+            memcpy(pkt.dc.lods, lods, sizeof(lods));
+            u32 pi = alloc_draw_packet(dcs, pkt);
+            if (is_valid(prev)) {
+                dcs->packets[prev].next = pi;
+            }
+            else {
+                mdl->first_packet = pi;
+            }
+            prev = pi;
             pl_iter = hset_next(&mat->pipelines, pl_iter);
         }
     }
+}
 
-    return err_code::VKR_NO_ERROR;
+static_model_draw_handle add_static_model(renderer *rndr,
+                                          const static_model *sm,
+                                          sizet transform_ind,
+                                          const mesh_cache *msh_cache,
+                                          const material_cache *mat_cache)
+{
+    auto dcs = &rndr->dcs;
+    u32 slot = dcs->free_model_head;
+    if (is_valid(slot)) {
+        dcs->free_model_head = dcs->models[slot].next_free;
+        dcs->models[slot].next_free = INVALID_ID;
+    }
+    else {
+        slot = (u32)dcs->models.size;
+        arr_emplace_back(&dcs->models);
+    }
+
+    auto mdl = &dcs->models[slot];
+    add_model_packets(rndr, mdl, sm, transform_ind, msh_cache, mat_cache);
+    return {slot, mdl->gen};
+}
+
+bool update_static_model(renderer *rndr,
+                         const static_model_draw_handle &hndl,
+                         const static_model *sm,
+                         sizet transform_ind,
+                         const mesh_cache *msh_cache,
+                         const material_cache *mat_cache)
+{
+    auto mdl = get_model_entry(&rndr->dcs, hndl);
+    if (!mdl) {
+        wlog("Tried to update static model with stale handle (slot %u gen %u)", hndl.slot, hndl.gen);
+        return false;
+    }
+    free_model_packets(&rndr->dcs, mdl);
+    add_model_packets(rndr, mdl, sm, transform_ind, msh_cache, mat_cache);
+    return true;
+}
+
+bool remove_static_model(renderer *rndr, const static_model_draw_handle &hndl)
+{
+    auto dcs = &rndr->dcs;
+    auto mdl = get_model_entry(dcs, hndl);
+    if (!mdl) {
+        wlog("Tried to remove static model with stale handle (slot %u gen %u)", hndl.slot, hndl.gen);
+        return false;
+    }
+    free_model_packets(dcs, mdl);
+    ++mdl->gen;
+    mdl->next_free = dcs->free_model_head;
+    dcs->free_model_head = hndl.slot;
+    return true;
 }
 
 int begin_render_frame(renderer *rndr, int finished_frame_count)
@@ -1705,28 +3515,85 @@ int begin_render_frame(renderer *rndr, int finished_frame_count)
     // triggered state so there will be no waiting on the first time. We then reset the fence (aka set it to
     // untriggered) and it is passed to the vkQueueSubmit call to trigger it again. So if not the first time rendering
     // this FIF, we are waiting for the vkQueueSubmit from the previous time this FIF was rendered to complete
+    profile_timepoints pt{};
+    ptimer_restart(&pt);
     VkResult vk_err = vkWaitForFences(dev->hndl, 1, &cur_frame->vkf->in_flight, VK_TRUE, UINT64_MAX);
     if (vk_err != VK_SUCCESS) {
         elog("Failed to wait for fence");
         return err_code::RENDER_WAIT_FENCE_FAIL;
     }
+    ptimer_split(&pt);
+    gprof_set_fence_wait_time(&rndr->gprof, NSEC_TO_MSEC(pt.dt_ns));
+
+    // The GPU is done with the last time this frame was rendered so its timestamps can be read without waiting
+    gprof_collect(&rndr->gprof, &rndr->vk, rndr->finished_frames % MAX_FRAMES_IN_FLIGHT);
+
+    // And so is its readback copy
+    if (cur_frame->readback_pending) {
+        auto buf = &dev->buffers[cur_frame->readback_buf_ind];
+        vmaInvalidateAllocation(dev->vma_alloc.hndl, buf->mem_hndl, 0, VK_WHOLE_SIZE);
+        rndr->readback_frame = rndr->finished_frames % MAX_FRAMES_IN_FLIGHT;
+        cur_frame->readback_pending = false;
+    }
+
+    // Descriptor sets are cached across frames - they are only dropped when the cache is invalidated
+    if (cur_frame->flush_desc_cache) {
+        flush_desc_cache(rndr, cur_frame);
+    }
+
+    // The GPU is done with everything allocated from the ring the last time this frame was rendered
+    vkr_reset_frame_ring(&cur_frame->vkf->ring);
+
+    // And with the secondary buffers recorded the last time - resetting the pools resets all of their buffers at once
+    for (sizet ti = 0; ti < cur_frame->record_threads.size; ++ti) {
+        auto rth = &cur_frame->record_threads[ti];
+        if (rth->used_bufs > 0) {
+            vkr_reset_cmd_pool(&rndr->vk, &rth->pool);
+            rth->used_bufs = 0;
+        }
+    }
 
-    // Clear all prev desc sets
-    vkr_reset_descriptor_pool(&cur_frame->vkf->desc_pool, &rndr->vk);
+    // Reclaim the staging space of finished uploads
+    vkr_update_uploads(&rndr->uploads, &rndr->vk);
+    cur_frame->frame_ubo = {};
+    cur_frame->instances = {};
+    cur_frame->draw_cmds = {};
+    cur_frame->cull_candidates = {};
 
     ImGui_ImplVulkan_NewFrame();
-    ImGui_ImplSDL3_NewFrame();
+    if (!rndr->headless) {
+        ImGui_ImplSDL3_NewFrame();
+    }
     ImGui::NewFrame();
 
     return err_code::VKR_NO_ERROR;
 }
 
+vkr_frame_alloc alloc_frame_data(renderer *rndr, sizet size, sizet alignment)
+{
+    return vkr_frame_ring_alloc(&get_current_frame(rndr)->vkf->ring, &rndr->vk, size, alignment);
+}
+
+const vkr_buffer *get_frame_ring_buffer(renderer *rndr)
+{
+    return &rndr->vk.inst.device.buffers[get_current_frame(rndr)->vkf->ring.buf_ind];
+}
+
+const void *get_readback_pixels(const renderer *rndr)
+{
+    if (!is_valid(rndr->readback_frame)) {
+        return nullptr;
+    }
+    auto buf = &rndr->vk.inst.device.buffers[rndr->per_frame_data[rndr->readback_frame].readback_buf_ind];
+    return buf->mem_info.pMappedData;
+}
+
 int end_render_frame(renderer *rndr, camera *cam, f64 dt)
 {
     auto dev = &rndr->vk.inst.device;
     auto cur_frame = get_current_frame(rndr);
 
-    if (window_resized_this_frame(rndr->vk.cfg.window)) {
+    if (!rndr->headless && window_resized_this_frame(rndr->vk.cfg.window)) {
         rndr->no_resize_frames = 0.0;
     }
     else {
@@ -1735,7 +3602,11 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
 
     // Get the next available swapchain image index or return if the
     u32 im_ind{};
+    profile_timepoints pt{};
+    ptimer_restart(&pt);
     s32 err = acquire_swapchain_image(rndr, cur_frame->vkf, &im_ind);
+    ptimer_split(&pt);
+    gprof_set_acquire_time(&rndr->gprof, NSEC_TO_MSEC(pt.dt_ns));
     if (err != err_code::RENDER_NO_ERROR) {
         ImGui::EndFrame();
         if (err != err_code::RENDER_ACQUIRE_IMAGE_FAIL) {
@@ -1748,7 +3619,7 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
     // handle recreation for other things that might happen so keep the acquire image and present image recreations
     // based on return value
     if (cam) {
-        ivec2 sz = get_window_pixel_size(rndr->vk.cfg.window);
+        ivec2 sz = (rndr->headless) ? ivec2{(int)rndr->headless_size.x, (int)rndr->headless_size.y} : get_window_pixel_size(rndr->vk.cfg.window);
         if (cam->vp_size != sz) {
             rndr->no_resize_frames = 0;
             cam->vp_size = sz;
@@ -1764,6 +3635,9 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
         }
     }
 
+    // Cull the static models against the camera frustum and build the visible draw lists for recording
+    cull_static_models(rndr, cam);
+
     // Here we reset the fence for the current frame.. we wait for it to be signaled in render_frame_begin before
     // clearing the frame's descriptor pool (so we don't clear any that are in use). Without resetting the fence,
     // vkWaitForFences call just immediately returns as the fence is still triggered.
@@ -1776,13 +3650,20 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
     // Once we have acquired our fences, update all buffers that need updating
     process_ubo_update_events(rndr, cur_frame);
 
-    // Update all uniform buffers and write the descriptor set updates for them
-    // This takes about %20 of the run frame
-    err = update_uniform_descriptors(rndr, cur_frame->vkf);
+    // Write the per frame ubo and the draw batches to the frame ring
+    write_frame_ubo(rndr, cur_frame);
+    write_draw_batches(rndr, cur_frame);
+
+    // Get the cached descriptor sets for this frame, writing only the new and invalidated ones
+    err = update_uniform_descriptors(rndr, cur_frame);
     if (err != err_code::RENDER_NO_ERROR) {
         return err;
     }
 
+    if (rndr->gprof.overlay) {
+        gprof_draw_overlay(&rndr->gprof);
+    }
+
     // Get IM GUI data
     ImGui::Render();
 
@@ -1791,12 +3672,18 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
     // ind to the command pool
     auto buf_ind = cur_frame->vkf->cmd_buf_ind;
     auto cmd_buf = &dev->qfams[buf_ind.pool_ind.qfam_ind].cmd_pools[buf_ind.pool_ind.pool_ind].buffers[buf_ind.buffer_ind];
-    auto fb = &dev->framebuffers[im_ind];
+
+    // Submit this frame's uploads before the frame so everything it draws has been copied (and acquired by the graphics
+    // queue when uploads run on a separate transfer queue)
+    err = vkr_submit_uploads(&rndr->uploads, &rndr->vk);
+    if (err != err_code::VKR_NO_ERROR) {
+        wlog("Failed to submit uploads with err code %d", err);
+    }
 
     // We have the acquired image index, though we don't know when it will be ready to have ops submitted, we can record
-    // the ops in the command buffer and submit once it is ready
-    // This takes about %80 of the run frame
-    err = record_command_buffer(rndr, fb, cur_frame->vkf, cmd_buf);
+    // the ops in the command buffer and submit once it is ready. This used to take about %80 of the run frame - with
+    // enough draw batches they are now recorded across the job pool threads.
+    err = record_command_buffer(rndr, im_ind, cur_frame->vkf, cmd_buf);
     if (err != err_code::RENDER_NO_ERROR) {
         return err;
     }
@@ -1806,6 +3693,9 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
     if (err != err_code::RENDER_NO_ERROR) {
         return err;
     }
+    if (rndr->headless) {
+        return err_code::RENDER_NO_ERROR;
+    }
     auto ret = present_image(rndr, cur_frame->vkf, im_ind);
 
     return ret;
@@ -1813,24 +3703,47 @@ int end_render_frame(renderer *rndr, camera *cam, f64 dt)
 
 void terminate_renderer(renderer *rndr)
 {
+    // No more jobs can run after this so the recording threads' pools can be destroyed with the rest once the device is idle
+    terminate_job_pool(&rndr->jobs);
     rndr->default_mat = {};
     for (int i = 0; i < rndr->per_frame_data.size; ++i) {
-        arr_terminate(&rndr->per_frame_data[i].buffer_updates);
-    }
-    hmap_terminate(&rndr->dcs.rpasses);
+        dirty_set_terminate(&rndr->per_frame_data[i].dirty_transforms);
+        dirty_set_terminate(&rndr->per_frame_data[i].dirty_materials);
+        dirty_set_terminate(&rndr->per_frame_data[i].dirty_pipelines);
+        hmap_terminate(&rndr->per_frame_data[i].desc_cache);
+    }
+    terminate_cull_info(&rndr->dcs.cull);
+    arr_terminate(&rndr->dcs.batches);
+    arr_terminate(&rndr->dcs.sort_scratch);
+    arr_terminate(&rndr->dcs.visible);
+    arr_terminate(&rndr->dcs.free_geometry_ids);
+    hmap_terminate(&rndr->dcs.geometry_ids);
+    arr_terminate(&rndr->dcs.models);
+    arr_terminate(&rndr->dcs.packets);
+    hmap_terminate(&rndr->dcs.group_lookup);
+    arr_terminate(&rndr->dcs.groups);
+    arr_terminate(&rndr->dcs.rpasses);
     mem_reset_arena(&rndr->vk_frame_linear);
     mem_reset_arena(&rndr->frame_linear);
-    mem_reset_arena(&rndr->dcs.dc_linear);
 
     // These are stack arenas so must go in this order
     hmap_terminate(&rndr->rmi.meshes);
-    mem_terminate_arena(&rndr->rmi.inds.node_pool);
-    mem_terminate_arena(&rndr->rmi.verts.node_pool);
+    for (sizet ci = 0; ci < rndr->rmi.chunks.size; ++ci) {
+        terminate_offset_allocator(&rndr->rmi.chunks[ci].inds.alloc);
+        terminate_offset_allocator(&rndr->rmi.chunks[ci].verts.alloc);
+    }
 
     vkr_device_wait_idle(&rndr->vk.inst.device);
+    save_pipeline_cache(rndr);
+    vkr_terminate_upload_manager(&rndr->uploads, &rndr->vk);
+    terminate_record_threads(rndr);
     terminate_imgui(rndr);
+    gprof_terminate(&rndr->gprof, &rndr->vk);
+    terminate_render_graph(&rndr->rgraph, &rndr->vk);
+    if (rndr->bindless_pool.hndl != VK_NULL_HANDLE) {
+        vkr_terminate_descriptor_pool(&rndr->bindless_pool, &rndr->vk);
+    }
     vkr_terminate(&rndr->vk);
-    mem_terminate_arena(&rndr->dcs.dc_linear);
     mem_terminate_arena(&rndr->vk_free_list);
     mem_terminate_arena(&rndr->vk_frame_linear);
     mem_terminate_arena(&rndr->frame_linear);
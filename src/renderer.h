@@ -5,7 +5,11 @@
 #include "containers/array.h"
 #include "containers/hmap.h"
 #include "sim_region.h"
-#include "vk_context.h"
+#include "occlusion.h"
+#include "offset_alloc.h"
+#include "job_pool.h"
+#include "render_graph.h"
+#include "gpu_profiler.h"
 
 struct ImGuiContext;
 
@@ -14,6 +18,10 @@ namespace nslib
 #define INVALID_IND ((sizet) - 1)
 
 inline const rid FWD_RPASS = make_rid("forward");
+inline const rid RG_SWAPCHAIN_IMAGE = make_rid("swapchain");
+inline const rid RG_FWD_DEPTH_IMAGE = make_rid("forward-depth");
+inline const rid GPROF_FRAME_SCOPE = make_rid("frame");
+inline const rid GPROF_GPU_CULL_SCOPE = make_rid("gpu-cull");
 inline const rid PLINE_FWD_RPASS_S0_OPAQUE_COL = make_rid("forward-s0-opaque-col");
 inline const rid PLINE_FWD_RPASS_S0_OPAQUE_DIFFUSE = make_rid("forward-s0-opaque-diffuse");
 
@@ -22,27 +30,33 @@ struct camera;
 struct static_model;
 struct transform;
 
-// 20 million triangles... thats a lot - works on desktop
-const sizet MAX_TRIANGLE_COUNT = 20000000;
-// Default ind buffer size (holding all of our inds) in ind count (not byte size)
-const sizet DEFAULT_IND_BUFFER_SIZE = MAX_TRIANGLE_COUNT * 3;
-// Default vert buffer size (holding all of our verts) in vert count (not byte size)
-// Consider there is on average 6 shared triangles per vert - i think dividing the above by 3 is plenty
-const sizet DEFAULT_VERT_BUFFER_SIZE = MAX_TRIANGLE_COUNT;
-// Initial mem pool size (in element count) for our sbuffer mem pools
-const sizet MAX_FREE_SBUFFER_NODE_COUNT = 1024;
-// Minimum allowed sbuffer_entry block size in the free list for verts
-const sizet MIN_VERT_FREE_BLOCK_SIZE = 4;
-// Minimum allowed sbuffer_entry block size in the free list for indices
-const sizet MIN_IND_FREE_BLOCK_SIZE = 6;
+// Vert count (not byte size) of each geometry chunk's vert buffer - about 24 MB
+const sizet GEOMETRY_CHUNK_VERT_COUNT = 1 << 20;
+// Ind count (not byte size) of each geometry chunk's ind buffer - about 6 MB
+const sizet GEOMETRY_CHUNK_IND_COUNT = 3 << 20;
+// Geometry chunks are added as meshes are uploaded up to this count - it has to fit in the draw key chunk bits
+const sizet MAX_GEOMETRY_CHUNK_COUNT = 64;
+// Initial node count for our sbuffer offset allocators - they grow as needed
+const sizet SBUFFER_INITIAL_NODE_COUNT = 1024;
 // Maximum number of render passes supported
 const sizet MAX_RENDERPASS_COUNT = 16;
+// Fewest draw batches worth recording in to their own secondary command buffer
+const sizet MIN_RECORD_JOB_BATCH_COUNT = 64;
+// Each render pass's batches are split in to at most this many jobs per recording thread so faster threads can pick up
+// the slack of slower ones
+const sizet RECORD_JOBS_PER_THREAD = 2;
 // Maximum number of materials the renderer supports
 const sizet MAX_PIPELINE_COUNT = 1024;
 // Maximum number of materials the renderer supports
 const sizet MAX_MATERIAL_COUNT = 4096;
-// Maximum number of objects
+// Size of the bindless texture array
+const sizet MAX_BINDLESS_TEXTURE_COUNT = 4096;
+// Maximum number of objects - this is also the maximum number of instances drawn per frame
 const sizet MAX_OBJECT_COUNT = 1000000;
+// Maximum number of instanced draws (and so indirect draw commands) per frame
+const sizet MAX_DRAW_COUNT = 65536;
+// Starting size of each frame's ring buffer - rings grow to fit the largest frame they have seen
+const sizet FRAME_RING_DEFAULT_SIZE = 4 * 1024 * 1024;
 
 
 namespace err_code
@@ -85,32 +99,60 @@ struct obj_ubo_data
     mat4 transform;
 };
 
+// Material parameters in the bindless material storage buffer, indexed by material ubo offset - tex_inds are indices in
+// to the bindless texture array for each sampler slot, or INVALID_ID if the slot has no uploaded texture
+struct bindless_material_data
+{
+    vec4 color;
+    uvec4 tex_inds;
+};
+static_assert(MAT_SAMPLER_SLOT_COUNT <= 4);
+
+// Entry in the instance storage buffer
+struct draw_instance
+{
+    u32 transform_ind;
+    u32 mat_ind;
+};
+
 struct sbuffer_entry
 {
     sizet offset;
     sizet size;
+    // Offset allocator node - needed to free the range
+    u32 node{INVALID_ID};
 };
 
-using sbuffer_entry_slnode = slnode<sbuffer_entry>;
-
 struct sbuffer_info
 {
     // Index of vk buffer this shared buffer refers to
     sizet buf_ind;
-    // The smallest allowable block size of free space... ie when searching through the free store we find a block that
-    // will fit the request, the remaining size of that block must be bigger than this to be broken off to its own entry
-    // in the free list
-    sizet min_free_block_size;
-    // The free list linked list - each node is allocated using the node pool arena
-    slist<sbuffer_entry> fl;
-    // The arena used to allocate each item in the free list
-    mem_arena node_pool;
+    // Element size in bytes
+    sizet elem_size;
+    // Ranges are in elements (not bytes) - freed ranges are merged with free neighbours so the buffer only fragments
+    // when live ranges are scattered, which defrag_mesh_buffers fixes
+    offset_allocator alloc;
+};
+
+// Index range of one level of detail within the submesh's ind range
+struct rsubmesh_lod
+{
+    u32 ind_offset;
+    u32 ind_count;
+    f32 error;
 };
 
 struct rsubmesh_entry
 {
+    // Index of the geometry chunk holding both the verts and inds
+    u32 chunk;
     sbuffer_entry verts;
+    // Holds the indices of every LOD back to back, so they all move together when the chunk is defragmented
     sbuffer_entry inds;
+    // LOD 0 is the full detail submesh and starts at the beginning of inds
+    static_array<rsubmesh_lod, MAX_LOD_COUNT> lods;
+    // Local space bounds of the submesh verts - used for culling
+    bbox bounds;
 };
 
 struct rmesh_entry
@@ -118,21 +160,253 @@ struct rmesh_entry
     static_array<rsubmesh_entry, MAX_SUBMESH_COUNT> submesh_entrees;
 };
 
-// We use a single vertex and indice buffer for all meshes
-struct rmesh_info
+// Shared vertex and indice buffer pair - a submesh's verts and inds always go in the same chunk so drawing it needs one
+// vertex/index buffer bind
+struct geometry_chunk
 {
-    hmap<rid, rmesh_entry> meshes;
     sbuffer_info verts;
     sbuffer_info inds;
+    // Indices are u32 instead of ind_t - only submeshes with wide_inds go in these chunks
+    b32 wide_inds;
+};
+
+// Mesh geometry is stored in device local chunks which are added as needed, so device memory tracks the loaded meshes.
+// Submeshes that don't fit in a default sized chunk get a chunk of their own sized to fit.
+struct rmesh_info
+{
+    hmap<rid, rmesh_entry> meshes;
+    static_array<geometry_chunk, MAX_GEOMETRY_CHUNK_COUNT> chunks;
 };
-struct render_pass_draw_group;
+struct rpass_info;
+struct pipeline_info;
+struct material_info;
 struct imgui_ctxt;
 struct profile_timepoints;
 
+// Draw packet sort key layout from the most to the least significant bits: render pass, pipeline, material, geometry
+// chunk, geometry, depth bucket. Sorting by the key keeps render passes in index order, groups draws by state and then
+// by geometry chunk so the vertex/index buffers are rebound as little as possible, and puts packets drawing the same
+// submesh with the same material next to each other so they can be drawn as one instanced draw. The instances within a
+// draw are ordered front to back.
+inline constexpr u32 DRAW_KEY_RPASS_BITS = 4;
+inline constexpr u32 DRAW_KEY_PIPELINE_BITS = 10;
+inline constexpr u32 DRAW_KEY_MATERIAL_BITS = 12;
+inline constexpr u32 DRAW_KEY_CHUNK_BITS = 6;
+inline constexpr u32 DRAW_KEY_GEOMETRY_BITS = 16;
+inline constexpr u32 DRAW_KEY_DEPTH_BITS = 16;
+inline constexpr u32 DRAW_KEY_RPASS_SHIFT = 64 - DRAW_KEY_RPASS_BITS;
+inline constexpr u32 DRAW_KEY_PIPELINE_SHIFT = DRAW_KEY_RPASS_SHIFT - DRAW_KEY_PIPELINE_BITS;
+inline constexpr u32 DRAW_KEY_MATERIAL_SHIFT = DRAW_KEY_PIPELINE_SHIFT - DRAW_KEY_MATERIAL_BITS;
+inline constexpr u32 DRAW_KEY_CHUNK_SHIFT = DRAW_KEY_MATERIAL_SHIFT - DRAW_KEY_CHUNK_BITS;
+inline constexpr u32 DRAW_KEY_GEOMETRY_SHIFT = DRAW_KEY_CHUNK_SHIFT - DRAW_KEY_GEOMETRY_BITS;
+inline constexpr u32 DRAW_KEY_DEPTH_SHIFT = DRAW_KEY_GEOMETRY_SHIFT - DRAW_KEY_DEPTH_BITS;
+inline constexpr u64 DRAW_KEY_GEOMETRY_MASK = ((u64(1) << DRAW_KEY_GEOMETRY_BITS) - 1) << DRAW_KEY_GEOMETRY_SHIFT;
+static_assert((1 << DRAW_KEY_CHUNK_BITS) >= MAX_GEOMETRY_CHUNK_COUNT);
+
+enum draw_call_flags
+{
+    DRAW_CALL_FLAG_NONE = 0,
+    DRAW_CALL_FLAG_HIDDEN = 1 << 0,
+    // The packet is on the free list
+    DRAW_CALL_FLAG_FREE = 1 << 1,
+};
+
+// Index range of one level of detail of a draw call, and the geometry id put in the packet key when it is drawn
+struct draw_lod
+{
+    u32 first_index;
+    u32 index_count;
+    u32 geometry_id;
+    // Simplification error in local units - used with the distance to pick the LOD each frame
+    f32 error;
+};
+
+struct draw_call
+{
+    draw_lod lods[MAX_LOD_COUNT];
+    u32 lod_count;
+    u32 instance_count;
+    u32 vertex_offset;
+    u32 first_instance;
+    // Geometry chunk the index and vertex offsets are in
+    u32 chunk;
+    u32 flags{};
+    // Index in to the static model cull info
+    u32 cull_ind{INVALID_ID};
+    // Index of the transform in the object storage buffer - written to the instance buffer for each visible instance
+    sizet ubo_offset;
+    // Material ubo offset - written to the instance buffer alongside the transform for bindless materials
+    u32 mat_ind;
+};
+
+// The frame and object descriptor set layouts are taken from the first pipeline added in the render pass. The set
+// indices are filled in each frame when the descriptor sets are allocated.
+struct draw_rpass_entry
+{
+    const rpass_info *rpinfo;
+    VkDescriptorSetLayout frame_layout;
+    VkDescriptorSetLayout obj_layout;
+    sizet frame_set;
+    sizet obj_set;
+};
+
+// Unique render pass, pipeline, and material combination - all packets with the same key above the depth bits belong
+// to the same group
+struct draw_group
+{
+    const rpass_info *rpinfo;
+    const pipeline_info *plinfo;
+    const material_info *mi;
+    VkDescriptorSetLayout pl_layout;
+    VkDescriptorSetLayout mat_layout;
+    sizet pl_set;
+    sizet mat_set;
+};
+
+struct draw_packet
+{
+    // Sort key with the depth bits cleared - they are filled in each frame
+    u64 key;
+    u32 group;
+    // Next packet of the same static model, or the next free packet if this one is free
+    u32 next{INVALID_ID};
+    draw_call dc;
+};
+
+// Returned by add_static_model - stays valid until the model is removed or clear_static_models is called. The
+// generation is bumped each time a slot is freed so stale handles are caught.
+struct static_model_draw_handle
+{
+    u32 slot{INVALID_ID};
+    u32 gen{};
+};
+
+inline bool is_valid(const static_model_draw_handle &hndl)
+{
+    return is_valid(hndl.slot);
+}
+
+// Static model slot - the packets added for the model are linked through draw_packet::next
+struct static_model_draw_entry
+{
+    u32 first_packet{INVALID_ID};
+    u32 gen{};
+    u32 next_free{INVALID_ID};
+};
+
+struct draw_sort_item
+{
+    u64 key;
+    u32 packet;
+    // LOD of the packet selected this frame - its geometry id is in the key
+    u32 lod;
+};
+
+// A run of visible packets with the same key down to the geometry bits drawn as one instanced draw. The batch index is
+// also the index of its command in the indirect buffer.
+struct draw_batch
+{
+    u32 packet;
+    u32 lod;
+    u32 first_instance;
+    u32 instance_count;
+};
+
+// Input to the GPU cull pass, one per instance - a world space bounding sphere, the transform written to the instance
+// buffer if the sphere is inside the frustum, and the indirect draw command whose instance count is incremented
+struct gpu_cull_candidate
+{
+    vec4 center_radius;
+    u32 transform_ind;
+    u32 draw_ind;
+    u32 mat_ind;
+    u32 pad;
+};
+
+struct gpu_cull_push_constants
+{
+    vec4 planes[FRUSTUM_PLANE_COUNT];
+    // x is the candidate count
+    uvec4 counts;
+};
+
+struct occluder_entry
+{
+    const mesh *msh;
+    u32 transform_ind;
+};
+
+// Bounds of every static model submesh added to the renderer, stored as SoA so the frustum cull can test four entries
+// at a time. Draw calls reference their entry by cull_ind - submeshes drawn by more than one pipeline share an entry.
+// The world space center/half extent arrays are padded to a multiple of four.
+struct static_model_cull_info
+{
+    array<u32> transform_inds;
+    array<bbox> local_bounds;
+    // Entries released by removed static models - their transform index is set to INVALID_ID until reused
+    array<u32> free_entries;
+
+    array<f32> center_x;
+    array<f32> center_y;
+    array<f32> center_z;
+    array<f32> ext_x;
+    array<f32> ext_y;
+    array<f32> ext_z;
+
+    // Result of the last cull - non zero if the entry is at least partially inside the frustum and not hidden behind
+    // the occluders
+    array<u8> visible;
+    sizet visible_count;
+    sizet occluded_count;
+
+    // Meshes rasterized in to the occlusion culler depth buffer each frame - the occlusion pass is skipped if empty
+    array<occluder_entry> occluders;
+    occlusion_culler occ;
+
+    // Set by the post transform ubo update functions - the world bounds are computed from the cached transforms
+    const comp_table<transform> *transforms;
+};
+
+// Geometry key id of an index range, and the number of live packet LODs drawing the range
+struct geometry_id_entry
+{
+    u32 id;
+    u32 ref_count;
+};
+
+// Flat list of draw packets for all static models. Each frame the packets that pass the cull get their depth bucket
+// filled in and are radix sorted by key in to visible, and recording walks that list linearly emitting state changes
+// only when the key prefix changes. Packets, cull entries and models are slot allocated with free lists so adding or
+// removing a model only touches its own packets. Groups and render pass entries are kept once added.
 struct static_model_draw_info
 {
-    hmap<rid, render_pass_draw_group *> rpasses;
-    mem_arena dc_linear;
+    // Render passes with at least one group, sorted by render pass index
+    array<draw_rpass_entry> rpasses;
+    array<draw_group> groups;
+    // Key prefix (depth bits cleared) to group index
+    hmap<u64, u32> group_lookup;
+    array<draw_packet> packets;
+    u32 free_packet_head{INVALID_ID};
+    array<static_model_draw_entry> models;
+    u32 free_model_head{INVALID_ID};
+    // Chunk (high 32 bits) and LOD first index to the id used in the geometry key bits - each LOD of a submesh has its
+    // own id so instances drawn at different LODs go in different batches. Ids are released when the last packet LOD
+    // using the range is freed, and released ids are handed out again before new ones.
+    hmap<u64, geometry_id_entry> geometry_ids;
+    array<u32> free_geometry_ids;
+
+    array<draw_sort_item> visible;
+    array<draw_sort_item> sort_scratch;
+
+    // Built from visible each frame, in the same order
+    array<draw_batch> batches;
+
+    // Candidates written for the GPU cull pass this frame, and the planes they are tested against
+    u32 gpu_cull_candidate_count;
+    frustum gpu_cull_frustum;
+    sizet gpu_cull_set;
+
+    static_model_cull_info cull;
 };
 // What we really want to do is have a big SSAO with all transforms for entire scene right?
 
@@ -142,12 +416,16 @@ struct sampled_texture_info
     sizet im;
     sizet im_view;
     sizet sampler;
+    // Index in the bindless texture array
+    u32 bindless_ind{INVALID_ID};
 };
 
 struct material_info
 {
     handle<material> mat{};
     sizet ubo_offset{};
+    // Bumped when the material or one of its textures changes so its cached descriptor sets are rewritten
+    u32 desc_version{};
 };
 
 struct pipeline_info
@@ -163,6 +441,8 @@ struct rpass_info
 {
     sizet rpind{};
     rid id{};
+    // The render graph pass the render pass was created for
+    u32 rg_pass{INVALID_ID};
 };
 
 struct imgui_ctxt
@@ -175,62 +455,103 @@ struct imgui_ctxt
     mem_arena fl;
 };
 
-enum update_buffer_event_type
+// Entries of a per frame buffer which must be re-uploaded before the frame is drawn, one bit per entry. Posting an
+// update only sets bits, so posting the same entry many times costs nothing extra, and the data is read from its
+// source when the frame is processed rather than when the update is posted.
+struct ubo_dirty_set
 {
-    UPDATE_BUFFER_EVENT_TYPE_TRANSFORM,
-    UPDATE_BUFFER_EVENT_TYPE_ALL_TRANSFORMS,
-    UPDATE_BUFFER_EVENT_TYPE_MATERIAL,
-    UPDATE_BUFFER_EVENT_TYPE_ALL_MATERIALS,
-    UPDATE_BUFFER_EVENT_TYPE_PIPELINE,
-    UPDATE_BUFFER_EVENT_TYPE_ALL_PIPELINES,
+    array<u64> bits;
+    // Number of bits set
+    sizet count;
+    // Every entry is dirty - bits are not used
+    b32 all;
 };
 
-struct transform_ubo_update_event
+enum desc_cache_set_type : u32
 {
-    const transform *tform;
-    sizet ubo_offset;
+    DESC_CACHE_SET_FRAME,
+    DESC_CACHE_SET_OBJECT,
+    DESC_CACHE_SET_PIPELINE,
+    DESC_CACHE_SET_MATERIAL,
+    DESC_CACHE_SET_GPU_CULL
 };
 
-struct transform_ubo_update_all_event
+// Identifies a cached descriptor set by its layout and the resource it points at - the resource is the pipeline or
+// material ubo slot for those set types and zero for the others
+struct desc_cache_key
 {
-    const comp_table<transform> *transforms;
+    VkDescriptorSetLayout layout;
+    u32 type;
+    u32 resource;
 };
 
-struct material_ubo_update_event
+inline bool operator==(const desc_cache_key &lhs, const desc_cache_key &rhs)
 {
-    const material_info *mi;
-};
+    return lhs.layout == rhs.layout && lhs.type == rhs.type && lhs.resource == rhs.resource;
+}
 
-struct material_ubo_update_all_event
-{};
+inline u64 hash_type(const desc_cache_key &key, u64 seed0, u64 seed1)
+{
+    return hash_ptr_xxhash3(&key, sizeof(desc_cache_key), seed0, seed1);
+}
 
-struct pipeline_ubo_update_event
+struct desc_cache_entry
 {
-    const pipeline_info *plinfo;
+    // Index in to the frame's descriptor pool sets
+    sizet set;
+    // Version of the resource the set was last written with
+    u32 version;
 };
 
-struct pipeline_ubo_update_all_event
-{};
+// Command pool for one recording thread in one frame in flight - the pool is reset as a whole when the frame begins
+// and its secondary buffers are reused in order
+struct record_thread_data
+{
+    vkr_command_pool pool;
+    sizet used_bufs;
+};
 
-struct update_ubo_buffer_event
+// Contiguous run of one render pass's draw batches recorded in to a secondary command buffer
+struct record_job
 {
-    u32 type{};
-    union
-    {
-        transform_ubo_update_event tf;
-        transform_ubo_update_all_event tfall;
-        material_ubo_update_event mat;
-        material_ubo_update_all_event matall;
-        pipeline_ubo_update_event pl;
-        pipeline_ubo_update_all_event plall;
-    };
+    u32 rpass_entry;
+    u32 first_batch;
+    u32 end_batch;
+    // GPU profiler scope of the first pipeline run in the job, with the rest following it
+    u32 first_scope;
+    VkCommandBuffer cmd_buf;
+    int err;
 };
 
 struct renderer_fif_data
 {
-    // Set of updates that will occur once we have our fence - these updates get posted to each frame
-    array<update_ubo_buffer_event> buffer_updates;
+    // Buffer entries to upload once we have our fence - updates are marked in every frame in flight
+    ubo_dirty_set dirty_transforms;
+    ubo_dirty_set dirty_materials;
+    ubo_dirty_set dirty_pipelines;
     vkr_frame *vkf;
+
+    // Descriptor sets allocated from this frame's pool are kept across frames and only rewritten when the version of
+    // the resource they point at changes. Sets are only touched after the frame's fence is waited on.
+    hmap<desc_cache_key, desc_cache_entry> desc_cache;
+    // Reset the pool and drop the cache the next time this frame begins
+    b32 flush_desc_cache;
+
+    // Index of this frame's bindless material set in the renderer bindless pool
+    sizet bindless_set{INVALID_IND};
+
+    // This frame's allocations from the frame ring
+    vkr_frame_alloc frame_ubo;
+    vkr_frame_alloc instances;
+    vkr_frame_alloc draw_cmds;
+    vkr_frame_alloc cull_candidates;
+
+    // One per job pool worker with the calling thread last
+    static_array<record_thread_data, MAX_JOB_THREAD_COUNT + 1> record_threads;
+
+    // Host visible buffer the offscreen color image is copied in to when headless with readback
+    sizet readback_buf_ind{INVALID_IND};
+    b32 readback_pending{false};
 };
 
 struct renderer
@@ -242,6 +563,9 @@ struct renderer
     vkr_context vk{};
     mem_arena vk_free_list;
 
+    // Mesh and texture uploads are batched and submitted once per frame
+    vkr_upload_manager uploads;
+
     mem_arena vk_frame_linear;
     mem_arena frame_linear;
 
@@ -285,14 +609,91 @@ struct renderer
     sizet default_image_view_ind;
     sizet default_sampler_ind;
 
-    sizet swapchain_fb_depth_stencil_iview_ind{INVALID_IND};
-    sizet swapchain_fb_depth_stencil_im_ind{INVALID_IND};
+    // Passes of the frame and the images they use - creates the render passes and framebuffers and records the barriers
+    // between the passes
+    render_graph rgraph;
+
+    // GPU timestamps around the frame, the render graph passes, and each run of draws with the same pipeline
+    gpu_profiler gprof;
+
+    // Record the static model draws of each material with vkCmdDrawIndexedIndirect from the per frame indirect buffer
+    // rather than a vkCmdDrawIndexed per batch. Turned off on init if the device doesn't support indirect first instance.
+    b32 indirect_draws{true};
+
+    // Frustum cull instances in a compute pass which fills in the instance buffer and indirect draw instance counts,
+    // instead of on the CPU. Needs indirect_draws and is turned off on init if the cull shader can't be loaded.
+    b32 gpu_cull{false};
+    sizet gpu_cull_plind{INVALID_IND};
+
+    // Each visible static model submesh is drawn with its coarsest LOD whose simplification error projects to at most
+    // this many pixels at the submesh's distance from the camera. Zero always draws the full detail LOD.
+    f32 lod_pixel_error{1.0f};
+
+    // Record the static model draw batches across the job pool threads in to secondary command buffers which the
+    // frame's primary buffer executes - frames with few batches are still recorded inline. Can only be changed before
+    // init, and is turned off on init if the machine has a single hardware thread.
+    b32 parallel_record{true};
+    // Runs pipeline creation at init, and the occlusion raster and draw recording each frame
+    job_pool jobs;
+    array<record_job> record_jobs;
+
+    // Bind all material parameters and textures once per pipeline through a descriptor indexed set instead of a set per
+    // material - materials are selected per instance so they no longer split draw batches. Can only be changed before
+    // init, and is turned off on init if the device doesn't support the needed descriptor indexing features.
+    b32 bindless{true};
+
+    // The pipeline cache is loaded from this file on init and saved back to it on terminate, so after the first run
+    // the driver skips compiling pipelines it has seen before. Null keeps the cache in memory only. Can only be changed
+    // before init.
+    const char *pipeline_cache_fname{"data/pipeline.cache"};
+    // Update after bind pool holding the bindless set of each frame in flight
+    vkr_descriptor_pool bindless_pool;
+    u32 bindless_texture_count{};
+
+    // Render in to offscreen images of headless_size instead of a window's swapchain - no window, surface, or present
+    // support is needed so the whole frame can be benchmarked on a CPU device like lavapipe. Frames end with the submit
+    // signaling the frame's fence instead of a present. Can only be changed before init.
+    b32 headless{false};
+    uvec2 headless_size{1280, 720};
+    // Copy each headless frame's color image in to host memory - see get_readback_pixels. Can only be changed before
+    // init.
+    b32 headless_readback{false};
+    // Frame in flight whose readback was the last to finish
+    u32 readback_frame{INVALID_ID};
 };
 
+// Remove all static models - all draw handles are invalidated
 void clear_static_models(renderer *rndr);
-int add_static_model(renderer *rndr, const static_model *sm, sizet transform_ind, const mesh_cache *msh_cache, const material_cache *mat_cache);
+
+// Add draw packets for each submesh and material pipeline of the static model - the mesh must already be uploaded. The
+// returned handle is used to update or remove the model later.
+static_model_draw_handle add_static_model(renderer *rndr,
+                                          const static_model *sm,
+                                          sizet transform_ind,
+                                          const mesh_cache *msh_cache,
+                                          const material_cache *mat_cache);
+
+// Rebuild the packets of the model in place (for a changed mesh, materials, or transform index) - the handle stays the
+// same. Returns false if the handle is stale.
+bool update_static_model(renderer *rndr,
+                         const static_model_draw_handle &hndl,
+                         const static_model *sm,
+                         sizet transform_ind,
+                         const mesh_cache *msh_cache,
+                         const material_cache *mat_cache);
+
+// Free the packets and cull entries of the model - returns false if the handle is stale
+bool remove_static_model(renderer *rndr, const static_model_draw_handle &hndl);
+
+// Rasterize the mesh in to the CPU occlusion depth buffer each frame using the transform at transform_ind - static models
+// hidden behind occluders are not drawn. Low poly stand ins for large models work best. The mesh must stay alive until
+// clear_static_models is called.
+void add_occluder(renderer *rndr, const mesh *msh, sizet transform_ind);
 
 void post_transform_ubo_update(renderer *rndr, const transform *tf, const comp_table<transform> *ctbl);
+// Upload the transforms at table indices [first, first + count) as one block - cheaper than posting them one at a time
+// when a contiguous run of the table changed
+void post_transform_ubo_update_range(renderer *rndr, const comp_table<transform> *ctbl, sizet first, sizet count);
 void post_transform_ubo_update_all(renderer *rndr, const comp_table<transform> *ctbl);
 void post_material_ubo_update(renderer *rndr, const rid &mat_id);
 void post_material_ubo_update_all(renderer *rndr);
@@ -300,29 +701,54 @@ void post_pipeline_ubo_update(renderer *rndr, const rid *plid);
 void post_pipeline_ubo_update_all(renderer *rndr);
 void post_ubo_update_all(renderer *rndr, const comp_table<transform> *ctbl);
 
+// Drop all cached descriptor sets - each frame in flight reallocates and rewrites its sets the next time it begins
+void invalidate_descriptor_cache(renderer *rndr);
+
 // NOTE: All of these mesh operations kind of need to wait on all rendering operations to complete as they modify the
 // vertex and index buffers - not sure yet if this is better done within the functions or in the caller. Also these should be done at the
 // start of a frame because any indices submitted in command buffers will be invalid after these operations. It almost seems like we should
 // get a list of these and then just do it at start of frame after we wait for sync if there are any to do.
 
-// Upload mesh data to GPU using the shared indice/vertex buffer, also "registers" the mesh with the renderer so it can
-// be drawn
+// Upload mesh data to GPU in to a geometry chunk (adding a chunk if none has room), also "registers" the mesh with the
+// renderer so it can be drawn
 bool upload_to_gpu(const mesh *msh, renderer *rdnr);
 
+// Upload many meshes at once - the ranges for all of them are reserved first, then the data for each geometry chunk is
+// packed in to the staging ring and copied with a single copy command per buffer. Meshes that were already uploaded are
+// skipped, in which case false is returned.
+bool upload_to_gpu(const mesh *const *meshes, sizet count, renderer *rndr);
+
 // Upload texture data to GPU using 
 bool upload_to_gpu(const texture *texture, renderer *rdnr);
 
 
-// Remove from gpu simply adds the meshes block to the free list, indicating that the block can be overwritten, and then
-// removes the mesh from our mesh entry list. It does not do any actual gpu uploading
+// Remove from gpu simply frees the meshes ranges (merging them with neighbouring free ranges), indicating that they can
+// be overwritten, and then removes the mesh from our mesh entry list. It does not do any actual gpu uploading
 bool remove_from_gpu(mesh *msh, renderer *rndr);
 
+// Compact the live mesh ranges to the start of each geometry chunk's vertex and index buffers. The ranges are copied in
+// to new buffers with one GPU copy per buffer, then the mesh entries and static model draw packets are patched with the
+// new offsets. This waits for the device to be idle so it is meant for load screens and the like, not every frame.
+int defrag_mesh_buffers(renderer *rndr);
+
+// The window handle is ignored (and can be null) if rndr->headless is set
 int init_renderer(renderer *rndr, const handle<material> &default_mat, void *win_hndl, mem_arena *fl_arena);
 
 int begin_render_frame(renderer *rndr, int finished_frames);
 
 int end_render_frame(renderer *rndr, camera *cam, f64 dt);
 
+// Allocate per frame data (immediate geometry for example) from the current frame's ring buffer. Must be called between
+// begin_render_frame and end_render_frame, and the data is only valid for this frame. Use get_frame_ring_buffer for
+// the buffer to bind with the returned offset.
+vkr_frame_alloc alloc_frame_data(renderer *rndr, sizet size, sizet alignment);
+const vkr_buffer *get_frame_ring_buffer(renderer *rndr);
+
+// Pixels of the last headless frame read back, as tightly packed VKR_HEADLESS_FORMAT rows of headless_size. Frames are
+// read back once their fence has been waited on in begin_render_frame, so this is MAX_FRAMES_IN_FLIGHT frames behind
+// and only valid until the next end_render_frame. Null if not headless with readback or no frame has finished yet.
+const void *get_readback_pixels(const renderer *rndr);
+
 void terminate_renderer(renderer *rndr);
 
 } // namespace nslib
@@ -79,6 +79,11 @@ bool remove_entity(entity *ent, sim_region *reg)
     return remove_entity(ent->id, reg);
 }
 
+frustum camera_frustum(const camera *cam)
+{
+    return math::extract_frustum(cam->proj * cam->view);
+}
+
 void init_sim_region(sim_region *reg, mem_arena *arena)
 {
     arr_init(&reg->ents, arena);
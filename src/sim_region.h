@@ -1,6 +1,7 @@
 #pragma once
 
 #include "math/matrix4.h"
+#include "math/frustum.h"
 #include "model.h"
 
 namespace nslib
@@ -225,6 +226,9 @@ entity *get_entity(u32 ent_id, sim_region *reg);
 bool remove_entity(u32 ent_id, sim_region *reg);
 bool remove_entity(entity *ent, sim_region *reg);
 
+// World space frustum from the camera's current proj and view matrices
+frustum camera_frustum(const camera *cam);
+
 void init_sim_region(sim_region *reg, mem_arena *arena);
 void terminate_sim_region(sim_region *reg);
 
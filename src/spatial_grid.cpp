@@ -0,0 +1,195 @@
+#include "spatial_grid.h"
+
+namespace nslib
+{
+
+intern u32 next_pow2(u32 v)
+{
+    u32 ret = 1;
+    while (ret < v) {
+        ret <<= 1;
+    }
+    return ret;
+}
+
+intern u32 hash_cell(const spatial_grid *grid, const ivec3 &cell)
+{
+    return ((u32)cell.x * 73856093u ^ (u32)cell.y * 19349663u ^ (u32)cell.z * 83492791u) & grid->bucket_mask;
+}
+
+intern bool same_cell(const spatial_grid *grid, const vec3 &pos, const ivec3 &cell)
+{
+    return spatial_grid_cell(grid, pos) == cell;
+}
+
+void init_spatial_grid(spatial_grid *grid, mem_arena *arena, f32 cell_size, u32 bucket_count)
+{
+    asrt(cell_size > 0.0f);
+    grid->cell_size = cell_size;
+    grid->inv_cell_size = 1.0f / cell_size;
+    bucket_count = next_pow2(bucket_count);
+    grid->bucket_mask = bucket_count - 1;
+    arr_init(&grid->bucket_start, arena, bucket_count + 1);
+    arr_init(&grid->cursor, arena, bucket_count);
+    arr_init(&grid->entries, arena);
+    arr_init(&grid->item_bucket, arena);
+    arr_resize(&grid->bucket_start, bucket_count + 1, 0u);
+}
+
+void terminate_spatial_grid(spatial_grid *grid)
+{
+    arr_terminate(&grid->cursor);
+    arr_terminate(&grid->item_bucket);
+    arr_terminate(&grid->entries);
+    arr_terminate(&grid->bucket_start);
+}
+
+ivec3 spatial_grid_cell(const spatial_grid *grid, const vec3 &pos)
+{
+    return {(s32)std::floor(pos.x * grid->inv_cell_size), (s32)std::floor(pos.y * grid->inv_cell_size), (s32)std::floor(pos.z * grid->inv_cell_size)};
+}
+
+template<class GetFunc>
+intern void rebuild(spatial_grid *grid, sizet count, GetFunc get_item)
+{
+    // Keep the load at or below one entry per bucket on average
+    u32 bucket_count = grid->bucket_mask + 1;
+    if (count > bucket_count) {
+        bucket_count = next_pow2((u32)count);
+        grid->bucket_mask = bucket_count - 1;
+    }
+
+    arr_resize(&grid->bucket_start, bucket_count + 1);
+    arr_resize(&grid->cursor, bucket_count);
+    arr_resize(&grid->item_bucket, count);
+    arr_resize(&grid->entries, count);
+    memset(grid->bucket_start.data, 0, arr_sizeof(grid->bucket_start));
+
+    // Count the items in each bucket
+    for (sizet i = 0; i < count; ++i) {
+        vec3 pos;
+        u32 ent_id;
+        get_item(i, &pos, &ent_id);
+        u32 b = hash_cell(grid, spatial_grid_cell(grid, pos));
+        grid->item_bucket[i] = b;
+        ++grid->bucket_start[b + 1];
+    }
+
+    // Prefix sum to turn counts in to start offsets
+    for (u32 b = 0; b < bucket_count; ++b) {
+        grid->bucket_start[b + 1] += grid->bucket_start[b];
+        grid->cursor[b] = grid->bucket_start[b];
+    }
+
+    // Scatter the items in to their buckets
+    for (sizet i = 0; i < count; ++i) {
+        auto entry = &grid->entries[grid->cursor[grid->item_bucket[i]]++];
+        get_item(i, &entry->pos, &entry->ent_id);
+    }
+}
+
+void spatial_grid_rebuild(spatial_grid *grid, const comp_table<transform> *tforms)
+{
+    rebuild(grid, tforms->entries.size, [tforms](sizet i, vec3 *pos, u32 *ent_id) {
+        *pos = tforms->entries[i].world_pos;
+        *ent_id = tforms->entries[i].ent_id;
+    });
+}
+
+void spatial_grid_rebuild(spatial_grid *grid, const vec3 *positions, const u32 *ent_ids, sizet count)
+{
+    rebuild(grid, count, [positions, ent_ids](sizet i, vec3 *pos, u32 *ent_id) {
+        *pos = positions[i];
+        *ent_id = ent_ids[i];
+    });
+}
+
+void spatial_grid_query_neighbors(const spatial_grid *grid, const vec3 &pos, array<u32> *ent_ids)
+{
+    ivec3 center = spatial_grid_cell(grid, pos);
+    for (s32 z = -1; z <= 1; ++z) {
+        for (s32 y = -1; y <= 1; ++y) {
+            for (s32 x = -1; x <= 1; ++x) {
+                ivec3 cell{center.x + x, center.y + y, center.z + z};
+                u32 b = hash_cell(grid, cell);
+                for (u32 i = grid->bucket_start[b]; i < grid->bucket_start[b + 1]; ++i) {
+                    if (same_cell(grid, grid->entries[i].pos, cell)) {
+                        arr_push_back(ent_ids, grid->entries[i].ent_id);
+                    }
+                }
+            }
+        }
+    }
+}
+
+void spatial_grid_query_radius(const spatial_grid *grid, const vec3 &center, f32 radius, array<u32> *ent_ids)
+{
+    ivec3 cmin = spatial_grid_cell(grid, center - vec3{radius});
+    ivec3 cmax = spatial_grid_cell(grid, center + vec3{radius});
+    f32 rad_sq = radius * radius;
+    for (s32 z = cmin.z; z <= cmax.z; ++z) {
+        for (s32 y = cmin.y; y <= cmax.y; ++y) {
+            for (s32 x = cmin.x; x <= cmax.x; ++x) {
+                ivec3 cell{x, y, z};
+                u32 b = hash_cell(grid, cell);
+                for (u32 i = grid->bucket_start[b]; i < grid->bucket_start[b + 1]; ++i) {
+                    auto entry = &grid->entries[i];
+                    if (math::length_sq(entry->pos - center) <= rad_sq && same_cell(grid, entry->pos, cell)) {
+                        arr_push_back(ent_ids, entry->ent_id);
+                    }
+                }
+            }
+        }
+    }
+}
+
+// Half of the 26 neighbor offsets - visiting only these (plus the own cell with j > i) reports each pair once
+intern const ivec3 FORWARD_NEIGHBORS[13] = {
+    {1, 0, 0},
+    {-1, 1, 0},
+    {0, 1, 0},
+    {1, 1, 0},
+    {-1, -1, 1},
+    {0, -1, 1},
+    {1, -1, 1},
+    {-1, 0, 1},
+    {0, 0, 1},
+    {1, 0, 1},
+    {-1, 1, 1},
+    {0, 1, 1},
+    {1, 1, 1},
+};
+
+void spatial_grid_find_pairs(const spatial_grid *grid, f32 radius, array<spatial_grid_pair> *pairs)
+{
+    asrt(radius <= grid->cell_size);
+    f32 rad_sq = radius * radius;
+    u32 bucket_count = grid->bucket_mask + 1;
+    for (u32 b = 0; b < bucket_count; ++b) {
+        for (u32 i = grid->bucket_start[b]; i < grid->bucket_start[b + 1]; ++i) {
+            auto ei = &grid->entries[i];
+            ivec3 cell = spatial_grid_cell(grid, ei->pos);
+
+            // Same cell - entries in the same cell are always in the same bucket
+            for (u32 j = i + 1; j < grid->bucket_start[b + 1]; ++j) {
+                auto ej = &grid->entries[j];
+                if (math::length_sq(ej->pos - ei->pos) <= rad_sq && same_cell(grid, ej->pos, cell)) {
+                    arr_push_back(pairs, {ei->ent_id, ej->ent_id});
+                }
+            }
+
+            for (int n = 0; n < 13; ++n) {
+                ivec3 ncell = cell + FORWARD_NEIGHBORS[n];
+                u32 nb = hash_cell(grid, ncell);
+                for (u32 j = grid->bucket_start[nb]; j < grid->bucket_start[nb + 1]; ++j) {
+                    auto ej = &grid->entries[j];
+                    if (math::length_sq(ej->pos - ei->pos) <= rad_sq && same_cell(grid, ej->pos, ncell)) {
+                        arr_push_back(pairs, {ei->ent_id, ej->ent_id});
+                    }
+                }
+            }
+        }
+    }
+}
+
+} // namespace nslib
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "sim_region.h"
+
+namespace nslib
+{
+
+inline constexpr f32 SPATIAL_GRID_DEFAULT_CELL_SIZE = 2.0f;
+inline constexpr u32 SPATIAL_GRID_DEFAULT_BUCKET_COUNT = 4096;
+
+struct spatial_grid_entry
+{
+    vec3 pos;
+    u32 ent_id;
+};
+
+struct spatial_grid_pair
+{
+    u32 ent_a;
+    u32 ent_b;
+};
+
+// Uniform grid over unbounded space - cells are hashed in to a fixed power of two number of buckets. The grid is
+// rebuilt from scratch each frame with a counting sort so all entries in a bucket are contiguous in entries and
+// bucket b spans [bucket_start[b], bucket_start[b + 1]). Different cells can hash to the same bucket so queries always
+// filter by cell (or distance).
+struct spatial_grid
+{
+    f32 cell_size{SPATIAL_GRID_DEFAULT_CELL_SIZE};
+    f32 inv_cell_size{1.0f / SPATIAL_GRID_DEFAULT_CELL_SIZE};
+    u32 bucket_mask{SPATIAL_GRID_DEFAULT_BUCKET_COUNT - 1};
+
+    array<u32> bucket_start;
+    array<spatial_grid_entry> entries;
+
+    // Scratch for the rebuild - bucket of each input item and the insertion cursor for each bucket
+    array<u32> item_bucket;
+    array<u32> cursor;
+};
+
+// bucket_count is rounded up to a power of two, and the grid grows it automatically on rebuild if there are more
+// entries than buckets
+void init_spatial_grid(spatial_grid *grid,
+                       mem_arena *arena,
+                       f32 cell_size = SPATIAL_GRID_DEFAULT_CELL_SIZE,
+                       u32 bucket_count = SPATIAL_GRID_DEFAULT_BUCKET_COUNT);
+void terminate_spatial_grid(spatial_grid *grid);
+
+ivec3 spatial_grid_cell(const spatial_grid *grid, const vec3 &pos);
+
+// Rebuild the grid from the world positions of every transform in the table - O(n)
+void spatial_grid_rebuild(spatial_grid *grid, const comp_table<transform> *tforms);
+
+// Rebuild from parallel arrays of positions and entity ids
+void spatial_grid_rebuild(spatial_grid *grid, const vec3 *positions, const u32 *ent_ids, sizet count);
+
+// Append all entity ids in the 3x3x3 block of cells around pos without any distance check
+void spatial_grid_query_neighbors(const spatial_grid *grid, const vec3 &pos, array<u32> *ent_ids);
+
+// Append all entity ids within radius of center
+void spatial_grid_query_radius(const spatial_grid *grid, const vec3 &center, f32 radius, array<u32> *ent_ids);
+
+// Append every unordered pair of entities closer than radius - each pair is reported once. The radius must not be
+// larger than the cell size.
+void spatial_grid_find_pairs(const spatial_grid *grid, f32 radius, array<spatial_grid_pair> *pairs);
+
+} // namespace nslib
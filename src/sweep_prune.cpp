@@ -0,0 +1,278 @@
+#include <algorithm>
+
+#include "logging.h"
+#include "sweep_prune.h"
+
+namespace nslib
+{
+
+intern bool endpoint_less(const sap_endpoint &lhs, const sap_endpoint &rhs)
+{
+    // Mins sort before maxes at the same value so touching boxes count as overlapping
+    if (lhs.val != rhs.val) {
+        return lhs.val < rhs.val;
+    }
+    return (lhs.data & SAP_ENDPOINT_FLAG_MAX) < (rhs.data & SAP_ENDPOINT_FLAG_MAX);
+}
+
+intern bool boxes_overlap(const sap_box *a, const sap_box *b)
+{
+#if NOBLE_STEED_SIMD
+    __m128 le0 = _mm_cmple_ps(a->min._v4, b->max._v4);
+    __m128 le1 = _mm_cmple_ps(b->min._v4, a->max._v4);
+    return (_mm_movemask_ps(_mm_and_ps(le0, le1)) & 0x7) == 0x7;
+#else
+    return a->min.x <= b->max.x && b->min.x <= a->max.x && a->min.y <= b->max.y && b->min.y <= a->max.y && a->min.z <= b->max.z &&
+           b->min.z <= a->max.z;
+#endif
+}
+
+intern void set_box_bounds(sap_box *box, const bbox &bounds)
+{
+    // A max endpoint sorting before its min would close the box in the sweep before it was opened
+    box->empty = bounds.min.x > bounds.max.x || bounds.min.y > bounds.max.y || bounds.min.z > bounds.max.z;
+    if (box->empty) {
+        box->min = {};
+        box->max = {};
+        return;
+    }
+    box->min = {bounds.min, 0.0f};
+    box->max = {bounds.max, 0.0f};
+}
+
+void init_sweep_prune(sweep_prune *sap, mem_arena *arena, int axis, sizet initial_capacity)
+{
+    asrt(axis >= 0 && axis < 3);
+    sap->axis = axis;
+    sap->free_box_head = INVALID_ID;
+    arr_init(&sap->boxes, arena, initial_capacity);
+    arr_init(&sap->endpoints, arena, initial_capacity * 2);
+    arr_init(&sap->pairs, arena);
+    arr_init(&sap->added, arena);
+    arr_init(&sap->removed, arena);
+    arr_init(&sap->active, arena);
+    arr_init(&sap->cur_pairs, arena);
+    hmap_init(&sap->ent_boxes, hash_type, arena);
+    hmap_init(&sap->mesh_bounds, hash_type, arena);
+}
+
+void terminate_sweep_prune(sweep_prune *sap)
+{
+    hmap_terminate(&sap->mesh_bounds);
+    hmap_terminate(&sap->ent_boxes);
+    arr_terminate(&sap->cur_pairs);
+    arr_terminate(&sap->active);
+    arr_terminate(&sap->removed);
+    arr_terminate(&sap->added);
+    arr_terminate(&sap->pairs);
+    arr_terminate(&sap->endpoints);
+    arr_terminate(&sap->boxes);
+}
+
+bool sap_insert(sweep_prune *sap, u32 ent_id, const bbox &bounds)
+{
+    if (hmap_find(&sap->ent_boxes, ent_id)) {
+        wlog("Entity %u already has a sap box", ent_id);
+        return false;
+    }
+
+    u32 bind = sap->free_box_head;
+    if (is_valid(bind)) {
+        sap->free_box_head = sap->boxes[bind].next_free;
+        sap->boxes[bind] = {};
+    }
+    else {
+        bind = (u32)sap->boxes.size;
+        arr_emplace_back(&sap->boxes);
+    }
+    sap->boxes[bind].ent_id = ent_id;
+    set_box_bounds(&sap->boxes[bind], bounds);
+    hmap_insert(&sap->ent_boxes, ent_id, bind);
+
+    arr_push_back(&sap->endpoints, {sap->boxes[bind].min[sap->axis], bind << 1});
+    arr_push_back(&sap->endpoints, {sap->boxes[bind].max[sap->axis], (bind << 1) | SAP_ENDPOINT_FLAG_MAX});
+    sap->added_endpoints += 2;
+    return true;
+}
+
+bool sap_remove(sweep_prune *sap, u32 ent_id)
+{
+    u32 bind{};
+    if (!hmap_remove(&sap->ent_boxes, ent_id, &bind)) {
+        return false;
+    }
+    // The endpoints are dropped in the next update - the box isn't put on the free list until then
+    sap->boxes[bind].ent_id = INVALID_ID;
+    sap->boxes[bind].pending_free = true;
+    ++sap->removed_boxes;
+    return true;
+}
+
+bool sap_set_bounds(sweep_prune *sap, u32 ent_id, const bbox &bounds)
+{
+    auto fiter = hmap_find(&sap->ent_boxes, ent_id);
+    if (!fiter) {
+        return false;
+    }
+    set_box_bounds(&sap->boxes[fiter->val], bounds);
+    return true;
+}
+
+void sap_invalidate_mesh_bounds(sweep_prune *sap, const rid &mesh_id)
+{
+    hmap_remove(&sap->mesh_bounds, mesh_id);
+}
+
+void sap_sync_static_models(sweep_prune *sap, sim_region *reg, const mesh_cache *msh_cache)
+{
+    auto sm_tbl = get_comp_tbl<static_model>(&reg->cdb);
+    auto tf_tbl = get_comp_tbl<transform>(&reg->cdb);
+    if (!sm_tbl || !tf_tbl) {
+        return;
+    }
+
+    for (sizet i = 0; i < sm_tbl->entries.size; ++i) {
+        auto sm = &sm_tbl->entries[i];
+        auto tf = get_comp(sm->ent_id, tf_tbl);
+        if (!tf) {
+            continue;
+        }
+
+        auto bnd_iter = hmap_find(&sap->mesh_bounds, sm->mesh_id);
+        if (!bnd_iter) {
+            auto msh = get_robj(msh_cache, sm->mesh_id);
+            if (!msh) {
+                continue;
+            }
+            bnd_iter = hmap_insert(&sap->mesh_bounds, sm->mesh_id, calc_bounds(msh.ptr));
+            asrt(bnd_iter);
+        }
+
+        bbox world_bb = math::transform(bnd_iter->val, tf->cached);
+        if (!sap_set_bounds(sap, sm->ent_id, world_bb)) {
+            sap_insert(sap, sm->ent_id, world_bb);
+        }
+    }
+
+    // Remove boxes for entities that lost their static model or transform
+    arr_clear(&sap->active);
+    auto iter = hmap_begin(&sap->ent_boxes);
+    while (iter) {
+        if (!hmap_find(&sm_tbl->entc_hm, iter->key) || !hmap_find(&tf_tbl->entc_hm, iter->key)) {
+            arr_push_back(&sap->active, iter->key);
+        }
+        iter = hmap_next(&sap->ent_boxes, iter);
+    }
+    for (sizet i = 0; i < sap->active.size; ++i) {
+        sap_remove(sap, sap->active[i]);
+    }
+    arr_clear(&sap->active);
+}
+
+// Drop endpoints of removed boxes and refresh the values of the rest from the current box bounds
+intern void refresh_endpoints(sweep_prune *sap)
+{
+    sizet write = 0;
+    for (sizet i = 0; i < sap->endpoints.size; ++i) {
+        auto ep = sap->endpoints[i];
+        u32 bind = ep.data >> 1;
+        auto box = &sap->boxes[bind];
+        if (!is_valid(box->ent_id)) {
+            continue;
+        }
+        ep.val = (ep.data & SAP_ENDPOINT_FLAG_MAX) ? box->max[sap->axis] : box->min[sap->axis];
+        sap->endpoints[write++] = ep;
+    }
+    arr_resize(&sap->endpoints, write);
+
+    // Now that no endpoints reference the removed boxes they can be reused
+    if (sap->removed_boxes > 0) {
+        for (u32 i = 0; i < sap->boxes.size; ++i) {
+            auto box = &sap->boxes[i];
+            if (box->pending_free) {
+                box->pending_free = false;
+                box->next_free = sap->free_box_head;
+                sap->free_box_head = i;
+            }
+        }
+        sap->removed_boxes = 0;
+    }
+}
+
+intern void insertion_sort(sap_endpoint *eps, sizet count)
+{
+    for (sizet i = 1; i < count; ++i) {
+        sap_endpoint ep = eps[i];
+        sizet j = i;
+        while (j > 0 && endpoint_less(ep, eps[j - 1])) {
+            eps[j] = eps[j - 1];
+            --j;
+        }
+        eps[j] = ep;
+    }
+}
+
+void sap_update_pairs(sweep_prune *sap)
+{
+    refresh_endpoints(sap);
+
+    // Frame coherence means the endpoints are nearly sorted already - a lot of new boxes will be far from their final
+    // position though
+    if ((f32)sap->added_endpoints > (f32)sap->endpoints.size * SAP_FULL_SORT_ADD_RATIO) {
+        std::sort(sap->endpoints.data, sap->endpoints.data + sap->endpoints.size, endpoint_less);
+    }
+    else {
+        insertion_sort(sap->endpoints.data, sap->endpoints.size);
+    }
+    sap->added_endpoints = 0;
+
+    // Sweep - boxes open on the sort axis are in active, and each new box is tested against them on all axes
+    arr_clear(&sap->active);
+    arr_clear(&sap->cur_pairs);
+    for (sizet i = 0; i < sap->endpoints.size; ++i) {
+        u32 bind = sap->endpoints[i].data >> 1;
+        auto box = &sap->boxes[bind];
+        if (box->empty) {
+            continue;
+        }
+        if (sap->endpoints[i].data & SAP_ENDPOINT_FLAG_MAX) {
+            asrt(sap->active.size > 0);
+            u32 last = sap->active[sap->active.size - 1];
+            sap->active[box->active_slot] = last;
+            sap->boxes[last].active_slot = box->active_slot;
+            arr_pop_back(&sap->active);
+        }
+        else {
+            for (sizet j = 0; j < sap->active.size; ++j) {
+                auto other = &sap->boxes[sap->active[j]];
+                if (boxes_overlap(box, other)) {
+                    arr_push_back(&sap->cur_pairs, sap_pair_key(box->ent_id, other->ent_id));
+                }
+            }
+            box->active_slot = (u32)sap->active.size;
+            arr_push_back(&sap->active, bind);
+        }
+    }
+    asrt(sap->active.size == 0);
+    std::sort(sap->cur_pairs.data, sap->cur_pairs.data + sap->cur_pairs.size);
+
+    // Diff the sorted pair lists to produce the events
+    arr_clear(&sap->added);
+    arr_clear(&sap->removed);
+    sizet pi = 0, ci = 0;
+    while (pi < sap->pairs.size || ci < sap->cur_pairs.size) {
+        if (ci == sap->cur_pairs.size || (pi < sap->pairs.size && sap->pairs[pi] < sap->cur_pairs[ci])) {
+            arr_push_back(&sap->removed, sap_pair_from_key(sap->pairs[pi++]));
+        }
+        else if (pi == sap->pairs.size || sap->cur_pairs[ci] < sap->pairs[pi]) {
+            arr_push_back(&sap->added, sap_pair_from_key(sap->cur_pairs[ci++]));
+        }
+        else {
+            ++pi;
+            ++ci;
+        }
+    }
+    swap(&sap->pairs, &sap->cur_pairs);
+}
+
+} // namespace nslib
@@ -0,0 +1,106 @@
+#pragma once
+
+#include "sim_region.h"
+
+namespace nslib
+{
+
+// If more than this fraction of the endpoints were added since the last update, do a full sort instead of relying on
+// insertion sort
+inline constexpr f32 SAP_FULL_SORT_ADD_RATIO = 0.25f;
+
+enum sap_endpoint_flags : u32
+{
+    SAP_ENDPOINT_FLAG_MAX = 1
+};
+
+// Endpoint along the sort axis - data holds the box index shifted left by one with the low bit set for max endpoints
+struct sap_endpoint
+{
+    f32 val;
+    u32 data;
+};
+
+// Boxes are stored as vec4 so the overlap test on all axes is a pair of SIMD compares
+struct sap_box
+{
+    vec4 min;
+    vec4 max;
+    u32 ent_id{INVALID_ID};
+    // Index in to the active list during the sweep
+    u32 active_slot{INVALID_ID};
+    u32 next_free{INVALID_ID};
+    // Removed boxes are only put on the free list once their endpoints have been dropped in an update
+    b32 pending_free{};
+    // Set from empty or inverted bounds (like those of a mesh with no verts) - the box is a point at the origin which
+    // is never opened in the sweep, so it overlaps nothing
+    b32 empty{};
+};
+
+struct sap_pair
+{
+    u32 ent_a;
+    u32 ent_b;
+};
+
+// Incremental sweep and prune broad phase. Endpoints on the sort axis are kept sorted between updates and re-sorted
+// with insertion sort, which is close to O(n) because objects move little from frame to frame. The sweep then tests
+// each box against the boxes currently open on the sort axis, and the result is diffed against the previous frame's
+// pairs to produce added and removed events.
+struct sweep_prune
+{
+    int axis{0};
+
+    array<sap_box> boxes;
+    array<sap_endpoint> endpoints;
+    u32 free_box_head{INVALID_ID};
+    sizet added_endpoints{};
+    sizet removed_boxes{};
+
+    // Entity id to box index
+    hmap<u32, u32> ent_boxes;
+
+    // Sorted pair keys overlapping as of the last update
+    array<u64> pairs;
+
+    // Pair events from the last update
+    array<sap_pair> added;
+    array<sap_pair> removed;
+
+    // Local space bounds of meshes referenced by static models - filled in lazily by sap_sync_static_models
+    hmap<rid, bbox> mesh_bounds;
+
+    // Scratch for the update
+    array<u32> active;
+    array<u64> cur_pairs;
+};
+
+void init_sweep_prune(sweep_prune *sap, mem_arena *arena, int axis = 0, sizet initial_capacity = 1024);
+void terminate_sweep_prune(sweep_prune *sap);
+
+bool sap_insert(sweep_prune *sap, u32 ent_id, const bbox &bounds);
+bool sap_remove(sweep_prune *sap, u32 ent_id);
+bool sap_set_bounds(sweep_prune *sap, u32 ent_id, const bbox &bounds);
+
+// Forget the cached local bounds for a mesh - must be called when mesh vertices change
+void sap_invalidate_mesh_bounds(sweep_prune *sap, const rid &mesh_id);
+
+// Insert, update or remove boxes so that every entity with both a static_model and a transform has a box with its
+// world space mesh bounds - call sap_update_pairs afterwards
+void sap_sync_static_models(sweep_prune *sap, sim_region *reg, const mesh_cache *msh_cache);
+
+// Re-sort endpoints, find all overlapping pairs, and fill the added and removed event arrays
+void sap_update_pairs(sweep_prune *sap);
+
+// Pair keys pack the smaller entity id in the high 32 bits and the larger in the low 32 bits
+inline u64 sap_pair_key(u32 ent_a, u32 ent_b)
+{
+    return (ent_a < ent_b) ? (((u64)ent_a << 32) | ent_b) : (((u64)ent_b << 32) | ent_a);
+}
+
+inline sap_pair sap_pair_from_key(u64 key)
+{
+    return {(u32)(key >> 32), (u32)(key & 0xffffffff)};
+}
+
+} // namespace nslib
@@ -4,6 +4,7 @@
 #include "platform.h"
 #include "SDL3/SDL_vulkan.h"
 #include "logging.h"
+#include "hashfuncs.h"
 
 #define PRINT_MEM_DEBUG false
 #define PRINT_MEM_INSTANCE_ONLY false
@@ -80,6 +81,7 @@ intern void *vk_alloc(void *user, sizet size, sizet alignment, VkSystemAllocatio
 {
     asrt(user);
     auto arenas = (vk_arenas *)user;
+    std::lock_guard<std::mutex> lock(*arenas->mtx);
     ++arenas->stats[scope].alloc_count;
     arenas->stats[scope].req_alloc += size;
 
@@ -129,6 +131,7 @@ intern void vk_free(void *user, void *ptr)
         return;
     }
     auto arenas = (vk_arenas *)user;
+    std::lock_guard<std::mutex> lock(*arenas->mtx);
     auto arena = arenas->persistent_arena;
 
     sizet header_size = sizeof(internal_alloc_header);
@@ -176,6 +179,7 @@ intern void *vk_realloc(void *user, void *ptr, sizet size, sizet alignment, VkSy
         return nullptr;
     }
     auto arenas = (vk_arenas *)user;
+    std::lock_guard<std::mutex> lock(*arenas->mtx);
     ++arenas->stats[scope].realloc_count;
     arenas->stats[scope].req_alloc += size;
 
@@ -369,7 +373,10 @@ int vkr_init_instance(const vkr_context *vk, vkr_instance *inst)
 
     // This is for clarity.. we could just directly pass the enabled extension count
     u32 ext_count{0};
-    const char *const *glfw_ext = SDL_Vulkan_GetInstanceExtensions(&ext_count);
+    const char *const *glfw_ext = nullptr;
+    if (!vk->cfg.headless) {
+        glfw_ext = SDL_Vulkan_GetInstanceExtensions(&ext_count);
+    }
     auto ext = (char **)mem_alloc((ext_count + vk->cfg.extra_instance_extension_count) * sizeof(char *), vk->cfg.arenas.command_arena);
 
     u32 copy_ind = 0;
@@ -487,6 +494,12 @@ vkr_queue_families vkr_get_queue_families(const vkr_context *vk, VkPhysicalDevic
             ilog("Selected queue family at index %d for graphics (%d available)", i, qfams[i].queueCount);
         }
 
+        // Without a surface nothing is presented - the present family is set to the graphics family below
+        if (vk->cfg.headless) {
+            ilog("Queue family ind %d has %d available queues with %#010x capabilities", i, qfams[i].queueCount, qfams[i].queueFlags);
+            continue;
+        }
+
         VkBool32 supported{false};
         vkGetPhysicalDeviceSurfaceSupportKHR(pdevice, i, vk->inst.surface, &supported);
         if (supported && (ret.qinfo[VKR_QUEUE_FAM_TYPE_PRESENT].available_count == 0 ||
@@ -501,6 +514,33 @@ vkr_queue_families vkr_get_queue_families(const vkr_context *vk, VkPhysicalDevic
 
         ilog("Queue family ind %d has %d available queues with %#010x capabilities", i, qfams[i].queueCount, qfams[i].queueFlags);
     }
+
+    if (vk->cfg.headless) {
+        ret.qinfo[VKR_QUEUE_FAM_TYPE_PRESENT] = ret.qinfo[VKR_QUEUE_FAM_TYPE_GFX];
+    }
+
+    // Uploads prefer a family without graphics (ideally without compute too) as that is usually a dedicated copy engine
+    // which runs alongside rendering. Without one uploads go through the graphics queue and no extra queue is requested.
+    u32 xfer_ind = VKR_INVALID;
+    for (u32 i = 0; i < count; ++i) {
+        auto flags = qfams[i].queueFlags;
+        if (test_flags(flags, VK_QUEUE_TRANSFER_BIT) && !test_flags(flags, VK_QUEUE_GRAPHICS_BIT) &&
+            (xfer_ind == VKR_INVALID || !test_flags(flags, VK_QUEUE_COMPUTE_BIT))) {
+            xfer_ind = i;
+        }
+    }
+    auto xfer = &ret.qinfo[VKR_QUEUE_FAM_TYPE_TRANSFER];
+    if (xfer_ind != VKR_INVALID) {
+        xfer->index = xfer_ind;
+        xfer->available_count = qfams[xfer_ind].queueCount;
+        ilog("Selected queue family at index %d for transfers (%d available)", xfer_ind, qfams[xfer_ind].queueCount);
+    }
+    else {
+        xfer->index = ret.qinfo[VKR_QUEUE_FAM_TYPE_GFX].index;
+        xfer->available_count = ret.qinfo[VKR_QUEUE_FAM_TYPE_GFX].available_count;
+        xfer->requested_count = 0;
+        ilog("No dedicated transfer queue family - transfers will use the graphics queue");
+    }
     return ret;
 }
 
@@ -559,6 +599,22 @@ int vkr_init_device(vkr_device *dev,
     // For now we will leave this blank - but probably enable geometry shaders later
     VkPhysicalDeviceFeatures features{};
     features.samplerAnisotropy = vk->inst.pdev_info.features.samplerAnisotropy;
+    // Needed for recording many draws with a single indirect draw call, and for indirect draws to use first instance
+    features.multiDrawIndirect = vk->inst.pdev_info.features.multiDrawIndirect;
+    features.drawIndirectFirstInstance = vk->inst.pdev_info.features.drawIndirectFirstInstance;
+
+    // Descriptor indexing features used for bindless textures
+    const VkPhysicalDeviceVulkan12Features *avail12 = &vk->inst.pdev_info.features12;
+    VkPhysicalDeviceVulkan12Features features12{};
+    features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    features12.descriptorIndexing = avail12->descriptorIndexing;
+    features12.runtimeDescriptorArray = avail12->runtimeDescriptorArray;
+    features12.descriptorBindingPartiallyBound = avail12->descriptorBindingPartiallyBound;
+    features12.descriptorBindingSampledImageUpdateAfterBind = avail12->descriptorBindingSampledImageUpdateAfterBind;
+    features12.descriptorBindingUpdateUnusedWhilePending = avail12->descriptorBindingUpdateUnusedWhilePending;
+    features12.shaderSampledImageArrayNonUniformIndexing = avail12->shaderSampledImageArrayNonUniformIndexing;
+    // Upload completion tracking
+    features12.timelineSemaphore = avail12->timelineSemaphore;
     ilog("Creating %d queues", create_size);
 
     VkDeviceCreateInfo create_inf{};
@@ -568,6 +624,7 @@ int vkr_init_device(vkr_device *dev,
     create_inf.enabledLayerCount = layer_count;
     create_inf.ppEnabledLayerNames = layers;
     create_inf.pEnabledFeatures = &features;
+    create_inf.pNext = &features12;
     create_inf.ppEnabledExtensionNames = device_extensions;
     create_inf.enabledExtensionCount = dev_ext_count;
 
@@ -624,7 +681,12 @@ int vkr_init_device(vkr_device *dev,
         }
     }
 
-    err = vkr_init_swapchain(&dev->swapchain, vk);
+    if (vk->cfg.headless) {
+        err = vkr_init_offscreen_swapchain(&dev->swapchain, vk);
+    }
+    else {
+        err = vkr_init_swapchain(&dev->swapchain, vk);
+    }
     if (err != err_code::VKR_NO_ERROR) {
         return err;
     }
@@ -675,17 +737,20 @@ int vkr_select_best_graphics_physical_device(const vkr_context *vk, vkr_phys_dev
             continue;
         }
 
-        // We need at least one supported format and present mode
-        u32 format_count{0};
-        vkGetPhysicalDeviceSurfaceFormatsKHR(pdevices[i], vk->inst.surface, &format_count, nullptr);
-        if (format_count == 0) {
-            continue;
-        }
+        // We need at least one supported format and present mode - unless headless, where any graphics device will do
+        // (including cpu devices such as lavapipe)
+        if (!vk->cfg.headless) {
+            u32 format_count{0};
+            vkGetPhysicalDeviceSurfaceFormatsKHR(pdevices[i], vk->inst.surface, &format_count, nullptr);
+            if (format_count == 0) {
+                continue;
+            }
 
-        u32 present_mode_count{0};
-        vkGetPhysicalDeviceSurfacePresentModesKHR(pdevices[i], vk->inst.surface, &present_mode_count, nullptr);
-        if (present_mode_count == 0) {
-            continue;
+            u32 present_mode_count{0};
+            vkGetPhysicalDeviceSurfacePresentModesKHR(pdevices[i], vk->inst.surface, &present_mode_count, nullptr);
+            if (present_mode_count == 0) {
+                continue;
+            }
         }
 
         VkPhysicalDeviceProperties props{};
@@ -749,6 +814,13 @@ int vkr_select_best_graphics_physical_device(const vkr_context *vk, vkr_phys_dev
     dev_info->props = sel_dev_props;
     dev_info->features = sel_dev_features;
 
+    VkPhysicalDeviceFeatures2 features2{};
+    features2.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+    features2.pNext = &dev_info->features12;
+    dev_info->features12.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES;
+    vkGetPhysicalDeviceFeatures2(dev_info->hndl, &features2);
+    dev_info->features12.pNext = nullptr;
+
     // Fill in the queue index offsets based on the fam index from vulkan - if our queue fams have the same index then
     // the queues coming from the later fams need to have an offset index set
     for (u32 i = 0; i < VKR_QUEUE_FAM_TYPE_COUNT; ++i) {
@@ -920,7 +992,49 @@ int vkr_init_swapchain(vkr_swapchain *sw_info, const vkr_context *vk)
     return err_code::VKR_NO_ERROR;
 }
 
-vkr_add_result vkr_add_cmd_bufs(vkr_command_pool *pool, const vkr_context *vk, sizet count)
+int vkr_init_offscreen_swapchain(vkr_swapchain *sw_info, const vkr_context *vk)
+{
+    ilog("Setting up offscreen swapchain of %u by %u", vk->cfg.headless_extent.x, vk->cfg.headless_extent.y);
+    arr_init(&sw_info->image_views, vk->cfg.arenas.persistent_arena);
+    arr_init(&sw_info->images, vk->cfg.arenas.persistent_arena);
+    arr_init(&sw_info->renders_finished, vk->cfg.arenas.persistent_arena);
+    sw_info->swapchain = VK_NULL_HANDLE;
+    sw_info->format = VKR_HEADLESS_FORMAT;
+    sw_info->extent = {vk->cfg.headless_extent.x, vk->cfg.headless_extent.y};
+
+    // One image per frame in flight so an image is never drawn to while an earlier frame is still using it
+    arr_resize(&sw_info->images, MAX_FRAMES_IN_FLIGHT, vkr_image{});
+    arr_resize(&sw_info->image_views, MAX_FRAMES_IN_FLIGHT, vkr_image_view{});
+    for (int i = 0; i < sw_info->images.size; ++i) {
+        vkr_image_cfg im_cfg{};
+        im_cfg.dims = {sw_info->extent.width, sw_info->extent.height, 1};
+        im_cfg.format = sw_info->format;
+        im_cfg.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT;
+        im_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_DEVICE;
+        im_cfg.vma_alloc = &vk->inst.device.vma_alloc;
+        int err = vkr_init_image(&sw_info->images[i], &im_cfg);
+        if (err != err_code::VKR_NO_ERROR) {
+            elog("Failed to create offscreen image at index %d", i);
+            arr_resize(&sw_info->image_views, i);
+            vkr_terminate_swapchain(sw_info, vk);
+            return err;
+        }
+
+        vkr_image_view_cfg iview_create{};
+        iview_create.image = &sw_info->images[i];
+        err = vkr_init_image_view(&sw_info->image_views[i], &iview_create, vk);
+        if (err != err_code::VKR_NO_ERROR) {
+            elog("Failed to create offscreen image view at index %d", i);
+            arr_resize(&sw_info->image_views, i);
+            vkr_terminate_swapchain(sw_info, vk);
+            return err_code::VKR_CREATE_IMAGE_VIEW_FAIL;
+        }
+    }
+    ilog("Successfully set up offscreen swapchain with %d image views", sw_info->image_views.size);
+    return err_code::VKR_NO_ERROR;
+}
+
+vkr_add_result vkr_add_cmd_bufs(vkr_command_pool *pool, const vkr_context *vk, sizet count, VkCommandBufferLevel level)
 {
     vkr_add_result ret{};
     array<VkCommandBuffer> hndls;
@@ -930,7 +1044,7 @@ vkr_add_result vkr_add_cmd_bufs(vkr_command_pool *pool, const vkr_context *vk, s
     VkCommandBufferAllocateInfo info{};
     info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
     info.commandPool = pool->hndl;
-    info.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    info.level = level;
     info.commandBufferCount = (u32)count;
     int err = vkAllocateCommandBuffers(vk->inst.device.hndl, &info, hndls.data);
     if (err != VK_SUCCESS) {
@@ -1030,6 +1144,16 @@ sizet vkr_add_cmd_pool(vkr_device_queue_fam_info *qfam, const vkr_command_pool &
     return ind;
 }
 
+int vkr_reset_cmd_pool(const vkr_context *vk, vkr_command_pool *cpool)
+{
+    int err = vkResetCommandPool(vk->inst.device.hndl, cpool->hndl, 0);
+    if (err != VK_SUCCESS) {
+        elog("Failed to reset command pool with vk code %d", err);
+        return err_code::VKR_RESET_COMMAND_POOL_FAIL;
+    }
+    return err_code::VKR_NO_ERROR;
+}
+
 void vkr_terminate_cmd_pool(const vkr_context *vk, u32 fam_ind, vkr_command_pool *cpool)
 {
     vkDestroyCommandPool(vk->inst.device.hndl, cpool->hndl, &vk->alloc_cbs);
@@ -1144,6 +1268,102 @@ const char *vkr_shader_stage_type_str(vkr_shader_stage_type st_type)
     }
 }
 
+intern int create_descriptor_set_layout(const vkr_descriptor_set_layout_desc *desc, VkDescriptorSetLayout *hndl, const vkr_context *vk)
+{
+    VkDescriptorSetLayoutCreateInfo ci{};
+    ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+    ci.flags = desc->flags;
+    ci.bindingCount = (u32)desc->bindings.size;
+    ci.pBindings = desc->bindings.data;
+
+    VkDescriptorSetLayoutBindingFlagsCreateInfo flags_ci{};
+    if (desc->binding_flags.size > 0) {
+        asrt(desc->binding_flags.size == desc->bindings.size);
+        flags_ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+        flags_ci.bindingCount = (u32)desc->binding_flags.size;
+        flags_ci.pBindingFlags = desc->binding_flags.data;
+        ci.pNext = &flags_ci;
+    }
+    return vkCreateDescriptorSetLayout(vk->inst.device.hndl, &ci, &vk->alloc_cbs, hndl);
+}
+
+intern bool pipeline_cache_header_matches(const vkr_pipeline_cache_header *header, const VkPhysicalDeviceProperties *props)
+{
+    return header->magic == VKR_PIPELINE_CACHE_MAGIC && header->version == VKR_PIPELINE_CACHE_VERSION &&
+           header->vendor_id == props->vendorID && header->device_id == props->deviceID &&
+           header->driver_version == props->driverVersion && memcmp(header->cache_uuid, props->pipelineCacheUUID, VK_UUID_SIZE) == 0;
+}
+
+int vkr_init_pipeline_cache(vkr_context *vk, const byte_array *saved_data)
+{
+    auto props = &vk->inst.pdev_info.props;
+    const void *initial_data{};
+    sizet initial_size{};
+    if (saved_data && saved_data->size > 0) {
+        auto header = (const vkr_pipeline_cache_header *)saved_data->data;
+        const u8 *data = saved_data->data + sizeof(vkr_pipeline_cache_header);
+        if (saved_data->size < sizeof(vkr_pipeline_cache_header) || !pipeline_cache_header_matches(header, props)) {
+            wlog("Saved pipeline cache is from another device or driver version - starting with an empty cache");
+        }
+        else if (header->data_size != saved_data->size - sizeof(vkr_pipeline_cache_header) ||
+                 xxhash3(data, header->data_size, 0) != header->data_hash) {
+            wlog("Saved pipeline cache is corrupt - starting with an empty cache");
+        }
+        else {
+            initial_data = data;
+            initial_size = header->data_size;
+        }
+    }
+
+    VkPipelineCacheCreateInfo ci{};
+    ci.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+    ci.initialDataSize = initial_size;
+    ci.pInitialData = initial_data;
+    int err = vkCreatePipelineCache(vk->inst.device.hndl, &ci, &vk->alloc_cbs, &vk->inst.device.pipeline_cache);
+    if (err != VK_SUCCESS) {
+        elog("Failed to create pipeline cache with vk err %d", err);
+        return err_code::VKR_CREATE_PIPELINE_CACHE_FAIL;
+    }
+    ilog("Created pipeline cache with %lu bytes of saved data", initial_size);
+    return err_code::VKR_NO_ERROR;
+}
+
+int vkr_get_pipeline_cache_data(const vkr_context *vk, byte_array *saved_data)
+{
+    auto dev = &vk->inst.device;
+    asrt(dev->pipeline_cache != VK_NULL_HANDLE);
+    sizet data_size{};
+    int err = vkGetPipelineCacheData(dev->hndl, dev->pipeline_cache, &data_size, nullptr);
+    if (err != VK_SUCCESS) {
+        elog("Failed to get pipeline cache data size with vk err %d", err);
+        return err_code::VKR_GET_PIPELINE_CACHE_DATA_FAIL;
+    }
+
+    arr_resize(saved_data, sizeof(vkr_pipeline_cache_header) + data_size);
+    u8 *data = saved_data->data + sizeof(vkr_pipeline_cache_header);
+    err = vkGetPipelineCacheData(dev->hndl, dev->pipeline_cache, &data_size, data);
+    if (err != VK_SUCCESS) {
+        elog("Failed to get pipeline cache data with vk err %d", err);
+        return err_code::VKR_GET_PIPELINE_CACHE_DATA_FAIL;
+    }
+    // The data can only shrink between the two calls
+    arr_resize(saved_data, sizeof(vkr_pipeline_cache_header) + data_size);
+    data = saved_data->data + sizeof(vkr_pipeline_cache_header);
+
+    auto props = &vk->inst.pdev_info.props;
+    vkr_pipeline_cache_header header{};
+    header.magic = VKR_PIPELINE_CACHE_MAGIC;
+    header.version = VKR_PIPELINE_CACHE_VERSION;
+    header.vendor_id = props->vendorID;
+    header.device_id = props->deviceID;
+    header.driver_version = props->driverVersion;
+    memcpy(header.cache_uuid, props->pipelineCacheUUID, VK_UUID_SIZE);
+    header.data_size = data_size;
+    header.data_hash = xxhash3(data, data_size, 0);
+    memcpy(saved_data->data, &header, sizeof(vkr_pipeline_cache_header));
+    return err_code::VKR_NO_ERROR;
+}
+
 int vkr_init_pipeline(vkr_pipeline *pipe_info, const vkr_pipeline_cfg *cfg, const vkr_context *vk)
 {
     VkPipelineShaderStageCreateInfo stages[VKR_SHADER_STAGE_COUNT]{};
@@ -1248,12 +1468,8 @@ int vkr_init_pipeline(vkr_pipeline *pipe_info, const vkr_pipeline_cfg *cfg, cons
 
     // Create the descriptor set layouts
     for (int desc_i = 0; desc_i < cfg->set_layouts.size; ++desc_i) {
-        VkDescriptorSetLayoutCreateInfo ci{};
-        ci.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-        ci.bindingCount = (u32)cfg->set_layouts[desc_i].bindings.size;
-        ci.pBindings = cfg->set_layouts[desc_i].bindings.data;
         VkDescriptorSetLayout hndl{};
-        int res = vkCreateDescriptorSetLayout(vk->inst.device.hndl, &ci, &vk->alloc_cbs, &hndl);
+        int res = create_descriptor_set_layout(&cfg->set_layouts[desc_i], &hndl, vk);
         if (res == VK_SUCCESS) {
             arr_push_back(&pipe_info->descriptor_layouts, hndl);
         }
@@ -1305,11 +1521,11 @@ int vkr_init_pipeline(vkr_pipeline *pipe_info, const vkr_pipeline_cfg *cfg, cons
     pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
     pipeline_info.basePipelineIndex = -1;
 
-    int err_ret = vkCreateGraphicsPipelines(vk->inst.device.hndl, VK_NULL_HANDLE, 1, &pipeline_info, &vk->alloc_cbs, &pipe_info->hndl);
-    if (err_ret != VK_SUCCESS) {
-        for (u32 si = 0; si < actual_stagei; ++si) {
-            vkr_terminate_shader_module(stages[si].module, vk);
-        }
+    int err_ret = err_code::VKR_NO_ERROR;
+    int res = vkCreateGraphicsPipelines(
+        vk->inst.device.hndl, vk->inst.device.pipeline_cache, 1, &pipeline_info, &vk->alloc_cbs, &pipe_info->hndl);
+    if (res != VK_SUCCESS) {
+        elog("Failed to create graphics pipeline with vk err %d", res);
         for (u32 i = 0; i < pipe_info->descriptor_layouts.size; ++i) {
             vkDestroyDescriptorSetLayout(vk->inst.device.hndl, pipe_info->descriptor_layouts[i], &vk->alloc_cbs);
         }
@@ -1319,7 +1535,70 @@ int vkr_init_pipeline(vkr_pipeline *pipe_info, const vkr_pipeline_cfg *cfg, cons
     for (u32 si = 0; si < actual_stagei; ++si) {
         vkr_terminate_shader_module(stages[si].module, vk);
     }
-    err_ret = err_code::VKR_NO_ERROR;
+    return err_ret;
+}
+
+int vkr_init_compute_pipeline(vkr_pipeline *pipe_info, const vkr_compute_pipeline_cfg *cfg, const vkr_context *vk)
+{
+    VkPipelineShaderStageCreateInfo stage{};
+    int err = vkr_init_shader_module(&stage.module, &cfg->shader_stage.code, vk);
+    if (err != err_code::VKR_NO_ERROR) {
+        elog("Could not initialize compute shader module");
+        return err;
+    }
+    stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    stage.pName = cfg->shader_stage.entry_point;
+
+    // Create the descriptor set layouts
+    for (int desc_i = 0; desc_i < cfg->set_layouts.size; ++desc_i) {
+        VkDescriptorSetLayout hndl{};
+        int res = create_descriptor_set_layout(&cfg->set_layouts[desc_i], &hndl, vk);
+        if (res != VK_SUCCESS) {
+            elog("Could not create descriptor set layout with vk err %d", res);
+            for (u32 i = 0; i < pipe_info->descriptor_layouts.size; ++i) {
+                vkDestroyDescriptorSetLayout(vk->inst.device.hndl, pipe_info->descriptor_layouts[i], &vk->alloc_cbs);
+            }
+            vkr_terminate_shader_module(stage.module, vk);
+            return err_code::VKR_CREATE_PIPELINE_LAYOUT_FAIL;
+        }
+        arr_push_back(&pipe_info->descriptor_layouts, hndl);
+    }
+
+    VkPipelineLayoutCreateInfo pipeline_layout_create_inf{};
+    pipeline_layout_create_inf.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+    pipeline_layout_create_inf.setLayoutCount = (u32)pipe_info->descriptor_layouts.size;
+    pipeline_layout_create_inf.pSetLayouts = pipe_info->descriptor_layouts.data;
+    pipeline_layout_create_inf.pushConstantRangeCount = (u32)cfg->push_constant_ranges.size;
+    pipeline_layout_create_inf.pPushConstantRanges = cfg->push_constant_ranges.data;
+    if (vkCreatePipelineLayout(vk->inst.device.hndl, &pipeline_layout_create_inf, &vk->alloc_cbs, &pipe_info->layout_hndl) != VK_SUCCESS) {
+        elog("Failed to create compute pipeline layout");
+        vkr_terminate_shader_module(stage.module, vk);
+        for (u32 i = 0; i < pipe_info->descriptor_layouts.size; ++i) {
+            vkDestroyDescriptorSetLayout(vk->inst.device.hndl, pipe_info->descriptor_layouts[i], &vk->alloc_cbs);
+        }
+        return err_code::VKR_CREATE_PIPELINE_LAYOUT_FAIL;
+    }
+
+    VkComputePipelineCreateInfo pipeline_info{};
+    pipeline_info.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+    pipeline_info.stage = stage;
+    pipeline_info.layout = pipe_info->layout_hndl;
+    pipeline_info.basePipelineHandle = VK_NULL_HANDLE;
+    pipeline_info.basePipelineIndex = -1;
+
+    int err_ret = err_code::VKR_NO_ERROR;
+    int res = vkCreateComputePipelines(
+        vk->inst.device.hndl, vk->inst.device.pipeline_cache, 1, &pipeline_info, &vk->alloc_cbs, &pipe_info->hndl);
+    if (res != VK_SUCCESS) {
+        elog("Failed to create compute pipeline with vk err %d", res);
+        for (u32 i = 0; i < pipe_info->descriptor_layouts.size; ++i) {
+            vkDestroyDescriptorSetLayout(vk->inst.device.hndl, pipe_info->descriptor_layouts[i], &vk->alloc_cbs);
+        }
+        vkDestroyPipelineLayout(vk->inst.device.hndl, pipe_info->layout_hndl, &vk->alloc_cbs);
+        err_ret = err_code::VKR_CREATE_PIPELINE_FAIL;
+    }
+    vkr_terminate_shader_module(stage.module, vk);
     return err_ret;
 }
 
@@ -1538,6 +1817,543 @@ void vkr_terminate_buffer(vkr_buffer *buffer, const vkr_context *vk)
     vmaDestroyBuffer(vk->inst.device.vma_alloc.hndl, buffer->hndl, buffer->mem_hndl);
 }
 
+intern int init_frame_ring_buffer(vkr_buffer *buf, const vkr_gpu_allocator *vma, sizet size)
+{
+    vkr_buffer_cfg buf_cfg{};
+    buf_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+    buf_cfg.usage = VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT |
+                    VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT;
+    buf_cfg.buffer_size = size;
+    buf_cfg.alloc_flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    buf_cfg.vma_alloc = vma;
+    return vkr_init_buffer(buf, &buf_cfg);
+}
+
+int vkr_init_frame_ring(vkr_frame_ring *ring, vkr_device *device, sizet size)
+{
+    asrt(size > 0);
+    vkr_buffer buf{};
+    int err = init_frame_ring_buffer(&buf, &device->vma_alloc, size);
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+    ring->buf_ind = vkr_add_buffer(device, buf);
+    ring->size = size;
+    ring->offset = 0;
+    ring->vma_alloc = &device->vma_alloc;
+    return err_code::VKR_NO_ERROR;
+}
+
+void vkr_reset_frame_ring(vkr_frame_ring *ring)
+{
+    ring->offset = 0;
+}
+
+vkr_frame_alloc vkr_frame_ring_alloc(vkr_frame_ring *ring, vkr_context *vk, sizet size, sizet alignment)
+{
+    asrt(is_valid(ring->buf_ind));
+    asrt(alignment > 0);
+    auto buf = &vk->inst.device.buffers[ring->buf_ind];
+    sizet offset = (ring->offset + alignment - 1) / alignment * alignment;
+
+    // Replace the buffer with one at least twice as large, copying over what was written so far this frame
+    if (offset + size > ring->size) {
+        sizet new_size = ring->size * 2;
+        while (new_size < offset + size) {
+            new_size *= 2;
+        }
+        vkr_buffer new_buf{};
+        if (init_frame_ring_buffer(&new_buf, ring->vma_alloc, new_size) != err_code::VKR_NO_ERROR) {
+            elog("Failed to grow frame ring from %lu to %lu bytes", ring->size, new_size);
+            return {};
+        }
+        memcpy(new_buf.mem_info.pMappedData, buf->mem_info.pMappedData, ring->offset);
+        vkr_terminate_buffer(buf, vk);
+        *buf = new_buf;
+        ilog("Grew frame ring from %lu to %lu bytes", ring->size, new_size);
+        ring->size = new_size;
+    }
+
+    ring->offset = offset + size;
+    return {offset, size, (char *)buf->mem_info.pMappedData + offset};
+}
+
+int vkr_init_upload_manager(vkr_upload_manager *um, vkr_context *vk, sizet staging_size)
+{
+    auto dev = &vk->inst.device;
+    if (!vk->inst.pdev_info.features12.timelineSemaphore) {
+        elog("Timeline semaphores are required for the upload manager");
+        return err_code::VKR_CREATE_SEMAPHORE_FAIL;
+    }
+
+    auto gfx = &dev->qfams[VKR_QUEUE_FAM_TYPE_GFX];
+    auto xfer = &dev->qfams[VKR_QUEUE_FAM_TYPE_TRANSFER];
+    um->gfx_q = gfx->qs[VKR_RENDER_QUEUE].hndl;
+    um->gfx_fam = gfx->fam_ind;
+    um->separate_fams = xfer->qs.size > 0 && xfer->fam_ind != gfx->fam_ind;
+    if (um->separate_fams) {
+        um->xfer_q = xfer->qs[0].hndl;
+        um->xfer_fam = xfer->fam_ind;
+    }
+    else {
+        um->xfer_q = um->gfx_q;
+        um->xfer_fam = um->gfx_fam;
+        xfer = gfx;
+    }
+
+    vkr_buffer_cfg buf_cfg{};
+    buf_cfg.buffer_size = staging_size;
+    buf_cfg.alloc_flags = VMA_ALLOCATION_CREATE_MAPPED_BIT | VMA_ALLOCATION_CREATE_HOST_ACCESS_SEQUENTIAL_WRITE_BIT;
+    buf_cfg.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+    buf_cfg.mem_usage = VMA_MEMORY_USAGE_AUTO_PREFER_HOST;
+    buf_cfg.vma_alloc = &dev->vma_alloc;
+    int err = vkr_init_buffer(&um->staging, &buf_cfg);
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+    um->staging_size = staging_size;
+    um->head = 0;
+    um->tail = 0;
+
+    VkSemaphoreTypeCreateInfo type_info{};
+    type_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO;
+    type_info.semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE;
+    type_info.initialValue = 0;
+    VkSemaphoreCreateInfo sem_info{};
+    sem_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    sem_info.pNext = &type_info;
+    if (vkCreateSemaphore(dev->hndl, &sem_info, &vk->alloc_cbs, &um->timeline) != VK_SUCCESS) {
+        elog("Failed to create upload timeline semaphore");
+        vkr_terminate_buffer(&um->staging, vk);
+        return err_code::VKR_CREATE_SEMAPHORE_FAIL;
+    }
+    um->last_value = 0;
+
+    // Command buffers for each batch slot - the graphics ones are only used for ownership acquires
+    auto xfer_res = vkr_add_cmd_bufs(&xfer->cmd_pools[xfer->default_pool], vk, VKR_MAX_UPLOAD_BATCHES);
+    if (xfer_res.err_code != err_code::VKR_NO_ERROR) {
+        return xfer_res.err_code;
+    }
+    um->xfer_cmd_begin = xfer_res.begin;
+    if (um->separate_fams) {
+        auto gfx_res = vkr_add_cmd_bufs(&gfx->cmd_pools[gfx->default_pool], vk, VKR_MAX_UPLOAD_BATCHES);
+        if (gfx_res.err_code != err_code::VKR_NO_ERROR) {
+            return gfx_res.err_code;
+        }
+        um->gfx_cmd_begin = gfx_res.begin;
+    }
+
+    arr_init(&um->free_cmds, vk->cfg.arenas.persistent_arena, VKR_MAX_UPLOAD_BATCHES);
+    for (sizet i = 0; i < VKR_MAX_UPLOAD_BATCHES; ++i) {
+        arr_push_back(&um->free_cmds, VKR_MAX_UPLOAD_BATCHES - 1 - i);
+    }
+    arr_init(&um->buf_barriers, vk->cfg.arenas.persistent_arena);
+    arr_init(&um->img_barriers, vk->cfg.arenas.persistent_arena);
+    arr_init(&um->copy_regions, vk->cfg.arenas.persistent_arena);
+    arr_init(&um->in_flight, vk->cfg.arenas.persistent_arena, VKR_MAX_UPLOAD_BATCHES);
+    um->recording = false;
+    ilog("Initialized upload manager with %lu byte staging ring%s",
+         staging_size,
+         (um->separate_fams) ? " on a dedicated transfer queue" : "");
+    return err_code::VKR_NO_ERROR;
+}
+
+void vkr_terminate_upload_manager(vkr_upload_manager *um, vkr_context *vk)
+{
+    vkr_wait_uploads(um, vk);
+    vkDestroySemaphore(vk->inst.device.hndl, um->timeline, &vk->alloc_cbs);
+    vkr_terminate_buffer(&um->staging, vk);
+    arr_terminate(&um->free_cmds);
+    arr_terminate(&um->buf_barriers);
+    arr_terminate(&um->img_barriers);
+    arr_terminate(&um->copy_regions);
+    arr_terminate(&um->in_flight);
+}
+
+intern VkCommandBuffer upload_xfer_cmd(vkr_upload_manager *um, vkr_context *vk, sizet cmd_ind)
+{
+    auto dev = &vk->inst.device;
+    auto fam = &dev->qfams[(um->separate_fams) ? VKR_QUEUE_FAM_TYPE_TRANSFER : VKR_QUEUE_FAM_TYPE_GFX];
+    return fam->cmd_pools[fam->default_pool].buffers[um->xfer_cmd_begin + cmd_ind].hndl;
+}
+
+intern VkCommandBuffer upload_gfx_cmd(vkr_upload_manager *um, vkr_context *vk, sizet cmd_ind)
+{
+    auto fam = &vk->inst.device.qfams[VKR_QUEUE_FAM_TYPE_GFX];
+    return fam->cmd_pools[fam->default_pool].buffers[um->gfx_cmd_begin + cmd_ind].hndl;
+}
+
+void vkr_update_uploads(vkr_upload_manager *um, vkr_context *vk)
+{
+    if (um->in_flight.size == 0) {
+        return;
+    }
+    u64 done{};
+    vkGetSemaphoreCounterValue(vk->inst.device.hndl, um->timeline, &done);
+    sizet retired = 0;
+    while (retired < um->in_flight.size && um->in_flight[retired].value <= done) {
+        um->tail = um->in_flight[retired].staging_end;
+        arr_push_back(&um->free_cmds, um->in_flight[retired].cmd_ind);
+        ++retired;
+    }
+    if (retired > 0) {
+        for (sizet i = retired; i < um->in_flight.size; ++i) {
+            um->in_flight[i - retired] = um->in_flight[i];
+        }
+        arr_resize(&um->in_flight, um->in_flight.size - retired);
+    }
+}
+
+// Wait for the oldest in flight batch and release its staging space
+intern int wait_oldest_upload(vkr_upload_manager *um, vkr_context *vk)
+{
+    asrt(um->in_flight.size > 0);
+    VkSemaphoreWaitInfo wait_info{};
+    wait_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO;
+    wait_info.semaphoreCount = 1;
+    wait_info.pSemaphores = &um->timeline;
+    wait_info.pValues = &um->in_flight[0].value;
+    if (vkWaitSemaphores(vk->inst.device.hndl, &wait_info, UINT64_MAX) != VK_SUCCESS) {
+        elog("Failed waiting on upload batch %lu", um->in_flight[0].value);
+        return err_code::VKR_UPLOAD_WAIT_FAIL;
+    }
+    vkr_update_uploads(um, vk);
+    return err_code::VKR_NO_ERROR;
+}
+
+intern int begin_upload_batch(vkr_upload_manager *um, vkr_context *vk)
+{
+    if (um->recording) {
+        return err_code::VKR_NO_ERROR;
+    }
+    vkr_update_uploads(um, vk);
+    if (um->free_cmds.size == 0) {
+        int err = wait_oldest_upload(um, vk);
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
+        }
+    }
+    um->cur = {};
+    um->cur.cmd_ind = *arr_back(&um->free_cmds);
+    arr_pop_back(&um->free_cmds);
+
+    VkCommandBufferBeginInfo beg_info{};
+    beg_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    beg_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    if (vkBeginCommandBuffer(upload_xfer_cmd(um, vk, um->cur.cmd_ind), &beg_info) != VK_SUCCESS) {
+        arr_push_back(&um->free_cmds, um->cur.cmd_ind);
+        return err_code::VKR_BEGIN_COMMAND_BUFFER_FAIL;
+    }
+    um->recording = true;
+    return err_code::VKR_NO_ERROR;
+}
+
+// Allocate contiguous staging space, submitting the recording batch and waiting on older ones if the ring is full. The
+// size must not be larger than the ring.
+intern int alloc_upload_staging(vkr_upload_manager *um, vkr_context *vk, sizet size, sizet alignment, sizet *offset)
+{
+    asrt(size <= um->staging_size);
+    while (true) {
+        // Nothing is pending so start over at the beginning of the ring
+        if (um->head == um->tail && !um->recording) {
+            um->head = um->tail = 0;
+        }
+
+        u64 pos = um->head % um->staging_size;
+        u64 aligned = (pos + alignment - 1) / alignment * alignment;
+        u64 start = um->head + (aligned - pos);
+        // Doesn't fit before the end - skip to the start of the ring
+        if (aligned + size > um->staging_size) {
+            start = um->head + (um->staging_size - pos);
+        }
+        if (start + size - um->tail <= um->staging_size) {
+            um->head = start + size;
+            *offset = (sizet)(start % um->staging_size);
+            return err_code::VKR_NO_ERROR;
+        }
+
+        vkr_update_uploads(um, vk);
+        if (start + size - um->tail <= um->staging_size) {
+            continue;
+        }
+        // The recording batch holds the rest of the ring
+        if (um->in_flight.size == 0) {
+            int err = vkr_submit_uploads(um, vk);
+            if (err != err_code::VKR_NO_ERROR) {
+                return err;
+            }
+        }
+        int err = wait_oldest_upload(um, vk);
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
+        }
+    }
+}
+
+int vkr_upload_buffer_data(vkr_upload_manager *um, vkr_context *vk, vkr_buffer *dest, const void *src_data, sizet size, sizet dest_offset)
+{
+    // Large uploads are split in to pieces that fit in half the ring so they can overlap with the previous piece
+    sizet max_chunk = um->staging_size / 2;
+    sizet copied = 0;
+    while (copied < size) {
+        sizet chunk = std::min(size - copied, max_chunk);
+        sizet staging_offset{};
+        int err = alloc_upload_staging(um, vk, chunk, 16, &staging_offset);
+        if (err == err_code::VKR_NO_ERROR) {
+            err = begin_upload_batch(um, vk);
+        }
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
+        }
+        memcpy((char *)um->staging.mem_info.pMappedData + staging_offset, (const char *)src_data + copied, chunk);
+
+        VkBufferCopy region{};
+        region.srcOffset = staging_offset;
+        region.dstOffset = dest_offset + copied;
+        region.size = chunk;
+        vkCmdCopyBuffer(upload_xfer_cmd(um, vk, um->cur.cmd_ind), um->staging.hndl, dest->hndl, 1, &region);
+        um->cur.staging_end = um->head;
+        copied += chunk;
+    }
+
+    VkBufferMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+    barrier.srcQueueFamilyIndex = (um->separate_fams) ? um->xfer_fam : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = (um->separate_fams) ? um->gfx_fam : VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = dest->hndl;
+    barrier.offset = dest_offset;
+    barrier.size = size;
+    arr_push_back(&um->buf_barriers, barrier);
+    return err_code::VKR_NO_ERROR;
+}
+
+int vkr_upload_buffer_regions(vkr_upload_manager *um, vkr_context *vk, vkr_buffer *dest, const vkr_buffer_upload *uploads, sizet count)
+{
+    sizet max_run = um->staging_size / 2;
+    sizet i = 0;
+    while (i < count) {
+        // Uploads too big to share a run are split up on their own
+        if (uploads[i].size > max_run) {
+            int err = vkr_upload_buffer_data(um, vk, dest, uploads[i].src_data, uploads[i].size, uploads[i].dest_offset);
+            if (err != err_code::VKR_NO_ERROR) {
+                return err;
+            }
+            ++i;
+            continue;
+        }
+
+        // Take as many of the following uploads as fit in half the ring, keeping each one 16 byte aligned
+        sizet run_end = i;
+        sizet run_size = 0;
+        while (run_end < count) {
+            sizet aligned_size = (uploads[run_end].size + 15) & ~sizet(15);
+            if (run_size + aligned_size > max_run) {
+                break;
+            }
+            run_size += aligned_size;
+            ++run_end;
+        }
+
+        sizet staging_offset{};
+        int err = alloc_upload_staging(um, vk, run_size, 16, &staging_offset);
+        if (err == err_code::VKR_NO_ERROR) {
+            err = begin_upload_batch(um, vk);
+        }
+        if (err != err_code::VKR_NO_ERROR) {
+            return err;
+        }
+
+        arr_clear(&um->copy_regions);
+        char *staging = (char *)um->staging.mem_info.pMappedData;
+        for (; i < run_end; ++i) {
+            memcpy(staging + staging_offset, uploads[i].src_data, uploads[i].size);
+
+            VkBufferCopy region{};
+            region.srcOffset = staging_offset;
+            region.dstOffset = uploads[i].dest_offset;
+            region.size = uploads[i].size;
+            arr_push_back(&um->copy_regions, region);
+
+            VkBufferMemoryBarrier barrier{};
+            barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+            barrier.srcQueueFamilyIndex = (um->separate_fams) ? um->xfer_fam : VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = (um->separate_fams) ? um->gfx_fam : VK_QUEUE_FAMILY_IGNORED;
+            barrier.buffer = dest->hndl;
+            barrier.offset = uploads[i].dest_offset;
+            barrier.size = uploads[i].size;
+            arr_push_back(&um->buf_barriers, barrier);
+
+            staging_offset += (uploads[i].size + 15) & ~sizet(15);
+        }
+        vkCmdCopyBuffer(
+            upload_xfer_cmd(um, vk, um->cur.cmd_ind), um->staging.hndl, dest->hndl, (u32)um->copy_regions.size, um->copy_regions.data);
+        um->cur.staging_end = um->head;
+    }
+    return err_code::VKR_NO_ERROR;
+}
+
+int vkr_upload_image_data(vkr_upload_manager *um, vkr_context *vk, vkr_image *dest, const void *src_data, sizet size)
+{
+    // Images can't be split up as easily as buffers - they take the slow path
+    if (size > um->staging_size) {
+        wlog("Image upload of %lu bytes is larger than the staging ring - uploading with a temporary staging buffer", size);
+        return vkr_stage_and_upload_image_data(dest, src_data, size, &vk->inst.device.qfams[VKR_QUEUE_FAM_TYPE_GFX], VKR_RENDER_QUEUE, vk);
+    }
+
+    sizet staging_offset{};
+    sizet align = std::max<sizet>(16, vk->inst.pdev_info.props.limits.optimalBufferCopyOffsetAlignment);
+    int err = alloc_upload_staging(um, vk, size, align, &staging_offset);
+    if (err == err_code::VKR_NO_ERROR) {
+        err = begin_upload_batch(um, vk);
+    }
+    if (err != err_code::VKR_NO_ERROR) {
+        return err;
+    }
+    memcpy((char *)um->staging.mem_info.pMappedData + staging_offset, src_data, size);
+    um->cur.staging_end = um->head;
+    auto cmd = upload_xfer_cmd(um, vk, um->cur.cmd_ind);
+
+    VkImageMemoryBarrier barrier{};
+    barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.image = dest->hndl;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+    VkBufferImageCopy region{};
+    region.bufferOffset = staging_offset;
+    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+    region.imageSubresource.layerCount = 1;
+    region.imageExtent = {dest->dims.x, dest->dims.y, dest->dims.z};
+    vkCmdCopyBufferToImage(cmd, um->staging.hndl, dest->hndl, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+    // Transitioned to shader read only (and moved to the graphics family) when the batch is submitted
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcQueueFamilyIndex = (um->separate_fams) ? um->xfer_fam : VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = (um->separate_fams) ? um->gfx_fam : VK_QUEUE_FAMILY_IGNORED;
+    arr_push_back(&um->img_barriers, barrier);
+    return err_code::VKR_NO_ERROR;
+}
+
+// Record the batch's barriers with the given access masks - for ownership transfers the release only has the source
+// half and the acquire only has the destination half
+intern void record_upload_barriers(vkr_upload_manager *um,
+                                   VkCommandBuffer cmd,
+                                   VkPipelineStageFlags src_stage,
+                                   VkAccessFlags src_access,
+                                   VkPipelineStageFlags dst_stage,
+                                   bool dst_access)
+{
+    for (sizet i = 0; i < um->buf_barriers.size; ++i) {
+        um->buf_barriers[i].srcAccessMask = src_access;
+        um->buf_barriers[i].dstAccessMask =
+            (dst_access) ? (VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_SHADER_READ_BIT) : 0;
+    }
+    for (sizet i = 0; i < um->img_barriers.size; ++i) {
+        um->img_barriers[i].srcAccessMask = src_access;
+        um->img_barriers[i].dstAccessMask = (dst_access) ? VK_ACCESS_SHADER_READ_BIT : 0;
+    }
+    vkCmdPipelineBarrier(cmd,
+                         src_stage,
+                         dst_stage,
+                         0,
+                         0,
+                         nullptr,
+                         (u32)um->buf_barriers.size,
+                         um->buf_barriers.data,
+                         (u32)um->img_barriers.size,
+                         um->img_barriers.data);
+}
+
+int vkr_submit_uploads(vkr_upload_manager *um, vkr_context *vk)
+{
+    if (!um->recording) {
+        return err_code::VKR_NO_ERROR;
+    }
+    const VkPipelineStageFlags read_stages = VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+    auto xfer_cmd = upload_xfer_cmd(um, vk, um->cur.cmd_ind);
+    if (um->separate_fams) {
+        record_upload_barriers(um, xfer_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, false);
+    }
+    else {
+        record_upload_barriers(um, xfer_cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT, read_stages, true);
+    }
+    vkEndCommandBuffer(xfer_cmd);
+    um->recording = false;
+
+    u64 xfer_value = um->last_value + 1;
+    VkTimelineSemaphoreSubmitInfo tl_info{};
+    tl_info.sType = VK_STRUCTURE_TYPE_TIMELINE_SEMAPHORE_SUBMIT_INFO;
+    tl_info.signalSemaphoreValueCount = 1;
+    tl_info.pSignalSemaphoreValues = &xfer_value;
+
+    VkSubmitInfo submit_info{};
+    submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+    submit_info.pNext = &tl_info;
+    submit_info.commandBufferCount = 1;
+    submit_info.pCommandBuffers = &xfer_cmd;
+    submit_info.signalSemaphoreCount = 1;
+    submit_info.pSignalSemaphores = &um->timeline;
+    int err = vkQueueSubmit(um->xfer_q, 1, &submit_info, VK_NULL_HANDLE);
+    if (err != VK_SUCCESS) {
+        elog("Failed to submit upload batch with vk err %d", err);
+        arr_push_back(&um->free_cmds, um->cur.cmd_ind);
+        arr_clear(&um->buf_barriers);
+        arr_clear(&um->img_barriers);
+        return err_code::VKR_UPLOAD_SUBMIT_FAIL;
+    }
+    um->last_value = xfer_value;
+
+    // Acquire the written ranges on the graphics queue once the copies are done
+    if (um->separate_fams) {
+        auto gfx_cmd = upload_gfx_cmd(um, vk, um->cur.cmd_ind);
+        VkCommandBufferBeginInfo beg_info{};
+        beg_info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beg_info.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        vkBeginCommandBuffer(gfx_cmd, &beg_info);
+        record_upload_barriers(um, gfx_cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, 0, read_stages, true);
+        vkEndCommandBuffer(gfx_cmd);
+
+        u64 acquire_value = xfer_value + 1;
+        VkPipelineStageFlags wait_stage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+        tl_info.waitSemaphoreValueCount = 1;
+        tl_info.pWaitSemaphoreValues = &xfer_value;
+        tl_info.pSignalSemaphoreValues = &acquire_value;
+        submit_info.waitSemaphoreCount = 1;
+        submit_info.pWaitSemaphores = &um->timeline;
+        submit_info.pWaitDstStageMask = &wait_stage;
+        submit_info.pCommandBuffers = &gfx_cmd;
+        err = vkQueueSubmit(um->gfx_q, 1, &submit_info, VK_NULL_HANDLE);
+        if (err != VK_SUCCESS) {
+            elog("Failed to submit upload acquire with vk err %d", err);
+        }
+        else {
+            um->last_value = acquire_value;
+        }
+    }
+
+    um->cur.value = um->last_value;
+    arr_push_back(&um->in_flight, um->cur);
+    arr_clear(&um->buf_barriers);
+    arr_clear(&um->img_barriers);
+    return (err == VK_SUCCESS) ? err_code::VKR_NO_ERROR : err_code::VKR_UPLOAD_SUBMIT_FAIL;
+}
+
+int vkr_wait_uploads(vkr_upload_manager *um, vkr_context *vk)
+{
+    int err = vkr_submit_uploads(um, vk);
+    while (err == err_code::VKR_NO_ERROR && um->in_flight.size > 0) {
+        err = wait_oldest_upload(um, vk);
+    }
+    return err;
+}
+
 sizet vkr_add_image(vkr_device *device, const vkr_image &copy)
 {
     sizet ind = device->images.size;
@@ -1928,6 +2744,7 @@ int vkr_init(const vkr_cfg *cfg, vkr_context *vk)
         ilog("Using global persistent arena %p", vk->cfg.arenas.persistent_arena);
     }
 
+    vk->cfg.arenas.mtx = &vk->alloc_mtx;
     vk->alloc_cbs.pUserData = &vk->cfg.arenas;
     vk->alloc_cbs.pfnAllocation = vk_alloc;
     vk->alloc_cbs.pfnFree = vk_free;
@@ -1938,7 +2755,7 @@ int vkr_init(const vkr_cfg *cfg, vkr_context *vk)
         return code;
     }
 
-    if (cfg->window) {
+    if (cfg->window && !cfg->headless) {
         code = vkr_init_surface(vk, &vk->inst.surface);
         if (code != err_code::VKR_NO_ERROR) {
             vkr_terminate(vk);
@@ -1987,9 +2804,22 @@ void vkr_terminate_swapchain(vkr_swapchain *sw_info, const vkr_context *vk)
     ilog("Terminating swapchain");
     for (int i = 0; i < sw_info->image_views.size; ++i) {
         vkr_terminate_image_view(&sw_info->image_views[i]);
+    }
+    for (int i = 0; i < sw_info->renders_finished.size; ++i) {
         vkDestroySemaphore(vk->inst.device.hndl, sw_info->renders_finished[i], &vk->alloc_cbs);
     }
-    vkDestroySwapchainKHR(vk->inst.device.hndl, sw_info->swapchain, &vk->alloc_cbs);
+
+    // Offscreen swapchains own their images - swapchain images belong to the swapchain
+    if (sw_info->swapchain != VK_NULL_HANDLE) {
+        vkDestroySwapchainKHR(vk->inst.device.hndl, sw_info->swapchain, &vk->alloc_cbs);
+    }
+    else {
+        for (int i = 0; i < sw_info->images.size; ++i) {
+            if (sw_info->images[i].hndl != VK_NULL_HANDLE) {
+                vkr_terminate_image(&sw_info->images[i]);
+            }
+        }
+    }
     arr_terminate(&sw_info->images);
     arr_terminate(&sw_info->image_views);
     arr_terminate(&sw_info->renders_finished);
@@ -2015,6 +2845,10 @@ void vkr_terminate_device(vkr_device *dev, const vkr_context *vk)
     for (int i = 0; i < dev->pipelines.size; ++i) {
         vkr_terminate_pipeline(&dev->pipelines[i], vk);
     }
+    if (dev->pipeline_cache != VK_NULL_HANDLE) {
+        vkDestroyPipelineCache(dev->hndl, dev->pipeline_cache, &vk->alloc_cbs);
+        dev->pipeline_cache = VK_NULL_HANDLE;
+    }
     for (int i = 0; i < dev->buffers.size; ++i) {
         vkr_terminate_buffer(&dev->buffers[i], vk);
     }
@@ -2102,6 +2936,27 @@ int vkr_begin_cmd_buf(const vkr_command_buffer *buf)
     return err_code::VKR_NO_ERROR;
 }
 
+int vkr_begin_secondary_cmd_buf(const vkr_command_buffer *buf, const vkr_rpass *rpass, const vkr_framebuffer *fb)
+{
+    VkCommandBufferInheritanceInfo inherit{};
+    inherit.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    inherit.renderPass = rpass->hndl;
+    inherit.subpass = 0;
+    inherit.framebuffer = fb->hndl;
+
+    VkCommandBufferBeginInfo info{};
+    info.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+    info.flags = VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT | VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    info.pInheritanceInfo = &inherit;
+
+    int err = vkBeginCommandBuffer(buf->hndl, &info);
+    if (err != VK_SUCCESS) {
+        elog("Failed to begin secondary command buffer with Vk code %d", err);
+        return err_code::VKR_BEGIN_COMMAND_BUFFER_FAIL;
+    }
+    return err_code::VKR_NO_ERROR;
+}
+
 int vkr_end_cmd_buf(const vkr_command_buffer *buf)
 {
     int err = vkEndCommandBuffer(buf->hndl);
@@ -2117,6 +2972,11 @@ sizet vkr_min_uniform_buffer_offset_alignment(vkr_context *vk)
     return vk->inst.pdev_info.props.limits.minUniformBufferOffsetAlignment;
 }
 
+sizet vkr_min_storage_buffer_offset_alignment(vkr_context *vk)
+{
+    return vk->inst.pdev_info.props.limits.minStorageBufferOffsetAlignment;
+}
+
 sizet vkr_uniform_buffer_offset_alignment(vkr_context *vk, sizet uniform_block_size)
 {
     auto min_alignment = vkr_min_uniform_buffer_offset_alignment(vk);
@@ -2132,7 +2992,8 @@ void vkr_cmd_begin_rpass(const vkr_command_buffer *cmd_buf,
                          const vkr_framebuffer *fb,
                          const vkr_rpass *rpass,
                          const VkClearValue *att_clear_vals,
-                         sizet clear_val_size)
+                         sizet clear_val_size,
+                         VkSubpassContents contents)
 {
     VkRenderPassBeginInfo info{};
     info.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
@@ -2148,7 +3009,7 @@ void vkr_cmd_begin_rpass(const vkr_command_buffer *cmd_buf,
     info.clearValueCount = (u32)clear_val_size;
     info.pClearValues = att_clear_vals;
 
-    vkCmdBeginRenderPass(cmd_buf->hndl, &info, VK_SUBPASS_CONTENTS_INLINE);
+    vkCmdBeginRenderPass(cmd_buf->hndl, &info, contents);
 }
 
 void vkr_cmd_end_rpass(const vkr_command_buffer *cmd_buf)
@@ -2203,12 +3064,13 @@ int vkr_copy_buffer(vkr_buffer *dest,
                     const VkBufferCopy *region,
                     vkr_device_queue_fam_info *cmd_q,
                     sizet qind,
-                    const vkr_context *vk)
+                    const vkr_context *vk,
+                    u32 region_count)
 {
     auto pool = &cmd_q->cmd_pools[cmd_q->transient_pool];
     auto tmp_buf = cmd_buf_begin(pool, vk);
     if (tmp_buf.err_code == err_code::VKR_NO_ERROR) {
-        vkCmdCopyBuffer(pool->buffers[tmp_buf.begin].hndl, src->hndl, dest->hndl, 1, region);
+        vkCmdCopyBuffer(pool->buffers[tmp_buf.begin].hndl, src->hndl, dest->hndl, region_count, region);
         return cmd_buf_end(tmp_buf, pool, cmd_q, qind, vk);
     }
     return tmp_buf.err_code;
@@ -1,4 +1,6 @@
 #pragma once
+#include <mutex>
+
 #include "vk_mem_alloc.h"
 #include "containers/array.h"
 #include "rid.h"
@@ -43,7 +45,12 @@ enum vkr
     VKR_COPY_BUFFER_BEGIN_FAIL,
     VKR_COPY_BUFFER_SUBMIT_FAIL,
     VKR_COPY_BUFFER_WAIT_IDLE_FAIL,
-    VKR_TRANSITION_IMAGE_UNSUPPORTED_LAYOUT
+    VKR_TRANSITION_IMAGE_UNSUPPORTED_LAYOUT,
+    VKR_UPLOAD_SUBMIT_FAIL,
+    VKR_UPLOAD_WAIT_FAIL,
+    VKR_RESET_COMMAND_POOL_FAIL,
+    VKR_CREATE_PIPELINE_CACHE_FAIL,
+    VKR_GET_PIPELINE_CACHE_DATA_FAIL
 };
 }
 
@@ -58,6 +65,8 @@ enum vkr_queue_fam_type
 {
     VKR_QUEUE_FAM_TYPE_GFX,
     VKR_QUEUE_FAM_TYPE_PRESENT,
+    // A transfer only family if the device has one - otherwise the graphics family with no queues of its own
+    VKR_QUEUE_FAM_TYPE_TRANSFER,
     VKR_QUEUE_FAM_TYPE_COUNT
 };
 
@@ -68,8 +77,15 @@ inline constexpr u32 MAX_QUEUE_REQUEST_COUNT = 32;
 inline constexpr u32 VKR_MAX_EXTENSION_STR_LEN = 128;
 inline constexpr sizet MAX_FRAMES_IN_FLIGHT = 2;
 inline constexpr u32 VKR_INVALID = (u32)-1;
+// Size of the upload manager's staging ring - uploads larger than this use a temporary staging buffer
+inline constexpr sizet VKR_UPLOAD_STAGING_DEFAULT_SIZE = 64 * 1024 * 1024;
+// Maximum number of upload submissions in flight at once
+inline constexpr sizet VKR_MAX_UPLOAD_BATCHES = 8;
 inline constexpr u32 MEM_ALLOC_TYPE_COUNT = VK_SYSTEM_ALLOCATION_SCOPE_INSTANCE + 1;
 inline constexpr u32 VKR_API_VERSION = VK_API_VERSION_1_3;
+// Format of the offscreen images standing in for the swapchain images when headless - rgba8 so reading them back needs
+// no swizzle
+inline constexpr VkFormat VKR_HEADLESS_FORMAT = VK_FORMAT_R8G8B8A8_UNORM;
 struct vkr_device;
 
 struct vk_mem_alloc_stats
@@ -99,6 +115,9 @@ struct vk_arenas
     mem_arena *persistent_arena{};
     // Should persist for the lifetime of a vulkan command
     mem_arena *command_arena{};
+    // Set by vkr_init - the driver calls the allocation callbacks from whichever thread is recording or creating
+    // objects, and the arenas are not thread safe
+    std::mutex *mtx{};
 };
 
 struct vkr_buffer_cfg
@@ -121,6 +140,26 @@ struct vkr_buffer
     VmaAllocationInfo mem_info;
 };
 
+// Host visible, persistently mapped buffer that per frame data is linearly sub-allocated from. The frame in flight
+// owning the ring resets it once its fence has signaled, so allocations only live for the frame they were made in. If
+// an allocation doesn't fit the buffer is replaced with a larger one, keeping the offsets of earlier allocations.
+struct vkr_frame_ring
+{
+    sizet buf_ind{INVALID_IND};
+    sizet size;
+    sizet offset;
+    const vkr_gpu_allocator *vma_alloc;
+};
+
+struct vkr_frame_alloc
+{
+    // Byte offset in to the ring buffer
+    sizet offset;
+    sizet size;
+    // Only valid until the next allocation which grows the ring - hold on to the offset instead
+    void *ptr;
+};
+
 struct vkr_image_cfg
 {
     uvec3 dims;
@@ -250,6 +289,8 @@ struct vkr_phys_device
 {
     VkPhysicalDevice hndl{VK_NULL_HANDLE};
     VkPhysicalDeviceFeatures features{};
+    // Vulkan 1.2 features such as descriptor indexing
+    VkPhysicalDeviceVulkan12Features features12{};
     VkPhysicalDeviceProperties props{};
     vkr_queue_families qfams{};
     VkPhysicalDeviceMemoryProperties mem_properties{};
@@ -282,9 +323,12 @@ struct vkr_descriptor_pool
 struct vkr_frame
 {
     vkr_cmd_buf_ind cmd_buf_ind;
-    sizet frame_ubo_ind;
+    // Frame ubo, instances, indirect draws and other data which is rewritten every frame
+    vkr_frame_ring ring;
     sizet pl_ubo_ind;
     sizet mat_ubo_ind;
+    // Bindless material storage buffer - only created when the renderer uses bindless materials
+    sizet mat_sb_ind{INVALID_IND};
     sizet obj_ubo_ind;
     vkr_descriptor_pool desc_pool;
     VkFence in_flight;
@@ -376,6 +420,9 @@ struct vkr_pipeline_cfg_color_blending
 struct vkr_descriptor_set_layout_desc
 {
     static_array<VkDescriptorSetLayoutBinding, 16> bindings;
+    // Optional - if not empty there must be one entry per binding
+    static_array<VkDescriptorBindingFlags, 16> binding_flags;
+    VkDescriptorSetLayoutCreateFlags flags{};
 };
 
 struct vkr_pipeline_cfg_depth_stencil
@@ -431,6 +478,15 @@ struct vkr_pipeline_cfg
     static_array<VkPushConstantRange, 32> push_constant_ranges;
 };
 
+struct vkr_compute_pipeline_cfg
+{
+    vkr_shader_stage shader_stage;
+
+    // Descriptor Sets and push constants
+    static_array<vkr_descriptor_set_layout_desc, 4> set_layouts;
+    static_array<VkPushConstantRange, 32> push_constant_ranges;
+};
+
 struct vkr_pipeline
 {
     vkr_rpass rpass;
@@ -486,6 +542,83 @@ struct vkr_device
     vkr_swapchain swapchain;
     static_array<vkr_frame, MAX_FRAMES_IN_FLIGHT> rframes;
     vkr_gpu_allocator vma_alloc;
+
+    // Every pipeline is created through this cache if it is set - see vkr_init_pipeline_cache
+    VkPipelineCache pipeline_cache{VK_NULL_HANDLE};
+};
+
+inline constexpr u32 VKR_PIPELINE_CACHE_MAGIC = 0x4e53504c; // NSPL
+inline constexpr u32 VKR_PIPELINE_CACHE_VERSION = 1;
+
+// Written in front of the driver's pipeline cache data when it is saved. The driver checks its own header against the
+// vendor, device and cache uuid, but not the driver version, and not whether the data made it to disk in one piece.
+struct vkr_pipeline_cache_header
+{
+    u32 magic;
+    u32 version;
+    u32 vendor_id;
+    u32 device_id;
+    u32 driver_version;
+    u8 cache_uuid[VK_UUID_SIZE];
+    u64 data_size;
+    u64 data_hash;
+};
+
+struct vkr_upload_batch
+{
+    // Timeline value signaled once the batch's copies (and ownership acquires) have completed
+    u64 value;
+    // Staging ring position just past the batch's data
+    u64 staging_end;
+    // Index of the batch's command buffers in the transfer and graphics default pools
+    sizet cmd_ind;
+};
+
+// Streams buffer and image uploads through a persistent staging ring. Uploads are recorded in to a batch which is
+// submitted once per frame (or when the ring fills up) on the transfer queue, and completion is tracked with a timeline
+// semaphore so staging space is reclaimed without stalling. When the transfer queue is in a different family than the
+// graphics queue, the transfer queue releases ownership of the written ranges and a small graphics queue submission
+// acquires them before anything rendered afterwards reads them.
+// One of the regions passed to vkr_upload_buffer_regions
+struct vkr_buffer_upload
+{
+    const void *src_data;
+    sizet size;
+    sizet dest_offset;
+};
+
+struct vkr_upload_manager
+{
+    vkr_buffer staging;
+    sizet staging_size;
+    // Total bytes allocated from and released back to the staging ring - ring offsets are these modulo the size
+    u64 head;
+    u64 tail;
+
+    VkSemaphore timeline{VK_NULL_HANDLE};
+    u64 last_value;
+
+    VkQueue xfer_q{VK_NULL_HANDLE};
+    VkQueue gfx_q{VK_NULL_HANDLE};
+    u32 xfer_fam;
+    u32 gfx_fam;
+    b32 separate_fams;
+    // First of the VKR_MAX_UPLOAD_BATCHES command buffers in the transfer and graphics default pools
+    sizet xfer_cmd_begin;
+    sizet gfx_cmd_begin;
+    array<sizet> free_cmds;
+
+    // The batch being recorded - its transfer command buffer is begun with the first upload
+    vkr_upload_batch cur;
+    b32 recording;
+    // Barriers making the batch's writes visible to (and owned by) the graphics queue
+    array<VkBufferMemoryBarrier> buf_barriers;
+    array<VkImageMemoryBarrier> img_barriers;
+    // Scratch for the regions of multi region copies
+    array<VkBufferCopy> copy_regions;
+
+    // Submitted batches, oldest first
+    array<vkr_upload_batch> in_flight;
 };
 
 struct vkr_instance
@@ -514,6 +647,10 @@ struct vkr_cfg
     vk_arenas arenas;
     int log_verbosity;
     void *window;
+    // Render in to offscreen images instead of a window surface - the window is ignored, no surface or swapchain is
+    // created, and the device doesn't need to support presenting. The offscreen images stand in for the swapchain images.
+    b32 headless;
+    uvec2 headless_extent{1280, 720};
     VkInstanceCreateFlags inst_create_flags;
     vkr_descriptor_cfg desc_cfg{};
 
@@ -535,6 +672,7 @@ struct vkr_context
     vkr_instance inst;
     vkr_cfg cfg;
     VkAllocationCallbacks alloc_cbs;
+    std::mutex alloc_mtx;
 };
 
 // Get the best depth format for the current device
@@ -579,7 +717,9 @@ void vkr_remove_descriptor_sets(vkr_descriptor_pool *pool, const vkr_context *vk
 sizet vkr_add_cmd_pool(vkr_device_queue_fam_info *qfam, const vkr_command_pool &cpool = {});
 int vkr_init_cmd_pool(const vkr_context *vk, u32 fam_ind, VkCommandPoolCreateFlags flags, vkr_command_pool *cpool);
 void vkr_terminate_cmd_pool(const vkr_context *vk, u32 fam_ind, vkr_command_pool *cpool);
-vkr_add_result vkr_add_cmd_bufs(vkr_command_pool *pool, const vkr_context *vk, sizet count = 1);
+vkr_add_result vkr_add_cmd_bufs(vkr_command_pool *pool, const vkr_context *vk, sizet count = 1, VkCommandBufferLevel level = VK_COMMAND_BUFFER_LEVEL_PRIMARY);
+// Return every command buffer allocated from the pool to the initial state - the pool's buffers must not be pending
+int vkr_reset_cmd_pool(const vkr_context *vk, vkr_command_pool *cpool);
 void vkr_remove_cmd_bufs(vkr_command_pool *pool, const vkr_context *vk, sizet ind, sizet count = 1);
 
 // Render passes
@@ -587,9 +727,17 @@ sizet vkr_add_render_pass(vkr_device *device, const vkr_rpass &copy = {});
 int vkr_init_render_pass(vkr_rpass *rpass, const vkr_rpass_cfg *cfg, const vkr_context *vk);
 void vkr_terminate_render_pass(const vkr_rpass *rpass, const vkr_context *vk);
 
-// Pipelines
+// Pipeline cache - the saved data is a vkr_pipeline_cache_header followed by the driver's data. Saved data from another
+// device or driver version (or anything that doesn't look like saved data at all) is ignored and the cache starts out
+// empty. The cache is destroyed with the device.
+int vkr_init_pipeline_cache(vkr_context *vk, const byte_array *saved_data);
+int vkr_get_pipeline_cache_data(const vkr_context *vk, byte_array *saved_data);
+
+// Pipelines - pipelines can be initialized on separate threads as long as they were all added first
 sizet vkr_add_pipeline(vkr_device *device, const vkr_pipeline &copy = {});
 int vkr_init_pipeline(vkr_pipeline *pipe_info, const vkr_pipeline_cfg *cfg, const vkr_context *vk);
+// Compute pipelines are stored in the device pipelines array as well - the render pass is left empty
+int vkr_init_compute_pipeline(vkr_pipeline *pipe_info, const vkr_compute_pipeline_cfg *cfg, const vkr_context *vk);
 void vkr_terminate_pipeline(const vkr_pipeline *pipe_info, const vkr_context *vk_ctxt);
 int vkr_init_shader_module(VkShaderModule *module, const byte_array *code, const vkr_context *vk);
 void vkr_terminate_shader_module(VkShaderModule module, const vkr_context *vk);
@@ -604,6 +752,12 @@ sizet vkr_add_buffer(vkr_device *device, const vkr_buffer &copy = {});
 int vkr_init_buffer(vkr_buffer *buffer, const vkr_buffer_cfg *cfg);
 void vkr_terminate_buffer(vkr_buffer *buffer, const vkr_context *vk);
 void *vkr_map_buffer(vkr_buffer *buf, const vkr_gpu_allocator *vma);
+
+// Frame rings - allocating must only happen while the GPU is not using the ring (between the owning frame's fence wait
+// and its submit) as growing the ring destroys the old buffer
+int vkr_init_frame_ring(vkr_frame_ring *ring, vkr_device *device, sizet size);
+void vkr_reset_frame_ring(vkr_frame_ring *ring);
+vkr_frame_alloc vkr_frame_ring_alloc(vkr_frame_ring *ring, vkr_context *vk, sizet size, sizet alignment);
 void vkr_unmap_buffer(vkr_buffer *buf, const vkr_gpu_allocator *vma);
 int vkr_stage_and_upload_buffer_data(vkr_buffer *dest_buffer,
                                      const void *src_data,
@@ -676,6 +830,10 @@ void vkr_terminate_swapchain_framebuffers(vkr_device *device, const vkr_context
 
 // The device should be created before calling this
 int vkr_init_swapchain(vkr_swapchain *sw_info, const vkr_context *vk);
+// Fill the swapchain with MAX_FRAMES_IN_FLIGHT offscreen images (color attachment and transfer src) the size of the
+// headless extent. There is no VkSwapchainKHR or render finished semaphores - vkr_terminate_swapchain destroys the
+// images.
+int vkr_init_offscreen_swapchain(vkr_swapchain *sw_info, const vkr_context *vk);
 void vkr_terminate_swapchain(vkr_swapchain *sw_info, const vkr_context *vk);
 
 int vkr_init_render_frames(vkr_device *dev, const vkr_context *vk);
@@ -704,17 +862,38 @@ int vkr_init(const vkr_cfg *cfg, vkr_context *vk);
 void vkr_terminate(vkr_context *vk);
 
 int vkr_begin_cmd_buf(const vkr_command_buffer *buf);
+// Begin a secondary command buffer that will be executed inside subpass 0 of the render pass on the framebuffer
+int vkr_begin_secondary_cmd_buf(const vkr_command_buffer *buf, const vkr_rpass *rpass, const vkr_framebuffer *fb);
 int vkr_end_cmd_buf(const vkr_command_buffer *buf);
 
 void vkr_cmd_begin_rpass(const vkr_command_buffer *cmd_buf,
                          const vkr_framebuffer *fb,
                          const vkr_rpass *rpass,
                          const VkClearValue *att_clear_vals,
-                         sizet clear_val_size);
+                         sizet clear_val_size,
+                         VkSubpassContents contents = VK_SUBPASS_CONTENTS_INLINE);
 void vkr_cmd_end_rpass(const vkr_command_buffer *cmd_buf);
 
+// Upload manager - uploads are only guaranteed to be visible to graphics queue work submitted after the batch holding
+// them is submitted with vkr_submit_uploads
+int vkr_init_upload_manager(vkr_upload_manager *um, vkr_context *vk, sizet staging_size = VKR_UPLOAD_STAGING_DEFAULT_SIZE);
+void vkr_terminate_upload_manager(vkr_upload_manager *um, vkr_context *vk);
+int vkr_upload_buffer_data(vkr_upload_manager *um, vkr_context *vk, vkr_buffer *dest, const void *src_data, sizet size, sizet dest_offset);
+// Pack the uploads back to back in the staging ring and copy them to dest with a single copy command - if they don't all
+// fit in half the ring they are split in to as few copies as needed
+int vkr_upload_buffer_regions(vkr_upload_manager *um, vkr_context *vk, vkr_buffer *dest, const vkr_buffer_upload *uploads, sizet count);
+// The image is transitioned from undefined to shader read only
+int vkr_upload_image_data(vkr_upload_manager *um, vkr_context *vk, vkr_image *dest, const void *src_data, sizet size);
+// Submit the batch being recorded, if any
+int vkr_submit_uploads(vkr_upload_manager *um, vkr_context *vk);
+// Release the staging space of completed batches
+void vkr_update_uploads(vkr_upload_manager *um, vkr_context *vk);
+// Submit the batch being recorded and wait for all uploads to complete
+int vkr_wait_uploads(vkr_upload_manager *um, vkr_context *vk);
+
 sizet vkr_min_uniform_buffer_offset_alignment(vkr_context *vk);
 sizet vkr_uniform_buffer_offset_alignment(vkr_context *vk, sizet uniform_block_size);
+sizet vkr_min_storage_buffer_offset_alignment(vkr_context *vk);
 
 void vkr_device_wait_idle(vkr_device *dev);
 
@@ -732,7 +911,8 @@ int vkr_copy_buffer(vkr_buffer *dest,
                     const VkBufferCopy *region,
                     vkr_device_queue_fam_info *cmd_q,
                     sizet qind,
-                    const vkr_context *vk);
+                    const vkr_context *vk,
+                    u32 region_count = 1);
 int vkr_copy_buffer_to_image(vkr_image *dest,
                              const vkr_buffer *src,
                              const VkBufferImageCopy *region,